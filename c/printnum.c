@@ -0,0 +1,54 @@
+// printnum.asm written in C, prints a number in decimal and in hex
+
+int powers[5] = { 1, 10, 100, 1000, 10000 };
+
+void putc(int c)
+{
+	__sys(6, c);
+}
+
+// Counts how many of each power of ten fit, skipping leading zeros
+void print_dec(unsigned value)
+{
+	int started = 0;
+	for (int i = 5; i != 0;)
+	{
+		unsigned power = powers[--i];
+		int digit = 0;
+		while (value >= power)
+		{
+			value -= power;
+			digit++;
+		}
+
+		if (digit != 0 || started || i == 0)
+		{
+			started = 1;
+			putc('0' + digit);
+		}
+	}
+}
+
+void print_hex(unsigned value)
+{
+	putc('0');
+	putc('x');
+	for (int shift = 12; ; shift -= 4)
+	{
+		int digit = (value >> shift) & 15;
+		putc(digit > 9 ? 'A' - 10 + digit : '0' + digit);
+		if (shift == 0)
+		{
+			break;
+		}
+	}
+}
+
+int main()
+{
+	unsigned number = 9999;
+	print_dec(number);
+	putc('\n');
+	print_hex(number);
+	return 0;
+}
@@ -0,0 +1,321 @@
+//
+//	qcpu-analyze - qcpu control flow analyzer
+//
+
+#include "ControlFlow.h"
+#include "Disassembler.h"
+#include "QCPU.h"
+#include "Timing.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace AnalyzerMain
+{
+	const size_t MAX_LISTED = 20;
+
+	std::string Hex(const uint32_t address)
+	{
+		char text[16];
+		snprintf(text, sizeof(text), "0x%04X", address);
+		return text;
+	}
+
+	std::string Name(const uint16_t address, const std::unordered_map<uint16_t, std::string>& names)
+	{
+		const auto it = names.find(address);
+		return it != names.end() ? it->second + " (" + Hex(address) + ")" : Hex(address);
+	}
+
+	// Labels whose address is taken as a value rather than jumped to, and that hold code, are
+	// what a computed jump could go to
+	std::vector<uint16_t> FindAddressTaken(const DebugInfo& debug)
+	{
+		std::vector<bool> code(0x10000, false);
+		for (const TokenData& token : debug.tokens)
+		{
+			code[token.address & 0xFFFF] = code[token.address & 0xFFFF] || token.type == ETokenType::Op;
+		}
+
+		std::vector<uint16_t> taken;
+		size_t operand = 0;
+		const Instruction* instruction = nullptr;
+		for (const TokenData& token : debug.tokens)
+		{
+			if (token.type == ETokenType::Label || token.type == ETokenType::Equ)
+			{
+				continue;
+			}
+			if (token.type == ETokenType::Op)
+			{
+				instruction = FindInstruction(token.data);
+				operand = 0;
+				continue;
+			}
+
+			const bool target = instruction != nullptr && operand < instruction->arity && instruction->roles[operand] == EOperandRole::Target;
+			operand++;
+
+			const auto label = debug.labels.find(token.data);
+			if (token.type == ETokenType::ImmediateLabelReference && !target && label != debug.labels.end() && code[label->second & 0xFFFF])
+			{
+				taken.push_back(static_cast<uint16_t>(label->second));
+			}
+		}
+
+		return taken;
+	}
+
+	std::string Cycles(const uint64_t cycles)
+	{
+		return cycles == UNBOUNDED_CYCLES ? "unbounded" : std::to_string(cycles);
+	}
+
+	std::string Depth(const int64_t depth)
+	{
+		return depth == UNBOUNDED_DEPTH ? "unbounded" : std::to_string(depth);
+	}
+
+	void PrintTiming(const ControlFlowGraph& graph, const TimingReport& report, const uint64_t hz, const std::unordered_map<uint16_t, std::string>& names)
+	{
+		std::cout << std::endl << "Worst case cycles and stack depths:" << std::endl;
+		for (size_t i = 0; i < graph.subroutines.size(); i++)
+		{
+			const SubroutineTiming& timing = report.subroutines[i];
+			std::cout << "  " << Name(graph.subroutines[i].entry, names) << ", " << Cycles(timing.cycles) << " cycles, call depth " << Depth(timing.callDepth)
+				<< ", stack depth " << Depth(timing.stackDepth);
+			std::cout << (timing.recursive ? ", recursive" : "") << (timing.computed ? ", computed jumps" : "") << (timing.irreducible ? ", irreducible loops" : "") << std::endl;
+		}
+
+		if (!report.loops.empty())
+		{
+			std::cout << std::endl << "Loops:" << std::endl;
+		}
+		for (const LoopTiming& loop : report.loops)
+		{
+			std::cout << "  " << std::string(loop.depth * 2, ' ') << Name(loop.header, names) << " in " << Name(graph.subroutines[loop.subroutine].entry, names) << ", "
+				<< (loop.bound == UNBOUNDED_CYCLES ? "no bound" : std::to_string(loop.bound) + " times") << " at " << Cycles(loop.iteration) << " cycles, " << Cycles(loop.cycles)
+				<< (loop.frame ? ", waits for a frame" : "") << std::endl;
+		}
+
+		std::cout << std::endl << "Call stack " << Depth(report.callDepth) << " of " << static_cast<uint32_t>(QCPU::CALL_STACK_SIZE)
+			<< ", data stack " << Depth(report.stackDepth) << " of " << static_cast<uint32_t>(QCPU::STACK_SIZE) << std::endl;
+
+		// Application::Run renders at 60 Hz, a frame's work has to fit between two of them
+		if (report.frameCycles == 0)
+		{
+			return;
+		}
+		std::cout << "A frame takes at most " << Cycles(report.frameCycles) << " cycles";
+		if (report.frameCycles == UNBOUNDED_CYCLES)
+		{
+			std::cout << std::endl;
+		}
+		else if (hz == 0)
+		{
+			std::cout << ", at 60 Hz that needs " << report.frameCycles * 60 << " cycles a second" << std::endl;
+		}
+		else
+		{
+			const uint64_t budget = hz / 60;
+			std::cout << " of the " << budget << " there are at " << hz << " cycles a second, "
+				<< (report.frameCycles <= budget ? "it fits" : "it doesn't fit") << std::endl;
+		}
+	}
+}
+
+int main(const int argc, char* argv[])
+{
+	using namespace AnalyzerMain;
+
+	std::vector<std::string> args(argv + 1, argv + argc);
+
+	auto option = [&args](const char* name)
+	{
+		const auto flag = std::find(args.begin(), args.end(), name);
+		if (flag == args.end())
+		{
+			return false;
+		}
+
+		args.erase(flag);
+		return true;
+	};
+
+	auto values = [&args](const char* name)
+	{
+		std::vector<std::string> found;
+		for (auto flag = std::find(args.begin(), args.end(), name); flag != args.end() && flag + 1 != args.end(); flag = std::find(args.begin(), args.end(), name))
+		{
+			found.push_back(*(flag + 1));
+			args.erase(flag, flag + 2);
+		}
+		return found;
+	};
+
+	// -dot prints the control flow graph for Graphviz, -calls just the call graph, -json both
+	// as data. -n ignores the .debug.
+	const bool dot = option("-dot");
+	const bool calls = option("-calls");
+	const bool json = option("-json");
+	const bool ignoreDebug = option("-n");
+
+	// -timing adds worst case cycles and stack depths. Each -bound <loop>=<n> says the loop
+	// starting at a label or address runs at most n times, -hz is how fast the VM runs.
+	const bool timing = option("-timing");
+	const std::vector<std::string> loopBounds = values("-bound");
+	const std::vector<std::string> hz = values("-hz");
+
+	if (args.size() != 1)
+	{
+		std::cout << "Usage: qcpu-analyze [-dot | -calls | -json] [-n] [-timing [-bound <loop>=<n>]... [-hz <cycles a second>]] <program>" << std::endl;
+		return 1;
+	}
+
+	AssemblyResult program;
+	bool hasDebug = false;
+	if (!Disassembler::Load(args[0], program, hasDebug))
+	{
+		std::cout << "Could not read " << args[0] << std::endl;
+		return 1;
+	}
+	hasDebug = hasDebug && !ignoreDebug;
+
+	const uint32_t size = static_cast<uint32_t>(std::min<size_t>(program.image.size(), 0x10000));
+	std::vector<uint16_t> memory = program.image;
+	memory.resize(0x10000);
+
+	// The program starts at 0, with a .debug the code its labels point at is known too
+	std::vector<uint16_t> entries = { 0 };
+	std::vector<uint16_t> code;
+	std::unordered_map<uint16_t, std::string> names;
+	if (hasDebug)
+	{
+		const std::vector<uint16_t> taken = FindAddressTaken(program.debug);
+		entries.insert(entries.end(), taken.begin(), taken.end());
+
+		for (const TokenData& token : program.debug.tokens)
+		{
+			if (token.type == ETokenType::Op)
+			{
+				code.push_back(static_cast<uint16_t>(token.address));
+			}
+		}
+		for (const auto& label : program.debug.labels)
+		{
+			std::string& name = names[static_cast<uint16_t>(label.second)];
+			name = name.empty() || label.first < name ? label.first : name;
+		}
+	}
+
+	const ControlFlowGraph graph = ControlFlowAnalyzer().Analyze(memory.data(), size, entries, code);
+
+	TimingAnalyzer timingAnalyzer;
+	for (const std::string& bound : loopBounds)
+	{
+		const size_t equals = bound.find('=');
+		const std::string loop = bound.substr(0, equals);
+		const auto label = program.debug.labels.find(loop);
+		try
+		{
+			if (equals == std::string::npos)
+			{
+				throw std::invalid_argument(bound);
+			}
+			const unsigned long address = hasDebug && label != program.debug.labels.end() ? static_cast<unsigned long>(label->second) : std::stoul(loop, nullptr, 0);
+			timingAnalyzer.SetLoopBound(static_cast<uint16_t>(address), std::stoull(bound.substr(equals + 1), nullptr, 0));
+		}
+		catch (const std::exception&)
+		{
+			std::cout << "Bad loop bound " << bound << ", expected <label or address>=<times>" << std::endl;
+			return 1;
+		}
+	}
+
+	if (dot || calls)
+	{
+		std::cout << graph.ToDot(calls, names);
+		return 0;
+	}
+	if (json)
+	{
+		std::cout << graph.ToJson(names);
+		return 0;
+	}
+
+	std::cout << args[0] << ": " << graph.blocks.size() << " blocks in " << graph.subroutines.size() << " subroutines" << std::endl;
+
+	std::cout << std::endl << "Subroutines:" << std::endl;
+	for (const Subroutine& subroutine : graph.subroutines)
+	{
+		std::cout << "  " << Name(subroutine.entry, names) << ", " << subroutine.blocks.size() << (subroutine.blocks.size() == 1 ? " block" : " blocks");
+		for (size_t i = 0; i < subroutine.callees.size(); i++)
+		{
+			std::cout << (i == 0 ? ", calls " : ", ") << Name(graph.subroutines[subroutine.callees[i]].entry, names);
+		}
+		std::cout << (subroutine.computedCalls ? ", makes computed calls" : "") << std::endl;
+	}
+
+	if (!graph.computedJumps.empty())
+	{
+		std::cout << std::endl << "Computed jumps and calls:" << std::endl;
+		for (const uint16_t address : graph.computedJumps)
+		{
+			std::cout << "  " << Hex(address) << std::endl;
+		}
+		if (!hasDebug)
+		{
+			std::cout << "  Without a .debug where they go isn't known, so code only they reach shows as unreached" << std::endl;
+		}
+	}
+
+	if (!graph.codeWrites.empty())
+	{
+		std::cout << std::endl << "Writes to code:" << std::endl;
+		for (const CodeWrite& write : graph.codeWrites)
+		{
+			std::cout << "  " << Hex(write.address) << " writes " << Hex(write.target) << ", part of the instruction at " << Name(write.instruction, names) << std::endl;
+		}
+	}
+	if (!graph.indirectWrites.empty())
+	{
+		std::cout << std::endl << graph.indirectWrites.size() << " instructions write where a register or memory says, they could write code too" << std::endl;
+	}
+
+	// With a .debug only dead code is worth listing, anything else unreached is data
+	size_t listed = 0;
+	size_t words = 0;
+	for (const AddressRange& range : graph.unreached)
+	{
+		words += range.end - range.start;
+		if (hasDebug && !range.code)
+		{
+			continue;
+		}
+
+		if (listed == 0)
+		{
+			std::cout << std::endl << (hasDebug ? "Unreachable code:" : "Unreached:") << std::endl;
+		}
+		if (listed++ < MAX_LISTED)
+		{
+			std::cout << "  " << Name(range.start, names) << " to " << Hex(range.end - 1) << std::endl;
+		}
+	}
+	if (listed > MAX_LISTED)
+	{
+		std::cout << "  and " << listed - MAX_LISTED << " more" << std::endl;
+	}
+	std::cout << std::endl << words << " of " << size << " words are never reached" << std::endl;
+
+	if (timing)
+	{
+		PrintTiming(graph, timingAnalyzer.Analyze(memory.data(), graph), hz.empty() ? 0 : std::strtoull(hz.back().c_str(), nullptr, 0), names);
+	}
+
+	return 0;
+}
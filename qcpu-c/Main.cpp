@@ -3,17 +3,117 @@
 //
 
 #include "Assembler.h"
+#include "BatchAssembler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <string>
+#include <vector>
 
 int main(const int argc, char* argv[])
 {
-	if (argc <= 1)
+	std::vector<std::string> args(argv + 1, argv + argc);
+
+	// -O can go anywhere and turns on the peephole optimizer, -Os also strips what a whole program never uses
+	auto option = [&args](const char* name)
+	{
+		const auto flag = std::find(args.begin(), args.end(), name);
+		if (flag == args.end())
+		{
+			return false;
+		}
+
+		args.erase(flag);
+		return true;
+	};
+
+	// -P <file> lays the program out by a profile the VM saved while running it, see Profile.h.
+	// It implies -O, so profile a build made with -O (or -Os) and then add -P to the same options.
+	Profile profile;
+	const auto path = std::find(args.begin(), args.end(), "-P");
+	if (path != args.end() && path + 1 != args.end())
+	{
+		if (!profile.Load(*(path + 1)))
+		{
+			std::cout << "Could not read profile " << *(path + 1) << std::endl;
+		}
+		args.erase(path, path + 2);
+	}
+
+	// -j <threads> limits how many files -b assembles at once, by default it is one per core
+	uint32_t threads = 0;
+	const auto jobs = std::find(args.begin(), args.end(), "-j");
+	if (jobs != args.end() && jobs + 1 != args.end())
+	{
+		threads = static_cast<uint32_t>(std::stoul(*(jobs + 1)));
+		args.erase(jobs, jobs + 2);
+	}
+
+	const bool strip = option("-Os");
+	const bool optimize = option("-O") || strip || !profile.executions.empty();
+
+	if (args.empty())
 	{
 		std::cout << "Please provide a file" << std::endl;
 	}
-	else if (argc == 3)
+	else if (args.size() == 2)
+	{
+		Assembler avengers(args[0]);
+		avengers.SetOptimize(optimize, strip);
+		avengers.SetProfile(profile);
+		avengers.AssembleAndSave(args[1]);
+	}
+	else if (args.size() == 3 && args[0] == "-c")
+	{
+		// Assemble a unit to an object file, to be linked with qcpu-ld
+		Assembler avengers(args[1]);
+		avengers.SetOptimize(optimize);
+		avengers.BuildObject(std::filesystem::path(args[1]).stem().string()).Save(args[2]);
+	}
+	else if (args.size() == 3 && args[0] == "-b")
 	{
-		Assembler avengers(argv[1]);
-		avengers.AssembleAndSave(argv[2]);
+		// Assemble a directory or manifest of programs into a directory, skipping what hasn't changed
+		const auto start = std::chrono::steady_clock::now();
+
+		BatchAssembler batch;
+		batch.SetOptimize(optimize, strip);
+		batch.SetThreads(threads);
+		const std::vector<BatchResult> results = batch.Run(BatchAssembler::FindJobs(args[1], args[2]));
+
+		size_t assembled = 0;
+		size_t failed = 0;
+		for (const BatchResult& result : results)
+		{
+			if (result.failed)
+			{
+				std::cout << "       failed  " << result.input << ": " << result.error << std::endl;
+				failed++;
+			}
+			else if (result.cached)
+			{
+				std::cout << "   up to date  " << result.input << std::endl;
+			}
+			else
+			{
+				std::cout << std::fixed << std::setprecision(2) << std::setw(9) << result.milliseconds << " ms  " << result.input << std::endl;
+				assembled++;
+			}
+		}
+
+		const double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Assembled " << assembled << " of " << results.size() << " files in " << std::setprecision(2) << total << " ms";
+		if (failed > 0)
+		{
+			std::cout << ", " << failed << " failed";
+		}
+		std::cout << std::endl;
+
+		if (failed > 0)
+		{
+			return 1;
+		}
 	}
 
 	return 0;
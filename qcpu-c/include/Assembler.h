@@ -4,11 +4,17 @@
 
 #pragma once
 
+#include "AssemblyResult.h"
+#include "ISA.h"
+#include "LexItem.h"
+#include "ObjectFile.h"
+#include "Profile.h"
 #include "TokenData.h"
 
 #include <cstdint>
-#include <regex>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -17,62 +23,145 @@
 #include <cereal/types/unordered_map.hpp>
 #include <cereal/types/vector.hpp>
 
-struct Opcode
+struct RegisterData
 {
-	Opcode(std::string name, const uint16_t value, const uint16_t arity)
+	RegisterData(std::string name, const uint16_t value)
 		: name(std::move(name))
 		, value(value)
-		, arity(arity)
 	{
 	}
 
 	std::string name;
 	uint16_t value;
-	uint16_t arity;
 };
 
-struct RegisterData
+// An error in the source, thrown instead of stopping the program once ThrowErrors is set
+struct AssemblyError : public std::runtime_error
 {
-	RegisterData(std::string name, const uint16_t value)
-		: name(std::move(name))
-		, value(value)
+	AssemblyError(const std::string& message, const int32_t line)
+		: std::runtime_error(message)
+		, line(line)
 	{
 	}
 
-	std::string name;
-	uint16_t value;
+	// The line being assembled when it was found, or 0 if it isn't known
+	int32_t line;
 };
 
 class Assembler
 {
 public:
-	const static std::vector<Opcode> OPS;
 	const static std::vector<RegisterData> REGISTERS;
 
+	// Bumped whenever the same source and options would assemble to something else, so that
+	// builds cached by an older assembler are done again
+	static const uint32_t VERSION = 1;
+
 public:
 	using LabelMap = std::unordered_map<std::string, int32_t>;
 
 public:
+	Assembler();
 	explicit Assembler(const std::string& file);
 	
 	uint16_t ParseInt(const std::string& s, uint16_t radix = 10) const;
-	uint16_t ParseNumber(const std::string& s) const;
-	bool IsNumber(const std::string& s) const;
+	static uint16_t ParseNumber(const std::string_view s);
+	static bool IsNumber(const std::string_view s);
 	void Prepare();
 
-	std::vector<TokenData> Tokenize();
-	std::vector<uint16_t> Convert(const std::vector<TokenData>& tokens, const std::unordered_map<std::string, int32_t>& labels) const;
+	// A unit assembled for the linker isn't a whole program, so nothing is stripped from it.
+	// end is set to the address layout finished at, after any trailing .ds.
+	std::vector<TokenData> Tokenize(const bool wholeProgram = true, int32_t* end = nullptr);
+	// Lexes text starting at firstLine, depth is left > 0 if a '(' is never closed
+	std::vector<LexItem> Lex(const std::string_view text, const int32_t firstLine = 1, int32_t* depth = nullptr);
+	// Assigns addresses to lexed items, appending to tokens and moving address along
+	static void Layout(const std::vector<LexItem>& items, const int32_t lineOffset, int32_t& address, std::vector<TokenData>& tokens);
+	static LabelMap BuildLabelTable(const std::vector<TokenData>& tokens);
+	// With relocations, every word holding an address is recorded and unknown labels are left for the linker
+	std::vector<uint16_t> Convert(const std::vector<TokenData>& tokens, const std::unordered_map<std::string, int32_t>& labels, std::vector<Relocation>* relocations = nullptr) const;
+	AssemblyResult Build();
+	ObjectFile BuildObject(const std::string& name);
 	std::vector<uint8_t> Assemble();
 	void AssembleAndSave(const std::string& filename);
+	static void Save(const AssemblyResult& result, const std::string& filename);
 	void Load(const std::string& in);
+	void LoadText(const std::string& text);
+	// .include paths are resolved against this, Load sets it to the file's directory
+	void SetDirectory(const std::string& baseDirectory);
+	// Runs the optimizer between lexing and layout, see Optimizer.h. With strip, whole
+	// programs also lose code and data that is never reached and share identical data.
+	void SetOptimize(const bool enabled, const bool strip = false);
+	// Lays out whole programs by how often their code ran, when optimizing. The counts have
+	// to be for the program as it is built without them, with the same options.
+	void SetProfile(const Profile& counts);
+
+	// Errors stop the program by default, with this they throw an AssemblyError instead. It
+	// applies to every assembler on the calling thread, so an editor can carry on after one.
+	static void ThrowErrors(const bool enabled);
+
+	// Every file .include read during the last build, as it was resolved
+	const std::vector<std::string>& GetIncludes() const { return includes; }
 
 private:
-	void ReplaceText(std::string& s, const std::regex& expression, const std::string& value) const;
-	bool HasMatch(const std::string& s, const std::regex& expression) const;
-	std::string GetMatch(const std::string& s, const std::regex& expression, int32_t index) const;
+	struct MacroToken
+	{
+		std::string text;
+		int32_t line;
+		bool label;
+	};
+
+	struct Macro
+	{
+		std::vector<std::string> parameters;
+		std::vector<MacroToken> body;
+	};
+
+	// A .macro or .rept body being collected until its matching .endm or .endr
+	struct Recording
+	{
+		Recording()
+			: active(false)
+			, rept(false)
+			, count(0)
+			, nesting(0)
+			, line(0)
+		{
+		}
+
+		bool active;
+		bool rept;
+		std::string name;
+		std::vector<std::string> parameters;	// For .rept, the optional counter
+		int32_t count;
+		std::vector<MacroToken> body;
+		int32_t nesting;
+		int32_t line;
+	};
+
+private:
+	ETokenType Classify(const std::string_view token) const;
+	void Emit(const std::string_view token, const bool label, const int32_t line, std::vector<LexItem>& items);
+	void Record(const std::string_view token, const bool label, const int32_t line, std::vector<LexItem>& items);
+	void Replay(const std::vector<MacroToken>& body, const std::vector<std::string>& parameters, const std::vector<std::string>& arguments, const int32_t line, std::vector<LexItem>& items);
+	void ApplyDirective(const std::string_view token, const int32_t line, std::vector<LexItem>& items);
+	void Include(const std::string& file, const int32_t line, std::vector<LexItem>& items);
+	int32_t EvaluateConstant(const std::string_view text, const std::string& directive, const int32_t line) const;
 	std::string ToLowercase(const std::string& s) const;
 
 	std::string fileText;
-	std::regex opRegex;
-	std::regex registerRegex;
+	std::string directory;
+
+	// Files currently being included, innermost last
+	std::vector<std::string> includeStack;
+	std::vector<std::string> includes;
+
+	// Defined while lexing, .equ values are kept here when they don't depend on labels
+	std::unordered_map<std::string, Macro> macros;
+	std::unordered_map<std::string, int32_t> constants;
+	Recording recording;
+	int32_t expansionDepth;
+
+	bool optimize;
+	bool stripUnused;
+	Profile profile;
 };
@@ -0,0 +1,48 @@
+//
+//	AssemblyResult
+//
+
+#pragma once
+
+#include "DebugInfo.h"
+
+#include <cstdint>
+#include <vector>
+
+// Everything produced by assembling a program, held in memory so it can be loaded
+// straight into a QCPU or written out with Assembler::Save
+struct AssemblyResult
+{
+	// Source line of the token at address, or -1 if nothing was assembled there
+	int32_t GetLine(const uint16_t address) const
+	{
+		for (const TokenData& token : debug.tokens)
+		{
+			if (token.address == address)
+			{
+				return token.line;
+			}
+		}
+
+		return -1;
+	}
+
+	// Address of a label, or -1 if there is no such label
+	int32_t GetSymbol(const std::string& name) const
+	{
+		const auto it = debug.labels.find(name);
+		return it != debug.labels.end() ? it->second : -1;
+	}
+
+	// The roots used when verifying the image, see DebugInfo::GetEntryPoints
+	std::vector<uint16_t> GetEntryPoints() const
+	{
+		return debug.GetEntryPoints();
+	}
+
+	// One word per address, starting at 0
+	std::vector<uint16_t> image;
+
+	// The line table (every token with its address and source line) and the symbol table
+	DebugInfo debug;
+};
@@ -0,0 +1,76 @@
+//
+//	BatchAssembler
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct BatchJob
+{
+	std::string input;
+	std::string output;
+};
+
+struct BatchResult
+{
+	BatchResult()
+		: input()
+		, output()
+		, cached(false)
+		, failed(false)
+		, error()
+		, milliseconds(0.0)
+	{
+	}
+
+	std::string input;
+	std::string output;
+
+	// Nothing that went into the output changed, so it was left as it was
+	bool cached;
+
+	// The source couldn't be read or has an error, so nothing was written
+	bool failed;
+	std::string error;
+
+	double milliseconds;
+};
+
+// Assembles a library of programs at once, a file per thread. Each output gets a .cache file
+// next to its .debug, holding a hash of the source, the options and the assembler's version,
+// and a hash of every file the source included. While those all still match, the output
+// is up to date and the file isn't assembled again, so rebuilding an unchanged library only
+// costs reading its sources. An error only fails the file it is in, the rest are still built.
+class BatchAssembler
+{
+public:
+	BatchAssembler();
+
+	void SetOptimize(const bool enabled, const bool strip = false);
+	// 0 uses one thread per core
+	void SetThreads(const uint32_t count);
+
+	// Results are in the same order as the jobs
+	std::vector<BatchResult> Run(const std::vector<BatchJob>& jobs) const;
+
+	// Every .asm file under a directory, or every line of a manifest file. A manifest line is
+	// an input and optionally its output, both relative to the manifest, and # starts a
+	// comment. Outputs that aren't given go in outputDirectory at the input's path relative
+	// to the directory or manifest, without its extension, so inputs with the same name in
+	// different subdirectories don't share one.
+	static std::vector<BatchJob> FindJobs(const std::string& path, const std::string& outputDirectory);
+
+private:
+	BatchResult Assemble(const BatchJob& job) const;
+	// Everything that decides the output apart from the includes
+	uint64_t HashSource(const std::string& source) const;
+	bool IsUpToDate(const BatchJob& job, const uint64_t key) const;
+
+private:
+	bool optimize;
+	bool stripUnused;
+	uint32_t threads;
+};
@@ -6,8 +6,10 @@
 
 #include "TokenData.h"
 
+#include <cstdint>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <cereal/cereal.hpp>
@@ -21,6 +23,31 @@ struct DebugInfo
 		archive(cereal::make_nvp("labels", labels));
 	}
 
+	// Address 0 plus every label on an instruction, the roots used when verifying an image.
+	// Labels on data are left out so their pages aren't taken for code.
+	std::vector<uint16_t> GetEntryPoints() const
+	{
+		std::unordered_set<int32_t> ops;
+		for (const TokenData& token : tokens)
+		{
+			if (token.type == ETokenType::Op)
+			{
+				ops.insert(token.address);
+			}
+		}
+
+		std::vector<uint16_t> entries = { 0 };
+		for (const auto& label : labels)
+		{
+			if (ops.count(label.second) != 0)
+			{
+				entries.push_back(static_cast<uint16_t>(label.second));
+			}
+		}
+
+		return entries;
+	}
+
 	std::vector<TokenData> tokens;
 	std::unordered_map<std::string, int32_t> labels;
 };
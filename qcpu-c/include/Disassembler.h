@@ -0,0 +1,52 @@
+//
+//	Disassembler
+//
+
+#pragma once
+
+#include "AssemblyResult.h"
+#include "DebugInfo.h"
+#include "DecodedOp.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// An instruction, or a run of words that aren't one
+struct DisassemblyLine
+{
+	uint16_t address;
+	uint16_t size;
+	bool code;
+
+	// Labels defined at address
+	std::vector<std::string> labels;
+	std::string text;
+};
+
+// Turns an image back into qasm, decoding it with the same tables as the VM. With the program's
+// .debug, its tokens say which words are instructions and which operands were labels. Without
+// it, every word that decodes as an instruction is taken as one and jump targets are given
+// labels. Either way, the text assembles back to the same image.
+class Disassembler
+{
+public:
+	Disassembler();
+
+	void SetDebugInfo(const DebugInfo& info);
+
+	std::vector<DisassemblyLine> Disassemble(const std::vector<uint16_t>& image) const;
+	// The lines as a source file, optionally with each line's address and words in a comment
+	static std::string ToText(const std::vector<DisassemblyLine>& lines, const std::vector<uint16_t>& image, const bool addresses = false);
+
+	// The instruction at address, or false if the words there aren't one the assembler can
+	// write, such as an unknown opcode or a register that doesn't exist
+	static bool Decode(const std::vector<uint16_t>& image, const size_t address, DecodedOp& op);
+
+	// Reads an image and its .debug, if there is one
+	static bool Load(const std::string& filename, AssemblyResult& program, bool& hasDebug);
+
+private:
+	bool hasDebug;
+	DebugInfo debug;
+};
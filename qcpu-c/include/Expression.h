@@ -0,0 +1,70 @@
+//
+//	Expression
+//
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+struct ExpressionValue
+{
+	ExpressionValue()
+		: value(0)
+		, relocations(0)
+	{
+	}
+
+	ExpressionValue(const int32_t value, const int32_t relocations)
+		: value(value)
+		, relocations(relocations)
+	{
+	}
+
+	int32_t value;
+
+	// How many label addresses were added in, net of those subtracted. In an object
+	// file 0 is an absolute value and 1 is an address that moves with the unit, any
+	// other count (or INVALID_RELOCATIONS) can't be linked.
+	int32_t relocations;
+};
+
+// Evaluates an assemble-time constant expression such as WIDTH*HEIGHT or (buffer+4)&0xFF.
+// Operators and their precedence follow C: unary - ~ +, then * / %, + -, << >>, &, ^, |.
+// Numbers use the assembler's formats, and identifiers are looked up through a resolver.
+class Expression
+{
+public:
+	static const int32_t INVALID_RELOCATIONS = 0x40000000;
+
+	// Returns false if the symbol is unknown
+	using Resolver = std::function<bool(const std::string_view name, ExpressionValue& value)>;
+
+public:
+	Expression(const std::string_view text, const Resolver& resolver);
+
+	bool Evaluate(ExpressionValue& result);
+	const std::string& GetError() const { return error; }
+
+	// True if text parses as an expression, without resolving any symbols
+	static bool IsExpression(const std::string_view text);
+
+private:
+	bool ParseBinary(const int32_t precedence, ExpressionValue& result);
+	bool ParseUnary(ExpressionValue& result);
+	bool ParsePrimary(ExpressionValue& result);
+	int32_t PeekOperator(std::string_view& op);
+	void SkipSpace();
+	bool Fail(const std::string& message);
+
+private:
+	std::string_view text;
+	size_t position;
+	const Resolver& resolver;
+	std::string error;
+
+	// Set while only the syntax is being checked, where values are placeholders
+	bool syntaxOnly;
+};
@@ -0,0 +1,70 @@
+//
+//	IncrementalAssembler
+//
+
+#pragma once
+
+#include "Assembler.h"
+#include "AssemblyResult.h"
+#include "LexItem.h"
+#include "TokenData.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct ImageDelta
+{
+	ImageDelta()
+		: relayout(true)
+	{
+	}
+
+	// Set when labels or instruction boundaries moved, or there was no previous image,
+	// the whole image has to be reloaded rather than patched
+	bool relayout;
+
+	// Address and new value of every word that differs from the previous image
+	std::vector<std::pair<uint16_t, uint16_t>> words;
+};
+
+// Reassembles source that is being edited, typically the text editor's buffer. Lines
+// are lexed once and reused while their text is unchanged, so an edit only costs the
+// lexing of the lines it touched plus a linear layout and conversion pass. Each
+// result is compared with the one before it, which lets a running VM be patched in
+// place when the layout allows, keeping its registers, stacks and data.
+class IncrementalAssembler
+{
+public:
+	IncrementalAssembler();
+
+	// .include paths in text are resolved against directory
+	ImageDelta Assemble(const std::string& text, const std::string& directory = std::string());
+	void Reset();
+
+	const AssemblyResult& GetResult() const { return result; }
+
+	// Lines that were lexed, rather than reused, by the last call to Assemble
+	size_t GetLexedLineCount() const { return lexedLines; }
+
+private:
+	struct CachedLine
+	{
+		std::vector<LexItem> items;
+		int32_t line;	// The line number the items were lexed with
+	};
+
+	bool LexLines(const std::string& text, std::vector<TokenData>& tokens);
+
+private:
+	Assembler assembler;
+	std::unordered_map<std::string, CachedLine> lineCache;
+
+	AssemblyResult result;
+	std::vector<int32_t> opAddresses;
+	bool hasImage;
+	size_t lexedLines;
+};
@@ -0,0 +1,38 @@
+//
+//	LexItem
+//
+
+#pragma once
+
+#include "TokenType.h"
+
+#include <cstdint>
+#include <string>
+
+enum class ELexItemKind : uint8_t
+{
+	Token,		// Placed at the current address, which then advances by one
+	Label,		// Placed at the current address
+	Org,		// Moves the current address to value
+	Reserve		// Advances the current address by value
+};
+
+// The output of the lexer, before addresses are assigned. Nothing here depends on
+// where the text sits in the file, so lexed lines can be reused after edits elsewhere.
+struct LexItem
+{
+	LexItem(const ELexItemKind kind, const ETokenType type, std::string data, const uint16_t value, const int32_t line)
+		: kind(kind)
+		, type(type)
+		, data(std::move(data))
+		, value(value)
+		, line(line)
+	{
+	}
+
+	ELexItemKind kind;
+	ETokenType type;
+	std::string data;
+	uint16_t value;
+	int32_t line;
+};
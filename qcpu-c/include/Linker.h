@@ -0,0 +1,29 @@
+//
+//	Linker
+//
+
+#pragma once
+
+#include "AssemblyResult.h"
+#include "ObjectFile.h"
+
+#include <string>
+#include <vector>
+
+// Lays separately assembled units out one after another, the first at address 0 so
+// it holds the entry point, and resolves the references between them. A reference
+// goes to the unit's own label when it has one, otherwise to the one unit that
+// exports that name. A .org inside a unit is relative to where the unit is placed.
+class Linker
+{
+public:
+	void Add(ObjectFile object);
+
+	// Assembles .asm files and loads .qo files, assembling in parallel, and adds them in order
+	void AddFiles(const std::vector<std::string>& files);
+
+	AssemblyResult Link() const;
+
+private:
+	std::vector<ObjectFile> objects;
+};
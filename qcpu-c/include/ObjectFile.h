@@ -0,0 +1,81 @@
+//
+//	ObjectFile
+//
+
+#pragma once
+
+#include "TokenData.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/unordered_map.hpp>
+#include <cereal/types/vector.hpp>
+
+// A word in an object file's image that holds an address and must be fixed up when linking
+struct Relocation
+{
+	Relocation()
+		: address(0)
+	{
+	}
+
+	Relocation(const uint16_t address, std::string symbol)
+		: address(address)
+		, symbol(std::move(symbol))
+	{
+	}
+
+	template <class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(cereal::make_nvp("address", address));
+		archive(cereal::make_nvp("symbol", symbol));
+	}
+
+	uint16_t address;
+
+	// Empty when the word already holds an address within this unit and only needs the
+	// unit's base adding, otherwise the word is replaced by the symbol's linked address
+	std::string symbol;
+};
+
+// A separately assembled unit, addressed from 0. Every label is exported, and a
+// reference to a label the unit doesn't define is left for the linker to resolve.
+struct ObjectFile
+{
+	ObjectFile()
+		: extent(0)
+	{
+	}
+
+	bool Load(const std::string& filename);
+	bool Save(const std::string& filename) const;
+
+	template <class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(cereal::make_nvp("name", name));
+		archive(cereal::make_nvp("image", image));
+		archive(cereal::make_nvp("extent", extent));
+		archive(cereal::make_nvp("symbols", symbols));
+		archive(cereal::make_nvp("relocations", relocations));
+		archive(cereal::make_nvp("tokens", tokens));
+	}
+
+	std::string name;
+	std::vector<uint16_t> image;
+
+	// Words the unit takes up once placed, more than image holds when it ends with space
+	// reserved by .ds or moved to by .org
+	int32_t extent;
+	std::unordered_map<std::string, int32_t> symbols;
+	std::vector<Relocation> relocations;
+
+	// The line table, addressed the same way as image
+	std::vector<TokenData> tokens;
+};
@@ -0,0 +1,134 @@
+//
+//	Optimizer
+//
+
+#pragma once
+
+#include "ISA.h"
+#include "LexItem.h"
+#include "Profile.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Peephole passes over lexed items, run between Lex and Layout when assembling with -O.
+// Addresses are only assigned afterwards and every item keeps the line it was lexed on,
+// so the line table stays correct for whatever is left. The passes are repeated until
+// none of them finds anything more to do:
+//
+//	- a jump to a jmp goes straight to that jmp's target
+//	- a jmp to the instruction right after it is removed
+//	- jcc L, jmp M, L: becomes the inverted jcc M, L:
+//	- mov r r is removed, psh v pop v is removed and psh v pop w becomes mov w v
+//	- mul by a power of two becomes lsl, mod by a power of two becomes and
+//	- psh r, jsr f, pop r loses the psh and pop when f can't write r
+//	- jsr to a short run of straight line code ending in ret is replaced by a copy of it
+//
+// What a subroutine can write is found by following every path from its label to its
+// ret, through the routines it calls. Saves are only removed around one that leaves the
+// stack as it found it, so it can't be using what the caller pushed.
+//
+// Labels stay where they are, but instructions between them can move or disappear, so
+// code that patches itself or computes addresses inside other instructions (label+2
+// and the like) should not be optimised.
+//
+// For a whole program (-Os) the text is then cut into sections, each running from a
+// label to the next one. Sections that can't be reached are dropped: reachable ones
+// are the first, those a reachable section falls through into, and those it refers
+// to by label, including through .equ. Data right after other data, named only by
+// labels nothing refers to, is taken to be more of the same table and goes wherever
+// it goes. Then sections of read-only data with the same contents, such as repeated
+// strings, are merged and their labels all name the one that is kept. Layout packs
+// what is left together. A label+N that reaches past the next referenced label, or a
+// write to data through a register, isn't seen by either step.
+//
+// Given a profile of the program as it is built without one (-P), sections are then
+// arranged by how often they ran. A jcc that is usually taken over straight line code
+// ending in a jmp, ret or ext is inverted to go to that code instead, and the code is
+// moved out of line. Then, heaviest first, each section that usually jumps to or falls
+// into another is placed right before it, inverting a branch at its end when that is
+// what now falls through, and adding a jmp where a section no longer falls into the one
+// it used to. The first section of a run stays first, sections that + and - labels
+// reach across stay together, and nothing moves past data or a .org. What never ran
+// ends up at the end of its run.
+class Optimizer
+{
+public:
+	// Returns the number of rewrites that were made. A unit that is linked with others
+	// isn't a whole program, since its labels can be used from elsewhere.
+	int32_t Optimize(std::vector<LexItem>& items, const bool wholeProgram = false, const Profile* profile = nullptr);
+
+private:
+	// Items [begin, end), the labels naming it run from begin to body
+	struct Section
+	{
+		size_t begin;
+		size_t body;
+		size_t end;
+	};
+
+	// What calling a subroutine can do to the caller
+	struct Clobbers
+	{
+		uint16_t registers;	// Bit n is set if register n may be written
+		bool balanced;		// Returns with the stack as it was, never popping below where it started
+	};
+
+	// Sections [first, last], which have to stay in this order
+	struct Block
+	{
+		size_t first;
+		size_t last;
+		bool movable;		// Only instructions, that nothing runs into from a place it can't follow
+	};
+
+private:
+	bool IsInstruction(const std::vector<LexItem>& items, const size_t index, const Instruction*& op) const;
+	void IndexLabels(const std::vector<LexItem>& items);
+	// The item a jump operand goes to, or -1 if it isn't a label defined in this text
+	int32_t FindTarget(const std::vector<LexItem>& items, const size_t operand) const;
+	// True if the labels starting at index include the one that operand refers to
+	bool LabelsInclude(const std::vector<LexItem>& items, size_t index, const size_t operand) const;
+
+	int32_t ThreadJumps(std::vector<LexItem>& items);
+	int32_t Simplify(std::vector<LexItem>& items);
+
+	Clobbers FindClobbers(const std::vector<LexItem>& items, const std::string& name);
+	// The label a jsr at index calls, or empty if it isn't one defined in this text
+	std::string FindCallee(const std::vector<LexItem>& items, const size_t index) const;
+	int32_t RemoveSaves(std::vector<LexItem>& items);
+	int32_t InlineLeaves(std::vector<LexItem>& items);
+
+	// Also fills owners with the section of every item
+	std::vector<Section> BuildSections(const std::vector<LexItem>& items, std::vector<size_t>& owners) const;
+	// Appends the label items an operand refers to, following .equ into their expressions
+	void CollectReferences(const std::vector<LexItem>& items, const size_t operand, std::vector<int32_t>& targets) const;
+	void CollectSymbols(const std::string& expression, std::vector<int32_t>& targets, std::vector<std::string>& visited) const;
+	// True if every label and .equ that any item refers to is defined, following .equ into
+	// their expressions
+	bool IsResolved(const std::vector<LexItem>& items) const;
+	bool AreDefined(const std::string& expression, std::vector<std::string>& visited) const;
+	// Sections that are the continuation of the data in the section before them
+	std::vector<bool> FindContinuations(const std::vector<LexItem>& items, const std::vector<Section>& sections, const std::vector<size_t>& owners) const;
+	int32_t StripUnreachable(std::vector<LexItem>& items);
+	int32_t MergeData(std::vector<LexItem>& items);
+
+	// True if execution can carry on past the end of the section. last is set to its final
+	// instruction if it is nothing but instructions, and to items.size() if it isn't.
+	bool FallsThrough(const std::vector<LexItem>& items, const Section& section, size_t& last) const;
+	// A named label that reaches the start of the section, or empty if it has none
+	std::string FindName(const std::vector<LexItem>& items, const Section& section) const;
+	// Blocks in the first end items can move, anything after that is code put out of line.
+	// Returns false if a + or - label can't be found.
+	bool BuildBlocks(const std::vector<LexItem>& items, const std::vector<Section>& sections, const std::vector<size_t>& owners, const size_t end, std::vector<Block>& blocks) const;
+	// The usually taken jcc a section ends with, jumping over code that is rare enough to move
+	size_t FindColdBranch(const std::vector<LexItem>& items, const Section& section, const std::vector<uint64_t>& runs, const std::vector<uint64_t>& jumps) const;
+	int32_t ArrangeByProfile(std::vector<LexItem>& items, const Profile& profile);
+
+	// Rebuilt before each pass, named labels map to their item index and .equ names to their expression
+	std::unordered_map<std::string, size_t> labels;
+	std::unordered_map<std::string, std::string> equs;
+	std::unordered_map<std::string, Clobbers> clobbers;
+};
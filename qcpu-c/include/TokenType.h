@@ -17,5 +17,8 @@ enum class ETokenType : uint8_t
 	Absolute,
 	Indirect,
 	Label,
-	Directive
+	Directive,
+	Expression,
+	AbsoluteExpression,
+	Equ
 };
\ No newline at end of file
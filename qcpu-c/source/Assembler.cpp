@@ -4,45 +4,24 @@
 
 #include "Assembler.h"
 #include "DebugInfo.h"
+#include "Expression.h"
 #include "Filesystem.h"
+#include "Optimizer.h"
 
 #define ASSERTF_DEF_ONCE
 #include "assertf.h"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstdarg>
+#include <cstdio>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <cereal/archives/json.hpp>
 
-const std::vector<Opcode> Assembler::OPS =
-{
-	Opcode("nop", 0x00, 0),
-	Opcode("ext", 0x01, 1),
-	Opcode("sys", 0x02, 1),
-	Opcode("mov", 0x03, 2),
-	Opcode("jmp", 0x04, 1),
-	Opcode("jeq", 0x05, 3),
-	Opcode("jne", 0x06, 3),
-	Opcode("jgt", 0x07, 3),
-	Opcode("jge", 0x08, 3),
-	Opcode("jlt", 0x09, 3),
-	Opcode("jle", 0x0A, 3),
-	Opcode("jsr", 0x0B, 1),
-	Opcode("ret", 0x0C, 0),
-	Opcode("add", 0x0D, 2),
-	Opcode("sub", 0x0E, 2),
-	Opcode("mul", 0x0F, 2),
-	Opcode("mod", 0x10, 2),
-	Opcode("and", 0x11, 2),
-	Opcode("orr", 0x12, 2),
-	Opcode("not", 0x13, 1),
-	Opcode("xor", 0x14, 2),
-	Opcode("lsl", 0x15, 2),
-	Opcode("lsr", 0x16, 2),
-	Opcode("psh", 0x17, 1),
-	Opcode("pop", 0x18, 1)
-};
-
 const std::vector<RegisterData> Assembler::REGISTERS =
 {
 	RegisterData("a", 0x00),
@@ -53,21 +32,142 @@ const std::vector<RegisterData> Assembler::REGISTERS =
 	RegisterData("y", 0x05)
 };
 
+// assertf, unless the thread has asked for errors to be thrown instead, see Assembler::ThrowErrors
+#define checkf(e, fmt, ...)										\
+	do															\
+	{															\
+		if (!AssemblerPrivate::throwErrors)						\
+		{														\
+			assertf(e, fmt, ##__VA_ARGS__);						\
+		}														\
+		else if (!(e))											\
+		{														\
+			AssemblerPrivate::Throw(fmt, ##__VA_ARGS__);		\
+		}														\
+	} while (0)
+
 namespace AssemblerPrivate
 {
-	std::unordered_map<std::string, int32_t> BuildLabelTable(const std::vector<TokenData>& tokens)
+	thread_local bool throwErrors = false;
+
+	// The source line being worked on, for errors whose message doesn't say
+	thread_local int32_t errorLine = 0;
+
+	[[noreturn]] void Throw(const char* format, ...)
+	{
+		char message[512];
+		va_list arguments;
+		va_start(arguments, format);
+		vsnprintf(message, sizeof(message), format, arguments);
+		va_end(arguments);
+
+		throw AssemblyError(message, errorLine);
+	}
+
+	// Character classes driving the lexer, everything not listed is part of a token
+	enum class ECharClass : uint8_t
 	{
-		std::unordered_map<std::string, int32_t> table;
+		Other,
+		Space,
+		Comment,
+		Open,
+		Close,
+		Colon
+	};
 
-		for (const auto& token : tokens)
+	struct CharClassTable
+	{
+		CharClassTable()
+			: classes()
 		{
-			if (token.type == ETokenType::Label && !(token.data == "+" || token.data == "-"))
+			classes.fill(ECharClass::Other);
+			for (const char c : { ' ', '\t', '\n', '\v', '\f', '\r', '\0' })
 			{
-				table[token.data] = token.address;
+				classes[static_cast<uint8_t>(c)] = ECharClass::Space;
 			}
+			classes[static_cast<uint8_t>(';')] = ECharClass::Comment;
+			classes[static_cast<uint8_t>('#')] = ECharClass::Comment;
+			classes[static_cast<uint8_t>('(')] = ECharClass::Open;
+			classes[static_cast<uint8_t>(')')] = ECharClass::Close;
+			classes[static_cast<uint8_t>(':')] = ECharClass::Colon;
+		}
+
+		ECharClass operator[](const char c) const
+		{
+			return classes[static_cast<uint8_t>(c)];
 		}
 
-		return table;
+		std::array<ECharClass, 256> classes;
+	};
+
+	static const CharClassTable CHAR_CLASSES;
+
+	bool IsDigit(const char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	bool IsAlpha(const char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+	}
+
+	bool IsWord(const char c)
+	{
+		return IsAlpha(c) || IsDigit(c) || c == '_';
+	}
+
+	bool IsHexDigit(const char c)
+	{
+		return IsDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+	}
+
+	bool IsBinaryDigit(const char c)
+	{
+		return c == '0' || c == '1';
+	}
+
+	template <class TPredicate>
+	bool All(const std::string_view s, TPredicate predicate)
+	{
+		for (const char c : s)
+		{
+			if (!predicate(c))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Splits a number into its digits and radix, returns false if it isn't one
+	bool SplitNumber(const std::string_view s, std::string_view& digits, uint16_t& radix)
+	{
+		if (!s.empty() && All(s, IsDigit))
+		{
+			digits = s;
+			radix = 10;
+			return true;
+		}
+
+		if (s.size() > 2 && s[0] == '0')
+		{
+			const std::string_view rest = s.substr(2);
+			if ((s[1] == 'x' || s[1] == 'X') && All(rest, IsHexDigit))
+			{
+				digits = rest;
+				radix = 16;
+				return true;
+			}
+			if ((s[1] == 'b' || s[1] == 'B') && All(rest, IsBinaryDigit))
+			{
+				digits = rest;
+				radix = 2;
+				return true;
+			}
+		}
+
+		return false;
 	}
 
 	std::vector<uint8_t> Write(const std::vector<uint16_t>& converted)
@@ -87,39 +187,217 @@ namespace AssemblerPrivate
 		return buffer;
 	}
 
-	const Opcode& FindOpByName(const std::string& name)
+	const RegisterData* FindReg(const std::string_view name)
 	{
-		for (auto& op : Assembler::OPS)
+		for (auto& reg : Assembler::REGISTERS)
 		{
-			if (op.name == name)
+			if (reg.name == name)
 			{
-				return op;
+				return &reg;
 			}
 		}
 
-		assertf(false, "Failed to find opcode with name: %s", name.c_str());
-		return Assembler::OPS[0]; // Invalid
+		return nullptr;
 	}
 
-	const RegisterData& FindRegByName(const std::string& name)
+	bool IsIdentifier(const std::string_view s)
 	{
-		for (auto& reg : Assembler::REGISTERS)
+		return !s.empty() && (IsAlpha(s[0]) || s[0] == '_') && All(s, IsWord);
+	}
+
+	std::string_view Trim(std::string_view s)
+	{
+		while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
 		{
-			if (reg.name == name)
+			s.remove_prefix(1);
+		}
+		while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+		{
+			s.remove_suffix(1);
+		}
+		return s;
+	}
+
+	// Splits on commas that aren't inside parentheses or quotes
+	std::vector<std::string> SplitArguments(const std::string_view s)
+	{
+		std::vector<std::string> arguments;
+		if (Trim(s).empty())
+		{
+			return arguments;
+		}
+
+		int32_t depth = 0;
+		bool quoted = false;
+		size_t start = 0;
+		for (size_t i = 0; i <= s.size(); i++)
+		{
+			const char c = i < s.size() ? s[i] : ',';
+			if (c == '\'')
+			{
+				quoted = !quoted;
+			}
+			else if (!quoted && c == '(')
+			{
+				depth++;
+			}
+			else if (!quoted && c == ')')
+			{
+				depth--;
+			}
+			else if (!quoted && depth == 0 && c == ',')
+			{
+				arguments.emplace_back(Trim(s.substr(start, i - start)));
+				start = i + 1;
+			}
+		}
+
+		return arguments;
+	}
+
+	// The lowercased name of a .directive, or empty if token isn't one
+	std::string DirectiveName(const std::string_view token)
+	{
+		std::string name;
+		if (token.size() >= 2 && token[0] == '.')
+		{
+			for (size_t i = 1; i < token.size() && IsWord(token[i]); i++)
+			{
+				name += static_cast<char>(tolower(token[i]));
+			}
+		}
+		return name;
+	}
+
+	// Replaces whole identifiers matching a parameter with its argument, leaving quoted text alone
+	std::string Substitute(const std::string& text, const std::vector<std::string>& parameters, const std::vector<std::string>& arguments)
+	{
+		if (parameters.empty())
+		{
+			return text;
+		}
+
+		std::string result;
+		result.reserve(text.size());
+
+		bool quoted = false;
+		size_t i = 0;
+		while (i < text.size())
+		{
+			if (text[i] == '\'')
 			{
-				return reg;
+				quoted = !quoted;
 			}
+
+			if (quoted || !IsWord(text[i]))
+			{
+				result += text[i++];
+				continue;
+			}
+
+			const size_t start = i;
+			while (i < text.size() && IsWord(text[i]))
+			{
+				i++;
+			}
+
+			const std::string_view word = std::string_view(text).substr(start, i - start);
+			const auto it = std::find(parameters.begin(), parameters.end(), word);
+			if (it != parameters.end())
+			{
+				result += arguments[it - parameters.begin()];
+			}
+			else
+			{
+				result += word;
+			}
+		}
+
+		return result;
+	}
+
+	bool ReadFile(const std::string& path, std::string& out)
+	{
+		std::ifstream file(path, std::ios::binary);
+		file.unsetf(std::ios::skipws);
+
+		std::streampos fileSize;
+		file.seekg(0, std::ios::end);
+		fileSize = file.tellg();
+		file.seekg(0, std::ios::beg);
+		if (fileSize <= 0)
+		{
+			return false;
+		}
+
+		out.resize(static_cast<size_t>(fileSize));
+		file.read(&out[0], fileSize);
+		return true;
+	}
+
+	const Instruction& FindOpByName(const std::string& name)
+	{
+		if (const Instruction* op = FindInstruction(name))
+		{
+			return *op;
+		}
+
+		checkf(false, "Failed to find opcode with name: %s", name.c_str());
+		return INSTRUCTIONS[0]; // Invalid
+	}
+
+	const RegisterData& FindRegByName(const std::string& name)
+	{
+		if (const RegisterData* reg = FindReg(name))
+		{
+			return *reg;
 		}
 
-		assertf(false, "Failed to find register with name: %s", name.c_str());
+		checkf(false, "Failed to find register with name: %s", name.c_str());
 		return Assembler::REGISTERS[0]; // Invalid
 	}
+
+	uint16_t GetAddressingMode(const ETokenType type)
+	{
+		switch (type)
+		{
+			case ETokenType::Absolute:
+			case ETokenType::AbsoluteLabelReference:
+			case ETokenType::AbsoluteExpression: return 0b01;
+			case ETokenType::Indirect: return 0b10;
+			case ETokenType::Register: return 0b11;
+			default: return 0b00;
+		}
+	}
+}
+
+Assembler::Assembler()
+	: fileText()
+	, directory()
+	, includeStack()
+	, includes()
+	, macros()
+	, constants()
+	, recording()
+	, expansionDepth(0)
+	, optimize(false)
+	, stripUnused(false)
+	, profile()
+{
 }
 
 Assembler::Assembler(const std::string& file)
 	: fileText()
-	, opRegex()
-	, registerRegex()
+	, directory()
+	, includeStack()
+	, includes()
+	, macros()
+	, constants()
+	, recording()
+	, expansionDepth(0)
+	, optimize(false)
+	, stripUnused(false)
+	, profile()
 {
 	Load(file);
 }
@@ -129,319 +407,736 @@ uint16_t Assembler::ParseInt(const std::string& s, uint16_t radix /*= 10*/) cons
 	return std::stoi(s, nullptr, radix);
 }
 
-uint16_t Assembler::ParseNumber(const std::string& s) const
+uint16_t Assembler::ParseNumber(const std::string_view s)
+{
+	std::string_view digits;
+	uint16_t radix = 10;
+	if (AssemblerPrivate::SplitNumber(s, digits, radix))
+	{
+		// Values wrap to 16 bits, the same as the VM's arithmetic
+		uint16_t value = 0;
+		for (const char c : digits)
+		{
+			const uint16_t digit = AssemblerPrivate::IsDigit(c) ? c - '0' : (c | 0x20) - 'a' + 10;
+			value = static_cast<uint16_t>(value * radix + digit);
+		}
+		return value;
+	}
+
+	checkf(false, "Error - Unable to parse number: %s", std::string(s).c_str());
+	return 0;
+}
+
+bool Assembler::IsNumber(const std::string_view s)
+{
+	std::string_view digits;
+	uint16_t radix = 10;
+	return AssemblerPrivate::SplitNumber(s, digits, radix);
+}
+
+void Assembler::Prepare()
+{
+	fileText.erase(std::remove(fileText.begin(), fileText.end(), '\r'), fileText.end());
+}
+
+ETokenType Assembler::Classify(const std::string_view token) const
 {
-	std::smatch match;
+	using namespace AssemblerPrivate;
 
-	// Grab all digits [0-9]
-	if (std::regex_search(s.begin(), s.end(), match, std::regex(R"(^\d+$)")))
+	// Checked in the order the grammar has always used, some tokens fit more than one rule
+	if (FindInstruction(token) != nullptr)
+	{
+		return ETokenType::Op;
+	}
+	if (token.size() == 1 && FindReg(token) != nullptr)
+	{
+		return ETokenType::Register;
+	}
+	if (token == "+" || token == "-")
 	{
-		return ParseInt(s);
+		return ETokenType::ImmediateLabelReference;
 	}
-	// Grab all the hex digits
-	if (std::regex_search(s.begin(), s.end(), match, std::regex(R"(^0x([0-9a-f]+)$)", std::regex_constants::icase)))
+	if (token.size() >= 2 && IsAlpha(token[0]) && All(token.substr(1), IsWord))
 	{
-		return ParseInt(match[0], 16);
+		return ETokenType::ImmediateLabelReference;
 	}
-	// Grab all the binary digits
-	if (std::regex_search(s.begin(), s.end(), match, std::regex(R"(^0b([01]+)$)", std::regex_constants::icase)))
+	if (IsNumber(token))
 	{
-		return ParseInt(match[1], 2);
+		return ETokenType::Immediate;
 	}
 
-	assertf(false, "Error - Unable to parse number: %s", s.c_str());
-	return 0;
+	// .name(argument), the argument may not span lines
+	if (token.size() >= 4 && token[0] == '.' && token.back() == ')')
+	{
+		size_t end = 1;
+		while (end < token.size() && IsWord(token[end]))
+		{
+			end++;
+		}
+
+		if (end > 1 && token[end] == '(' && end + 1 < token.size()
+			&& token.find('\n', end) == std::string_view::npos)
+		{
+			return ETokenType::Directive;
+		}
+	}
+
+	if (token.size() >= 2 && token[0] == '$' && All(token.substr(1), IsWord) && IsNumber(token.substr(1)))
+	{
+		return ETokenType::Absolute;
+	}
+	if (token.size() == 3 && token[0] == '[' && token[2] == ']' && FindReg(token.substr(1, 1)) != nullptr)
+	{
+		return ETokenType::Indirect;
+	}
+	if (token == "$:+" || token == "$-")
+	{
+		return ETokenType::ImmediateLabelReference;
+	}
+	if (token.size() >= 3 && token[0] == '$' && IsAlpha(token[1]) && All(token.substr(2), IsWord))
+	{
+		return ETokenType::AbsoluteLabelReference;
+	}
+
+	// A directive without an argument, such as .endm
+	if (token.size() >= 2 && token[0] == '.' && All(token.substr(1), IsWord))
+	{
+		return ETokenType::Directive;
+	}
+
+	// Anything else that reads as a constant expression, label+4, (WIDTH * HEIGHT) etc.
+	if (Expression::IsExpression(token))
+	{
+		return ETokenType::Expression;
+	}
+	if (token.size() >= 2 && token[0] == '$' && Expression::IsExpression(token.substr(1)))
+	{
+		return ETokenType::AbsoluteExpression;
+	}
+
+	return ETokenType::None;
 }
 
-bool Assembler::IsNumber(const std::string& s) const
+void Assembler::Emit(const std::string_view token, const bool label, const int32_t line, std::vector<LexItem>& items)
 {
-	if (std::regex_match(s, std::regex(R"(^\d+$)")))
+	if (recording.active)
 	{
-		return true;
+		Record(token, label, line, items);
+		return;
 	}
-	if (std::regex_match(s, std::regex(R"(^0x[0-9a-f]+$)", std::regex_constants::icase)))
+
+	if (label)
 	{
-		return true;
+		items.emplace_back(ELexItemKind::Label, ETokenType::Label, std::string(token), 0, line);
+		return;
 	}
-	if (std::regex_match(s, std::regex(R"(^0b[01]+$)", std::regex_constants::icase)))
+
+	// name(arguments) invokes a macro, expanded in place and attributed to this line
+	const size_t open = token.find('(');
+	if (open != std::string_view::npos && open > 0 && token.back() == ')')
 	{
-		return true;
+		const std::string name(token.substr(0, open));
+		const auto it = macros.find(name);
+		if (it != macros.end())
+		{
+			const std::vector<std::string> arguments = AssemblerPrivate::SplitArguments(token.substr(open + 1, token.size() - open - 2));
+			checkf(arguments.size() == it->second.parameters.size(), "Macro %s takes %d arguments but was given %d on line %d",
+				name.c_str(), static_cast<int32_t>(it->second.parameters.size()), static_cast<int32_t>(arguments.size()), line);
+
+			Replay(it->second.body, it->second.parameters, arguments, line, items);
+			return;
+		}
+	}
+
+	AssemblerPrivate::errorLine = line;
+
+	const ETokenType type = Classify(token);
+	if (type == ETokenType::None)
+	{
+		if (AssemblerPrivate::throwErrors)
+		{
+			AssemblerPrivate::Throw("Unrecognised token %s on line %d", std::string(token).c_str(), line);
+		}
+		std::cout << "Unrecognised Token: " << "[" << token << "] on line " << line << std::endl;
 	}
-	return false;
 
-	return false;
+	if (type == ETokenType::Directive)
+	{
+		// Directives are handled by the assembler
+		ApplyDirective(token, line, items);
+	}
+	else
+	{
+		items.emplace_back(ELexItemKind::Token, type, std::string(token), 0, line);
+	}
 }
 
-void Assembler::Prepare()
+void Assembler::Record(const std::string_view token, const bool label, const int32_t line, std::vector<LexItem>& items)
 {
-	auto buildOpcodeRegex = []
+	const std::string directive = label ? std::string() : AssemblerPrivate::DirectiveName(token);
+
+	if (directive == "macro" || directive == "rept")
+	{
+		recording.nesting++;
+	}
+	else if ((directive == "endm" || directive == "endr") && recording.nesting > 0)
+	{
+		recording.nesting--;
+	}
+	else if (directive == "endm" || directive == "endr")
 	{
-		std::string regexBuilder = R"(^(?:)";
-		for (size_t i = 0; i < OPS.size(); i++)
+		checkf((directive == "endr") == recording.rept, ".%s on line %d doesn't match the .%s on line %d",
+			directive.c_str(), line, recording.rept ? "rept" : "macro", recording.line);
+
+		Recording finished = std::move(recording);
+		recording = Recording();
+
+		if (finished.rept)
 		{
-			if (i < OPS.size() - 1)
+			// Unrolled copies keep the lines they were written on
+			for (int32_t i = 0; i < finished.count; i++)
 			{
-				regexBuilder += OPS[i].name + "|";
+				Replay(finished.body, finished.parameters, { std::to_string(i) }, -1, items);
 			}
-			else
+		}
+		else
+		{
+			macros[finished.name] = Macro{ std::move(finished.parameters), std::move(finished.body) };
+		}
+		return;
+	}
+
+	recording.body.push_back(MacroToken{ std::string(token), line, label });
+}
+
+void Assembler::Replay(const std::vector<MacroToken>& body, const std::vector<std::string>& parameters, const std::vector<std::string>& arguments, const int32_t line, std::vector<LexItem>& items)
+{
+	checkf(expansionDepth < 64, "Macros and .rept are nested too deeply on line %d, does a macro invoke itself?", line);
+
+	expansionDepth++;
+	for (const MacroToken& token : body)
+	{
+		Emit(AssemblerPrivate::Substitute(token.text, parameters, arguments), token.label, line < 0 ? token.line : line, items);
+	}
+	expansionDepth--;
+}
+
+void Assembler::ApplyDirective(const std::string_view token, const int32_t line, std::vector<LexItem>& items)
+{
+	using namespace AssemblerPrivate;
+
+	// Classify has already checked the shape, .name(argument) or just .name
+	const size_t open = token.find('(');
+	const bool bare = open == std::string_view::npos;
+	const std::string directive = ToLowercase(std::string(token.substr(1, bare ? std::string_view::npos : open - 1)));
+	const std::string_view argument = bare ? std::string_view() : token.substr(open + 1, token.size() - open - 2);
+
+	if (directive == "org")
+	{
+		items.emplace_back(ELexItemKind::Org, ETokenType::None, std::string(), static_cast<uint16_t>(EvaluateConstant(argument, directive, line)), line);
+	}
+	else if (directive == "text")
+	{
+		if (argument.size() >= 2 && argument.front() == '\'' && argument.back() == '\'')
+		{
+			for (const char byte : argument.substr(1, argument.size() - 2))
 			{
-				regexBuilder += OPS[i].name;
+				items.emplace_back(ELexItemKind::Token, ETokenType::Immediate, std::to_string(static_cast<uint16_t>(byte)), 0, line);
 			}
 		}
-		regexBuilder += R"()$)";
-		return std::regex(regexBuilder);
-	};
+		else
+		{
+			checkf(false, "the argument for .text directive must be a string surrounded by \'quote marks\'");
+		}
+	}
+	else if (directive == "ds")
+	{
+		items.emplace_back(ELexItemKind::Reserve, ETokenType::None, std::string(), static_cast<uint16_t>(EvaluateConstant(argument, directive, line)), line);
+	}
+	else if (directive == "include")
+	{
+		if (argument.size() >= 2 && argument.front() == '\'' && argument.back() == '\'')
+		{
+			Include(std::string(argument.substr(1, argument.size() - 2)), line, items);
+		}
+		else
+		{
+			checkf(false, "the argument for .include directive must be a path surrounded by \'quote marks\'");
+		}
+	}
+	else if (directive == "equ")
+	{
+		// .equ(NAME, expression), the expression may use labels so it is evaluated by Convert
+		const std::vector<std::string> arguments = SplitArguments(argument);
+		checkf(arguments.size() == 2 && IsIdentifier(arguments[0]), "The arguments for a .equ directive must be a name and an expression, on line %d", line);
+		checkf(constants.find(arguments[0]) == constants.end(), "%s is defined more than once, on line %d", arguments[0].c_str(), line);
+
+		items.emplace_back(ELexItemKind::Label, ETokenType::Equ, arguments[0] + "=" + arguments[1], 0, line);
 
-	auto buildRegisterRegex = []
+		// Those that only use numbers and earlier constants can also size .ds, .org and .rept
+		const Expression::Resolver resolver = [this](const std::string_view name, ExpressionValue& value)
+		{
+			const auto it = constants.find(std::string(name));
+			if (it == constants.end())
+			{
+				return false;
+			}
+			value = ExpressionValue(it->second, 0);
+			return true;
+		};
+
+		ExpressionValue value;
+		if (Expression(arguments[1], resolver).Evaluate(value))
+		{
+			constants[arguments[0]] = value.value;
+		}
+	}
+	else if (directive == "macro")
+	{
+		// .macro(name, parameter...) until .endm, invoked as name(argument...)
+		std::vector<std::string> arguments = SplitArguments(argument);
+		checkf(!arguments.empty() && IsIdentifier(arguments[0]), "A .macro directive must start with the macro's name, on line %d", line);
+		checkf(FindInstruction(arguments[0]) == nullptr, "Macro %s on line %d has the same name as an instruction", arguments[0].c_str(), line);
+
+		recording = Recording();
+		recording.active = true;
+		recording.name = arguments[0];
+		recording.parameters.assign(arguments.begin() + 1, arguments.end());
+		recording.line = line;
+	}
+	else if (directive == "rept")
+	{
+		// .rept(count) or .rept(count, counter) until .endr, the counter runs from 0 to count - 1
+		const std::vector<std::string> arguments = SplitArguments(argument);
+		checkf(arguments.size() == 1 || (arguments.size() == 2 && IsIdentifier(arguments[1])), "The arguments for a .rept directive must be a count and an optional counter name, on line %d", line);
+
+		recording = Recording();
+		recording.active = true;
+		recording.rept = true;
+		recording.count = EvaluateConstant(arguments[0], directive, line);
+		recording.parameters.assign(arguments.begin() + 1, arguments.end());
+		recording.line = line;
+	}
+	else if (directive == "endm" || directive == "endr")
+	{
+		checkf(false, ".%s on line %d has no matching .%s", directive.c_str(), line, directive == "endm" ? "macro" : "rept");
+	}
+	else
+	{
+		checkf(false, "Unrecognised directive: %s", directive.c_str());
+	}
+}
+
+int32_t Assembler::EvaluateConstant(const std::string_view text, const std::string& directive, const int32_t line) const
+{
+	if (IsNumber(text))
+	{
+		return ParseNumber(text);
+	}
+
+	const Expression::Resolver resolver = [this](const std::string_view name, ExpressionValue& value)
 	{
-		std::string regexBuilder = R"(^[)";
-		for (const RegisterData& reg : REGISTERS)
+		const auto it = constants.find(std::string(name));
+		if (it == constants.end())
 		{
-			regexBuilder += reg.name;
+			return false;
 		}
-		regexBuilder += R"(]$)";
-		return std::regex(regexBuilder);
+		value = ExpressionValue(it->second, 0);
+		return true;
 	};
 
-	fileText = std::regex_replace(fileText, std::regex(R"(\r)"), "");
-	opRegex = buildOpcodeRegex();
-	registerRegex = buildRegisterRegex();
+	Expression expression(text, resolver);
+	ExpressionValue value;
+	if (!expression.Evaluate(value))
+	{
+		checkf(false, "The argument for a .%s directive must be a constant expression, on line %d: %s", directive.c_str(), line, expression.GetError().c_str());
+	}
+
+	return value.value;
 }
 
-std::vector<TokenData> Assembler::Tokenize()
+void Assembler::Include(const std::string& file, const int32_t line, std::vector<LexItem>& items)
+{
+	const std::filesystem::path path = (std::filesystem::path(directory) / file).lexically_normal();
+	const std::string resolved = path.string();
+	checkf(std::find(includeStack.begin(), includeStack.end(), resolved) == includeStack.end(), "%s includes itself", resolved.c_str());
+
+	std::string text;
+	if (!AssemblerPrivate::ReadFile(resolved, text))
+	{
+		checkf(false, "Unable to read included file: %s", resolved.c_str());
+		return;
+	}
+	text.erase(std::remove(text.begin(), text.end(), '\r'), text.end());
+
+	// Nested includes are relative to the file that contains them
+	const std::string outer = directory;
+	directory = path.parent_path().string();
+	includeStack.push_back(resolved);
+	if (std::find(includes.begin(), includes.end(), resolved) == includes.end())
+	{
+		includes.push_back(resolved);
+	}
+
+	std::vector<LexItem> included = Lex(text);
+
+	includeStack.pop_back();
+	directory = outer;
+
+	// The line table only describes one file, so included code is attributed to the .include
+	for (LexItem& item : included)
+	{
+		item.line = line;
+		items.push_back(std::move(item));
+	}
+}
+
+std::vector<TokenData> Assembler::Tokenize(const bool wholeProgram /*= true*/, int32_t* end /*= nullptr*/)
 {
 	Prepare();
+	includes.clear();
 
 	std::vector<TokenData> tokens;
-	std::vector<std::string> labels;
+	tokens.reserve(fileText.size() / 4);
+
+	std::vector<LexItem> items = Lex(fileText);
+	if (optimize)
+	{
+		// Addresses in a unit only mean something once it is linked
+		const bool arrange = wholeProgram && !profile.executions.empty();
+		Optimizer().Optimize(items, stripUnused && wholeProgram, arrange ? &profile : nullptr);
+	}
 
-	int32_t line = 1;
 	int32_t address = 0;
+	Layout(items, 0, address, tokens);
+
+	if (end != nullptr)
+	{
+		*end = address;
+	}
+
+	return tokens;
+}
+
+std::vector<LexItem> Assembler::Lex(const std::string_view source, const int32_t firstLine /*= 1*/, int32_t* depthOut /*= nullptr*/)
+{
+	using namespace AssemblerPrivate;
+
+	// Reading at [size] yields a '\0', which flushes the last token
+	const char* text = source.data();
+	const int32_t size = static_cast<int32_t>(source.size());
+
+	std::vector<LexItem> items;
+	items.reserve(source.size() / 4);
+
+	// Macros and constants are visible from where they are defined to the end of the
+	// program, including files it includes, so only a fresh top level lex clears them
+	const bool outermost = includeStack.empty() && expansionDepth == 0;
+	if (outermost)
+	{
+		macros.clear();
+		constants.clear();
+		recording = Recording();
+	}
+
+	int32_t line = firstLine;
 	int32_t depth = 0;
 	int32_t index = 0;
-	int32_t size = static_cast<int32_t>(fileText.size());
-	std::string token;
+
+	// The current token is text[tokenStart, index) unless a comment cut into it, then it is
+	// gathered in scratch instead, since the comment text is not part of it
+	int32_t tokenStart = -1;
+	bool useScratch = false;
+	std::string scratch;
+
+	auto current = [&]() -> std::string_view
+	{
+		if (useScratch)
+		{
+			return scratch;
+		}
+		return tokenStart < 0 ? std::string_view() : std::string_view(text + tokenStart, index - tokenStart);
+	};
+
+	auto append = [&]()
+	{
+		if (useScratch)
+		{
+			scratch += text[index];
+		}
+		else if (tokenStart < 0)
+		{
+			tokenStart = index;
+		}
+	};
+
+	auto clear = [&]()
+	{
+		tokenStart = -1;
+		useScratch = false;
+		scratch.clear();
+	};
 
 	while (index <= size)
 	{
-		// Grab the character at [index]
-		std::string c(1, fileText[index]);
+		const char c = index < size ? text[index] : '\0';
+		const ECharClass charClass = CHAR_CLASSES[c];
 
-		// If it's a ';' or a '#', consume until we hit a new line or the end of the file 
-		if (c == ";" || c == "#")
+		// A ';' or a '#' runs to the end of the line, even inside parentheses
+		if (charClass == ECharClass::Comment)
 		{
-			while (!(fileText[index] == '\n' || fileText[index] == '\0'))
+			if (tokenStart >= 0 && !useScratch)
+			{
+				scratch.assign(current());
+				useScratch = true;
+			}
+
+			while (index < size && !(text[index] == '\n' || text[index] == '\0'))
 			{
 				index++;
 			}
 			continue;
 		}
 
-		if (depth == 0 && c == "(")
+		if (depth == 0 && charClass == ECharClass::Open)
 		{
 			depth++;
 		}
 
 		if (depth > 0)
 		{
-			token += c;
-			if (c == ")")
+			append();
+			if (charClass == ECharClass::Close)
 			{
 				depth--;
 			}
+		}
+		else if (charClass == ECharClass::Space)
+		{
+			const std::string_view token = current();
+			if (!token.empty())
+			{
+				Emit(token, false, line, items);
+				clear();
+			}
 
-			if (c == "\\n")
+			if (c == '\n')
 			{
 				line++;
 			}
 		}
+		else if (charClass == ECharClass::Colon)
+		{
+			Emit(current(), true, line, items);
+			clear();
+		}
 		else
 		{
-			// Are we whitespace or at the end of the file?
-			if (regex_match(c, std::regex(R"(\s|\0)")))
-			{
-				if (!token.empty())
-				{
-					auto type = ETokenType::None;
+			append(); // still building a token...
+		}
 
-					if (std::regex_match(token, opRegex))
-					{
-						type = ETokenType::Op;
-					}
-					else if (HasMatch(token, registerRegex))
-					{
-						type = ETokenType::Register;
-					}
-					else if (HasMatch(token, std::regex(R"(^\+|-$)", std::regex_constants::icase)))
-					{
-						type = ETokenType::ImmediateLabelReference;
-					}
-					else if (HasMatch(token, std::regex(R"(^[a-z]\w+$)", std::regex_constants::icase)))
-					{
-						type = ETokenType::ImmediateLabelReference;
-					}
-					else if (IsNumber(token))
-					{
-						type = ETokenType::Immediate;
-					}
-					else if (HasMatch(token, std::regex(R"(^\.\w+(?:\(.*\))$)", std::regex_constants::icase)))
-					{
-						type = ETokenType::Directive;
-					}
-					else if (HasMatch(token, std::regex(R"(^\$\w+$)", std::regex_constants::icase))
-						&& IsNumber(GetMatch(token, std::regex(R"(^\$(\w+)$)"), 1)))
-					{
-						type = ETokenType::Absolute;
-					}
-					else if (HasMatch(token, std::regex(R"(^\[\w*\]$)", std::regex_constants::icase))
-						&& std::regex_match(GetMatch(token, std::regex(R"(^\[(\w*)\]$)", std::regex_constants::icase), 1), registerRegex))
-					{
-						type = ETokenType::Indirect;
-					}
-					else if (std::regex_match(token, std::regex(R"(^\$(:\+|-)$)", std::regex_constants::icase)))
-					{
-						type = ETokenType::ImmediateLabelReference;
-					}
-					else if (std::regex_match(token, std::regex(R"(^\$[a-z]\w+$)", std::regex_constants::icase)))
-					{
-						type = ETokenType::AbsoluteLabelReference;
-					}
-					else
-					{
-						std::cout << "Unrecognised Token: " << "[" << token << "] on line " << line << std::endl;
-					}
+		index++;
+	}
 
-					if (type == ETokenType::Directive)
-					{
-						// Directives are handles by assembler
-						std::regex expr(R"(^[\.](\w+)(?:\((.*)\))$)", std::regex_constants::icase);
-						std::string directive = ToLowercase(GetMatch(token, expr, 1));
-						std::string argument = GetMatch(token, expr, 2);
+	if (outermost)
+	{
+		checkf(!recording.active, "The .%s on line %d has no matching .%s", recording.rept ? "rept" : "macro", recording.line, recording.rept ? "endr" : "endm");
+	}
 
-						if (directive == "org")
-						{
-							if (IsNumber(argument))
-							{
-								address = ParseNumber(argument);
-							}
-							else
-							{
-								assertf(false, "The argument for a .org directive must be a numeric literal");
-							}
-						}
-						else if (directive == "text")
-						{
-							if (std::regex_match(argument, std::regex(R"(^'.*'$)")))
-							{
-								std::string temp = GetMatch(argument, std::regex("^'(.*)'$"), 1);
-								ReplaceText(temp, std::regex(R"(\n)"), R"(\n)");
-								for (const char byte : temp)
-								{
-									std::string s = std::to_string(static_cast<uint16_t>(byte));
-									tokens.emplace_back(ETokenType::Immediate, s, address, line);
-									address++;
-								}
-							}
-							else
-							{
-								assertf(false, "the argument for .text directive must be a string surrounded by \'quote marks\'");
-							}
-						}
-						else if (directive == "ds")
-						{
-							if (IsNumber(argument))
-							{
-								address += ParseNumber(argument);
-							}
-							else
-							{
-								assertf(false, "The argument for a .ds directive must be a numeric literal");
-							}
-						}
-						else
-						{
-							assertf(false, "Unrecognised directive: %s", directive);
-						}
+	if (depthOut != nullptr)
+	{
+		*depthOut = depth;
+	}
 
-						token.clear();
-					}
-					else
-					{
-						tokens.emplace_back(type, token, address, line);
-						token.clear();
-						address++;
-					}
-				}
+	return items;
+}
 
-				if (c == "\n")
-				{
-					line++;
-				}
+void Assembler::Layout(const std::vector<LexItem>& items, const int32_t lineOffset, int32_t& address, std::vector<TokenData>& tokens)
+{
+	for (const LexItem& item : items)
+	{
+		switch (item.kind)
+		{
+			case ELexItemKind::Token:
+			{
+				tokens.emplace_back(item.type, item.data, address, item.line + lineOffset);
+				address++;
 			}
-			else
+			break;
+
+			case ELexItemKind::Label:
 			{
-				// Are we build a label?
-				if (regex_match(c, std::regex(":")))
-				{
-					tokens.emplace_back(ETokenType::Label, token, address, line);
-					token.clear();
-				}
-				else
-				{
-					token += c; // still building a token...
-				}
+				tokens.emplace_back(item.type, item.data, address, item.line + lineOffset);
 			}
+			break;
+
+			case ELexItemKind::Org:
+			{
+				address = item.value;
+			}
+			break;
+
+			case ELexItemKind::Reserve:
+			{
+				address += item.value;
+			}
+			break;
 		}
+	}
+}
 
-		index++;
+Assembler::LabelMap Assembler::BuildLabelTable(const std::vector<TokenData>& tokens)
+{
+	LabelMap table;
+
+	for (const auto& token : tokens)
+	{
+		if (token.type == ETokenType::Label && !(token.data == "+" || token.data == "-"))
+		{
+			table[token.data] = token.address;
+		}
 	}
 
-	return tokens;
+	return table;
 }
 
-std::vector<uint16_t> Assembler::Convert(const std::vector<TokenData>& tokens, const std::unordered_map<std::string, int32_t>& labels) const
+std::vector<uint16_t> Assembler::Convert(const std::vector<TokenData>& tokens, const std::unordered_map<std::string, int32_t>& labels, std::vector<Relocation>* relocations /*= nullptr*/) const
 {
-	std::unordered_map<ETokenType, uint16_t> addressingModeMap;
-	addressingModeMap.emplace(ETokenType::Immediate, 0b00);
-	addressingModeMap.emplace(ETokenType::ImmediateLabelReference, 0b00);
-	addressingModeMap.emplace(ETokenType::Absolute, 0b01);
-	addressingModeMap.emplace(ETokenType::AbsoluteLabelReference, 0b01);
-	addressingModeMap.emplace(ETokenType::Indirect, 0b10);
-	addressingModeMap.emplace(ETokenType::Register, 0b11);
-
 	uint16_t maxAddress = 0;
 	for (const auto& token : tokens)
 	{
+		if (token.type == ETokenType::Equ)
+		{
+			continue;
+		}
+
+		AssemblerPrivate::errorLine = token.line;
+		checkf(token.address >= 0 && token.address <= 0xFFFF, "Program does not fit in memory, address %d on line %d", token.address, token.line);
 		maxAddress = (token.address > maxAddress) ? token.address : maxAddress;
 	}
 
 	std::vector<uint16_t> memory;
 	memory.resize(maxAddress + 1);
 
+	// Anonymous labels resolve to the nearest '-:' before or '+:' after the reference,
+	// found with one sweep in each direction. -1 means there is none.
+	std::vector<int32_t> anonymous(tokens.size(), -1);
+	int32_t previous = -1;
+	for (size_t i = 0; i < tokens.size(); i++)
+	{
+		const TokenData& token = tokens[i];
+		if (token.type == ETokenType::Label && token.data == "-")
+		{
+			previous = token.address;
+		}
+		else if (token.data == "-")
+		{
+			anonymous[i] = previous;
+		}
+	}
+
+	int32_t next = -1;
+	for (size_t i = tokens.size(); i-- > 0;)
+	{
+		const TokenData& token = tokens[i];
+		if (token.type == ETokenType::Label && token.data == "+")
+		{
+			next = token.address;
+		}
+		else if (token.data == "+")
+		{
+			anonymous[i] = next;
+		}
+	}
+
+	// .equ symbols are evaluated when first used, labels take priority over them
+	std::unordered_map<std::string, std::string> equs;
+	for (const TokenData& token : tokens)
+	{
+		if (token.type == ETokenType::Equ)
+		{
+			const size_t split = token.data.find('=');
+			const std::string name = token.data.substr(0, split);
+			AssemblerPrivate::errorLine = token.line;
+			checkf(equs.find(name) == equs.end(), "%s is defined more than once, on line %d", name.c_str(), token.line);
+			equs[name] = token.data.substr(split + 1);
+		}
+	}
+
+	std::unordered_map<std::string, ExpressionValue> evaluated;
+	std::vector<std::string> evaluating;
+	Expression::Resolver resolve = [&](const std::string_view name, ExpressionValue& value) -> bool
+	{
+		const std::string key(name);
+		const auto label = labels.find(key);
+		if (label != labels.end())
+		{
+			value = ExpressionValue(label->second, 1);
+			return true;
+		}
+
+		const auto done = evaluated.find(key);
+		if (done != evaluated.end())
+		{
+			value = done->second;
+			return true;
+		}
+
+		const auto equ = equs.find(key);
+		if (equ == equs.end())
+		{
+			return false;
+		}
+
+		checkf(std::find(evaluating.begin(), evaluating.end(), key) == evaluating.end(), "%s is defined in terms of itself", key.c_str());
+		evaluating.push_back(key);
+		Expression expression(equ->second, resolve);
+		const bool result = expression.Evaluate(value);
+		checkf(result, "Couldn't evaluate .equ %s: %s", key.c_str(), expression.GetError().c_str());
+		evaluating.pop_back();
+
+		evaluated[key] = value;
+		return result;
+	};
+
+	// In an object file a value derived from one label moves with the unit, one that isn't doesn't
+	auto relocate = [&](const TokenData& token, const ExpressionValue& value)
+	{
+		if (relocations != nullptr)
+		{
+			checkf(value.relocations == 0 || value.relocations == 1, "%s on line %d can't be linked, only a label plus or minus a constant can",
+				token.data.c_str(), token.line);
+			if (value.relocations == 1)
+			{
+				relocations->emplace_back(static_cast<uint16_t>(token.address), std::string());
+			}
+		}
+	};
+
 	for (size_t i = 0; i < tokens.size(); i++)
 	{
 		const TokenData& token = tokens[i];
 		uint16_t word = 0;
+		AssemblerPrivate::errorLine = token.line;
+
+		if (token.type == ETokenType::Equ)
+		{
+			continue;
+		}
 
 		switch (token.type)
 		{
 			case ETokenType::Op:
 			{
-				const Opcode& op = AssemblerPrivate::FindOpByName(token.data);
-				auto args = std::vector<TokenData>(tokens.begin() + i + 1, tokens.begin() + i + 1 + op.arity);
-				std::vector<uint16_t> types;
+				const Instruction& op = AssemblerPrivate::FindOpByName(token.data);
+				std::array<uint16_t, 4> types = {};
 
-				for (const TokenData& arg : args)
+				for (size_t j = 0; j < op.arity && i + 1 + j < tokens.size(); j++)
 				{
-					types.push_back(addressingModeMap[arg.type]);
+					types[j] = AssemblerPrivate::GetAddressingMode(tokens[i + 1 + j].type);
 				}
 
-				while (types.size() < 4)
-				{
-					types.push_back(0b00);
-				}
-
-				word = types[0] << 14 | types[1] << 12 | types[2] << 10 | types[3] << 8 | op.value;
+				word = types[0] << 14 | types[1] << 12 | types[2] << 10 | types[3] << 8 | static_cast<uint16_t>(op.opcode);
 			}
 			break;
 
@@ -456,39 +1151,46 @@ std::vector<uint16_t> Assembler::Convert(const std::vector<TokenData>& tokens, c
 			{
 				if (token.data == "-")
 				{
-					for (size_t j = i - 1; j >= 0; j--)
+					checkf(anonymous[i] >= 0, "Couldn't find label: -");
+					word = static_cast<uint16_t>(anonymous[i]);
+					if (relocations != nullptr)
 					{
-						const TokenData& t = tokens[j];
-						if (t.type == ETokenType::Label && t.data == "-")
-						{
-							word = t.address;
-							break;
-						}
+						relocations->emplace_back(static_cast<uint16_t>(token.address), std::string());
 					}
 				}
 				else if (token.data == "+")
 				{
-					for (size_t j = i + 1; j < tokens.size(); j++)
+					word = anonymous[i] >= 0 ? static_cast<uint16_t>(anonymous[i]) : 0;
+					if (relocations != nullptr && anonymous[i] >= 0)
 					{
-						const TokenData& t = tokens[j];
-						if (t.type == ETokenType::Label && t.data == "+")
-						{
-							word = t.address;
-							break;
-						}
+						relocations->emplace_back(static_cast<uint16_t>(token.address), std::string());
 					}
 				}
 				else
 				{
-					std::string label = token.data;
-					ReplaceText(label, std::regex(R"(^\$)"), "");
-					if (labels.find(label) != labels.end())
+					const std::string label = token.data[0] == '$' ? token.data.substr(1) : token.data;
+					const auto it = labels.find(label);
+					ExpressionValue constant;
+					if (it != labels.end())
+					{
+						word = it->second;
+						if (relocations != nullptr)
+						{
+							relocations->emplace_back(static_cast<uint16_t>(token.address), std::string());
+						}
+					}
+					else if (equs.find(label) != equs.end() && resolve(label, constant))
+					{
+						word = static_cast<uint16_t>(constant.value);
+						relocate(token, constant);
+					}
+					else if (relocations != nullptr)
 					{
-						word = labels.at(label);
+						relocations->emplace_back(static_cast<uint16_t>(token.address), label);
 					}
 					else
 					{
-						assertf(false, "Couldn't find label: %s", label.c_str());
+						checkf(false, "Couldn't find label: %s", label.c_str());
 					}
 				}
 			}
@@ -502,13 +1204,29 @@ std::vector<uint16_t> Assembler::Convert(const std::vector<TokenData>& tokens, c
 
 			case ETokenType::Absolute:
 			{
-				word = ParseNumber(GetMatch(token.data, std::regex(R"(\$(\w+)"), 1));
+				word = ParseNumber(std::string_view(token.data).substr(1));
+			}
+			break;
+
+			case ETokenType::Expression: // Fallthrough intentional
+			case ETokenType::AbsoluteExpression:
+			{
+				const std::string_view text = std::string_view(token.data).substr(token.type == ETokenType::AbsoluteExpression ? 1 : 0);
+				Expression expression(text, resolve);
+				ExpressionValue value;
+				if (!expression.Evaluate(value))
+				{
+					checkf(false, "Couldn't evaluate %s on line %d: %s", token.data.c_str(), token.line, expression.GetError().c_str());
+				}
+
+				word = static_cast<uint16_t>(value.value);
+				relocate(token, value);
 			}
 			break;
 
 			case ETokenType::Indirect:
 			{
-				word = AssemblerPrivate::FindRegByName(ToLowercase(GetMatch(token.data, std::regex(R"(\[(a|b|c|d|x|y)\])", std::regex_constants::icase), 1))).value;
+				word = AssemblerPrivate::FindRegByName(ToLowercase(token.data.substr(1, 1))).value;
 			}
 			break;
 
@@ -524,22 +1242,42 @@ std::vector<uint16_t> Assembler::Convert(const std::vector<TokenData>& tokens, c
 	return memory;
 }
 
-std::vector<uint8_t> Assembler::Assemble()
+AssemblyResult Assembler::Build()
 {
-	auto tokens = Tokenize();
-	auto labelTable = AssemblerPrivate::BuildLabelTable(tokens);
-	auto converted = Convert(tokens, labelTable);
-	auto bytes = AssemblerPrivate::Write(converted);
+	AssemblyResult result;
+	result.debug.tokens = Tokenize();
+	result.debug.labels = BuildLabelTable(result.debug.tokens);
+	result.image = Convert(result.debug.tokens, result.debug.labels);
+
+	return result;
+}
 
-	return bytes;
+ObjectFile Assembler::BuildObject(const std::string& name)
+{
+	ObjectFile object;
+	object.name = name;
+	int32_t end = 0;
+	object.tokens = Tokenize(false, &end);
+	object.symbols = BuildLabelTable(object.tokens);
+	object.image = Convert(object.tokens, object.symbols, &object.relocations);
+	object.extent = std::max(end, static_cast<int32_t>(object.image.size()));
+
+	return object;
+}
+
+std::vector<uint8_t> Assembler::Assemble()
+{
+	return AssemblerPrivate::Write(Build().image);
 }
 
 void Assembler::AssembleAndSave(const std::string& filename)
 {
-	auto tokens = Tokenize();
-	auto labelTable = AssemblerPrivate::BuildLabelTable(tokens);
-	auto converted = Convert(tokens, labelTable);
-	auto bytes = AssemblerPrivate::Write(converted);
+	Save(Build(), filename);
+}
+
+void Assembler::Save(const AssemblyResult& result, const std::string& filename)
+{
+	auto bytes = AssemblerPrivate::Write(result.image);
 
 	std::ofstream file(filename, std::ios::out | std::ios::binary);
 	if (!bytes.empty())
@@ -550,54 +1288,43 @@ void Assembler::AssembleAndSave(const std::string& filename)
 	FileWriter writer;
 	if (writer.Open(filename + ".debug"))
 	{
-		DebugInfo debug;
 		cereal::JSONOutputArchive archive(writer.GetStream());
-		debug.tokens = tokens;
-		debug.labels = labelTable;
-		archive(cereal::make_nvp("debug", debug));
+		archive(cereal::make_nvp("debug", result.debug));
 	}
 }
 
 void Assembler::Load(const std::string& in)
 {
-	std::ifstream file(in, std::ios::binary);
-	file.unsetf(std::ios::skipws);
-
-	std::streampos fileSize;
-	file.seekg(0, std::ios::end);
-	fileSize = file.tellg();
-	file.seekg(0, std::ios::beg);
-	if (fileSize <= 0)
+	if (AssemblerPrivate::ReadFile(in, fileText))
 	{
-		return;
+		directory = std::filesystem::path(in).parent_path().string();
 	}
+}
 
-	fileText.reserve(fileSize);
-	fileText.insert(fileText.begin(),
-					std::istream_iterator<char>(file),
-					std::istream_iterator<char>());
+void Assembler::LoadText(const std::string& text)
+{
+	fileText = text;
 }
 
-void Assembler::ReplaceText(std::string& s, const std::regex& expression, const std::string& value) const
+void Assembler::SetDirectory(const std::string& baseDirectory)
 {
-	s = std::regex_replace(s, expression, value);
+	directory = baseDirectory;
 }
 
-bool Assembler::HasMatch(const std::string& s, const std::regex& expression) const
+void Assembler::SetOptimize(const bool enabled, const bool strip /*= false*/)
 {
-	return std::regex_match(s, expression);
+	optimize = enabled;
+	stripUnused = strip;
 }
 
-std::string Assembler::GetMatch(const std::string& s, const std::regex& expression, const int32_t index) const
+void Assembler::ThrowErrors(const bool enabled)
 {
-	std::smatch match;
-	if (std::regex_search(s.begin(), s.end(), match, expression))
-	{
-		return match[index];
-	}
+	AssemblerPrivate::throwErrors = enabled;
+}
 
-	assertf(false, "Failed to find match for: %s at index %d", s.c_str(), index);
-	return "";
+void Assembler::SetProfile(const Profile& counts)
+{
+	profile = counts;
 }
 
 std::string Assembler::ToLowercase(const std::string& s) const
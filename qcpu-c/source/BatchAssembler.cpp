@@ -0,0 +1,252 @@
+//
+//	BatchAssembler
+//
+
+#include "BatchAssembler.h"
+
+#include "Assembler.h"
+#include "Hash.h"
+#include "ISA.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace BatchAssemblerPrivate
+{
+	bool ReadText(const std::string& path, std::string& out)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			return false;
+		}
+
+		std::stringstream text;
+		text << file.rdbuf();
+		out = text.str();
+		return true;
+	}
+
+	uint64_t HashFile(const std::string& path)
+	{
+		std::string text;
+		return ReadText(path, text) ? Fnv1a(text.data(), text.size()) : 0;
+	}
+
+	// The encoding of every instruction, which the version alone might not keep up with
+	uint64_t HashInstructionSet()
+	{
+		uint64_t hash = FNV_OFFSET_BASIS;
+		for (const Instruction& instruction : INSTRUCTIONS)
+		{
+			const std::string_view mnemonic = instruction.mnemonic;
+			hash = Fnv1a(mnemonic.data(), mnemonic.size(), hash);
+			hash = Fnv1a(&instruction.opcode, sizeof(instruction.opcode), hash);
+			hash = Fnv1a(&instruction.arity, sizeof(instruction.arity), hash);
+			hash = Fnv1a(instruction.roles.data(), sizeof(instruction.roles), hash);
+		}
+
+		return hash;
+	}
+
+	std::string CachePath(const std::string& output)
+	{
+		return output + ".cache";
+	}
+}
+
+BatchAssembler::BatchAssembler()
+	: optimize(false)
+	, stripUnused(false)
+	, threads(0)
+{
+}
+
+void BatchAssembler::SetOptimize(const bool enabled, const bool strip /*= false*/)
+{
+	optimize = enabled;
+	stripUnused = strip;
+}
+
+void BatchAssembler::SetThreads(const uint32_t count)
+{
+	threads = count;
+}
+
+std::vector<BatchResult> BatchAssembler::Run(const std::vector<BatchJob>& jobs) const
+{
+	std::vector<BatchResult> results(jobs.size());
+
+	// Each thread takes the next job until there are none left. They throw errors rather than
+	// stop the program, and are all workers so the calling thread's setting is left alone.
+	std::atomic<size_t> next(0);
+	auto work = [&]()
+	{
+		Assembler::ThrowErrors(true);
+		for (size_t i = next++; i < jobs.size(); i = next++)
+		{
+			results[i] = Assemble(jobs[i]);
+		}
+	};
+
+	const uint32_t count = std::min<uint32_t>(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency()), static_cast<uint32_t>(jobs.size()));
+	std::vector<std::thread> workers;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		workers.emplace_back(work);
+	}
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	return results;
+}
+
+std::vector<BatchJob> BatchAssembler::FindJobs(const std::string& path, const std::string& outputDirectory)
+{
+	namespace fs = std::filesystem;
+
+	auto output = [&outputDirectory](const fs::path& relative)
+	{
+		return (fs::path(outputDirectory) / relative).replace_extension().string();
+	};
+
+	std::vector<BatchJob> jobs;
+	if (fs::is_directory(path))
+	{
+		for (const fs::directory_entry& entry : fs::recursive_directory_iterator(path))
+		{
+			if (entry.is_regular_file() && entry.path().extension() == ".asm")
+			{
+				jobs.push_back(BatchJob{ entry.path().string(), output(entry.path().lexically_relative(path)) });
+			}
+		}
+
+		std::sort(jobs.begin(), jobs.end(), [](const BatchJob& a, const BatchJob& b) { return a.input < b.input; });
+		return jobs;
+	}
+
+	std::ifstream manifest(path);
+	const fs::path base = fs::path(path).parent_path();
+	std::string line;
+	while (std::getline(manifest, line))
+	{
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream words(line);
+		std::string input;
+		std::string result;
+		if (words >> input)
+		{
+			words >> result;
+			jobs.push_back(BatchJob{ (base / input).string(), result.empty() ? output(input) : (base / result).string() });
+		}
+	}
+
+	return jobs;
+}
+
+BatchResult BatchAssembler::Assemble(const BatchJob& job) const
+{
+	using namespace BatchAssemblerPrivate;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	BatchResult result;
+	result.input = job.input;
+	result.output = job.output;
+
+	std::string source;
+	if (!ReadText(job.input, source))
+	{
+		result.failed = true;
+		result.error = "Could not read the file";
+		return result;
+	}
+	const uint64_t key = HashSource(source);
+
+	result.cached = IsUpToDate(job, key);
+	if (!result.cached)
+	{
+		Assembler assembler(job.input);
+		assembler.SetOptimize(optimize, stripUnused);
+
+		AssemblyResult assembly;
+		try
+		{
+			assembly = assembler.Build();
+		}
+		catch (const AssemblyError& error)
+		{
+			result.failed = true;
+			result.error = error.what();
+			return result;
+		}
+
+		const std::filesystem::path directory = std::filesystem::path(job.output).parent_path();
+		if (!directory.empty())
+		{
+			std::filesystem::create_directories(directory);
+		}
+		Assembler::Save(assembly, job.output);
+
+		// Written last, so an output that was never finished is never taken as up to date. The
+		// output's own hash catches it being replaced by something else, like a build without -b.
+		std::ofstream cache(CachePath(job.output));
+		cache << std::hex << key << " " << HashFile(job.output) << "\n";
+		for (const std::string& include : assembler.GetIncludes())
+		{
+			cache << HashFile(include) << " " << include << "\n";
+		}
+	}
+
+	result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+uint64_t BatchAssembler::HashSource(const std::string& source) const
+{
+	using namespace BatchAssemblerPrivate;
+
+	const uint8_t options[] = { optimize, stripUnused };
+	const uint32_t version = Assembler::VERSION;
+	const uint64_t instructions = HashInstructionSet();
+
+	uint64_t hash = Fnv1a(&version, sizeof(version));
+	hash = Fnv1a(&instructions, sizeof(instructions), hash);
+	hash = Fnv1a(options, sizeof(options), hash);
+	return Fnv1a(source.data(), source.size(), hash);
+}
+
+bool BatchAssembler::IsUpToDate(const BatchJob& job, const uint64_t key) const
+{
+	using namespace BatchAssemblerPrivate;
+
+	std::ifstream cache(CachePath(job.output));
+	uint64_t cachedKey = 0;
+	uint64_t output = 0;
+	if (!(cache >> std::hex >> cachedKey >> output) || cachedKey != key || HashFile(job.output) != output)
+	{
+		return false;
+	}
+
+	// The includes the source had last time, which are still the ones it has while it is unchanged
+	uint64_t hash = 0;
+	std::string include;
+	while (cache >> hash >> std::ws && std::getline(cache, include))
+	{
+		if (HashFile(include) != hash)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,418 @@
+//
+//	Disassembler
+//
+
+#include "Disassembler.h"
+
+#include "Assembler.h"
+#include "ISA.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <cereal/archives/json.hpp>
+
+namespace DisassemblerPrivate
+{
+	// Without a .debug, this many zero words in a row are taken as reserved space rather than nops
+	const size_t MIN_GAP = 8;
+	const size_t WORDS_PER_LINE = 8;
+
+	// What pass one found at each address
+	const uint8_t DATA = 0;
+	const uint8_t START = 1;
+	const uint8_t OPERAND = 2;
+	const uint8_t GAP = 3;
+
+	void AppendNumber(std::string& text, const uint16_t value)
+	{
+		char digits[8];
+		snprintf(digits, sizeof(digits), value < 10 ? "%u" : "0x%X", static_cast<unsigned int>(value));
+		text += digits;
+	}
+
+	bool IsReference(const ETokenType type)
+	{
+		return type == ETokenType::ImmediateLabelReference || type == ETokenType::AbsoluteLabelReference;
+	}
+}
+
+Disassembler::Disassembler()
+	: hasDebug(false)
+	, debug()
+{
+}
+
+void Disassembler::SetDebugInfo(const DebugInfo& info)
+{
+	hasDebug = true;
+	debug = info;
+}
+
+std::vector<DisassemblyLine> Disassembler::Disassemble(const std::vector<uint16_t>& image) const
+{
+	using namespace DisassemblerPrivate;
+
+	const size_t size = image.size();
+
+	// The token for each word, labels and constants aside
+	std::vector<int32_t> tokenAt(hasDebug ? size : 0, -1);
+	for (size_t i = 0; i < debug.tokens.size() && hasDebug; i++)
+	{
+		const TokenData& token = debug.tokens[i];
+		if (token.type != ETokenType::Label && token.type != ETokenType::Equ && token.address >= 0 && static_cast<size_t>(token.address) < size)
+		{
+			tokenAt[token.address] = static_cast<int32_t>(i);
+		}
+	}
+
+	// Zero words in a row from each address, for finding reserved space
+	std::vector<uint32_t> zeros(size + 1, 0);
+	for (size_t i = size; i-- > 0;)
+	{
+		zeros[i] = image[i] == 0 ? zeros[i + 1] + 1 : 0;
+	}
+
+	// Pass one splits the image into instructions, data and gaps. An instruction in the .debug
+	// is only taken as one if the image still holds it.
+	std::vector<uint8_t> kind(size, DATA);
+	std::vector<uint32_t> targets;
+	for (size_t address = 0; address < size;)
+	{
+		const int32_t token = hasDebug ? tokenAt[address] : -1;
+		if (hasDebug ? token < 0 && image[address] == 0 : zeros[address] >= MIN_GAP)
+		{
+			const size_t end = hasDebug ? address + 1 : address + zeros[address];
+			std::fill(kind.begin() + address, kind.begin() + end, GAP);
+			address = end;
+			continue;
+		}
+
+		DecodedOp op;
+		const bool code = Decode(image, address, op)
+			&& (!hasDebug || (token >= 0 && debug.tokens[token].type == ETokenType::Op && debug.tokens[token].data == FindInstruction(static_cast<uint16_t>(op.opcode))->mnemonic));
+		if (!code)
+		{
+			address++;
+			continue;
+		}
+
+		const Instruction* instruction = FindInstruction(static_cast<uint16_t>(op.opcode));
+		for (size_t i = 0; i < op.arity; i++)
+		{
+			kind[address + 1 + i] = OPERAND;
+			if (!hasDebug && instruction->roles[i] == EOperandRole::Target && op.args[i].mode == EAddressingMode::Imm)
+			{
+				targets.push_back(op.args[i].value);
+			}
+		}
+		kind[address] = START;
+		address += 1 + op.arity;
+	}
+
+	// A label can go anywhere but the middle of an instruction
+	auto placeable = [&](const int32_t address)
+	{
+		return address >= 0 && static_cast<size_t>(address) <= size && (static_cast<size_t>(address) == size || kind[address] != OPERAND);
+	};
+
+	std::unordered_map<int32_t, std::vector<std::string>> labels;
+	std::unordered_set<std::string> names;
+	for (const auto& label : debug.labels)
+	{
+		names.insert(label.first);
+		if (placeable(label.second))
+		{
+			labels[label.second].push_back(label.first);
+		}
+	}
+	for (auto& label : labels)
+	{
+		std::sort(label.second.begin(), label.second.end());
+	}
+
+	// Anonymous labels in the source, and jumps when there is no source, get made up names
+	for (size_t i = 0; i < debug.tokens.size() && hasDebug; i++)
+	{
+		const TokenData& token = debug.tokens[i];
+		if (IsReference(token.type) && (token.data == "+" || token.data == "-") && token.address >= 0 && static_cast<size_t>(token.address) < size)
+		{
+			targets.push_back(image[token.address]);
+		}
+	}
+	for (const uint32_t target : targets)
+	{
+		if (labels.find(target) == labels.end() && placeable(target))
+		{
+			char name[16];
+			snprintf(name, sizeof(name), "L%04X", target);
+			std::string unique = name;
+			while (!names.insert(unique).second)
+			{
+				unique += '_';
+			}
+			labels[target].push_back(unique);
+		}
+	}
+
+	// A reference by name keeps its name, one to an anonymous label gets the name made up for it.
+	// Without a .debug, jump targets are the only values taken as labels.
+	auto appendValue = [&](std::string& text, const size_t address, const bool target)
+	{
+		const uint16_t value = image[address];
+		const auto at = labels.find(value);
+		const int32_t token = hasDebug ? tokenAt[address] : -1;
+		if (at != labels.end() && token >= 0 && IsReference(debug.tokens[token].type))
+		{
+			const std::string& data = debug.tokens[token].data;
+			const std::string name = data[0] == '$' ? data.substr(1) : data;
+			if (name == "+" || name == "-")
+			{
+				text += at->second.front();
+				return;
+			}
+			if (std::find(at->second.begin(), at->second.end(), name) != at->second.end())
+			{
+				text += name;
+				return;
+			}
+		}
+		else if (at != labels.end() && target && !hasDebug)
+		{
+			text += at->second.front();
+			return;
+		}
+
+		AppendNumber(text, value);
+	};
+
+	// Pass two writes the lines, data and gaps stopping at every label so it can be placed
+	std::vector<DisassemblyLine> lines;
+	lines.reserve(size / 2 + 1);
+	for (size_t address = 0; address < size;)
+	{
+		DisassemblyLine line;
+		line.address = static_cast<uint16_t>(address);
+		line.code = kind[address] == START;
+
+		const auto at = labels.find(static_cast<int32_t>(address));
+		if (at != labels.end())
+		{
+			line.labels = at->second;
+		}
+
+		auto next = [&](const size_t end, const uint8_t type)
+		{
+			return end < size && kind[end] == type && labels.find(static_cast<int32_t>(end)) == labels.end();
+		};
+
+		if (line.code)
+		{
+			DecodedOp op;
+			Decode(image, address, op);
+			const Instruction* instruction = FindInstruction(static_cast<uint16_t>(op.opcode));
+
+			line.text = instruction->mnemonic;
+			for (size_t i = 0; i < op.arity; i++)
+			{
+				line.text += ' ';
+				switch (op.args[i].mode)
+				{
+					case EAddressingMode::Imm:
+					{
+						appendValue(line.text, address + 1 + i, instruction->roles[i] == EOperandRole::Target);
+					} break;
+
+					case EAddressingMode::Abs:
+					{
+						line.text += '$';
+						appendValue(line.text, address + 1 + i, false);
+					} break;
+
+					case EAddressingMode::Ind:
+					{
+						line.text += '[' + Assembler::REGISTERS[op.args[i].value].name + ']';
+					} break;
+
+					case EAddressingMode::Reg:
+					{
+						line.text += Assembler::REGISTERS[op.args[i].value].name;
+					} break;
+				}
+			}
+			line.size = 1 + op.arity;
+		}
+		else if (kind[address] == GAP)
+		{
+			size_t end = address + 1;
+			while (next(end, GAP))
+			{
+				end++;
+			}
+
+			// Reserved space at the very end isn't part of an image, so the last word is written out
+			if (end == size && end - address > 1)
+			{
+				end--;
+			}
+
+			if (end == size)
+			{
+				line.text = "0";
+			}
+			else
+			{
+				line.text = ".ds(" + std::to_string(end - address) + ")";
+			}
+			line.size = static_cast<uint16_t>(end - address);
+		}
+		else
+		{
+			size_t end = address;
+			do
+			{
+				if (end != address)
+				{
+					line.text += ' ';
+				}
+				appendValue(line.text, end, false);
+				end++;
+			} while (end - address < WORDS_PER_LINE && next(end, DATA));
+			line.size = static_cast<uint16_t>(end - address);
+		}
+
+		address += line.size;
+		lines.push_back(std::move(line));
+	}
+
+	// A label just past the end of the image
+	const auto end = labels.find(static_cast<int32_t>(size));
+	if (end != labels.end())
+	{
+		DisassemblyLine line;
+		line.address = static_cast<uint16_t>(size);
+		line.size = 0;
+		line.code = false;
+		line.labels = end->second;
+		lines.push_back(std::move(line));
+	}
+
+	return lines;
+}
+
+std::string Disassembler::ToText(const std::vector<DisassemblyLine>& lines, const std::vector<uint16_t>& image, const bool addresses /*= false*/)
+{
+	const size_t COMMENT_COLUMN = 32;
+
+	std::string text;
+	text.reserve(lines.size() * (addresses ? 64 : 24));
+	for (const DisassemblyLine& line : lines)
+	{
+		for (const std::string& label : line.labels)
+		{
+			text += label;
+			text += ":\n";
+		}
+		if (line.text.empty())
+		{
+			continue;
+		}
+
+		text += '\t';
+		text += line.text;
+		if (addresses)
+		{
+			text.append(line.text.size() + 4 < COMMENT_COLUMN ? COMMENT_COLUMN - 4 - line.text.size() : 1, ' ');
+
+			char words[16];
+			snprintf(words, sizeof(words), "; %04X:", line.address);
+			text += words;
+			for (size_t i = 0; i < line.size && i < (line.code ? 5u : DisassemblerPrivate::WORDS_PER_LINE); i++)
+			{
+				snprintf(words, sizeof(words), " %04X", image[line.address + i]);
+				text += words;
+			}
+		}
+		text += '\n';
+	}
+
+	return text;
+}
+
+bool Disassembler::Decode(const std::vector<uint16_t>& image, const size_t address, DecodedOp& op)
+{
+	if (address >= image.size())
+	{
+		return false;
+	}
+
+	const uint16_t word = image[address];
+	const Instruction* instruction = FindInstruction(static_cast<uint16_t>(word & 0x00FF));
+	if (instruction == nullptr || address + instruction->arity >= image.size())
+	{
+		return false;
+	}
+
+	// The assembler leaves the modes of missing operands as 0
+	const uint8_t modes = static_cast<uint8_t>(word >> 8);
+	const uint8_t unused = static_cast<uint8_t>(0xFF >> (2 * instruction->arity));
+	if ((modes & unused) != 0)
+	{
+		return false;
+	}
+
+	const std::array<EAddressingMode, 4> decoded = GetAddressingModes(modes);
+	for (size_t i = 0; i < instruction->arity; i++)
+	{
+		op.args[i] = OpArgs(image[address + 1 + i], decoded[i]);
+		if ((decoded[i] == EAddressingMode::Reg || decoded[i] == EAddressingMode::Ind) && op.args[i].value >= Assembler::REGISTERS.size())
+		{
+			return false;
+		}
+	}
+
+	op.opcode = instruction->opcode;
+	op.arity = instruction->arity;
+	op.cycles = instruction->cycles;
+	op.valid = true;
+	return true;
+}
+
+bool Disassembler::Load(const std::string& filename, AssemblyResult& program, bool& hasDebug)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+
+	// Two bytes a word, low byte first
+	const std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	program.image.resize(bytes.size() / 2);
+	for (size_t i = 0; i < program.image.size(); i++)
+	{
+		program.image[i] = static_cast<uint16_t>(bytes[i * 2] | bytes[i * 2 + 1] << 8);
+	}
+
+	hasDebug = false;
+	std::ifstream info(filename + ".debug");
+	if (info)
+	{
+		try
+		{
+			cereal::JSONInputArchive archive(info);
+			archive(cereal::make_nvp("debug", program.debug));
+			hasDebug = true;
+		}
+		catch (const cereal::Exception&)
+		{
+			program.debug = DebugInfo();
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,271 @@
+//
+//	Expression
+//
+
+#include "Expression.h"
+#include "Assembler.h"
+
+namespace ExpressionPrivate
+{
+	struct BinaryOperator
+	{
+		const char* symbol;
+		int32_t precedence;
+	};
+
+	// Longest symbols first, so that << is not read as <
+	static const BinaryOperator OPERATORS[] =
+	{
+		{ "<<", 4 },
+		{ ">>", 4 },
+		{ "|", 1 },
+		{ "^", 2 },
+		{ "&", 3 },
+		{ "+", 5 },
+		{ "-", 5 },
+		{ "*", 6 },
+		{ "/", 6 },
+		{ "%", 6 }
+	};
+
+	bool IsWord(const char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+	}
+
+	// Only + and - keep a relocatable address meaningful, anything else makes it unlinkable
+	int32_t CombineRelocations(const char op, const int32_t lhs, const int32_t rhs)
+	{
+		if (lhs == Expression::INVALID_RELOCATIONS || rhs == Expression::INVALID_RELOCATIONS)
+		{
+			return Expression::INVALID_RELOCATIONS;
+		}
+
+		switch (op)
+		{
+			case '+': return lhs + rhs;
+			case '-': return lhs - rhs;
+			default: return (lhs == 0 && rhs == 0) ? 0 : Expression::INVALID_RELOCATIONS;
+		}
+	}
+}
+
+Expression::Expression(const std::string_view text, const Resolver& resolver)
+	: text(text)
+	, position(0)
+	, resolver(resolver)
+	, error()
+	, syntaxOnly(false)
+{
+}
+
+bool Expression::Evaluate(ExpressionValue& result)
+{
+	position = 0;
+	error.clear();
+
+	if (!ParseBinary(1, result))
+	{
+		return false;
+	}
+
+	SkipSpace();
+	if (position != text.size())
+	{
+		return Fail("unexpected '" + std::string(text.substr(position)) + "'");
+	}
+
+	return true;
+}
+
+bool Expression::IsExpression(const std::string_view text)
+{
+	const Resolver anything = [](const std::string_view, ExpressionValue& value)
+	{
+		value = ExpressionValue(1, 0);
+		return true;
+	};
+
+	Expression expression(text, anything);
+	expression.syntaxOnly = true;
+
+	ExpressionValue result;
+	return expression.Evaluate(result);
+}
+
+bool Expression::ParseBinary(const int32_t precedence, ExpressionValue& result)
+{
+	if (!ParseUnary(result))
+	{
+		return false;
+	}
+
+	std::string_view op;
+	for (int32_t current = PeekOperator(op); current >= precedence; current = PeekOperator(op))
+	{
+		position += op.size();
+
+		// Every operator is left associative, so the right hand side only takes tighter ones
+		ExpressionValue rhs;
+		if (!ParseBinary(current + 1, rhs))
+		{
+			return false;
+		}
+
+		const int32_t a = result.value;
+		const int32_t b = rhs.value;
+		switch (op[0])
+		{
+			case '+': result.value = static_cast<int32_t>(static_cast<uint32_t>(a) + static_cast<uint32_t>(b)); break;
+			case '-': result.value = static_cast<int32_t>(static_cast<uint32_t>(a) - static_cast<uint32_t>(b)); break;
+			case '*': result.value = static_cast<int32_t>(static_cast<uint32_t>(a) * static_cast<uint32_t>(b)); break;
+			case '&': result.value = a & b; break;
+			case '|': result.value = a | b; break;
+			case '^': result.value = a ^ b; break;
+			case '<': result.value = static_cast<int32_t>(static_cast<uint32_t>(a) << (b & 31)); break;
+			case '>': result.value = static_cast<int32_t>(static_cast<uint32_t>(a) >> (b & 31)); break;
+			case '/':
+			case '%':
+			{
+				if (b == 0)
+				{
+					if (!syntaxOnly)
+					{
+						return Fail("division by zero");
+					}
+					break;
+				}
+
+				// -0x80000000 / -1 doesn't fit, so dividing by -1 is done as negating
+				if (b == -1)
+				{
+					result.value = op[0] == '/' ? static_cast<int32_t>(0u - static_cast<uint32_t>(a)) : 0;
+					break;
+				}
+				result.value = op[0] == '/' ? a / b : a % b;
+			}
+			break;
+		}
+
+		result.relocations = ExpressionPrivate::CombineRelocations(op[0], result.relocations, rhs.relocations);
+	}
+
+	return true;
+}
+
+bool Expression::ParseUnary(ExpressionValue& result)
+{
+	SkipSpace();
+	if (position < text.size() && (text[position] == '-' || text[position] == '~' || text[position] == '+'))
+	{
+		const char op = text[position++];
+		if (!ParseUnary(result))
+		{
+			return false;
+		}
+
+		if (op == '-')
+		{
+			result.value = static_cast<int32_t>(0u - static_cast<uint32_t>(result.value));
+			result.relocations = ExpressionPrivate::CombineRelocations('-', 0, result.relocations);
+		}
+		else if (op == '~')
+		{
+			result.value = ~result.value;
+			result.relocations = ExpressionPrivate::CombineRelocations('~', result.relocations, 0);
+		}
+
+		return true;
+	}
+
+	return ParsePrimary(result);
+}
+
+bool Expression::ParsePrimary(ExpressionValue& result)
+{
+	SkipSpace();
+	if (position >= text.size())
+	{
+		return Fail("expected a value");
+	}
+
+	if (text[position] == '(')
+	{
+		position++;
+		if (!ParseBinary(1, result))
+		{
+			return false;
+		}
+
+		SkipSpace();
+		if (position >= text.size() || text[position] != ')')
+		{
+			return Fail("expected ')'");
+		}
+		position++;
+		return true;
+	}
+
+	const size_t start = position;
+	while (position < text.size() && ExpressionPrivate::IsWord(text[position]))
+	{
+		position++;
+	}
+
+	const std::string_view word = text.substr(start, position - start);
+	if (word.empty())
+	{
+		return Fail("unexpected '" + std::string(text.substr(start)) + "'");
+	}
+
+	if (word[0] >= '0' && word[0] <= '9')
+	{
+		if (!Assembler::IsNumber(word))
+		{
+			return Fail("invalid number " + std::string(word));
+		}
+
+		result = ExpressionValue(Assembler::ParseNumber(word), 0);
+		return true;
+	}
+
+	if (!resolver(word, result))
+	{
+		return Fail("unknown symbol " + std::string(word));
+	}
+
+	return true;
+}
+
+int32_t Expression::PeekOperator(std::string_view& op)
+{
+	SkipSpace();
+	for (const ExpressionPrivate::BinaryOperator& candidate : ExpressionPrivate::OPERATORS)
+	{
+		if (text.substr(position).rfind(candidate.symbol, 0) == 0)
+		{
+			op = candidate.symbol;
+			return candidate.precedence;
+		}
+	}
+
+	return 0;
+}
+
+void Expression::SkipSpace()
+{
+	while (position < text.size() && (text[position] == ' ' || text[position] == '\t'))
+	{
+		position++;
+	}
+}
+
+bool Expression::Fail(const std::string& message)
+{
+	if (error.empty())
+	{
+		error = message;
+	}
+
+	return false;
+}
@@ -0,0 +1,164 @@
+//
+//	IncrementalAssembler
+//
+
+#include "IncrementalAssembler.h"
+
+#include <algorithm>
+
+namespace IncrementalAssemblerPrivate
+{
+	bool Contains(std::string text, const char* directive)
+	{
+		std::transform(text.begin(), text.end(), text.begin(), tolower);
+		return text.find(directive) != std::string::npos;
+	}
+
+	// Constants, macros and .rept blocks carry state from one line to the next, and an included
+	// file may define any of them
+	bool IsStateful(const std::string& text)
+	{
+		return Contains(text, ".equ") || Contains(text, ".macro") || Contains(text, ".rept") || Contains(text, ".include");
+	}
+}
+
+IncrementalAssembler::IncrementalAssembler()
+	: assembler()
+	, lineCache()
+	, result()
+	, opAddresses()
+	, hasImage(false)
+	, lexedLines(0)
+{
+}
+
+ImageDelta IncrementalAssembler::Assemble(const std::string& text, const std::string& directory /*= std::string()*/)
+{
+	assembler.SetDirectory(directory);
+
+	std::vector<TokenData> newTokens;
+	if (IncrementalAssemblerPrivate::IsStateful(text) || !LexLines(text, newTokens))
+	{
+		// Either a '(' ran over a line break or a line depends on ones before it, so lines can't be lexed on their own
+		lineCache.clear();
+
+		std::string prepared = text;
+		prepared.erase(std::remove(prepared.begin(), prepared.end(), '\r'), prepared.end());
+
+		int32_t address = 0;
+		newTokens.clear();
+		Assembler::Layout(assembler.Lex(prepared), 0, address, newTokens);
+		lexedLines = std::count(prepared.begin(), prepared.end(), '\n') + 1;
+	}
+
+	Assembler::LabelMap newLabels = Assembler::BuildLabelTable(newTokens);
+	std::vector<uint16_t> newImage = assembler.Convert(newTokens, newLabels);
+
+	std::vector<int32_t> newOpAddresses;
+	for (const TokenData& token : newTokens)
+	{
+		if (token.type == ETokenType::Op)
+		{
+			newOpAddresses.push_back(token.address);
+		}
+	}
+
+	// Patching is only safe while everything the VM may hold on to, the pc, return
+	// addresses and pointers to labels, still lands where it did before
+	ImageDelta delta;
+	delta.relayout = !hasImage
+		|| newImage.size() != result.image.size()
+		|| newLabels != result.debug.labels
+		|| newOpAddresses != opAddresses;
+
+	if (!delta.relayout)
+	{
+		for (size_t i = 0; i < newImage.size(); i++)
+		{
+			if (newImage[i] != result.image[i])
+			{
+				delta.words.emplace_back(static_cast<uint16_t>(i), newImage[i]);
+			}
+		}
+	}
+
+	result.image = std::move(newImage);
+	result.debug.tokens = std::move(newTokens);
+	result.debug.labels = std::move(newLabels);
+	opAddresses = std::move(newOpAddresses);
+	hasImage = true;
+
+	return delta;
+}
+
+void IncrementalAssembler::Reset()
+{
+	lineCache.clear();
+	result = AssemblyResult();
+	opAddresses.clear();
+	hasImage = false;
+	lexedLines = 0;
+}
+
+bool IncrementalAssembler::LexLines(const std::string& text, std::vector<TokenData>& tokens)
+{
+	// Lines still in use move over to the new cache, so deleted lines don't accumulate
+	std::unordered_map<std::string, CachedLine> previous;
+	previous.swap(lineCache);
+
+	int32_t address = 0;
+	int32_t line = 1;
+	size_t start = 0;
+	lexedLines = 0;
+
+	while (start <= text.size())
+	{
+		size_t end = text.find('\n', start);
+		if (end == std::string::npos)
+		{
+			end = text.size();
+		}
+
+		std::string key = text.substr(start, end - start);
+		key.erase(std::remove(key.begin(), key.end(), '\r'), key.end());
+
+		const CachedLine* cached = nullptr;
+
+		auto it = lineCache.find(key);
+		if (it != lineCache.end())
+		{
+			cached = &it->second;
+		}
+		else
+		{
+			auto old = previous.find(key);
+			if (old != previous.end())
+			{
+				cached = &lineCache.emplace(key, std::move(old->second)).first->second;
+				previous.erase(old);
+			}
+			else
+			{
+				CachedLine lexed;
+				int32_t depth = 0;
+				lexed.items = assembler.Lex(key, line, &depth);
+				lexed.line = line;
+				lexedLines++;
+
+				if (depth != 0)
+				{
+					return false;
+				}
+
+				cached = &lineCache.emplace(key, std::move(lexed)).first->second;
+			}
+		}
+
+		Assembler::Layout(cached->items, line - cached->line, address, tokens);
+
+		start = end + 1;
+		line++;
+	}
+
+	return true;
+}
@@ -0,0 +1,126 @@
+//
+//	Linker
+//
+
+#include "Linker.h"
+#include "Assembler.h"
+
+#include "assertf.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <future>
+#include <unordered_map>
+
+namespace LinkerPrivate
+{
+	// Marks a name that more than one unit exports
+	static const int32_t AMBIGUOUS = -1;
+
+	ObjectFile LoadUnit(const std::string& file)
+	{
+		const std::filesystem::path path(file);
+		ObjectFile object;
+
+		if (path.extension() == ".qo")
+		{
+			const bool loaded = object.Load(file);
+			assertf(loaded, "Unable to load object file: %s", file.c_str());
+		}
+		else
+		{
+			Assembler assembler(file);
+			object = assembler.BuildObject(path.stem().string());
+		}
+
+		return object;
+	}
+}
+
+void Linker::Add(ObjectFile object)
+{
+	objects.push_back(std::move(object));
+}
+
+void Linker::AddFiles(const std::vector<std::string>& files)
+{
+	// Each unit is assembled by its own Assembler, so they are independent of each other
+	std::vector<std::future<ObjectFile>> units;
+	units.reserve(files.size());
+	for (const std::string& file : files)
+	{
+		units.push_back(std::async(std::launch::async, LinkerPrivate::LoadUnit, file));
+	}
+
+	for (std::future<ObjectFile>& unit : units)
+	{
+		Add(unit.get());
+	}
+}
+
+AssemblyResult Linker::Link() const
+{
+	std::vector<int32_t> bases;
+	// A unit's space reserved at the end isn't in its image but is still its own
+	int32_t size = 0;
+	for (const ObjectFile& object : objects)
+	{
+		bases.push_back(size);
+		size += std::max(object.extent, static_cast<int32_t>(object.image.size()));
+	}
+	assertf(size <= 0x10000, "Linked program does not fit in memory, it needs %d words", size);
+
+	std::unordered_map<std::string, int32_t> exports;
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		for (const auto& symbol : objects[i].symbols)
+		{
+			const auto inserted = exports.emplace(symbol.first, static_cast<int32_t>(i));
+			if (!inserted.second)
+			{
+				inserted.first->second = LinkerPrivate::AMBIGUOUS;
+			}
+		}
+	}
+
+	AssemblyResult result;
+	result.image.resize(size);
+
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		const ObjectFile& object = objects[i];
+		const int32_t base = bases[i];
+		std::copy(object.image.begin(), object.image.end(), result.image.begin() + base);
+
+		for (const Relocation& relocation : object.relocations)
+		{
+			uint16_t& word = result.image[base + relocation.address];
+			if (relocation.symbol.empty())
+			{
+				word = static_cast<uint16_t>(word + base);
+				continue;
+			}
+
+			const auto it = exports.find(relocation.symbol);
+			assertf(it != exports.end(), "Undefined symbol %s referenced by %s", relocation.symbol.c_str(), object.name.c_str());
+			assertf(it->second != LinkerPrivate::AMBIGUOUS, "Symbol %s referenced by %s is defined by more than one unit", relocation.symbol.c_str(), object.name.c_str());
+
+			const ObjectFile& owner = objects[it->second];
+			word = static_cast<uint16_t>(bases[it->second] + owner.symbols.at(relocation.symbol));
+		}
+
+		for (const TokenData& token : object.tokens)
+		{
+			result.debug.tokens.emplace_back(token.type, token.data, token.address + base, token.line);
+		}
+
+		// Labels that clash with another unit's are kept under unit::label, so every one is still a verifier entry point
+		for (const auto& symbol : object.symbols)
+		{
+			const std::string name = exports.at(symbol.first) == LinkerPrivate::AMBIGUOUS ? object.name + "::" + symbol.first : symbol.first;
+			result.debug.labels[name] = symbol.second + base;
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,36 @@
+//
+//	ObjectFile
+//
+
+#include "ObjectFile.h"
+#include "Filesystem.h"
+
+#include <cereal/archives/json.hpp>
+
+bool ObjectFile::Load(const std::string& filename)
+{
+	FileReader reader;
+	if (reader.Open(filename))
+	{
+		cereal::JSONInputArchive archive(reader.GetStream());
+		archive(cereal::make_nvp("object", *this));
+
+		return true;
+	}
+
+	return false;
+}
+
+bool ObjectFile::Save(const std::string& filename) const
+{
+	FileWriter writer;
+	if (writer.Open(filename))
+	{
+		cereal::JSONOutputArchive archive(writer.GetStream());
+		archive(cereal::make_nvp("object", *this));
+
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,1644 @@
+//
+//	Optimizer
+//
+
+#include "Optimizer.h"
+#include "Assembler.h"
+
+#include <algorithm>
+
+namespace OptimizerPrivate
+{
+	// Every pass can expose more work for the others, but only so much
+	static const int32_t MAX_PASSES = 16;
+
+	// Leaf routines up to this many words are copied into their callers
+	static const int32_t MAX_INLINE_WORDS = 6;
+
+	static const uint16_t ALL_REGISTERS = 0xFFFF;
+
+	static const size_t NONE = static_cast<size_t>(-1);
+
+	bool IsAnonymous(const std::string& name)
+	{
+		return name == "+" || name == "-";
+	}
+
+	// Operand types that name a register or memory, rather than a value
+	bool IsWritable(const ETokenType type)
+	{
+		switch (type)
+		{
+			case ETokenType::Register:
+			case ETokenType::Indirect:
+			case ETokenType::Absolute:
+			case ETokenType::AbsoluteLabelReference:
+			case ETokenType::AbsoluteExpression: return true;
+			default: return false;
+		}
+	}
+
+	// The branch taken exactly when the given one isn't
+	EOpCode Invert(const EOpCode opcode)
+	{
+		switch (opcode)
+		{
+			case EOpCode::JEQ: return EOpCode::JNE;
+			case EOpCode::JNE: return EOpCode::JEQ;
+			case EOpCode::JGT: return EOpCode::JLE;
+			case EOpCode::JLE: return EOpCode::JGT;
+			case EOpCode::JGE: return EOpCode::JLT;
+			case EOpCode::JLT: return EOpCode::JGE;
+			default: return opcode;
+		}
+	}
+
+	bool IsConditional(const EOpCode opcode)
+	{
+		return Invert(opcode) != opcode;
+	}
+
+	// Execution never carries on to the next instruction after these
+	bool IsTerminal(const EOpCode opcode)
+	{
+		return opcode == EOpCode::JMP || opcode == EOpCode::RET || opcode == EOpCode::EXT;
+	}
+
+	bool IsWord(const char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+	}
+
+	// Returns -1 unless value is a power of two
+	int32_t Log2(const uint16_t value)
+	{
+		if (value == 0 || (value & (value - 1)) != 0)
+		{
+			return -1;
+		}
+
+		int32_t shift = 0;
+		while ((1 << shift) != value)
+		{
+			shift++;
+		}
+		return shift;
+	}
+
+	uint16_t RegisterBit(const std::string& name)
+	{
+		for (const RegisterData& reg : Assembler::REGISTERS)
+		{
+			if (reg.name == name)
+			{
+				return static_cast<uint16_t>(1 << reg.value);
+			}
+		}
+		return 0;
+	}
+
+	LexItem MakeOp(const EOpCode opcode, const int32_t line)
+	{
+		return LexItem(ELexItemKind::Token, ETokenType::Op, FindInstruction(static_cast<uint16_t>(opcode))->mnemonic, 0, line);
+	}
+}
+
+int32_t Optimizer::Optimize(std::vector<LexItem>& items, const bool wholeProgram /*= false*/, const Profile* profile /*= nullptr*/)
+{
+	int32_t total = 0;
+	auto peephole = [&]()
+	{
+		for (int32_t pass = 0; pass < OptimizerPrivate::MAX_PASSES; pass++)
+		{
+			// Branches are inverted before they are threaded, which would hide the jmp they skip
+			IndexLabels(items);
+			int32_t rewrites = Simplify(items);
+
+			IndexLabels(items);
+			rewrites += ThreadJumps(items);
+
+			IndexLabels(items);
+			rewrites += RemoveSaves(items);
+
+			IndexLabels(items);
+			rewrites += InlineLeaves(items);
+			if (rewrites == 0)
+			{
+				break;
+			}
+
+			total += rewrites;
+		}
+	};
+
+	peephole();
+
+	if (wholeProgram)
+	{
+		IndexLabels(items);
+		const int32_t stripped = StripUnreachable(items);
+
+		IndexLabels(items);
+		total += stripped + MergeData(items);
+
+		// Code that was in between may have been all that kept a jmp from being redundant
+		if (stripped > 0)
+		{
+			peephole();
+		}
+	}
+
+	if (profile != nullptr)
+	{
+		IndexLabels(items);
+		const int32_t arranged = ArrangeByProfile(items, *profile);
+		total += arranged;
+
+		// A jmp to the section now placed after it can go
+		if (arranged > 0)
+		{
+			peephole();
+		}
+	}
+
+	return total;
+}
+
+bool Optimizer::IsInstruction(const std::vector<LexItem>& items, const size_t index, const Instruction*& op) const
+{
+	if (index >= items.size() || items[index].kind != ELexItemKind::Token || items[index].type != ETokenType::Op)
+	{
+		return false;
+	}
+
+	op = FindInstruction(items[index].data);
+	if (op == nullptr || index + op->arity >= items.size())
+	{
+		return false;
+	}
+
+	// A label between an op and its operands would be jumped into, leave those alone
+	for (size_t i = index + 1; i <= index + op->arity; i++)
+	{
+		if (items[i].kind != ELexItemKind::Token || items[i].type == ETokenType::Op)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Optimizer::IndexLabels(const std::vector<LexItem>& items)
+{
+	labels.clear();
+	equs.clear();
+	clobbers.clear();
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		// The last definition wins, as it does in the label table
+		if (items[i].kind == ELexItemKind::Label && items[i].type == ETokenType::Label && !OptimizerPrivate::IsAnonymous(items[i].data))
+		{
+			labels[items[i].data] = i;
+		}
+		else if (items[i].type == ETokenType::Equ)
+		{
+			const size_t split = items[i].data.find('=');
+			equs[items[i].data.substr(0, split)] = items[i].data.substr(split + 1);
+		}
+	}
+}
+
+int32_t Optimizer::FindTarget(const std::vector<LexItem>& items, const size_t operand) const
+{
+	const std::string& name = items[operand].data;
+	if (name == "-")
+	{
+		for (size_t i = operand; i-- > 0;)
+		{
+			if (items[i].kind == ELexItemKind::Label && items[i].data == "-")
+			{
+				return static_cast<int32_t>(i);
+			}
+		}
+		return -1;
+	}
+
+	if (name == "+")
+	{
+		for (size_t i = operand + 1; i < items.size(); i++)
+		{
+			if (items[i].kind == ELexItemKind::Label && items[i].data == "+")
+			{
+				return static_cast<int32_t>(i);
+			}
+		}
+		return -1;
+	}
+
+	const auto it = labels.find(name);
+	return it != labels.end() ? static_cast<int32_t>(it->second) : -1;
+}
+
+bool Optimizer::LabelsInclude(const std::vector<LexItem>& items, size_t index, const size_t operand) const
+{
+	if (items[operand].type != ETokenType::ImmediateLabelReference)
+	{
+		return false;
+	}
+
+	const int32_t target = FindTarget(items, operand);
+	for (; index < items.size() && items[index].kind == ELexItemKind::Label; index++)
+	{
+		if (static_cast<int32_t>(index) == target)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int32_t Optimizer::ThreadJumps(std::vector<LexItem>& items)
+{
+	int32_t rewrites = 0;
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const Instruction* op = nullptr;
+		if (!IsInstruction(items, i, op) || op->arity == 0 || op->roles[0] != EOperandRole::Target
+			|| items[i + 1].type != ETokenType::ImmediateLabelReference)
+		{
+			continue;
+		}
+
+		// Follow the chain of jmps, giving up on one that never leaves
+		std::vector<size_t> visited = { i };
+		std::string destination;
+		bool cycle = false;
+		for (int32_t target = FindTarget(items, i + 1); target >= 0;)
+		{
+			size_t next = static_cast<size_t>(target);
+			while (next < items.size() && items[next].kind == ELexItemKind::Label)
+			{
+				next++;
+			}
+
+			const Instruction* jump = nullptr;
+			if (!IsInstruction(items, next, jump) || jump->opcode != EOpCode::JMP
+				|| items[next + 1].type != ETokenType::ImmediateLabelReference || OptimizerPrivate::IsAnonymous(items[next + 1].data))
+			{
+				break;
+			}
+
+			if (std::find(visited.begin(), visited.end(), next) != visited.end())
+			{
+				cycle = true;
+				break;
+			}
+
+			visited.push_back(next);
+			destination = items[next + 1].data;
+			target = FindTarget(items, next + 1);
+		}
+
+		if (!cycle && !destination.empty() && destination != items[i + 1].data)
+		{
+			items[i + 1].data = destination;
+			rewrites++;
+		}
+	}
+
+	return rewrites;
+}
+
+int32_t Optimizer::Simplify(std::vector<LexItem>& items)
+{
+	using namespace OptimizerPrivate;
+
+	std::vector<LexItem> output;
+	output.reserve(items.size());
+
+	int32_t rewrites = 0;
+	size_t i = 0;
+	while (i < items.size())
+	{
+		const Instruction* op = nullptr;
+		if (!IsInstruction(items, i, op))
+		{
+			output.push_back(items[i++]);
+			continue;
+		}
+
+		const size_t next = i + 1 + op->arity;
+		const Instruction* following = nullptr;
+		const bool adjacent = IsInstruction(items, next, following);
+
+		switch (op->opcode)
+		{
+			case EOpCode::MOV:
+			{
+				if (items[i + 1].type == ETokenType::Register && items[i + 1].type == items[i + 2].type && items[i + 1].data == items[i + 2].data)
+				{
+					i = next;
+					rewrites++;
+					continue;
+				}
+			}
+			break;
+
+			case EOpCode::PSH:
+			{
+				if (!adjacent || following->opcode != EOpCode::POP || !IsWritable(items[next + 1].type))
+				{
+					break;
+				}
+
+				const LexItem& source = items[i + 1];
+				const LexItem& destination = items[next + 1];
+				if (source.type != destination.type || source.data != destination.data)
+				{
+					output.push_back(MakeOp(EOpCode::MOV, items[i].line));
+					output.push_back(destination);
+					output.push_back(source);
+				}
+
+				i = next + 2;
+				rewrites++;
+				continue;
+			}
+			break;
+
+			case EOpCode::MUL:
+			case EOpCode::MDL:
+			{
+				const LexItem& operand = items[i + 2];
+				const int32_t shift = operand.type == ETokenType::Immediate ? Log2(Assembler::ParseNumber(operand.data)) : -1;
+				if (shift < 0)
+				{
+					break;
+				}
+
+				const bool multiply = op->opcode == EOpCode::MUL;
+				output.push_back(MakeOp(multiply ? EOpCode::LSL : EOpCode::AND, items[i].line));
+				output.push_back(items[i + 1]);
+				output.push_back(LexItem(ELexItemKind::Token, ETokenType::Immediate, std::to_string(multiply ? shift : (1 << shift) - 1), 0, operand.line));
+
+				i = next;
+				rewrites++;
+				continue;
+			}
+			break;
+
+			case EOpCode::JMP:
+			{
+				if (LabelsInclude(items, next, i + 1))
+				{
+					i = next;
+					rewrites++;
+					continue;
+				}
+			}
+			break;
+
+			default:
+			{
+				// jcc L, jmp M, L: only falls through to the jmp when the branch isn't taken
+				if (!IsConditional(op->opcode) || !adjacent || following->opcode != EOpCode::JMP || !LabelsInclude(items, next + 2, i + 1))
+				{
+					break;
+				}
+
+				LexItem target = items[next + 1];
+				target.line = items[i + 1].line;
+
+				output.push_back(MakeOp(Invert(op->opcode), items[i].line));
+				output.push_back(target);
+				output.push_back(items[i + 2]);
+				output.push_back(items[i + 3]);
+
+				i = next + 2;
+				rewrites++;
+				continue;
+			}
+			break;
+		}
+
+		output.insert(output.end(), items.begin() + i, items.begin() + next);
+		i = next;
+	}
+
+	items = std::move(output);
+	return rewrites;
+}
+
+std::vector<Optimizer::Section> Optimizer::BuildSections(const std::vector<LexItem>& items, std::vector<size_t>& owners) const
+{
+	std::vector<Section> sections;
+	owners.assign(items.size(), 0);
+
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		if (i == 0 || (items[i].kind == ELexItemKind::Label && items[i - 1].kind != ELexItemKind::Label))
+		{
+			if (!sections.empty())
+			{
+				sections.back().end = i;
+			}
+
+			size_t body = i;
+			while (body < items.size() && items[body].kind == ELexItemKind::Label)
+			{
+				body++;
+			}
+
+			sections.push_back(Section{ i, body, items.size() });
+		}
+
+		owners[i] = sections.size() - 1;
+	}
+
+	return sections;
+}
+
+void Optimizer::CollectReferences(const std::vector<LexItem>& items, const size_t operand, std::vector<int32_t>& targets) const
+{
+	const LexItem& item = items[operand];
+	std::vector<std::string> visited;
+
+	switch (item.type)
+	{
+		case ETokenType::ImmediateLabelReference:
+		{
+			if (OptimizerPrivate::IsAnonymous(item.data))
+			{
+				const int32_t target = FindTarget(items, operand);
+				if (target >= 0)
+				{
+					targets.push_back(target);
+				}
+			}
+			else
+			{
+				CollectSymbols(item.data, targets, visited);
+			}
+		}
+		break;
+
+		case ETokenType::AbsoluteLabelReference:
+		case ETokenType::Expression:
+		case ETokenType::AbsoluteExpression:
+		{
+			CollectSymbols(item.data, targets, visited);
+		}
+		break;
+
+		default:
+		{
+		}
+		break;
+	}
+}
+
+void Optimizer::CollectSymbols(const std::string& expression, std::vector<int32_t>& targets, std::vector<std::string>& visited) const
+{
+	size_t i = 0;
+	while (i < expression.size())
+	{
+		if (!OptimizerPrivate::IsWord(expression[i]))
+		{
+			i++;
+			continue;
+		}
+
+		const size_t start = i;
+		while (i < expression.size() && OptimizerPrivate::IsWord(expression[i]))
+		{
+			i++;
+		}
+
+		// Numbers are words too, but never names
+		const std::string word = expression.substr(start, i - start);
+		if (word[0] >= '0' && word[0] <= '9')
+		{
+			continue;
+		}
+
+		const auto label = labels.find(word);
+		if (label != labels.end())
+		{
+			targets.push_back(static_cast<int32_t>(label->second));
+			continue;
+		}
+
+		const auto equ = equs.find(word);
+		if (equ != equs.end() && std::find(visited.begin(), visited.end(), word) == visited.end())
+		{
+			visited.push_back(word);
+			CollectSymbols(equ->second, targets, visited);
+		}
+	}
+}
+
+bool Optimizer::IsResolved(const std::vector<LexItem>& items) const
+{
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const LexItem& item = items[i];
+		if (item.kind != ELexItemKind::Token)
+		{
+			continue;
+		}
+
+		std::vector<std::string> visited;
+		switch (item.type)
+		{
+			case ETokenType::ImmediateLabelReference:
+			{
+				// A + with nothing after it assembles to 0, a - with nothing before it is an error
+				if (OptimizerPrivate::IsAnonymous(item.data))
+				{
+					if (item.data == "-" && FindTarget(items, i) < 0)
+					{
+						return false;
+					}
+				}
+				else if (!AreDefined(item.data, visited))
+				{
+					return false;
+				}
+			}
+			break;
+
+			case ETokenType::AbsoluteLabelReference:
+			case ETokenType::Expression:
+			case ETokenType::AbsoluteExpression:
+			{
+				if (!AreDefined(item.data, visited))
+				{
+					return false;
+				}
+			}
+			break;
+
+			default:
+			{
+			}
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool Optimizer::AreDefined(const std::string& expression, std::vector<std::string>& visited) const
+{
+	size_t i = 0;
+	while (i < expression.size())
+	{
+		if (!OptimizerPrivate::IsWord(expression[i]))
+		{
+			i++;
+			continue;
+		}
+
+		const size_t start = i;
+		while (i < expression.size() && OptimizerPrivate::IsWord(expression[i]))
+		{
+			i++;
+		}
+
+		const std::string word = expression.substr(start, i - start);
+		if ((word[0] >= '0' && word[0] <= '9') || labels.find(word) != labels.end())
+		{
+			continue;
+		}
+
+		const auto equ = equs.find(word);
+		if (equ == equs.end())
+		{
+			return false;
+		}
+
+		if (std::find(visited.begin(), visited.end(), word) == visited.end())
+		{
+			visited.push_back(word);
+			if (!AreDefined(equ->second, visited))
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+std::vector<bool> Optimizer::FindContinuations(const std::vector<LexItem>& items, const std::vector<Section>& sections, const std::vector<size_t>& owners) const
+{
+	std::vector<bool> mentioned(sections.size(), false);
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		if (items[i].kind == ELexItemKind::Token)
+		{
+			std::vector<int32_t> targets;
+			CollectReferences(items, i, targets);
+			for (const int32_t target : targets)
+			{
+				mentioned[owners[target]] = true;
+			}
+		}
+	}
+
+	auto isData = [&items](const Section& section)
+	{
+		for (size_t i = section.body; i < section.end; i++)
+		{
+			if (items[i].kind == ELexItemKind::Org || items[i].type == ETokenType::Op)
+			{
+				return false;
+			}
+		}
+		return section.body != section.end;
+	};
+
+	std::vector<bool> continuations(sections.size(), false);
+	for (size_t index = 1; index < sections.size(); index++)
+	{
+		continuations[index] = !mentioned[index] && isData(sections[index]) && isData(sections[index - 1]);
+	}
+
+	return continuations;
+}
+
+int32_t Optimizer::StripUnreachable(std::vector<LexItem>& items)
+{
+	// A reference to a label that isn't defined is an error even in code that is never reached,
+	// so such a program is left whole for the assembler to report it
+	if (!IsResolved(items))
+	{
+		return 0;
+	}
+
+	std::vector<size_t> owners;
+	const std::vector<Section> sections = BuildSections(items, owners);
+	const std::vector<bool> continuations = FindContinuations(items, sections, owners);
+
+	std::vector<bool> live(sections.size(), false);
+	std::vector<size_t> pending = { 0 };
+	live[0] = true;
+
+	while (!pending.empty())
+	{
+		const size_t index = pending.back();
+		const Section& section = sections[index];
+		pending.pop_back();
+
+		std::vector<int32_t> targets;
+		bool fallsThrough = true;
+		for (size_t i = section.body; i < section.end;)
+		{
+			const Instruction* op = nullptr;
+			if (IsInstruction(items, i, op))
+			{
+				for (size_t j = i + 1; j <= i + op->arity; j++)
+				{
+					CollectReferences(items, j, targets);
+				}
+
+				fallsThrough = !OptimizerPrivate::IsTerminal(op->opcode);
+				i += 1 + op->arity;
+				continue;
+			}
+
+			// Execution doesn't run on into data, a .org doesn't change where it goes
+			if (items[i].kind == ELexItemKind::Token)
+			{
+				CollectReferences(items, i, targets);
+			}
+			if (items[i].kind != ELexItemKind::Org)
+			{
+				fallsThrough = false;
+			}
+			i++;
+		}
+
+		if (index + 1 < sections.size() && (fallsThrough || continuations[index + 1]))
+		{
+			targets.push_back(static_cast<int32_t>(sections[index + 1].begin));
+		}
+
+		for (const int32_t target : targets)
+		{
+			const size_t owner = owners[target];
+			if (!live[owner])
+			{
+				live[owner] = true;
+				pending.push_back(owner);
+			}
+		}
+	}
+
+	std::vector<LexItem> output;
+	output.reserve(items.size());
+
+	int32_t stripped = 0;
+	for (size_t index = 0; index < sections.size(); index++)
+	{
+		const Section& section = sections[index];
+		if (live[index])
+		{
+			output.insert(output.end(), items.begin() + section.begin, items.begin() + section.end);
+			continue;
+		}
+
+		// A .org still places what comes after it, and constants cost nothing
+		for (size_t i = section.begin; i < section.end; i++)
+		{
+			if (items[i].kind == ELexItemKind::Org || items[i].type == ETokenType::Equ)
+			{
+				output.push_back(items[i]);
+			}
+		}
+		stripped++;
+	}
+
+	items = std::move(output);
+	return stripped;
+}
+
+int32_t Optimizer::MergeData(std::vector<LexItem>& items)
+{
+	std::vector<size_t> owners;
+	const std::vector<Section> sections = BuildSections(items, owners);
+	const std::vector<bool> continuations = FindContinuations(items, sections, owners);
+
+	// Anything written through its address has to stay a copy of its own, that includes the
+	// destination of a block operation
+	std::vector<bool> written(sections.size(), false);
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const Instruction* op = nullptr;
+		if (!IsInstruction(items, i, op))
+		{
+			continue;
+		}
+
+		const bool block = op->opcode == EOpCode::CPY || op->opcode == EOpCode::FIL;
+		for (size_t j = 0; j < op->arity; j++)
+		{
+			if (op->roles[j] == EOperandRole::Write || op->roles[j] == EOperandRole::ReadWrite || (block && j == 0))
+			{
+				std::vector<int32_t> targets;
+				CollectReferences(items, i + 1 + j, targets);
+				for (const int32_t target : targets)
+				{
+					written[owners[target]] = true;
+				}
+			}
+		}
+	}
+
+	std::unordered_map<std::string, size_t> contents;
+	std::vector<std::vector<size_t>> aliases(sections.size());
+	std::vector<bool> merged(sections.size(), false);
+
+	for (size_t index = 1; index < sections.size(); index++)
+	{
+		// Part of a larger table, which would be read past the end of the copy that was kept
+		const Section& section = sections[index];
+		const bool table = continuations[index] || (index + 1 < sections.size() && continuations[index + 1]);
+		if (written[index] || table || section.body == section.end)
+		{
+			continue;
+		}
+
+		// Only plain data, named by at least one label that isn't anonymous
+		bool named = false;
+		bool data = true;
+		for (size_t i = section.begin; i < section.end && data; i++)
+		{
+			const LexItem& item = items[i];
+			if (i < section.body)
+			{
+				named |= item.type == ETokenType::Label;
+				data = !OptimizerPrivate::IsAnonymous(item.data);
+			}
+			else
+			{
+				data = item.kind == ELexItemKind::Token && item.type != ETokenType::Op && !OptimizerPrivate::IsAnonymous(item.data);
+			}
+		}
+
+		if (!named || !data)
+		{
+			continue;
+		}
+
+		std::string key;
+		for (size_t i = section.body; i < section.end; i++)
+		{
+			key += std::to_string(static_cast<int32_t>(items[i].type)) + ":" + items[i].data + "\n";
+		}
+
+		const auto inserted = contents.emplace(key, index);
+		if (!inserted.second)
+		{
+			merged[index] = true;
+			aliases[inserted.first->second].push_back(index);
+		}
+	}
+
+	std::vector<LexItem> output;
+	output.reserve(items.size());
+
+	int32_t rewrites = 0;
+	for (size_t index = 0; index < sections.size(); index++)
+	{
+		const Section& section = sections[index];
+		if (merged[index])
+		{
+			for (size_t i = section.begin; i < section.body; i++)
+			{
+				if (items[i].type == ETokenType::Equ)
+				{
+					output.push_back(items[i]);
+				}
+			}
+			rewrites++;
+			continue;
+		}
+
+		// The labels of every copy are placed with the one that is kept
+		output.insert(output.end(), items.begin() + section.begin, items.begin() + section.body);
+		for (const size_t alias : aliases[index])
+		{
+			for (size_t i = sections[alias].begin; i < sections[alias].body; i++)
+			{
+				if (items[i].type == ETokenType::Label)
+				{
+					output.push_back(items[i]);
+				}
+			}
+		}
+		output.insert(output.end(), items.begin() + section.body, items.begin() + section.end);
+	}
+
+	items = std::move(output);
+	return rewrites;
+}
+
+Optimizer::Clobbers Optimizer::FindClobbers(const std::vector<LexItem>& items, const std::string& name)
+{
+	using namespace OptimizerPrivate;
+
+	const auto known = clobbers.find(name);
+	if (known != clobbers.end())
+	{
+		return known->second;
+	}
+
+	// Anything that can't be followed could do anything, that includes a routine calling itself
+	const Clobbers unknown = { ALL_REGISTERS, false };
+	clobbers[name] = unknown;
+
+	const auto label = labels.find(name);
+	if (label == labels.end())
+	{
+		return unknown;
+	}
+
+	Clobbers result = { 0, true };
+	std::unordered_map<size_t, int32_t> depths;
+	std::vector<std::pair<size_t, int32_t>> pending = { { label->second, 0 } };
+	while (!pending.empty())
+	{
+		size_t i = pending.back().first;
+		const int32_t depth = pending.back().second;
+		pending.pop_back();
+
+		while (i < items.size() && items[i].kind == ELexItemKind::Label)
+		{
+			i++;
+		}
+
+		// Every path has to reach an instruction with the same stack depth
+		const auto seen = depths.find(i);
+		if (seen != depths.end())
+		{
+			result.balanced &= seen->second == depth;
+			continue;
+		}
+		depths[i] = depth;
+
+		const Instruction* op = nullptr;
+		if (!IsInstruction(items, i, op))
+		{
+			return unknown;
+		}
+
+		for (size_t j = 0; j < op->arity; j++)
+		{
+			if ((op->roles[j] == EOperandRole::Write || op->roles[j] == EOperandRole::ReadWrite) && items[i + 1 + j].type == ETokenType::Register)
+			{
+				result.registers |= RegisterBit(items[i + 1 + j].data);
+			}
+		}
+
+		const size_t next = i + 1 + op->arity;
+		switch (op->opcode)
+		{
+			case EOpCode::SYS:
+			{
+				// System calls take their argument in x and hand any result back there
+				result.registers |= RegisterBit("x");
+				pending.emplace_back(next, depth);
+			}
+			break;
+
+			case EOpCode::PSH:
+			{
+				pending.emplace_back(next, depth + 1);
+			}
+			break;
+
+			case EOpCode::POP:
+			{
+				result.balanced &= depth > 0;
+				pending.emplace_back(next, depth - 1);
+			}
+			break;
+
+			case EOpCode::RET:
+			{
+				result.balanced &= depth == 0;
+			}
+			break;
+
+			case EOpCode::EXT:
+			{
+			}
+			break;
+
+			case EOpCode::JSR:
+			{
+				const std::string callee = FindCallee(items, i);
+				if (callee.empty())
+				{
+					return unknown;
+				}
+
+				const Clobbers called = FindClobbers(items, callee);
+				result.registers |= called.registers;
+				result.balanced &= called.balanced;
+				pending.emplace_back(next, depth);
+			}
+			break;
+
+			default:
+			{
+				if (op->arity > 0 && op->roles[0] == EOperandRole::Target)
+				{
+					const int32_t target = items[i + 1].type == ETokenType::ImmediateLabelReference ? FindTarget(items, i + 1) : -1;
+					if (target < 0)
+					{
+						return unknown;
+					}
+
+					pending.emplace_back(static_cast<size_t>(target), depth);
+					if (op->opcode == EOpCode::JMP)
+					{
+						break;
+					}
+				}
+
+				pending.emplace_back(next, depth);
+			}
+			break;
+		}
+	}
+
+	clobbers[name] = result;
+	return result;
+}
+
+std::string Optimizer::FindCallee(const std::vector<LexItem>& items, const size_t index) const
+{
+	const Instruction* op = nullptr;
+	if (!IsInstruction(items, index, op) || op->opcode != EOpCode::JSR)
+	{
+		return std::string();
+	}
+
+	const LexItem& operand = items[index + 1];
+	if (operand.type != ETokenType::ImmediateLabelReference || OptimizerPrivate::IsAnonymous(operand.data) || labels.find(operand.data) == labels.end())
+	{
+		return std::string();
+	}
+
+	return operand.data;
+}
+
+int32_t Optimizer::RemoveSaves(std::vector<LexItem>& items)
+{
+	std::vector<bool> removed(items.size(), false);
+	int32_t rewrites = 0;
+
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const std::string callee = FindCallee(items, i);
+		const Clobbers called = callee.empty() ? Clobbers{ OptimizerPrivate::ALL_REGISTERS, false } : FindClobbers(items, callee);
+		if (!called.balanced)
+		{
+			continue;
+		}
+
+		// psh a, psh b, jsr f, pop b, pop a pairs up from the jsr outwards
+		size_t before = i;
+		size_t after = i + 2;
+		const Instruction* save = nullptr;
+		const Instruction* restore = nullptr;
+		while (before >= 2 && IsInstruction(items, before - 2, save) && save->opcode == EOpCode::PSH
+			&& IsInstruction(items, after, restore) && restore->opcode == EOpCode::POP
+			&& items[before - 1].type == ETokenType::Register && items[after + 1].type == ETokenType::Register
+			&& items[before - 1].data == items[after + 1].data)
+		{
+			if ((called.registers & OptimizerPrivate::RegisterBit(items[before - 1].data)) == 0)
+			{
+				removed[before - 2] = removed[before - 1] = removed[after] = removed[after + 1] = true;
+				rewrites++;
+			}
+
+			before -= 2;
+			after += 2;
+		}
+	}
+
+	if (rewrites > 0)
+	{
+		std::vector<LexItem> output;
+		output.reserve(items.size());
+		for (size_t i = 0; i < items.size(); i++)
+		{
+			if (!removed[i])
+			{
+				output.push_back(std::move(items[i]));
+			}
+		}
+		items = std::move(output);
+	}
+
+	return rewrites;
+}
+
+int32_t Optimizer::InlineLeaves(std::vector<LexItem>& items)
+{
+	using namespace OptimizerPrivate;
+
+	std::vector<LexItem> output;
+	output.reserve(items.size());
+
+	int32_t rewrites = 0;
+	size_t i = 0;
+	while (i < items.size())
+	{
+		const std::string callee = FindCallee(items, i);
+		if (callee.empty())
+		{
+			output.push_back(items[i++]);
+			continue;
+		}
+
+		// Straight line code up to the ret, with nothing that depends on where it sits
+		size_t body = labels.at(callee);
+		while (body < items.size() && items[body].kind == ELexItemKind::Label)
+		{
+			body++;
+		}
+
+		size_t end = body;
+		int32_t words = 0;
+		bool leaf = false;
+		const Instruction* op = nullptr;
+		while (words <= MAX_INLINE_WORDS && IsInstruction(items, end, op))
+		{
+			if (op->opcode == EOpCode::RET)
+			{
+				leaf = true;
+				break;
+			}
+
+			bool anonymous = false;
+			for (size_t j = end + 1; j <= end + op->arity; j++)
+			{
+				anonymous |= IsAnonymous(items[j].data);
+			}
+
+			if (anonymous || op->opcode == EOpCode::EXT || (op->arity > 0 && op->roles[0] == EOperandRole::Target))
+			{
+				break;
+			}
+
+			words += 1 + op->arity;
+			end += 1 + op->arity;
+		}
+
+		if (!leaf || words > MAX_INLINE_WORDS)
+		{
+			output.insert(output.end(), items.begin() + i, items.begin() + i + 2);
+			i += 2;
+			continue;
+		}
+
+		// The copy is attributed to the call, as a macro expansion is
+		for (size_t j = body; j < end; j++)
+		{
+			output.push_back(items[j]);
+			output.back().line = items[i].line;
+		}
+
+		i += 2;
+		rewrites++;
+	}
+
+	items = std::move(output);
+	return rewrites;
+}
+
+bool Optimizer::FallsThrough(const std::vector<LexItem>& items, const Section& section, size_t& last) const
+{
+	bool fallsThrough = true;
+	bool code = section.body != section.end;
+	last = items.size();
+
+	for (size_t i = section.body; i < section.end;)
+	{
+		const Instruction* op = nullptr;
+		if (IsInstruction(items, i, op))
+		{
+			fallsThrough = !OptimizerPrivate::IsTerminal(op->opcode);
+			last = i;
+			i += 1 + op->arity;
+			continue;
+		}
+
+		// As in StripUnreachable, execution doesn't run on into data and a .org doesn't change that
+		if (items[i].kind != ELexItemKind::Org)
+		{
+			fallsThrough = false;
+		}
+		code = false;
+		i++;
+	}
+
+	if (!code)
+	{
+		last = items.size();
+	}
+
+	return fallsThrough;
+}
+
+std::string Optimizer::FindName(const std::vector<LexItem>& items, const Section& section) const
+{
+	for (size_t i = section.begin; i < section.body; i++)
+	{
+		const auto label = items[i].type == ETokenType::Label ? labels.find(items[i].data) : labels.end();
+		if (label != labels.end() && label->second == i)
+		{
+			return items[i].data;
+		}
+	}
+
+	return std::string();
+}
+
+bool Optimizer::BuildBlocks(const std::vector<LexItem>& items, const std::vector<Section>& sections, const std::vector<size_t>& owners, const size_t end, std::vector<Block>& blocks) const
+{
+	using namespace OptimizerPrivate;
+
+	// glued[k] keeps section k right after section k - 1
+	std::vector<bool> glued(sections.size(), false);
+	std::vector<bool> code(sections.size(), false);
+	std::vector<bool> falls(sections.size(), false);
+	for (size_t k = 0; k < sections.size(); k++)
+	{
+		size_t last = 0;
+		falls[k] = FallsThrough(items, sections[k], last);
+		code[k] = last < items.size();
+
+		// A jmp can take the place of falling through, but only from code and to a name
+		if (k > 0 && sections[k].begin < end && falls[k - 1] && (!code[k - 1] || FindName(items, sections[k]).empty()))
+		{
+			glued[k] = true;
+		}
+	}
+
+	// + and - go to the nearest label in their direction, so nothing can come in between
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		if (items[i].kind != ELexItemKind::Token || items[i].type != ETokenType::ImmediateLabelReference || !IsAnonymous(items[i].data))
+		{
+			continue;
+		}
+
+		const int32_t target = FindTarget(items, i);
+		if (target < 0)
+		{
+			return false;
+		}
+
+		const size_t from = std::min(owners[i], owners[target]);
+		const size_t to = std::max(owners[i], owners[target]);
+		for (size_t k = from + 1; k <= to; k++)
+		{
+			glued[k] = true;
+		}
+	}
+
+	blocks.clear();
+	for (size_t k = 0; k < sections.size(); k++)
+	{
+		if (k == 0 || !glued[k])
+		{
+			blocks.push_back(Block{ k, k, true });
+		}
+
+		blocks.back().last = k;
+		blocks.back().movable = blocks.back().movable && code[k];
+	}
+
+	// Nothing can be put after code that runs off the end
+	for (Block& block : blocks)
+	{
+		if (sections[block.last].end == end && falls[block.last])
+		{
+			block.movable = false;
+		}
+	}
+
+	return true;
+}
+
+size_t Optimizer::FindColdBranch(const std::vector<LexItem>& items, const Section& section, const std::vector<uint64_t>& runs, const std::vector<uint64_t>& jumps) const
+{
+	using namespace OptimizerPrivate;
+
+	std::vector<size_t> ops;
+	for (size_t i = section.body; i < section.end;)
+	{
+		const Instruction* op = nullptr;
+		if (!IsInstruction(items, i, op))
+		{
+			return items.size();
+		}
+
+		ops.push_back(i);
+		i += 1 + op->arity;
+	}
+
+	// The code has to end the section without falling out of it, and must not use + or -
+	// since it is going somewhere else. The branch has to go over it to the next section.
+	const Instruction* op = nullptr;
+	if (ops.empty() || section.end >= items.size() || !IsInstruction(items, ops.back(), op) || !IsTerminal(op->opcode))
+	{
+		return items.size();
+	}
+
+	for (size_t k = ops.size() - 1; k > 0; k--)
+	{
+		IsInstruction(items, ops[k], op);
+		for (size_t j = ops[k] + 1; j <= ops[k] + op->arity; j++)
+		{
+			if (items[j].type == ETokenType::ImmediateLabelReference && IsAnonymous(items[j].data))
+			{
+				return items.size();
+			}
+		}
+
+		const size_t branch = ops[k - 1];
+		IsInstruction(items, branch, op);
+		if (IsConditional(op->opcode))
+		{
+			// Worth moving when the branch usually goes over it
+			const bool cold = runs[branch] > 0 && jumps[branch] > runs[branch] / 2;
+			return cold && LabelsInclude(items, section.end, branch + 1) ? branch : items.size();
+		}
+	}
+
+	return items.size();
+}
+
+int32_t Optimizer::ArrangeByProfile(std::vector<LexItem>& items, const Profile& profile)
+{
+	using namespace OptimizerPrivate;
+
+	// Counts belong to each op, at the address Layout would give it
+	std::vector<uint64_t> runs(items.size(), 0);
+	std::vector<uint64_t> jumps(items.size(), 0);
+	uint32_t address = 0;
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		switch (items[i].kind)
+		{
+			case ELexItemKind::Token:
+			{
+				runs[i] = profile.GetExecutions(address);
+				jumps[i] = profile.GetTaken(address);
+				address++;
+			}
+			break;
+
+			case ELexItemKind::Org:
+			{
+				address = items[i].value;
+			}
+			break;
+
+			case ELexItemKind::Reserve:
+			{
+				address += items[i].value;
+			}
+			break;
+
+			default:
+			{
+			}
+			break;
+		}
+	}
+
+	std::vector<size_t> owners;
+	std::vector<Section> sections = BuildSections(items, owners);
+	std::vector<Block> blocks;
+	if (!BuildBlocks(items, sections, owners, items.size(), blocks))
+	{
+		return 0;
+	}
+
+	// Cold code is put after everything else for now, and the branch over it inverted to go there
+	std::vector<LexItem> output;
+	std::vector<uint64_t> outputRuns;
+	std::vector<uint64_t> outputJumps;
+	std::vector<LexItem> cold;
+	std::vector<uint64_t> coldRuns;
+	std::vector<uint64_t> coldJumps;
+	std::vector<size_t> origins;
+	size_t serial = 0;
+
+	for (const Block& block : blocks)
+	{
+		for (size_t index = block.first; index <= block.last; index++)
+		{
+			const Section& section = sections[index];
+			const size_t branch = block.movable ? FindColdBranch(items, section, runs, jumps) : items.size();
+			const size_t stop = std::min(branch, section.end);
+			output.insert(output.end(), items.begin() + section.begin, items.begin() + stop);
+			outputRuns.insert(outputRuns.end(), runs.begin() + section.begin, runs.begin() + stop);
+			outputJumps.insert(outputJumps.end(), jumps.begin() + section.begin, jumps.begin() + stop);
+			if (branch == items.size())
+			{
+				continue;
+			}
+
+			std::string name;
+			do
+			{
+				name = "__cold" + std::to_string(serial++);
+			}
+			while (labels.count(name) != 0);
+
+			const Instruction* op = nullptr;
+			IsInstruction(items, branch, op);
+
+			origins.push_back(output.size());
+			output.push_back(MakeOp(Invert(op->opcode), items[branch].line));
+			output.push_back(LexItem(ELexItemKind::Token, ETokenType::ImmediateLabelReference, name, 0, items[branch + 1].line));
+			output.insert(output.end(), items.begin() + branch + 2, items.begin() + branch + 1 + op->arity);
+			outputRuns.push_back(runs[branch]);
+			outputJumps.push_back(runs[branch] - std::min(runs[branch], jumps[branch]));
+			outputRuns.resize(output.size(), 0);
+			outputJumps.resize(output.size(), 0);
+
+			const size_t body = branch + 1 + op->arity;
+			cold.push_back(LexItem(ELexItemKind::Label, ETokenType::Label, name, 0, items[body].line));
+			cold.insert(cold.end(), items.begin() + body, items.begin() + section.end);
+			coldRuns.push_back(0);
+			coldRuns.insert(coldRuns.end(), runs.begin() + body, runs.begin() + section.end);
+			coldJumps.push_back(0);
+			coldJumps.insert(coldJumps.end(), jumps.begin() + body, jumps.begin() + section.end);
+		}
+	}
+
+	const size_t end = output.size();
+	if (!origins.empty())
+	{
+		output.insert(output.end(), cold.begin(), cold.end());
+		outputRuns.insert(outputRuns.end(), coldRuns.begin(), coldRuns.end());
+		outputJumps.insert(outputJumps.end(), coldJumps.begin(), coldJumps.end());
+		items = std::move(output);
+		runs = std::move(outputRuns);
+		jumps = std::move(outputJumps);
+
+		// Only + and - that were going over the cold code are gone, so the rest still resolve
+		IndexLabels(items);
+		sections = BuildSections(items, owners);
+		BuildBlocks(items, sections, owners, end, blocks);
+	}
+
+	std::vector<size_t> sectionBlocks(sections.size(), 0);
+	for (size_t b = 0; b < blocks.size(); b++)
+	{
+		for (size_t k = blocks[b].first; k <= blocks[b].last; k++)
+		{
+			sectionBlocks[k] = b;
+		}
+	}
+
+	// Each run of blocks that can move is arranged by itself, and named by its first block.
+	// Cold code joins the run it came from.
+	std::vector<size_t> entries(blocks.size(), NONE);
+	size_t outlined = 0;
+	for (size_t b = 0; b < blocks.size(); b++)
+	{
+		if (!blocks[b].movable)
+		{
+			continue;
+		}
+
+		if (sections[blocks[b].first].begin >= end)
+		{
+			entries[b] = entries[sectionBlocks[owners[origins[outlined++]]]];
+		}
+		else
+		{
+			entries[b] = b > 0 && entries[b - 1] != NONE ? entries[b - 1] : b;
+		}
+	}
+
+	// How often each block went straight on to another
+	struct Edge
+	{
+		size_t from;
+		size_t to;
+		uint64_t weight;
+	};
+
+	std::vector<Edge> edges;
+	std::vector<size_t> lasts(blocks.size(), items.size());
+	std::vector<bool> falls(blocks.size(), false);
+	for (size_t b = 0; b < blocks.size(); b++)
+	{
+		size_t last = items.size();
+		falls[b] = FallsThrough(items, sections[blocks[b].last], last);
+		lasts[b] = last;
+		if (entries[b] == NONE)
+		{
+			continue;
+		}
+
+		const Instruction* op = nullptr;
+		IsInstruction(items, last, op);
+		const bool conditional = IsConditional(op->opcode);
+		if (falls[b] && b + 1 < blocks.size() && entries[b + 1] == entries[b])
+		{
+			const uint64_t stayed = runs[last] - std::min(runs[last], conditional ? jumps[last] : 0);
+			edges.push_back(Edge{ b, b + 1, stayed });
+		}
+
+		if ((op->opcode == EOpCode::JMP || conditional) && items[last + 1].type == ETokenType::ImmediateLabelReference)
+		{
+			const int32_t target = FindTarget(items, last + 1);
+			const size_t to = target >= 0 ? sectionBlocks[owners[target]] : NONE;
+			if (to != NONE && to != b && entries[to] == entries[b] && owners[target] == blocks[to].first && static_cast<size_t>(target) < sections[blocks[to].first].body)
+			{
+				edges.push_back(Edge{ b, to, conditional ? jumps[last] : runs[last] });
+			}
+		}
+	}
+
+	// Heaviest first, chain each block to the one it goes to most, while both ends are free
+	std::stable_sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) { return a.weight > b.weight; });
+
+	std::vector<size_t> next(blocks.size(), NONE);
+	std::vector<size_t> previous(blocks.size(), NONE);
+	auto head = [&previous](size_t block)
+	{
+		while (previous[block] != NONE)
+		{
+			block = previous[block];
+		}
+		return block;
+	};
+
+	for (const Edge& edge : edges)
+	{
+		// The first block of a run stays first, and a chain can't close into a loop
+		if (edge.weight == 0 || next[edge.from] != NONE || previous[edge.to] != NONE || entries[edge.to] == edge.to || head(edge.from) == edge.to)
+		{
+			continue;
+		}
+
+		next[edge.from] = edge.to;
+		previous[edge.to] = edge.from;
+	}
+
+	// A run starts with its first block's chain and the rest follow hottest first, except
+	// that the one running on into what comes after the run stays last
+	std::vector<size_t> order;
+	for (size_t b = 0; b < blocks.size(); b++)
+	{
+		if (entries[b] == NONE)
+		{
+			order.push_back(b);
+			continue;
+		}
+
+		if (entries[b] != b)
+		{
+			continue;
+		}
+
+		size_t tail = b;
+		while (tail + 1 < blocks.size() && entries[tail + 1] == b && sections[blocks[tail + 1].first].begin < end)
+		{
+			tail++;
+		}
+		const size_t anchor = falls[tail] ? head(tail) : NONE;
+
+		std::vector<size_t> heads;
+		for (size_t c = b; c < blocks.size(); c++)
+		{
+			if (entries[c] == b && previous[c] == NONE)
+			{
+				heads.push_back(c);
+			}
+		}
+
+		auto rank = [b, anchor](const size_t chain)
+		{
+			return chain == b ? 0 : (chain == anchor ? 2 : 1);
+		};
+		std::stable_sort(heads.begin(), heads.end(), [&](const size_t x, const size_t y)
+		{
+			if (rank(x) != rank(y))
+			{
+				return rank(x) < rank(y);
+			}
+			return runs[sections[blocks[x].first].body] > runs[sections[blocks[y].first].body];
+		});
+
+		for (const size_t chain : heads)
+		{
+			for (size_t c = chain; c != NONE; c = next[c])
+			{
+				order.push_back(c);
+			}
+		}
+	}
+
+	std::vector<LexItem> arranged;
+	arranged.reserve(items.size());
+
+	int32_t moved = 0;
+	for (size_t k = 0; k < order.size(); k++)
+	{
+		const size_t b = order[k];
+		const size_t placed = k + 1 < order.size() ? order[k + 1] : NONE;
+		if (k > 0 && order[k - 1] + 1 != b)
+		{
+			moved++;
+		}
+
+		const size_t begin = sections[blocks[b].first].begin;
+		const size_t offset = arranged.size();
+		arranged.insert(arranged.end(), items.begin() + begin, items.begin() + sections[blocks[b].last].end);
+		if (entries[b] == NONE || !falls[b] || placed == b + 1)
+		{
+			continue;
+		}
+
+		// It used to fall into the block after it, which has a name or they'd be glued
+		const std::string name = FindName(items, sections[blocks[b + 1].first]);
+		const size_t last = lasts[b];
+		const Instruction* op = nullptr;
+		IsInstruction(items, last, op);
+		if (IsConditional(op->opcode) && placed != NONE && LabelsInclude(items, sections[blocks[placed].first].begin, last + 1))
+		{
+			const size_t branch = offset + last - begin;
+			arranged[branch] = MakeOp(Invert(op->opcode), items[last].line);
+			arranged[branch + 1].data = name;
+		}
+		else
+		{
+			arranged.push_back(MakeOp(EOpCode::JMP, items[last].line));
+			arranged.push_back(LexItem(ELexItemKind::Token, ETokenType::ImmediateLabelReference, name, 0, items[last].line));
+		}
+	}
+
+	if (moved == 0 && origins.empty())
+	{
+		return 0;
+	}
+
+	items = std::move(arranged);
+	return moved + static_cast<int32_t>(origins.size());
+}
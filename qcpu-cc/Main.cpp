@@ -0,0 +1,56 @@
+//
+//	qcpu-cc - qcpu C compiler
+//
+
+#include "Assembler.h"
+#include "CodeGenerator.h"
+#include "IRBuilder.h"
+#include "Parser.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+int main(const int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		std::cout << "Usage: qcpu-cc <program.c> <output>" << std::endl;
+		std::cout << "An output ending in .asm is written as assembly, anything else is assembled with -Os" << std::endl;
+		return 1;
+	}
+
+	const std::string input = argv[1];
+	const std::string output = argv[2];
+
+	std::ifstream file(input);
+	if (!file.is_open())
+	{
+		std::cout << "Could not read " << input << std::endl;
+		return 1;
+	}
+
+	std::stringstream text;
+	text << file.rdbuf();
+
+	const Program program = Parser(text.str()).Parse();
+	const IRProgram ir = IRBuilder().Build(program);
+	const std::string assembly = CodeGenerator().Generate(ir, std::filesystem::path(input).filename().string());
+
+	if (output.size() > 4 && output.substr(output.size() - 4) == ".asm")
+	{
+		std::ofstream(output) << assembly;
+	}
+	else
+	{
+		// The code is written plainly, the peephole optimizer tidies up after it
+		Assembler assembler;
+		assembler.LoadText(assembly);
+		assembler.SetOptimize(true, true);
+		assembler.AssembleAndSave(output);
+	}
+
+	return 0;
+}
@@ -0,0 +1,67 @@
+//
+//	CodeGenerator
+//
+
+#pragma once
+
+#include "IR.h"
+#include "RegisterAllocator.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Writes an IRProgram out as qasm, for the assembler to turn into a binary.
+//
+// The first two arguments and the result of a function are passed in x and y, the rest in
+// words of memory set aside for the function. A function saves the registers from a to d
+// that it uses and nothing else. There is no way to address the stack, so locals that
+// live in memory have one fixed frame per function, which is pushed around a call that
+// could come back into the same function.
+class CodeGenerator
+{
+public:
+	CodeGenerator();
+
+	std::string Generate(const IRProgram& program, const std::string& name);
+
+private:
+	// Moves that happen all at once, each is a destination and a source
+	typedef std::vector<std::pair<std::string, std::string>> Moves;
+
+private:
+	void GenerateFunction(const size_t index);
+	void GenerateEntry(const IRInstruction& instruction);
+	void GenerateCompute(const IRInstruction& instruction);
+	void GenerateBranch(const IRInstruction& instruction);
+	void GenerateCall(const IRInstruction& instruction, const size_t at);
+	void GenerateSys(const IRInstruction& instruction);
+	void GenerateReturn(const IRInstruction& instruction, const size_t at);
+	void GenerateData(const IRProgram& program);
+
+	void ParallelMove(Moves moves);
+	// An operand as qasm, a spilled address is loaded into a free register around the instruction
+	std::string Text(const Operand& operand, std::vector<std::string>& before, std::vector<std::string>& after, uint8_t& taken);
+	std::string Text(const Operand& operand) const;
+	std::string SlotLabel(const int32_t slot) const;
+	uint8_t Registers(const Operand& operand) const;
+
+	void Line(const std::string& text);
+	void Label(const std::string& label);
+
+private:
+	std::string output;
+	const IRProgram* program;
+
+	// reaches[f][g] is true if calling f can end up calling g
+	std::vector<std::vector<bool>> reaches;
+	int32_t scratch;
+	std::vector<int32_t> slotCounts;
+
+	// Set up for the function being generated
+	size_t current;
+	const IRFunction* function;
+	Allocation allocation;
+	std::vector<int32_t> saved;
+};
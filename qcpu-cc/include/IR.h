@@ -0,0 +1,155 @@
+//
+//	IR
+//
+
+#pragma once
+
+#include "OpCode.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Names from the source are given a prefix, so that they can't be taken for registers or
+// mnemonics, or clash with the labels the compiler makes up
+inline std::string UserLabel(const std::string& name)
+{
+	return "u_" + name;
+}
+
+// Where the arguments after the first two are put for a function, x and y hold those two
+inline std::string ParameterLabel(const std::string& function, const int32_t index)
+{
+	return "p_" + function + "_" + std::to_string(index);
+}
+
+// The subroutine that divides x by y, leaving the quotient in x
+static const char* const DIVIDE_LABEL = "k_div";
+
+enum class EOperandKind : uint8_t
+{
+	None,
+	Register,		// a virtual register, given a CPU register or a memory slot by the allocator
+	Immediate,
+	Address,		// label+value, as an immediate
+	Memory,			// the word at label+value, or at value when there is no label
+	Indirect		// the word at the address held in a virtual register
+};
+
+struct Operand
+{
+	Operand()
+		: kind(EOperandKind::None)
+		, index(-1)
+		, value(0)
+		, label()
+	{
+	}
+
+	Operand(const EOperandKind kind, const int32_t index, const uint16_t value, std::string label)
+		: kind(kind)
+		, index(index)
+		, value(value)
+		, label(std::move(label))
+	{
+	}
+
+	static Operand Register(const int32_t index) { return Operand(EOperandKind::Register, index, 0, std::string()); }
+	static Operand Immediate(const uint16_t value) { return Operand(EOperandKind::Immediate, -1, value, std::string()); }
+	static Operand Address(const std::string& label, const uint16_t offset = 0) { return Operand(EOperandKind::Address, -1, offset, label); }
+	static Operand Memory(const std::string& label, const uint16_t offset = 0) { return Operand(EOperandKind::Memory, -1, offset, label); }
+	static Operand Indirect(const int32_t index) { return Operand(EOperandKind::Indirect, index, 0, std::string()); }
+
+	// The virtual register this reads to find its value or its address, or -1
+	int32_t GetRegister() const { return kind == EOperandKind::Register || kind == EOperandKind::Indirect ? index : -1; }
+
+	EOperandKind kind;
+	int32_t index;
+	uint16_t value;
+	std::string label;
+};
+
+enum class EIROp : uint8_t
+{
+	Entry,			// defines the parameters in arguments
+	Compute,		// opcode is MOV or one of the ALU ops, a is written and b is read
+	Jump,
+	Branch,			// opcode is one of the conditional jumps, comparing a with b
+	Label,
+	Call,			// a is the result, or None if it isn't used
+	Sys,			// value is the system call, arguments holds x if there is one, a is the result
+	Return			// a is the result, or None
+};
+
+// Close to the CPU's own instructions, so that every operand can be any of the addressing
+// modes and most of them become one instruction. Only the virtual registers are left to
+// be allocated.
+struct IRInstruction
+{
+	IRInstruction(const EIROp op, const EOpCode opcode, Operand a, Operand b, std::string label)
+		: op(op)
+		, opcode(opcode)
+		, a(std::move(a))
+		, b(std::move(b))
+		, label(std::move(label))
+		, value(0)
+		, arguments()
+	{
+	}
+
+	EIROp op;
+	EOpCode opcode;
+	Operand a;
+	Operand b;
+	std::string label;		// Jump and branch targets, labels and the subroutine a call goes to
+	uint16_t value;
+	std::vector<Operand> arguments;
+};
+
+// Words of data under a label, reserve more zeroed words follow them
+struct IRData
+{
+	std::string label;
+	std::vector<std::string> words;
+	int32_t reserve;
+};
+
+struct IRFunction
+{
+	IRFunction()
+		: name()
+		, label()
+		, code()
+		, registers(0)
+		, parameters(0)
+		, memory()
+		, callees()
+		, isMain(false)
+	{
+	}
+
+	std::string name;
+	std::string label;
+	std::vector<IRInstruction> code;
+	int32_t registers;
+	int32_t parameters;
+
+	// Locals that live in memory rather than in a register, arrays and those whose address is taken
+	std::vector<IRData> memory;
+	std::vector<std::string> callees;
+	bool isMain;
+};
+
+struct IRProgram
+{
+	IRProgram()
+		: functions()
+		, data()
+		, usesDivide(false)
+	{
+	}
+
+	std::vector<IRFunction> functions;
+	std::vector<IRData> data;
+	bool usesDivide;
+};
@@ -0,0 +1,112 @@
+//
+//	IRBuilder
+//
+
+#pragma once
+
+#include "IR.h"
+#include "Syntax.h"
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Turns a parsed Program into IR, one function at a time. Locals live in virtual registers
+// unless they are arrays or have their address taken, then they get words in memory of
+// their own. Globals are used where they are, as the CPU can operate on memory directly.
+//
+// Expressions are built into the register they are assigned to wherever that is safe, and
+// conditions become compare and branch instructions rather than values. Constants are
+// folded, and loops test their condition at the bottom so each pass takes one branch.
+class IRBuilder
+{
+public:
+	IRBuilder();
+
+	IRProgram Build(const Program& program);
+
+private:
+	enum class EVariableKind : uint8_t
+	{
+		Register,
+		Memory,			// a word at label
+		Array			// words starting at label, the name is their address
+	};
+
+	struct Variable
+	{
+		EVariableKind kind;
+		int32_t index;
+		std::string label;
+		Type type;
+	};
+
+	struct Signature
+	{
+		size_t parameters;
+		bool isVoid;
+		bool defined;
+	};
+
+	// Where break and continue go
+	struct Loop
+	{
+		std::string breakLabel;
+		std::string continueLabel;
+	};
+
+private:
+	void BuildGlobal(const Global& global);
+	void BuildFunction(const Function& function);
+	// A global's initial value as it is written in the data
+	std::string ConstantWord(const Expr& expr);
+
+	void BuildStatement(const Stmt& statement);
+	void BuildDeclaration(const Stmt& statement);
+
+	// Jumps to label if expr is true, or if it is false when when is false
+	void BuildBranch(const Expr& expr, const std::string& label, const bool when);
+	// Only for what expr does, its value isn't needed
+	void BuildEffect(const Expr& expr);
+	// Builds the value of expr into a virtual register that it doesn't use
+	void BuildInto(const int32_t target, const Expr& expr);
+	// Any kind of operand holding the value of expr, which may be in memory
+	Operand BuildValue(const Expr& expr);
+	// The value of expr, in a register or memory but not through one
+	Operand BuildPlain(const Expr& expr);
+	// The operand expr names, to be assigned to
+	Operand BuildPlace(const Expr& expr);
+	Operand BuildAddress(const Expr& expr);
+	Operand BuildAssign(const Expr& expr);
+	void BuildCall(const Expr& expr, const Operand& result);
+	void BuildBinary(const Operand& target, const Expr& expr);
+	// The word an address points to
+	Operand Dereference(const Operand& address);
+
+	bool Fold(const Expr& expr, uint16_t& value) const;
+	bool References(const Expr& expr, const std::string& name) const;
+	void CollectAddressTaken(const Stmt& statement);
+	void CollectAddressTaken(const Expr& expr);
+	const Variable& FindVariable(const std::string& name, const int32_t line) const;
+	std::string StringLabel(const std::string& text);
+
+	int32_t NewRegister();
+	std::string NewLabel();
+	void Emit(const EIROp op, const EOpCode opcode, const Operand& a = Operand(), const Operand& b = Operand(), const std::string& label = std::string());
+
+private:
+	IRProgram result;
+	std::unordered_map<std::string, Signature> signatures;
+	std::unordered_map<std::string, Variable> globals;
+	std::unordered_map<std::string, std::string> strings;
+
+	// Set up for the function being built
+	IRFunction* function;
+	const Function* source;
+	std::vector<std::unordered_map<std::string, Variable>> scopes;
+	std::vector<Loop> loops;
+	std::set<std::string> addressTaken;
+	int32_t labels;
+};
@@ -0,0 +1,82 @@
+//
+//	Parser
+//
+
+#pragma once
+
+#include "Syntax.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Reads the C subset qcpu-cc compiles into a Program. Errors stop compilation with the
+// line they were found on, the same way the assembler reports them.
+//
+// Supported are int, char, void and unsigned, pointers, one dimensional arrays, functions
+// and globals, the usual statements (if, while, do, for, break, continue, return) and
+// every C operator apart from sizeof, the comma operator and member access. Casts are
+// accepted and ignored, since every type is a word.
+class Parser
+{
+public:
+	explicit Parser(const std::string_view text);
+
+	Program Parse();
+
+private:
+	enum class ETokenKind : uint8_t
+	{
+		Identifier,
+		Keyword,
+		Number,
+		String,
+		Symbol,
+		End
+	};
+
+	struct Token
+	{
+		ETokenKind kind;
+		std::string text;		// Strings have their escapes already applied
+		uint16_t value;
+		int32_t line;
+	};
+
+private:
+	void Tokenize(const std::string_view text);
+
+	const Token& Peek(const size_t ahead = 0) const;
+	const Token& Next();
+	bool Accept(const char* symbol);
+	void Expect(const char* symbol);
+	std::string ExpectIdentifier();
+	bool IsTypeName(const size_t ahead = 0) const;
+
+	void ParseTopLevel(Program& program);
+	// The base type, int, void and the like, without the * that belong to each name
+	Type ParseType();
+	void ParseArraySuffix(Type& type, const bool parameter);
+	// Gives an array declared with [] the length of its values, and checks they fit
+	void SizeArray(Type& type, const std::vector<std::unique_ptr<Expr>>& values, const int32_t line) const;
+
+	std::unique_ptr<Stmt> ParseStatement();
+	std::unique_ptr<Stmt> ParseBlock();
+	// One Declare for each name in the declaration
+	void ParseDeclaration(std::vector<std::unique_ptr<Stmt>>& statements);
+	void ParseInitialiser(std::vector<std::unique_ptr<Expr>>& values);
+
+	std::unique_ptr<Expr> ParseExpression();
+	std::unique_ptr<Expr> ParseAssignment();
+	std::unique_ptr<Expr> ParseConditional();
+	std::unique_ptr<Expr> ParseBinary(const int32_t precedence);
+	std::unique_ptr<Expr> ParseUnary();
+	std::unique_ptr<Expr> ParsePostfix();
+	std::unique_ptr<Expr> ParsePrimary();
+
+private:
+	std::vector<Token> tokens;
+	size_t position;
+};
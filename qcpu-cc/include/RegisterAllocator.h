@@ -0,0 +1,84 @@
+//
+//	RegisterAllocator
+//
+
+#pragma once
+
+#include "IR.h"
+
+#include <cstdint>
+#include <vector>
+
+// Where each virtual register of a function ended up, a CPU register or a word of memory
+struct Allocation
+{
+	static const int32_t REGISTER_COUNT = 6;
+	static const int32_t X = 4;
+	static const int32_t Y = 5;
+
+	Allocation()
+		: registers()
+		, slots()
+		, slotCount(0)
+		, liveOut()
+		, used(0)
+	{
+	}
+
+	bool IsLiveOut(const size_t instruction, const int32_t index) const
+	{
+		return (liveOut[instruction][index / 64] >> (index % 64)) & 1;
+	}
+
+	// Register a to y as 0 to 5, or -1 if the value is in its slot instead
+	std::vector<int32_t> registers;
+	std::vector<int32_t> slots;
+	int32_t slotCount;
+
+	// What is still needed after each instruction, as a bit set of virtual registers
+	std::vector<std::vector<uint64_t>> liveOut;
+
+	// Bit n is set if register n holds anything
+	uint8_t used;
+};
+
+// Linear scan allocation, in the order values are first set, over which values are needed
+// at the same time as which others, found by liveness analysis. Calls and system
+// calls are free to change x and y, so anything that is still needed after one goes in a
+// to d, which a function saves itself if it uses them. Everything else tries x and y first,
+// so a leaf function that needs few registers saves nothing. A value that is moved, passed
+// or returned is given the same register as the other side of the move where it can be,
+// and when there aren't enough registers the one that is needed furthest away is put in
+// memory, where the CPU can use it as an operand all the same.
+class RegisterAllocator
+{
+public:
+	Allocation Allocate(const IRFunction& function);
+
+private:
+	// A register the value would like, or -1
+	struct Hint
+	{
+		int32_t fixed;
+		int32_t follows;	// another virtual register to share with
+	};
+
+private:
+	void FindLiveness(const IRFunction& function);
+	void FindHints(const IRFunction& function);
+	// Marks the values that can't share a register because both are needed at once here
+	void FindInterference(const IRInstruction& instruction, const std::vector<int32_t>& defines, const std::vector<uint64_t>& out);
+
+	static void Uses(const IRInstruction& instruction, std::vector<int32_t>& uses);
+	static void Defines(const IRInstruction& instruction, std::vector<int32_t>& defines);
+
+	bool IsLive(const std::vector<uint64_t>& set, const int32_t index) const { return (set[index / 64] >> (index % 64)) & 1; }
+
+private:
+	int32_t count;
+	size_t words;
+	std::vector<std::vector<uint64_t>> liveIn;
+	std::vector<std::vector<uint64_t>> liveOut;
+	std::vector<Hint> hints;
+	std::vector<std::vector<bool>> interferes;
+};
@@ -0,0 +1,156 @@
+//
+//	Syntax
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Every value is one 16 bit word, so a type only says what can be done with it. int is
+// unsigned, as the CPU only compares and divides unsigned values, and char is the same
+// as int since memory holds a word per character. Arrays are one dimensional.
+struct Type
+{
+	Type()
+		: isVoid(false)
+		, pointers(0)
+		, length(-1)
+	{
+	}
+
+	bool IsArray() const { return length >= 0; }
+	bool IsPointer() const { return pointers > 0 || IsArray(); }
+
+	bool isVoid;
+	int32_t pointers;
+	int32_t length;		// Words in an array, -1 for anything else
+};
+
+enum class EExprKind : uint8_t
+{
+	Number,
+	String,
+	Name,
+	Unary,			// op is one of - ~ ! * &
+	Binary,
+	Assign,			// op is = or a compound assignment such as +=
+	Increment,		// op is ++ or --, prefix says which side it is on
+	Index,
+	Call,
+	Conditional		// operands are the condition and the two values
+};
+
+struct Expr
+{
+	Expr(const EExprKind kind, const int32_t line)
+		: kind(kind)
+		, op()
+		, name()
+		, value(0)
+		, prefix(false)
+		, line(line)
+		, operands()
+	{
+	}
+
+	EExprKind kind;
+	std::string op;
+	std::string name;		// Names and calls, and the text of a string
+	uint16_t value;
+	bool prefix;
+	int32_t line;
+	std::vector<std::unique_ptr<Expr>> operands;
+};
+
+enum class EStmtKind : uint8_t
+{
+	Block,
+	Declare,
+	If,
+	While,
+	DoWhile,
+	For,
+	Break,
+	Continue,
+	Return,
+	Expression,
+	Empty
+};
+
+// Children are used as each kind needs them: If has the condition in expr and the branches
+// in body, For has init, expr, step and body[0], and Declare has the initialisers in values.
+struct Stmt
+{
+	Stmt(const EStmtKind kind, const int32_t line)
+		: kind(kind)
+		, line(line)
+		, name()
+		, type()
+		, expr()
+		, step()
+		, init()
+		, values()
+		, body()
+	{
+	}
+
+	EStmtKind kind;
+	int32_t line;
+	std::string name;
+	Type type;
+	std::unique_ptr<Expr> expr;
+	std::unique_ptr<Expr> step;
+	std::unique_ptr<Stmt> init;
+	std::vector<std::unique_ptr<Expr>> values;
+	std::vector<std::unique_ptr<Stmt>> body;
+};
+
+struct Parameter
+{
+	std::string name;
+	Type type;
+};
+
+struct Function
+{
+	Function()
+		: name()
+		, result()
+		, parameters()
+		, body()
+		, line(0)
+	{
+	}
+
+	std::string name;
+	Type result;
+	std::vector<Parameter> parameters;
+	std::unique_ptr<Stmt> body;		// null for a declaration without a body
+	int32_t line;
+};
+
+// A global and its initial contents, which have to be constants or strings
+struct Global
+{
+	Global()
+		: name()
+		, type()
+		, values()
+		, line(0)
+	{
+	}
+
+	std::string name;
+	Type type;
+	std::vector<std::unique_ptr<Expr>> values;
+	int32_t line;
+};
+
+struct Program
+{
+	std::vector<Function> functions;
+	std::vector<Global> globals;
+};
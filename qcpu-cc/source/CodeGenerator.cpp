@@ -0,0 +1,557 @@
+//
+//	CodeGenerator
+//
+
+#include "CodeGenerator.h"
+
+#include "ISA.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace CodeGeneratorPrivate
+{
+	static const char* const REGISTER_NAMES = "abcdxy";
+
+	// x = x / y, a restoring division one bit at a time with the remainder in a
+	static const char* const DIVIDE =
+		"k_div:\n"
+		"\tpsh a\n"
+		"\tpsh b\n"
+		"\tmov a 0\n"
+		"\tmov b 16\n"
+		"k_div_loop:\n"
+		"\tlsl a 1\n"
+		"\tjlt k_div_low x 0x8000\n"
+		"\torr a 1\n"
+		"k_div_low:\n"
+		"\tlsl x 1\n"
+		"\tjlt k_div_next a y\n"
+		"\tsub a y\n"
+		"\torr x 1\n"
+		"k_div_next:\n"
+		"\tsub b 1\n"
+		"\tjne k_div_loop b 0\n"
+		"\tpop b\n"
+		"\tpop a\n"
+		"\tret\n";
+
+	std::string Offset(const std::string& label, const uint16_t offset)
+	{
+		return offset != 0 ? label + "+" + std::to_string(offset) : label;
+	}
+
+	std::string Mnemonic(const EOpCode opcode)
+	{
+		return FindInstruction(static_cast<uint16_t>(opcode))->mnemonic;
+	}
+}
+
+CodeGenerator::CodeGenerator()
+	: output()
+	, program(nullptr)
+	, reaches()
+	, scratch(0)
+	, slotCounts()
+	, current(0)
+	, function(nullptr)
+	, allocation()
+	, saved()
+{
+}
+
+std::string CodeGenerator::Generate(const IRProgram& inProgram, const std::string& name)
+{
+	using namespace CodeGeneratorPrivate;
+
+	program = &inProgram;
+	output = "; Generated by qcpu-cc from " + name + "\n\n";
+	scratch = 0;
+	slotCounts.clear();
+
+	// Which functions each one can end up calling, to know which calls can recurse
+	const size_t count = program->functions.size();
+	std::unordered_map<std::string, size_t> indices;
+	for (size_t f = 0; f < count; f++)
+	{
+		indices[program->functions[f].name] = f;
+	}
+
+	reaches.assign(count, std::vector<bool>(count, false));
+	for (size_t f = 0; f < count; f++)
+	{
+		std::vector<size_t> open = { f };
+		while (!open.empty())
+		{
+			const size_t g = open.back();
+			open.pop_back();
+			for (const std::string& callee : program->functions[g].callees)
+			{
+				const size_t h = indices.at(callee);
+				if (!reaches[f][h])
+				{
+					reaches[f][h] = true;
+					open.push_back(h);
+				}
+			}
+		}
+	}
+
+	// main is called and its result is the exit code
+	Line("jsr " + UserLabel("main"));
+	Line("ext x");
+	output += "\n";
+
+	for (size_t f = 0; f < count; f++)
+	{
+		GenerateFunction(f);
+		output += "\n";
+	}
+
+	if (program->usesDivide)
+	{
+		output += DIVIDE;
+		output += "\n";
+	}
+
+	GenerateData(*program);
+
+	function = nullptr;
+	program = nullptr;
+	return output;
+}
+
+void CodeGenerator::GenerateFunction(const size_t index)
+{
+	current = index;
+	function = &program->functions[index];
+	allocation = RegisterAllocator().Allocate(*function);
+	slotCounts.push_back(allocation.slotCount);
+
+	// main only has to save registers if it calls itself, nothing else needs them kept
+	bool called = !function->isMain;
+	for (size_t f = 0; f < reaches.size() && !called; f++)
+	{
+		called = reaches[f][index];
+	}
+
+	saved.clear();
+	for (int32_t reg = 0; reg < Allocation::X && called; reg++)
+	{
+		if (((allocation.used >> reg) & 1) != 0)
+		{
+			saved.push_back(reg);
+		}
+	}
+
+	Label(function->label);
+	for (size_t i = 0; i < function->code.size(); i++)
+	{
+		const IRInstruction& instruction = function->code[i];
+		switch (instruction.op)
+		{
+			case EIROp::Entry:
+			{
+				GenerateEntry(instruction);
+			} break;
+
+			case EIROp::Compute:
+			{
+				GenerateCompute(instruction);
+			} break;
+
+			case EIROp::Jump:
+			{
+				// Not needed when the label is next
+				size_t next = i + 1;
+				while (next < function->code.size() && function->code[next].op == EIROp::Label && function->code[next].label != instruction.label)
+				{
+					next++;
+				}
+				if (next >= function->code.size() || function->code[next].op != EIROp::Label)
+				{
+					Line("jmp " + instruction.label);
+				}
+			} break;
+
+			case EIROp::Branch:
+			{
+				GenerateBranch(instruction);
+			} break;
+
+			case EIROp::Label:
+			{
+				Label(instruction.label);
+			} break;
+
+			case EIROp::Call:
+			{
+				GenerateCall(instruction, i);
+			} break;
+
+			case EIROp::Sys:
+			{
+				GenerateSys(instruction);
+			} break;
+
+			case EIROp::Return:
+			{
+				GenerateReturn(instruction, i);
+			} break;
+		}
+	}
+
+	if (!saved.empty())
+	{
+		Label("e_" + function->name);
+		for (auto reg = saved.rbegin(); reg != saved.rend(); ++reg)
+		{
+			Line(std::string("pop ") + CodeGeneratorPrivate::REGISTER_NAMES[*reg]);
+		}
+		Line("ret");
+	}
+}
+
+void CodeGenerator::GenerateEntry(const IRInstruction& instruction)
+{
+	using namespace CodeGeneratorPrivate;
+
+	for (const int32_t reg : saved)
+	{
+		Line(std::string("psh ") + REGISTER_NAMES[reg]);
+	}
+
+	// Parameters that are never read don't need to be moved anywhere
+	Moves moves;
+	for (size_t i = 0; i < instruction.arguments.size(); i++)
+	{
+		const Operand& parameter = instruction.arguments[i];
+		if (!allocation.IsLiveOut(0, parameter.index))
+		{
+			continue;
+		}
+
+		const std::string from = i < 2 ? std::string(1, REGISTER_NAMES[Allocation::X + i]) : "$" + ParameterLabel(function->name, static_cast<int32_t>(i));
+		moves.emplace_back(Text(parameter), from);
+	}
+	ParallelMove(std::move(moves));
+}
+
+void CodeGenerator::GenerateCompute(const IRInstruction& instruction)
+{
+	std::vector<std::string> before;
+	std::vector<std::string> after;
+	uint8_t taken = Registers(instruction.a) | Registers(instruction.b);
+
+	const std::string a = Text(instruction.a, before, after, taken);
+	if (instruction.opcode == EOpCode::NOT)
+	{
+		for (const std::string& line : before) Line(line);
+		Line("not " + a);
+		for (const std::string& line : after) Line(line);
+		return;
+	}
+
+	const std::string b = Text(instruction.b, before, after, taken);
+	if (instruction.opcode == EOpCode::MOV && a == b)
+	{
+		return;
+	}
+
+	for (const std::string& line : before) Line(line);
+	Line(CodeGeneratorPrivate::Mnemonic(instruction.opcode) + " " + a + " " + b);
+	for (const std::string& line : after) Line(line);
+}
+
+void CodeGenerator::GenerateBranch(const IRInstruction& instruction)
+{
+	std::vector<std::string> before;
+	std::vector<std::string> after;
+	uint8_t taken = Registers(instruction.a) | Registers(instruction.b);
+
+	// The register holding a spilled address can't be restored after the jump, so the word
+	// it points to is copied out first
+	std::string operands[2];
+	const Operand* sides[2] = { &instruction.a, &instruction.b };
+	for (int32_t side = 0; side < 2; side++)
+	{
+		operands[side] = Text(*sides[side], before, after, taken);
+		if (!after.empty())
+		{
+			const std::string word = "k_scratch" + std::to_string(scratch++);
+			const std::string reg = operands[side].substr(1, 1);
+			before.push_back("mov " + reg + " " + operands[side]);
+			before.push_back("mov $" + word + " " + reg);
+			before.insert(before.end(), after.rbegin(), after.rend());
+			after.clear();
+			operands[side] = "$" + word;
+		}
+	}
+
+	for (const std::string& line : before) Line(line);
+	Line(CodeGeneratorPrivate::Mnemonic(instruction.opcode) + " " + instruction.label + " " + operands[0] + " " + operands[1]);
+}
+
+void CodeGenerator::GenerateCall(const IRInstruction& instruction, const size_t at)
+{
+	using namespace CodeGeneratorPrivate;
+
+	// A call that can come back here would overwrite the memory this call still needs, so
+	// the frame is kept on the stack until it returns
+	std::vector<std::string> frame;
+	const std::string callee = instruction.label.compare(0, 2, "u_") == 0 ? instruction.label.substr(2) : std::string();
+	bool recursive = false;
+	for (size_t f = 0; f < program->functions.size() && !callee.empty(); f++)
+	{
+		if (program->functions[f].name == callee)
+		{
+			recursive = f == current || reaches[f][current];
+		}
+	}
+
+	if (recursive)
+	{
+		for (const IRData& local : function->memory)
+		{
+			for (int32_t word = 0; word < local.reserve; word++)
+			{
+				frame.push_back("$" + Offset(local.label, static_cast<uint16_t>(word)));
+			}
+		}
+		for (int32_t v = 0; v < function->registers; v++)
+		{
+			if (allocation.slots[v] >= 0 && allocation.IsLiveOut(at, v) && v != instruction.a.GetRegister())
+			{
+				frame.push_back("$" + SlotLabel(allocation.slots[v]));
+			}
+		}
+	}
+
+	for (const std::string& word : frame)
+	{
+		Line("psh " + word);
+	}
+
+	Moves moves;
+	for (size_t i = 0; i < instruction.arguments.size(); i++)
+	{
+		const std::string to = i < 2 ? std::string(1, REGISTER_NAMES[Allocation::X + i]) : "$" + ParameterLabel(callee, static_cast<int32_t>(i));
+		moves.emplace_back(to, Text(instruction.arguments[i]));
+	}
+	ParallelMove(std::move(moves));
+
+	Line("jsr " + instruction.label);
+	for (auto word = frame.rbegin(); word != frame.rend(); ++word)
+	{
+		Line("pop " + *word);
+	}
+
+	if (instruction.a.kind != EOperandKind::None)
+	{
+		GenerateCompute(IRInstruction(EIROp::Compute, EOpCode::MOV, instruction.a, Operand::Register(-1), std::string()));
+	}
+}
+
+void CodeGenerator::GenerateSys(const IRInstruction& instruction)
+{
+	if (!instruction.arguments.empty())
+	{
+		const std::string value = Text(instruction.arguments[0]);
+		if (value != "x")
+		{
+			Line("mov x " + value);
+		}
+	}
+
+	Line("sys " + std::to_string(instruction.value));
+	if (instruction.a.kind != EOperandKind::None)
+	{
+		GenerateCompute(IRInstruction(EIROp::Compute, EOpCode::MOV, instruction.a, Operand::Register(-1), std::string()));
+	}
+}
+
+void CodeGenerator::GenerateReturn(const IRInstruction& instruction, const size_t at)
+{
+	if (instruction.a.kind != EOperandKind::None)
+	{
+		const std::string value = Text(instruction.a);
+		if (value != "x")
+		{
+			Line("mov x " + value);
+		}
+	}
+
+	if (saved.empty())
+	{
+		Line("ret");
+	}
+	else if (at + 1 < function->code.size())
+	{
+		Line("jmp e_" + function->name);
+	}
+}
+
+void CodeGenerator::GenerateData(const IRProgram& inProgram)
+{
+	using namespace CodeGeneratorPrivate;
+
+	auto data = [this](const IRData& item)
+	{
+		std::string line = item.label + ":";
+		for (const std::string& word : item.words)
+		{
+			line += " " + word;
+		}
+		if (item.reserve > 0)
+		{
+			line += " .ds(" + std::to_string(item.reserve) + ")";
+		}
+		if (item.words.empty() && item.reserve <= 0)
+		{
+			line += " 0";
+		}
+		output += line + "\n";
+	};
+
+	// Each function's locals, spill slots and the parameters after the first two
+	for (size_t f = 0; f < inProgram.functions.size(); f++)
+	{
+		const IRFunction& each = inProgram.functions[f];
+		for (const IRData& local : each.memory)
+		{
+			data(local);
+		}
+
+		for (int32_t slot = 0; slot < slotCounts[f]; slot++)
+		{
+			data(IRData{ "s_" + each.name + "_" + std::to_string(slot), { "0" }, 0 });
+		}
+		for (int32_t i = 2; i < each.parameters; i++)
+		{
+			data(IRData{ ParameterLabel(each.name, i), { "0" }, 0 });
+		}
+	}
+
+	for (const IRData& item : inProgram.data)
+	{
+		data(item);
+	}
+
+	for (int32_t i = 0; i < scratch; i++)
+	{
+		data(IRData{ "k_scratch" + std::to_string(i), { "0" }, 0 });
+	}
+}
+
+void CodeGenerator::ParallelMove(Moves moves)
+{
+	moves.erase(std::remove_if(moves.begin(), moves.end(), [](const auto& move) { return move.first == move.second; }), moves.end());
+
+	// A move can go as soon as nothing else still reads what it overwrites. When every move
+	// left is waiting on another they form a cycle, which is broken by pushing one value.
+	static const std::string STACK = "<stack>";
+	while (!moves.empty())
+	{
+		bool progress = false;
+		for (auto move = moves.begin(); move != moves.end(); ++move)
+		{
+			const std::string& to = move->first;
+			const bool read = std::any_of(moves.begin(), moves.end(), [&to](const auto& other) { return other.second == to; });
+			if (!read)
+			{
+				Line(move->second == STACK ? "pop " + to : "mov " + to + " " + move->second);
+				moves.erase(move);
+				progress = true;
+				break;
+			}
+		}
+
+		if (!progress)
+		{
+			const std::string held = moves.front().first;
+			Line("psh " + held);
+			for (auto& move : moves)
+			{
+				if (move.second == held)
+				{
+					move.second = STACK;
+				}
+			}
+		}
+	}
+}
+
+std::string CodeGenerator::Text(const Operand& operand, std::vector<std::string>& before, std::vector<std::string>& after, uint8_t& taken)
+{
+	using namespace CodeGeneratorPrivate;
+
+	if (operand.kind != EOperandKind::Indirect || allocation.registers[operand.index] >= 0)
+	{
+		return Text(operand);
+	}
+
+	// Any register the instruction doesn't use will do, it is put back afterwards
+	int32_t reg = 0;
+	while (((taken >> reg) & 1) != 0)
+	{
+		reg++;
+	}
+	taken |= static_cast<uint8_t>(1 << reg);
+
+	const std::string name(1, REGISTER_NAMES[reg]);
+	before.push_back("psh " + name);
+	before.push_back("mov " + name + " $" + SlotLabel(allocation.slots[operand.index]));
+	after.insert(after.begin(), "pop " + name);
+	return "[" + name + "]";
+}
+
+std::string CodeGenerator::Text(const Operand& operand) const
+{
+	using namespace CodeGeneratorPrivate;
+
+	switch (operand.kind)
+	{
+		case EOperandKind::Register:
+		{
+			// -1 is where a call or system call leaves its result
+			if (operand.index < 0)
+			{
+				return "x";
+			}
+			const int32_t reg = allocation.registers[operand.index];
+			return reg >= 0 ? std::string(1, REGISTER_NAMES[reg]) : "$" + SlotLabel(allocation.slots[operand.index]);
+		}
+
+		case EOperandKind::Immediate: return std::to_string(operand.value);
+		case EOperandKind::Address: return Offset(operand.label, operand.value);
+		case EOperandKind::Memory: return operand.label.empty() ? "$" + std::to_string(operand.value) : "$" + Offset(operand.label, operand.value);
+		case EOperandKind::Indirect: return std::string("[") + REGISTER_NAMES[allocation.registers[operand.index]] + "]";
+		default: return std::string();
+	}
+}
+
+std::string CodeGenerator::SlotLabel(const int32_t slot) const
+{
+	return "s_" + function->name + "_" + std::to_string(slot);
+}
+
+uint8_t CodeGenerator::Registers(const Operand& operand) const
+{
+	const int32_t index = operand.GetRegister();
+	if (index < 0 || allocation.registers[index] < 0)
+	{
+		return 0;
+	}
+
+	return static_cast<uint8_t>(1 << allocation.registers[index]);
+}
+
+void CodeGenerator::Line(const std::string& text)
+{
+	output += "\t" + text + "\n";
+}
+
+void CodeGenerator::Label(const std::string& label)
+{
+	output += label + ":\n";
+}
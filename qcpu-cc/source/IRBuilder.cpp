@@ -0,0 +1,1173 @@
+//
+//	IRBuilder
+//
+
+#include "IRBuilder.h"
+
+#include <assertf.h>
+
+#include <algorithm>
+
+namespace IRBuilderPrivate
+{
+	struct OperatorCode
+	{
+		const char* symbol;
+		EOpCode opcode;
+	};
+
+	static const OperatorCode ARITHMETIC[] =
+	{
+		{ "+", EOpCode::ADD },
+		{ "-", EOpCode::SUB },
+		{ "*", EOpCode::MUL },
+		{ "%", EOpCode::MDL },
+		{ "&", EOpCode::AND },
+		{ "|", EOpCode::ORR },
+		{ "^", EOpCode::XOR },
+		{ "<<", EOpCode::LSL },
+		{ ">>", EOpCode::LSR }
+	};
+
+	static const OperatorCode COMPARISONS[] =
+	{
+		{ "==", EOpCode::JEQ },
+		{ "!=", EOpCode::JNE },
+		{ "<", EOpCode::JLT },
+		{ "<=", EOpCode::JLE },
+		{ ">", EOpCode::JGT },
+		{ ">=", EOpCode::JGE }
+	};
+
+	// Returns false if symbol isn't in the table
+	template <size_t N>
+	bool FindOpCode(const OperatorCode (&table)[N], const std::string& symbol, EOpCode& opcode)
+	{
+		for (const OperatorCode& entry : table)
+		{
+			if (symbol == entry.symbol)
+			{
+				opcode = entry.opcode;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// The branch taken when the one given isn't
+	EOpCode Invert(const EOpCode opcode)
+	{
+		switch (opcode)
+		{
+			case EOpCode::JEQ: return EOpCode::JNE;
+			case EOpCode::JNE: return EOpCode::JEQ;
+			case EOpCode::JLT: return EOpCode::JGE;
+			case EOpCode::JGE: return EOpCode::JLT;
+			case EOpCode::JGT: return EOpCode::JLE;
+			default: return EOpCode::JGT;
+		}
+	}
+
+	bool IsLogical(const std::string& op)
+	{
+		return op == "&&" || op == "||";
+	}
+
+	// Returns the shift, or -1 if value isn't a power of two
+	int32_t FindShift(const uint16_t value)
+	{
+		for (int32_t shift = 0; shift < 16; shift++)
+		{
+			if (value == (1 << shift))
+			{
+				return shift;
+			}
+		}
+
+		return -1;
+	}
+}
+
+IRBuilder::IRBuilder()
+	: result()
+	, signatures()
+	, globals()
+	, strings()
+	, function(nullptr)
+	, source(nullptr)
+	, scopes()
+	, loops()
+	, addressTaken()
+	, labels(0)
+{
+}
+
+IRProgram IRBuilder::Build(const Program& program)
+{
+	// Every function can be called from anywhere, declared before it or not
+	for (const Function& declaration : program.functions)
+	{
+		const auto it = signatures.find(declaration.name);
+		if (it != signatures.end())
+		{
+			assertf(it->second.parameters == declaration.parameters.size(), "%s is declared with different parameters on line %d", declaration.name.c_str(), declaration.line);
+			assertf(!it->second.defined || declaration.body == nullptr, "%s is defined more than once, on line %d", declaration.name.c_str(), declaration.line);
+		}
+
+		Signature& signature = signatures[declaration.name];
+		signature.parameters = declaration.parameters.size();
+		signature.isVoid = declaration.result.isVoid && declaration.result.pointers == 0;
+		signature.defined = signature.defined || declaration.body != nullptr;
+	}
+
+	assertf(signatures.find("main") != signatures.end() && signatures["main"].defined, "There is no main function");
+
+	for (const Global& global : program.globals)
+	{
+		BuildGlobal(global);
+	}
+
+	for (const Function& definition : program.functions)
+	{
+		if (definition.body != nullptr)
+		{
+			BuildFunction(definition);
+		}
+	}
+
+	for (const auto& signature : signatures)
+	{
+		assertf(signature.second.defined, "%s is declared but never defined", signature.first.c_str());
+	}
+
+	return std::move(result);
+}
+
+void IRBuilder::BuildGlobal(const Global& global)
+{
+	assertf(globals.find(global.name) == globals.end() && signatures.find(global.name) == signatures.end(), "%s is defined more than once, on line %d", global.name.c_str(), global.line);
+
+	const std::string label = UserLabel(global.name);
+	globals[global.name] = Variable{ global.type.IsArray() ? EVariableKind::Array : EVariableKind::Memory, -1, label, global.type };
+
+	IRData data{ label, {}, 0 };
+	if (global.values.size() == 1 && global.values[0]->kind == EExprKind::String && global.type.IsArray())
+	{
+		for (const char c : global.values[0]->name)
+		{
+			data.words.push_back(std::to_string(static_cast<uint8_t>(c)));
+		}
+		data.words.push_back("0");
+	}
+	else
+	{
+		for (const std::unique_ptr<Expr>& value : global.values)
+		{
+			data.words.push_back(ConstantWord(*value));
+		}
+	}
+
+	const int32_t length = global.type.IsArray() ? global.type.length : 1;
+	data.reserve = length - static_cast<int32_t>(data.words.size());
+	result.data.push_back(std::move(data));
+}
+
+void IRBuilder::BuildFunction(const Function& definition)
+{
+	assertf(globals.find(definition.name) == globals.end(), "%s is defined more than once, on line %d", definition.name.c_str(), definition.line);
+
+	result.functions.emplace_back();
+	function = &result.functions.back();
+	function->name = definition.name;
+	function->label = UserLabel(definition.name);
+	function->parameters = static_cast<int32_t>(definition.parameters.size());
+	function->isMain = definition.name == "main";
+	source = &definition;
+
+	addressTaken.clear();
+	CollectAddressTaken(*definition.body);
+	scopes.assign(1, {});
+	loops.clear();
+
+	// A parameter whose address is taken arrives in a register like the others, and is then
+	// stored in memory of its own
+	IRInstruction entry(EIROp::Entry, EOpCode::NOP, Operand(), Operand(), std::string());
+	std::vector<std::pair<std::string, int32_t>> stores;
+	for (const Parameter& parameter : definition.parameters)
+	{
+		Type type = parameter.type;
+		const int32_t index = NewRegister();
+		entry.arguments.push_back(Operand::Register(index));
+
+		if (addressTaken.count(parameter.name) != 0)
+		{
+			const std::string label = "l_" + function->name + "_" + std::to_string(labels++);
+			function->memory.push_back(IRData{ label, {}, 1 });
+			scopes.back()[parameter.name] = Variable{ EVariableKind::Memory, -1, label, type };
+			stores.emplace_back(label, index);
+		}
+		else
+		{
+			scopes.back()[parameter.name] = Variable{ EVariableKind::Register, index, std::string(), type };
+		}
+	}
+	function->code.push_back(std::move(entry));
+
+	for (const auto& store : stores)
+	{
+		Emit(EIROp::Compute, EOpCode::MOV, Operand::Memory(store.first), Operand::Register(store.second));
+	}
+
+	BuildStatement(*definition.body);
+
+	// Falling off the end returns, main returns 0 as in C
+	if (function->code.back().op != EIROp::Return)
+	{
+		Emit(EIROp::Return, EOpCode::RET, function->isMain ? Operand::Immediate(0) : Operand());
+	}
+
+	function = nullptr;
+	source = nullptr;
+}
+
+std::string IRBuilder::ConstantWord(const Expr& expr)
+{
+	uint16_t value = 0;
+	if (Fold(expr, value))
+	{
+		return std::to_string(value);
+	}
+
+	if (expr.kind == EExprKind::String)
+	{
+		return StringLabel(expr.name);
+	}
+
+	// The address of a global, written as an array's name or &name
+	const Expr* name = expr.kind == EExprKind::Unary && expr.op == "&" ? expr.operands[0].get() : &expr;
+	if (name->kind == EExprKind::Name)
+	{
+		const auto it = globals.find(name->name);
+		if (it != globals.end() && (it->second.kind == EVariableKind::Array || name != &expr))
+		{
+			return it->second.label;
+		}
+	}
+
+	assertf(false, "A global's value must be a constant, a string or the address of a global, on line %d", expr.line);
+	return std::string();
+}
+
+void IRBuilder::BuildStatement(const Stmt& statement)
+{
+	using namespace IRBuilderPrivate;
+
+	switch (statement.kind)
+	{
+		case EStmtKind::Block:
+		{
+			scopes.emplace_back();
+			for (const std::unique_ptr<Stmt>& child : statement.body)
+			{
+				BuildStatement(*child);
+			}
+			scopes.pop_back();
+		} break;
+
+		case EStmtKind::Declare:
+		{
+			BuildDeclaration(statement);
+		} break;
+
+		case EStmtKind::If:
+		{
+			// if (...) break; and continue; are a single branch out of the loop
+			const Stmt* only = statement.body[0].get();
+			while (only->kind == EStmtKind::Block && only->body.size() == 1)
+			{
+				only = only->body[0].get();
+			}
+			if (statement.body.size() == 1 && !loops.empty() && (only->kind == EStmtKind::Break || only->kind == EStmtKind::Continue))
+			{
+				BuildBranch(*statement.expr, only->kind == EStmtKind::Break ? loops.back().breakLabel : loops.back().continueLabel, true);
+				break;
+			}
+
+			const std::string end = NewLabel();
+			const std::string otherwise = statement.body.size() > 1 ? NewLabel() : end;
+			BuildBranch(*statement.expr, otherwise, false);
+			BuildStatement(*statement.body[0]);
+			if (statement.body.size() > 1)
+			{
+				Emit(EIROp::Jump, EOpCode::JMP, Operand(), Operand(), end);
+				Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), otherwise);
+				BuildStatement(*statement.body[1]);
+			}
+			Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), end);
+		} break;
+
+		case EStmtKind::While:
+		case EStmtKind::DoWhile:
+		case EStmtKind::For:
+		{
+			// The condition is at the bottom, a while or for jumps to it first. for has its own
+			// scope, so that what it declares ends with it.
+			scopes.emplace_back();
+			if (statement.init != nullptr)
+			{
+				const std::vector<std::unique_ptr<Stmt>>* init = statement.init->kind == EStmtKind::Block ? &statement.init->body : nullptr;
+				if (init != nullptr)
+				{
+					for (const std::unique_ptr<Stmt>& declaration : *init)
+					{
+						BuildStatement(*declaration);
+					}
+				}
+				else
+				{
+					BuildStatement(*statement.init);
+				}
+			}
+
+			const std::string body = NewLabel();
+			const std::string next = NewLabel();
+			const std::string test = statement.step != nullptr ? NewLabel() : next;
+			const std::string end = NewLabel();
+
+			uint16_t constant = 0;
+			const bool always = statement.expr == nullptr || (Fold(*statement.expr, constant) && constant != 0);
+			if (statement.kind != EStmtKind::DoWhile && !always)
+			{
+				Emit(EIROp::Jump, EOpCode::JMP, Operand(), Operand(), test);
+			}
+
+			Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), body);
+			loops.push_back(Loop{ end, next });
+			BuildStatement(*statement.body[0]);
+			loops.pop_back();
+
+			Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), next);
+			if (statement.step != nullptr)
+			{
+				BuildEffect(*statement.step);
+				Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), test);
+			}
+
+			if (always)
+			{
+				Emit(EIROp::Jump, EOpCode::JMP, Operand(), Operand(), body);
+			}
+			else
+			{
+				BuildBranch(*statement.expr, body, true);
+			}
+			Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), end);
+			scopes.pop_back();
+		} break;
+
+		case EStmtKind::Break:
+		case EStmtKind::Continue:
+		{
+			const bool isBreak = statement.kind == EStmtKind::Break;
+			assertf(!loops.empty(), "%s outside of a loop on line %d", isBreak ? "break" : "continue", statement.line);
+			Emit(EIROp::Jump, EOpCode::JMP, Operand(), Operand(), isBreak ? loops.back().breakLabel : loops.back().continueLabel);
+		} break;
+
+		case EStmtKind::Return:
+		{
+			const bool isVoid = source->result.isVoid && source->result.pointers == 0;
+			assertf(statement.expr == nullptr || !isVoid, "%s is void but returns a value on line %d", source->name.c_str(), statement.line);
+			Emit(EIROp::Return, EOpCode::RET, statement.expr != nullptr ? BuildPlain(*statement.expr) : Operand());
+		} break;
+
+		case EStmtKind::Expression:
+		{
+			BuildEffect(*statement.expr);
+		} break;
+
+		case EStmtKind::Empty:
+		{
+		} break;
+	}
+}
+
+void IRBuilder::BuildDeclaration(const Stmt& statement)
+{
+	const Type& type = statement.type;
+	assertf(scopes.back().find(statement.name) == scopes.back().end(), "%s is declared more than once, on line %d", statement.name.c_str(), statement.line);
+
+	// Arrays and locals whose address is taken get their own words, the rest live in registers
+	if (type.IsArray() || addressTaken.count(statement.name) != 0)
+	{
+		const std::string label = "l_" + function->name + "_" + std::to_string(labels++);
+		const int32_t length = type.IsArray() ? type.length : 1;
+		function->memory.push_back(IRData{ label, {}, length });
+
+		// Set every time the declaration runs, as in C, with the rest of an array cleared
+		if (!statement.values.empty())
+		{
+			std::vector<Operand> values;
+			if (type.IsArray() && statement.values[0]->kind == EExprKind::String)
+			{
+				for (const char c : statement.values[0]->name)
+				{
+					values.push_back(Operand::Immediate(static_cast<uint8_t>(c)));
+				}
+			}
+			else
+			{
+				for (const std::unique_ptr<Expr>& value : statement.values)
+				{
+					values.push_back(BuildValue(*value));
+				}
+			}
+
+			for (int32_t i = 0; i < length; i++)
+			{
+				const Operand value = static_cast<size_t>(i) < values.size() ? values[i] : Operand::Immediate(0);
+				Emit(EIROp::Compute, EOpCode::MOV, Operand::Memory(label, static_cast<uint16_t>(i)), value);
+			}
+		}
+
+		scopes.back()[statement.name] = Variable{ type.IsArray() ? EVariableKind::Array : EVariableKind::Memory, -1, label, type };
+		return;
+	}
+
+	// The name is only in scope once it has its value, so int x = x + 1 uses an outer x
+	const int32_t index = NewRegister();
+	if (!statement.values.empty())
+	{
+		BuildInto(index, *statement.values[0]);
+	}
+	scopes.back()[statement.name] = Variable{ EVariableKind::Register, index, std::string(), type };
+}
+
+void IRBuilder::BuildBranch(const Expr& expr, const std::string& label, const bool when)
+{
+	using namespace IRBuilderPrivate;
+
+	uint16_t constant = 0;
+	if (Fold(expr, constant))
+	{
+		if ((constant != 0) == when)
+		{
+			Emit(EIROp::Jump, EOpCode::JMP, Operand(), Operand(), label);
+		}
+		return;
+	}
+
+	if (expr.kind == EExprKind::Unary && expr.op == "!")
+	{
+		BuildBranch(*expr.operands[0], label, !when);
+		return;
+	}
+
+	if (expr.kind == EExprKind::Binary && IsLogical(expr.op))
+	{
+		// a && b jumps if both are true, and past b as soon as a is false
+		if ((expr.op == "&&") == when)
+		{
+			const std::string skip = NewLabel();
+			BuildBranch(*expr.operands[0], skip, !when);
+			BuildBranch(*expr.operands[1], label, when);
+			Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), skip);
+		}
+		else
+		{
+			BuildBranch(*expr.operands[0], label, when);
+			BuildBranch(*expr.operands[1], label, when);
+		}
+		return;
+	}
+
+	EOpCode opcode = EOpCode::JNE;
+	if (expr.kind == EExprKind::Binary && FindOpCode(COMPARISONS, expr.op, opcode))
+	{
+		const Operand lhs = BuildValue(*expr.operands[0]);
+		const Operand rhs = BuildValue(*expr.operands[1]);
+		Emit(EIROp::Branch, when ? opcode : Invert(opcode), lhs, rhs, label);
+		return;
+	}
+
+	Emit(EIROp::Branch, when ? EOpCode::JNE : EOpCode::JEQ, BuildValue(expr), Operand::Immediate(0), label);
+}
+
+void IRBuilder::BuildEffect(const Expr& expr)
+{
+	switch (expr.kind)
+	{
+		case EExprKind::Increment:
+		{
+			Emit(EIROp::Compute, expr.op == "++" ? EOpCode::ADD : EOpCode::SUB, BuildPlace(*expr.operands[0]), Operand::Immediate(1));
+		} break;
+
+		case EExprKind::Assign:
+		{
+			BuildAssign(expr);
+		} break;
+
+		case EExprKind::Call:
+		{
+			BuildCall(expr, Operand());
+		} break;
+
+		case EExprKind::Conditional:
+		{
+			const std::string otherwise = NewLabel();
+			const std::string end = NewLabel();
+			BuildBranch(*expr.operands[0], otherwise, false);
+			BuildEffect(*expr.operands[1]);
+			Emit(EIROp::Jump, EOpCode::JMP, Operand(), Operand(), end);
+			Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), otherwise);
+			BuildEffect(*expr.operands[2]);
+			Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), end);
+		} break;
+
+		case EExprKind::Binary:
+		{
+			if (IRBuilderPrivate::IsLogical(expr.op))
+			{
+				const std::string end = NewLabel();
+				BuildBranch(*expr.operands[0], end, expr.op == "||");
+				BuildEffect(*expr.operands[1]);
+				Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), end);
+				break;
+			}
+
+			BuildEffect(*expr.operands[0]);
+			BuildEffect(*expr.operands[1]);
+		} break;
+
+		case EExprKind::Unary:
+		case EExprKind::Index:
+		{
+			for (const std::unique_ptr<Expr>& operand : expr.operands)
+			{
+				BuildEffect(*operand);
+			}
+		} break;
+
+		default:
+		{
+		} break;
+	}
+}
+
+void IRBuilder::BuildInto(const int32_t target, const Expr& expr)
+{
+	using namespace IRBuilderPrivate;
+
+	const Operand destination = Operand::Register(target);
+
+	uint16_t constant = 0;
+	if (Fold(expr, constant))
+	{
+		Emit(EIROp::Compute, EOpCode::MOV, destination, Operand::Immediate(constant));
+		return;
+	}
+
+	EOpCode opcode = EOpCode::NOP;
+	const bool condition = (expr.kind == EExprKind::Binary && (IsLogical(expr.op) || FindOpCode(COMPARISONS, expr.op, opcode)))
+		|| (expr.kind == EExprKind::Unary && expr.op == "!");
+
+	// A condition as a value is 1 or 0
+	if (condition)
+	{
+		const std::string end = NewLabel();
+		Emit(EIROp::Compute, EOpCode::MOV, destination, Operand::Immediate(1));
+		BuildBranch(expr, end, true);
+		Emit(EIROp::Compute, EOpCode::MOV, destination, Operand::Immediate(0));
+		Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), end);
+		return;
+	}
+
+	switch (expr.kind)
+	{
+		case EExprKind::Binary:
+		{
+			// An array plus a constant is a constant address, see BuildValue
+			const Expr& lhs = *expr.operands[0];
+			const bool array = lhs.kind == EExprKind::String || (lhs.kind == EExprKind::Name && FindVariable(lhs.name, lhs.line).kind == EVariableKind::Array);
+			if ((expr.op == "+" || expr.op == "-") && array && Fold(*expr.operands[1], constant))
+			{
+				Emit(EIROp::Compute, EOpCode::MOV, destination, BuildValue(expr));
+			}
+			else
+			{
+				BuildBinary(destination, expr);
+			}
+		} break;
+
+		case EExprKind::Unary:
+		{
+			if (expr.op == "-")
+			{
+				const Operand value = BuildValue(*expr.operands[0]);
+				Emit(EIROp::Compute, EOpCode::MOV, destination, Operand::Immediate(0));
+				Emit(EIROp::Compute, EOpCode::SUB, destination, value);
+			}
+			else if (expr.op == "~")
+			{
+				BuildInto(target, *expr.operands[0]);
+				Emit(EIROp::Compute, EOpCode::NOT, destination);
+			}
+			else
+			{
+				Emit(EIROp::Compute, EOpCode::MOV, destination, BuildValue(expr));
+			}
+		} break;
+
+		case EExprKind::Call:
+		{
+			BuildCall(expr, destination);
+		} break;
+
+		case EExprKind::Conditional:
+		{
+			const std::string otherwise = NewLabel();
+			const std::string end = NewLabel();
+			BuildBranch(*expr.operands[0], otherwise, false);
+			BuildInto(target, *expr.operands[1]);
+			Emit(EIROp::Jump, EOpCode::JMP, Operand(), Operand(), end);
+			Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), otherwise);
+			BuildInto(target, *expr.operands[2]);
+			Emit(EIROp::Label, EOpCode::NOP, Operand(), Operand(), end);
+		} break;
+
+		default:
+		{
+			Emit(EIROp::Compute, EOpCode::MOV, destination, BuildValue(expr));
+		} break;
+	}
+}
+
+void IRBuilder::BuildBinary(const Operand& target, const Expr& expr)
+{
+	using namespace IRBuilderPrivate;
+
+	const Expr* lhs = expr.operands[0].get();
+	const Expr* rhs = expr.operands[1].get();
+
+	uint16_t constant = 0;
+	if (expr.op == "/")
+	{
+		const int32_t shift = Fold(*rhs, constant) ? FindShift(constant) : -1;
+		if (shift >= 0)
+		{
+			BuildInto(target.index, *lhs);
+			if (shift > 0)
+			{
+				Emit(EIROp::Compute, EOpCode::LSR, target, Operand::Immediate(static_cast<uint16_t>(shift)));
+			}
+			return;
+		}
+
+		IRInstruction call(EIROp::Call, EOpCode::JSR, target, Operand(), DIVIDE_LABEL);
+		call.arguments.push_back(BuildPlain(*lhs));
+		call.arguments.push_back(BuildPlain(*rhs));
+		function->code.push_back(std::move(call));
+		result.usesDivide = true;
+		return;
+	}
+
+	EOpCode opcode = EOpCode::NOP;
+	assertf(FindOpCode(ARITHMETIC, expr.op, opcode), "Unknown operator %s on line %d", expr.op.c_str(), expr.line);
+
+	// The side that needs working out goes first, straight into the target, so the other can
+	// be used where it is
+	auto simple = [this](const Expr& e)
+	{
+		uint16_t value = 0;
+		return e.kind == EExprKind::Name || e.kind == EExprKind::String || Fold(e, value);
+	};
+
+	const bool commutative = opcode == EOpCode::ADD || opcode == EOpCode::MUL || opcode == EOpCode::AND || opcode == EOpCode::ORR || opcode == EOpCode::XOR;
+	if (commutative && simple(*lhs) && !simple(*rhs))
+	{
+		std::swap(lhs, rhs);
+	}
+
+	BuildInto(target.index, *lhs);
+	Emit(EIROp::Compute, opcode, target, BuildValue(*rhs));
+}
+
+Operand IRBuilder::BuildValue(const Expr& expr)
+{
+	uint16_t constant = 0;
+	if (Fold(expr, constant))
+	{
+		return Operand::Immediate(constant);
+	}
+
+	switch (expr.kind)
+	{
+		case EExprKind::String:
+		{
+			return Operand::Address(StringLabel(expr.name));
+		}
+
+		case EExprKind::Name:
+		{
+			const Variable& variable = FindVariable(expr.name, expr.line);
+			switch (variable.kind)
+			{
+				case EVariableKind::Register: return Operand::Register(variable.index);
+				case EVariableKind::Memory: return Operand::Memory(variable.label);
+				default: return Operand::Address(variable.label);
+			}
+		}
+
+		case EExprKind::Unary:
+		{
+			if (expr.op == "*")
+			{
+				return Dereference(BuildValue(*expr.operands[0]));
+			}
+			if (expr.op == "&")
+			{
+				return BuildAddress(*expr.operands[0]);
+			}
+		} break;
+
+		case EExprKind::Index:
+		{
+			return BuildPlace(expr);
+		}
+
+		case EExprKind::Assign:
+		{
+			return BuildAssign(expr);
+		}
+
+		case EExprKind::Increment:
+		{
+			const Operand place = BuildPlace(*expr.operands[0]);
+			const EOpCode opcode = expr.op == "++" ? EOpCode::ADD : EOpCode::SUB;
+			if (expr.prefix)
+			{
+				Emit(EIROp::Compute, opcode, place, Operand::Immediate(1));
+				return place;
+			}
+
+			const Operand before = Operand::Register(NewRegister());
+			Emit(EIROp::Compute, EOpCode::MOV, before, place);
+			Emit(EIROp::Compute, opcode, place, Operand::Immediate(1));
+			return before;
+		}
+
+		case EExprKind::Binary:
+		{
+			// An array plus a constant is still a constant address
+			if ((expr.op == "+" || expr.op == "-") && Fold(*expr.operands[1], constant))
+			{
+				const Operand base = BuildValue(*expr.operands[0]);
+				if (base.kind == EOperandKind::Address)
+				{
+					return Operand::Address(base.label, static_cast<uint16_t>(expr.op == "+" ? base.value + constant : base.value - constant));
+				}
+
+				const Operand sum = Operand::Register(NewRegister());
+				Emit(EIROp::Compute, EOpCode::MOV, sum, base);
+				Emit(EIROp::Compute, expr.op == "+" ? EOpCode::ADD : EOpCode::SUB, sum, Operand::Immediate(constant));
+				return sum;
+			}
+		} break;
+
+		default:
+		{
+		} break;
+	}
+
+	const int32_t index = NewRegister();
+	BuildInto(index, expr);
+	return Operand::Register(index);
+}
+
+Operand IRBuilder::BuildPlain(const Expr& expr)
+{
+	const Operand value = BuildValue(expr);
+	if (value.kind != EOperandKind::Indirect)
+	{
+		return value;
+	}
+
+	const Operand copy = Operand::Register(NewRegister());
+	Emit(EIROp::Compute, EOpCode::MOV, copy, value);
+	return copy;
+}
+
+Operand IRBuilder::BuildPlace(const Expr& expr)
+{
+	switch (expr.kind)
+	{
+		case EExprKind::Name:
+		{
+			const Variable& variable = FindVariable(expr.name, expr.line);
+			assertf(variable.kind != EVariableKind::Array, "The array %s can't be assigned to, on line %d", expr.name.c_str(), expr.line);
+			return variable.kind == EVariableKind::Register ? Operand::Register(variable.index) : Operand::Memory(variable.label);
+		}
+
+		case EExprKind::Unary:
+		{
+			if (expr.op == "*")
+			{
+				return Dereference(BuildValue(*expr.operands[0]));
+			}
+		} break;
+
+		case EExprKind::Index:
+		{
+			const Operand base = BuildValue(*expr.operands[0]);
+			const Operand index = BuildValue(*expr.operands[1]);
+			if (index.kind == EOperandKind::Immediate && (base.kind == EOperandKind::Address || base.kind == EOperandKind::Immediate))
+			{
+				return Operand::Memory(base.label, static_cast<uint16_t>(base.value + index.value));
+			}
+
+			const Operand address = Operand::Register(NewRegister());
+			Emit(EIROp::Compute, EOpCode::MOV, address, base);
+			if (index.kind != EOperandKind::Immediate || index.value != 0)
+			{
+				Emit(EIROp::Compute, EOpCode::ADD, address, index);
+			}
+			return Operand::Indirect(address.index);
+		}
+
+		default:
+		{
+		} break;
+	}
+
+	assertf(false, "This can't be assigned to, on line %d", expr.line);
+	return Operand();
+}
+
+Operand IRBuilder::BuildAddress(const Expr& expr)
+{
+	if (expr.kind == EExprKind::Unary && expr.op == "*")
+	{
+		return BuildValue(*expr.operands[0]);
+	}
+
+	if (expr.kind == EExprKind::String || (expr.kind == EExprKind::Name && FindVariable(expr.name, expr.line).kind == EVariableKind::Array))
+	{
+		return BuildValue(expr);
+	}
+
+	const Operand place = BuildPlace(expr);
+	switch (place.kind)
+	{
+		case EOperandKind::Memory: return place.label.empty() ? Operand::Immediate(place.value) : Operand::Address(place.label, place.value);
+		case EOperandKind::Indirect: return Operand::Register(place.index);
+		default: assertf(false, "Can't take the address of this on line %d", expr.line); return Operand();
+	}
+}
+
+Operand IRBuilder::BuildAssign(const Expr& expr)
+{
+	using namespace IRBuilderPrivate;
+
+	const Expr& lhs = *expr.operands[0];
+	const Expr& rhs = *expr.operands[1];
+
+	if (expr.op == "=")
+	{
+		// Straight into the variable's register, unless the value still needs the old one
+		if (lhs.kind == EExprKind::Name)
+		{
+			const Variable& variable = FindVariable(lhs.name, lhs.line);
+			if (variable.kind == EVariableKind::Register && !References(rhs, lhs.name))
+			{
+				BuildInto(variable.index, rhs);
+				return Operand::Register(variable.index);
+			}
+		}
+
+		const Operand value = BuildValue(rhs);
+		const Operand place = BuildPlace(lhs);
+		Emit(EIROp::Compute, EOpCode::MOV, place, value);
+		return place;
+	}
+
+	const std::string op = expr.op.substr(0, expr.op.size() - 1);
+	const Operand place = BuildPlace(lhs);
+
+	uint16_t constant = 0;
+	const int32_t shift = op == "/" && Fold(rhs, constant) ? FindShift(constant) : -1;
+	if (op == "/" && shift < 0)
+	{
+		const Operand quotient = Operand::Register(NewRegister());
+		IRInstruction call(EIROp::Call, EOpCode::JSR, quotient, Operand(), DIVIDE_LABEL);
+		if (place.kind == EOperandKind::Indirect)
+		{
+			const Operand copy = Operand::Register(NewRegister());
+			Emit(EIROp::Compute, EOpCode::MOV, copy, place);
+			call.arguments.push_back(copy);
+		}
+		else
+		{
+			call.arguments.push_back(place);
+		}
+		call.arguments.push_back(BuildPlain(rhs));
+		function->code.push_back(std::move(call));
+		result.usesDivide = true;
+
+		Emit(EIROp::Compute, EOpCode::MOV, place, quotient);
+		return place;
+	}
+
+	if (op == "/")
+	{
+		if (shift > 0)
+		{
+			Emit(EIROp::Compute, EOpCode::LSR, place, Operand::Immediate(static_cast<uint16_t>(shift)));
+		}
+		return place;
+	}
+
+	EOpCode opcode = EOpCode::NOP;
+	assertf(FindOpCode(ARITHMETIC, op, opcode), "Unknown operator %s on line %d", expr.op.c_str(), expr.line);
+	Emit(EIROp::Compute, opcode, place, BuildValue(rhs));
+	return place;
+}
+
+void IRBuilder::BuildCall(const Expr& expr, const Operand& target)
+{
+	// __sys(n) and __sys(n, x) make system call n, which must be a constant, and give back x
+	if (expr.name == "__sys")
+	{
+		uint16_t call = 0;
+		assertf(!expr.operands.empty() && expr.operands.size() <= 2 && Fold(*expr.operands[0], call),
+			"__sys takes a constant system call number and an optional value, on line %d", expr.line);
+
+		IRInstruction sys(EIROp::Sys, EOpCode::SYS, target, Operand(), std::string());
+		sys.value = call;
+		if (expr.operands.size() > 1)
+		{
+			sys.arguments.push_back(BuildPlain(*expr.operands[1]));
+		}
+		function->code.push_back(std::move(sys));
+		return;
+	}
+
+	const auto it = signatures.find(expr.name);
+	assertf(it != signatures.end(), "%s is not a function, on line %d", expr.name.c_str(), expr.line);
+	assertf(it->second.parameters == expr.operands.size(), "%s takes %d arguments but is given %d on line %d",
+		expr.name.c_str(), static_cast<int32_t>(it->second.parameters), static_cast<int32_t>(expr.operands.size()), expr.line);
+	assertf(target.kind == EOperandKind::None || !it->second.isVoid, "%s doesn't return a value, on line %d", expr.name.c_str(), expr.line);
+
+	IRInstruction call(EIROp::Call, EOpCode::JSR, target, Operand(), UserLabel(expr.name));
+	for (const std::unique_ptr<Expr>& argument : expr.operands)
+	{
+		call.arguments.push_back(BuildPlain(*argument));
+	}
+	function->code.push_back(std::move(call));
+
+	if (std::find(function->callees.begin(), function->callees.end(), expr.name) == function->callees.end())
+	{
+		function->callees.push_back(expr.name);
+	}
+}
+
+Operand IRBuilder::Dereference(const Operand& address)
+{
+	switch (address.kind)
+	{
+		case EOperandKind::Address: return Operand::Memory(address.label, address.value);
+		case EOperandKind::Immediate: return Operand::Memory(std::string(), address.value);
+		case EOperandKind::Register: return Operand::Indirect(address.index);
+		default:
+		{
+			const Operand copy = Operand::Register(NewRegister());
+			Emit(EIROp::Compute, EOpCode::MOV, copy, address);
+			return Operand::Indirect(copy.index);
+		}
+	}
+}
+
+bool IRBuilder::Fold(const Expr& expr, uint16_t& value) const
+{
+	using namespace IRBuilderPrivate;
+
+	switch (expr.kind)
+	{
+		case EExprKind::Number:
+		{
+			value = expr.value;
+			return true;
+		}
+
+		case EExprKind::Unary:
+		{
+			uint16_t operand = 0;
+			if (expr.op == "*" || expr.op == "&" || !Fold(*expr.operands[0], operand))
+			{
+				return false;
+			}
+
+			value = static_cast<uint16_t>(expr.op == "-" ? -operand : (expr.op == "~" ? ~operand : !operand));
+			return true;
+		}
+
+		case EExprKind::Binary:
+		{
+			uint16_t a = 0;
+			uint16_t b = 0;
+			if (!Fold(*expr.operands[0], a) || !Fold(*expr.operands[1], b))
+			{
+				return false;
+			}
+
+			const std::string& op = expr.op;
+			if ((op == "/" || op == "%") && b == 0)
+			{
+				return false;
+			}
+
+			if (op == "+") value = static_cast<uint16_t>(a + b);
+			else if (op == "-") value = static_cast<uint16_t>(a - b);
+			else if (op == "*") value = static_cast<uint16_t>(a * b);
+			else if (op == "/") value = static_cast<uint16_t>(a / b);
+			else if (op == "%") value = static_cast<uint16_t>(a % b);
+			else if (op == "&") value = a & b;
+			else if (op == "|") value = a | b;
+			else if (op == "^") value = a ^ b;
+			else if (op == "<<") value = static_cast<uint16_t>(b < 16 ? a << b : 0);
+			else if (op == ">>") value = static_cast<uint16_t>(b < 16 ? a >> b : 0);
+			else if (op == "==") value = a == b;
+			else if (op == "!=") value = a != b;
+			else if (op == "<") value = a < b;
+			else if (op == "<=") value = a <= b;
+			else if (op == ">") value = a > b;
+			else if (op == ">=") value = a >= b;
+			else if (op == "&&") value = a && b;
+			else if (op == "||") value = a || b;
+			else return false;
+			return true;
+		}
+
+		case EExprKind::Conditional:
+		{
+			uint16_t condition = 0;
+			return Fold(*expr.operands[0], condition) && Fold(*expr.operands[condition != 0 ? 1 : 2], value);
+		}
+
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+bool IRBuilder::References(const Expr& expr, const std::string& name) const
+{
+	if (expr.kind == EExprKind::Name && expr.name == name)
+	{
+		return true;
+	}
+
+	for (const std::unique_ptr<Expr>& operand : expr.operands)
+	{
+		if (References(*operand, name))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void IRBuilder::CollectAddressTaken(const Stmt& statement)
+{
+	// By name only, so every local of that name is kept in memory, which is safe
+	for (const Expr* expr : { statement.expr.get(), statement.step.get() })
+	{
+		if (expr != nullptr)
+		{
+			CollectAddressTaken(*expr);
+		}
+	}
+
+	for (const std::unique_ptr<Expr>& value : statement.values)
+	{
+		CollectAddressTaken(*value);
+	}
+
+	if (statement.init != nullptr)
+	{
+		CollectAddressTaken(*statement.init);
+	}
+
+	for (const std::unique_ptr<Stmt>& child : statement.body)
+	{
+		CollectAddressTaken(*child);
+	}
+}
+
+void IRBuilder::CollectAddressTaken(const Expr& expr)
+{
+	if (expr.kind == EExprKind::Unary && expr.op == "&" && expr.operands[0]->kind == EExprKind::Name)
+	{
+		addressTaken.insert(expr.operands[0]->name);
+	}
+
+	for (const std::unique_ptr<Expr>& operand : expr.operands)
+	{
+		CollectAddressTaken(*operand);
+	}
+}
+
+const IRBuilder::Variable& IRBuilder::FindVariable(const std::string& name, const int32_t line) const
+{
+	for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope)
+	{
+		const auto it = scope->find(name);
+		if (it != scope->end())
+		{
+			return it->second;
+		}
+	}
+
+	const auto it = globals.find(name);
+	assertf(it != globals.end(), "%s is not declared, on line %d", name.c_str(), line);
+	return it->second;
+}
+
+std::string IRBuilder::StringLabel(const std::string& text)
+{
+	// Equal strings share their words
+	const auto it = strings.find(text);
+	if (it != strings.end())
+	{
+		return it->second;
+	}
+
+	const std::string label = "str_" + std::to_string(strings.size());
+	strings[text] = label;
+
+	IRData data{ label, {}, 0 };
+	for (const char c : text)
+	{
+		data.words.push_back(std::to_string(static_cast<uint8_t>(c)));
+	}
+	data.words.push_back("0");
+	result.data.push_back(std::move(data));
+
+	return label;
+}
+
+int32_t IRBuilder::NewRegister()
+{
+	return function->registers++;
+}
+
+std::string IRBuilder::NewLabel()
+{
+	return "L_" + function->name + "_" + std::to_string(labels++);
+}
+
+void IRBuilder::Emit(const EIROp op, const EOpCode opcode, const Operand& a /*= Operand()*/, const Operand& b /*= Operand()*/, const std::string& label /*= std::string()*/)
+{
+	function->code.emplace_back(op, opcode, a, b, label);
+}
@@ -0,0 +1,755 @@
+//
+//	Parser
+//
+
+#include "Parser.h"
+
+#include <assertf.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace ParserPrivate
+{
+	static const char* KEYWORDS[] =
+	{
+		"int", "char", "void", "unsigned", "if", "else", "while", "do", "for", "break", "continue", "return"
+	};
+
+	// Longest first, so that <<= is not read as << and =
+	static const char* SYMBOLS[] =
+	{
+		"<<=", ">>=",
+		"<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "++", "--", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=",
+		"+", "-", "*", "/", "%", "&", "|", "^", "~", "!", "<", ">", "=", "?", ":", ";", ",", "(", ")", "[", "]", "{", "}"
+	};
+
+	struct BinaryOperator
+	{
+		const char* symbol;
+		int32_t precedence;
+	};
+
+	static const BinaryOperator OPERATORS[] =
+	{
+		{ "||", 1 },
+		{ "&&", 2 },
+		{ "|", 3 },
+		{ "^", 4 },
+		{ "&", 5 },
+		{ "==", 6 },
+		{ "!=", 6 },
+		{ "<", 7 },
+		{ ">", 7 },
+		{ "<=", 7 },
+		{ ">=", 7 },
+		{ "<<", 8 },
+		{ ">>", 8 },
+		{ "+", 9 },
+		{ "-", 9 },
+		{ "*", 10 },
+		{ "/", 10 },
+		{ "%", 10 }
+	};
+
+	bool IsAlpha(const char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+	}
+
+	bool IsDigit(const char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	int32_t FindPrecedence(const std::string& symbol)
+	{
+		for (const BinaryOperator& op : OPERATORS)
+		{
+			if (symbol == op.symbol)
+			{
+				return op.precedence;
+			}
+		}
+
+		return -1;
+	}
+
+	// The character after a \ in a string or character constant
+	char Unescape(const char c, const int32_t line)
+	{
+		switch (c)
+		{
+			case 'n': return '\n';
+			case 't': return '\t';
+			case 'r': return '\r';
+			case '0': return '\0';
+			case '\\': return '\\';
+			case '\'': return '\'';
+			case '"': return '"';
+			default: assertf(false, "Unknown escape \\%c on line %d", c, line); return c;
+		}
+	}
+}
+
+Parser::Parser(const std::string_view text)
+	: tokens()
+	, position(0)
+{
+	Tokenize(text);
+}
+
+Program Parser::Parse()
+{
+	Program program;
+	while (Peek().kind != ETokenKind::End)
+	{
+		ParseTopLevel(program);
+	}
+
+	return program;
+}
+
+void Parser::Tokenize(const std::string_view text)
+{
+	using namespace ParserPrivate;
+
+	int32_t line = 1;
+	size_t i = 0;
+	while (i < text.size())
+	{
+		const char c = text[i];
+		if (c == '\n')
+		{
+			line++;
+			i++;
+		}
+		else if (c == ' ' || c == '\t' || c == '\r')
+		{
+			i++;
+		}
+		else if (text.substr(i, 2) == "//")
+		{
+			while (i < text.size() && text[i] != '\n')
+			{
+				i++;
+			}
+		}
+		else if (text.substr(i, 2) == "/*")
+		{
+			const size_t end = text.find("*/", i + 2);
+			assertf(end != std::string_view::npos, "Comment on line %d is never closed", line);
+			line += static_cast<int32_t>(std::count(text.begin() + i, text.begin() + end, '\n'));
+			i = end + 2;
+		}
+		else if (IsAlpha(c))
+		{
+			const size_t start = i;
+			while (i < text.size() && (IsAlpha(text[i]) || IsDigit(text[i])))
+			{
+				i++;
+			}
+
+			const std::string word(text.substr(start, i - start));
+			const bool keyword = std::find_if(std::begin(KEYWORDS), std::end(KEYWORDS), [&word](const char* k) { return word == k; }) != std::end(KEYWORDS);
+			tokens.push_back(Token{ keyword ? ETokenKind::Keyword : ETokenKind::Identifier, word, 0, line });
+		}
+		else if (IsDigit(c))
+		{
+			const size_t start = i;
+			while (i < text.size() && (IsAlpha(text[i]) || IsDigit(text[i])))
+			{
+				i++;
+			}
+
+			const std::string number(text.substr(start, i - start));
+			const bool binary = number.size() > 2 && (number[1] == 'b' || number[1] == 'B');
+			char* end = nullptr;
+			const unsigned long value = std::strtoul(number.c_str() + (binary ? 2 : 0), &end, binary ? 2 : 0);
+			assertf(*end == '\0' && value <= 0xFFFF, "%s on line %d isn't a 16 bit number", number.c_str(), line);
+			tokens.push_back(Token{ ETokenKind::Number, number, static_cast<uint16_t>(value), line });
+		}
+		else if (c == '\'' || c == '"')
+		{
+			std::string contents;
+			i++;
+			while (i < text.size() && text[i] != c)
+			{
+				assertf(text[i] != '\n', "Missing closing %c on line %d", c, line);
+				contents += text[i] == '\\' && i + 1 < text.size() ? Unescape(text[++i], line) : text[i];
+				i++;
+			}
+			assertf(i < text.size(), "Missing closing %c on line %d", c, line);
+			i++;
+
+			if (c == '"')
+			{
+				tokens.push_back(Token{ ETokenKind::String, contents, 0, line });
+			}
+			else
+			{
+				assertf(contents.size() == 1, "A character constant holds one character, on line %d", line);
+				tokens.push_back(Token{ ETokenKind::Number, contents, static_cast<uint8_t>(contents[0]), line });
+			}
+		}
+		else
+		{
+			const char* const* symbol = std::find_if(std::begin(SYMBOLS), std::end(SYMBOLS), [&](const char* s) { return text.substr(i, strlen(s)) == s; });
+			assertf(symbol != std::end(SYMBOLS), "Unexpected '%c' on line %d", c, line);
+			tokens.push_back(Token{ ETokenKind::Symbol, *symbol, 0, line });
+			i += strlen(*symbol);
+		}
+	}
+
+	tokens.push_back(Token{ ETokenKind::End, "end of file", 0, line });
+}
+
+const Parser::Token& Parser::Peek(const size_t ahead /*= 0*/) const
+{
+	return tokens[std::min(position + ahead, tokens.size() - 1)];
+}
+
+const Parser::Token& Parser::Next()
+{
+	const Token& token = Peek();
+	position = std::min(position + 1, tokens.size() - 1);
+	return token;
+}
+
+bool Parser::Accept(const char* symbol)
+{
+	if (Peek().kind == ETokenKind::Symbol && Peek().text == symbol)
+	{
+		Next();
+		return true;
+	}
+
+	return false;
+}
+
+void Parser::Expect(const char* symbol)
+{
+	assertf(Accept(symbol), "Expected '%s' but found '%s' on line %d", symbol, Peek().text.c_str(), Peek().line);
+}
+
+std::string Parser::ExpectIdentifier()
+{
+	assertf(Peek().kind == ETokenKind::Identifier, "Expected a name but found '%s' on line %d", Peek().text.c_str(), Peek().line);
+	return Next().text;
+}
+
+bool Parser::IsTypeName(const size_t ahead /*= 0*/) const
+{
+	const Token& token = Peek(ahead);
+	return token.kind == ETokenKind::Keyword && (token.text == "int" || token.text == "char" || token.text == "void" || token.text == "unsigned");
+}
+
+void Parser::ParseTopLevel(Program& program)
+{
+	assertf(IsTypeName(), "Expected a declaration but found '%s' on line %d", Peek().text.c_str(), Peek().line);
+
+	// Each name adds its own pointers to the base type, as in int a, *b
+	const Type base = ParseType();
+	for (bool first = true; first || Accept(","); first = false)
+	{
+		Type type = base;
+		while (Accept("*"))
+		{
+			type.pointers++;
+		}
+
+		const int32_t line = Peek().line;
+		const std::string name = ExpectIdentifier();
+		if (first && Accept("("))
+		{
+			Function function;
+			function.name = name;
+			function.result = type;
+			function.line = line;
+
+			// f(void) is the same as f()
+			if (Peek().text == "void" && Peek(1).text == ")")
+			{
+				Next();
+			}
+
+			if (!Accept(")"))
+			{
+				do
+				{
+					Parameter parameter;
+					parameter.type = ParseType();
+					while (Accept("*"))
+					{
+						parameter.type.pointers++;
+					}
+					parameter.name = ExpectIdentifier();
+					ParseArraySuffix(parameter.type, true);
+					function.parameters.push_back(std::move(parameter));
+				}
+				while (Accept(","));
+				Expect(")");
+			}
+
+			if (!Accept(";"))
+			{
+				function.body = ParseBlock();
+			}
+			program.functions.push_back(std::move(function));
+			return;
+		}
+
+		Global global;
+		global.name = name;
+		global.type = type;
+		global.line = line;
+		ParseArraySuffix(global.type, false);
+		if (Accept("="))
+		{
+			ParseInitialiser(global.values);
+		}
+		SizeArray(global.type, global.values, line);
+
+		program.globals.push_back(std::move(global));
+	}
+
+	Expect(";");
+}
+
+Type Parser::ParseType()
+{
+	assertf(IsTypeName(), "Expected a type but found '%s' on line %d", Peek().text.c_str(), Peek().line);
+
+	Type type;
+	type.isVoid = Next().text == "void";
+
+	// unsigned, unsigned int and unsigned char are all int
+	if (tokens[position - 1].text == "unsigned" && IsTypeName() && Peek().text != "void")
+	{
+		Next();
+	}
+
+	return type;
+}
+
+void Parser::ParseArraySuffix(Type& type, const bool parameter)
+{
+	if (!Accept("["))
+	{
+		return;
+	}
+
+	// An array parameter is a pointer, its length is only for the reader
+	if (parameter)
+	{
+		if (Peek().kind == ETokenKind::Number)
+		{
+			Next();
+		}
+		type.pointers++;
+	}
+	else
+	{
+		type.length = Peek().kind == ETokenKind::Number ? Next().value : 0;
+	}
+	Expect("]");
+}
+
+void Parser::SizeArray(Type& type, const std::vector<std::unique_ptr<Expr>>& values, const int32_t line) const
+{
+	// A string is its characters and a 0 after them
+	const int32_t words = values.size() == 1 && values[0]->kind == EExprKind::String ? static_cast<int32_t>(values[0]->name.size()) + 1 : static_cast<int32_t>(values.size());
+
+	assertf(!type.isVoid || type.pointers > 0, "Nothing can be void on line %d", line);
+	assertf(type.IsArray() || values.size() <= 1, "Only an array takes a list of values, on line %d", line);
+	if (type.IsArray())
+	{
+		type.length = type.length == 0 ? words : type.length;
+		assertf(type.length > 0, "An array needs a length or values on line %d", line);
+		assertf(words <= type.length, "Too many values for an array of %d on line %d", type.length, line);
+	}
+}
+
+std::unique_ptr<Stmt> Parser::ParseStatement()
+{
+	const Token& token = Peek();
+	const int32_t line = token.line;
+
+	if (token.text == "{" && token.kind == ETokenKind::Symbol)
+	{
+		return ParseBlock();
+	}
+
+	if (IsTypeName())
+	{
+		std::unique_ptr<Stmt> block = std::make_unique<Stmt>(EStmtKind::Block, line);
+		ParseDeclaration(block->body);
+		return block;
+	}
+
+	if (token.kind == ETokenKind::Keyword)
+	{
+		const std::string keyword = Next().text;
+		if (keyword == "if")
+		{
+			std::unique_ptr<Stmt> statement = std::make_unique<Stmt>(EStmtKind::If, line);
+			Expect("(");
+			statement->expr = ParseExpression();
+			Expect(")");
+			statement->body.push_back(ParseStatement());
+			if (Peek().text == "else" && Peek().kind == ETokenKind::Keyword)
+			{
+				Next();
+				statement->body.push_back(ParseStatement());
+			}
+			return statement;
+		}
+
+		if (keyword == "while")
+		{
+			std::unique_ptr<Stmt> statement = std::make_unique<Stmt>(EStmtKind::While, line);
+			Expect("(");
+			statement->expr = ParseExpression();
+			Expect(")");
+			statement->body.push_back(ParseStatement());
+			return statement;
+		}
+
+		if (keyword == "do")
+		{
+			std::unique_ptr<Stmt> statement = std::make_unique<Stmt>(EStmtKind::DoWhile, line);
+			statement->body.push_back(ParseStatement());
+			assertf(Peek().text == "while", "Expected 'while' after the body of a do on line %d", Peek().line);
+			Next();
+			Expect("(");
+			statement->expr = ParseExpression();
+			Expect(")");
+			Expect(";");
+			return statement;
+		}
+
+		if (keyword == "for")
+		{
+			std::unique_ptr<Stmt> statement = std::make_unique<Stmt>(EStmtKind::For, line);
+			Expect("(");
+			if (IsTypeName())
+			{
+				statement->init = std::make_unique<Stmt>(EStmtKind::Block, line);
+				ParseDeclaration(statement->init->body);
+			}
+			else if (!Accept(";"))
+			{
+				statement->init = std::make_unique<Stmt>(EStmtKind::Expression, line);
+				statement->init->expr = ParseExpression();
+				Expect(";");
+			}
+
+			if (!Accept(";"))
+			{
+				statement->expr = ParseExpression();
+				Expect(";");
+			}
+
+			if (!Accept(")"))
+			{
+				statement->step = ParseExpression();
+				Expect(")");
+			}
+
+			statement->body.push_back(ParseStatement());
+			return statement;
+		}
+
+		if (keyword == "break" || keyword == "continue")
+		{
+			Expect(";");
+			return std::make_unique<Stmt>(keyword == "break" ? EStmtKind::Break : EStmtKind::Continue, line);
+		}
+
+		if (keyword == "return")
+		{
+			std::unique_ptr<Stmt> statement = std::make_unique<Stmt>(EStmtKind::Return, line);
+			if (!Accept(";"))
+			{
+				statement->expr = ParseExpression();
+				Expect(";");
+			}
+			return statement;
+		}
+
+		assertf(false, "Unexpected '%s' on line %d", keyword.c_str(), line);
+	}
+
+	if (Accept(";"))
+	{
+		return std::make_unique<Stmt>(EStmtKind::Empty, line);
+	}
+
+	std::unique_ptr<Stmt> statement = std::make_unique<Stmt>(EStmtKind::Expression, line);
+	statement->expr = ParseExpression();
+	Expect(";");
+	return statement;
+}
+
+std::unique_ptr<Stmt> Parser::ParseBlock()
+{
+	std::unique_ptr<Stmt> block = std::make_unique<Stmt>(EStmtKind::Block, Peek().line);
+	Expect("{");
+	while (!Accept("}"))
+	{
+		assertf(Peek().kind != ETokenKind::End, "The block on line %d is never closed", block->line);
+		if (IsTypeName())
+		{
+			ParseDeclaration(block->body);
+		}
+		else
+		{
+			block->body.push_back(ParseStatement());
+		}
+	}
+
+	return block;
+}
+
+void Parser::ParseDeclaration(std::vector<std::unique_ptr<Stmt>>& statements)
+{
+	const Type base = ParseType();
+	do
+	{
+		std::unique_ptr<Stmt> statement = std::make_unique<Stmt>(EStmtKind::Declare, Peek().line);
+		statement->type = base;
+		while (Accept("*"))
+		{
+			statement->type.pointers++;
+		}
+
+		statement->name = ExpectIdentifier();
+		ParseArraySuffix(statement->type, false);
+		if (Accept("="))
+		{
+			ParseInitialiser(statement->values);
+		}
+		SizeArray(statement->type, statement->values, statement->line);
+
+		statements.push_back(std::move(statement));
+	}
+	while (Accept(","));
+
+	Expect(";");
+}
+
+void Parser::ParseInitialiser(std::vector<std::unique_ptr<Expr>>& values)
+{
+	if (!Accept("{"))
+	{
+		values.push_back(ParseAssignment());
+		return;
+	}
+
+	while (!Accept("}"))
+	{
+		values.push_back(ParseAssignment());
+		if (!Accept(","))
+		{
+			Expect("}");
+			break;
+		}
+	}
+}
+
+std::unique_ptr<Expr> Parser::ParseExpression()
+{
+	return ParseAssignment();
+}
+
+std::unique_ptr<Expr> Parser::ParseAssignment()
+{
+	static const char* ASSIGNMENTS[] = { "=", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "<<=", ">>=" };
+
+	std::unique_ptr<Expr> target = ParseConditional();
+	const Token& token = Peek();
+	if (token.kind != ETokenKind::Symbol || std::find_if(std::begin(ASSIGNMENTS), std::end(ASSIGNMENTS), [&token](const char* a) { return token.text == a; }) == std::end(ASSIGNMENTS))
+	{
+		return target;
+	}
+
+	std::unique_ptr<Expr> assign = std::make_unique<Expr>(EExprKind::Assign, token.line);
+	assign->op = Next().text;
+	assign->operands.push_back(std::move(target));
+	assign->operands.push_back(ParseAssignment());
+	return assign;
+}
+
+std::unique_ptr<Expr> Parser::ParseConditional()
+{
+	std::unique_ptr<Expr> condition = ParseBinary(1);
+	const int32_t line = Peek().line;
+	if (!Accept("?"))
+	{
+		return condition;
+	}
+
+	std::unique_ptr<Expr> select = std::make_unique<Expr>(EExprKind::Conditional, line);
+	select->operands.push_back(std::move(condition));
+	select->operands.push_back(ParseExpression());
+	Expect(":");
+	select->operands.push_back(ParseConditional());
+	return select;
+}
+
+std::unique_ptr<Expr> Parser::ParseBinary(const int32_t precedence)
+{
+	using namespace ParserPrivate;
+
+	std::unique_ptr<Expr> lhs = ParseUnary();
+	for (;;)
+	{
+		const Token& token = Peek();
+		const int32_t current = token.kind == ETokenKind::Symbol ? FindPrecedence(token.text) : -1;
+		if (current < precedence)
+		{
+			return lhs;
+		}
+
+		// Every operator is left associative, so the right hand side only takes tighter ones
+		std::unique_ptr<Expr> binary = std::make_unique<Expr>(EExprKind::Binary, token.line);
+		binary->op = Next().text;
+		binary->operands.push_back(std::move(lhs));
+		binary->operands.push_back(ParseBinary(current + 1));
+		lhs = std::move(binary);
+	}
+}
+
+std::unique_ptr<Expr> Parser::ParseUnary()
+{
+	const Token& token = Peek();
+	const int32_t line = token.line;
+	if (token.kind != ETokenKind::Symbol)
+	{
+		return ParsePostfix();
+	}
+
+	// A cast changes nothing, since every type is a word
+	if (token.text == "(" && IsTypeName(1))
+	{
+		Next();
+		ParseType();
+		while (Accept("*"))
+		{
+		}
+		Expect(")");
+		return ParseUnary();
+	}
+
+	if (token.text == "++" || token.text == "--")
+	{
+		std::unique_ptr<Expr> increment = std::make_unique<Expr>(EExprKind::Increment, line);
+		increment->op = Next().text;
+		increment->prefix = true;
+		increment->operands.push_back(ParseUnary());
+		return increment;
+	}
+
+	if (token.text == "+")
+	{
+		Next();
+		return ParseUnary();
+	}
+
+	if (token.text == "-" || token.text == "~" || token.text == "!" || token.text == "*" || token.text == "&")
+	{
+		std::unique_ptr<Expr> unary = std::make_unique<Expr>(EExprKind::Unary, line);
+		unary->op = Next().text;
+		unary->operands.push_back(ParseUnary());
+		return unary;
+	}
+
+	return ParsePostfix();
+}
+
+std::unique_ptr<Expr> Parser::ParsePostfix()
+{
+	std::unique_ptr<Expr> expr = ParsePrimary();
+	for (;;)
+	{
+		const int32_t line = Peek().line;
+		if (Accept("["))
+		{
+			std::unique_ptr<Expr> index = std::make_unique<Expr>(EExprKind::Index, line);
+			index->operands.push_back(std::move(expr));
+			index->operands.push_back(ParseExpression());
+			Expect("]");
+			expr = std::move(index);
+		}
+		else if (Peek().kind == ETokenKind::Symbol && Peek().text == "(")
+		{
+			assertf(expr->kind == EExprKind::Name, "Only a function can be called, on line %d", line);
+			Next();
+
+			std::unique_ptr<Expr> call = std::make_unique<Expr>(EExprKind::Call, line);
+			call->name = expr->name;
+			if (!Accept(")"))
+			{
+				do
+				{
+					call->operands.push_back(ParseAssignment());
+				}
+				while (Accept(","));
+				Expect(")");
+			}
+			expr = std::move(call);
+		}
+		else if (Peek().kind == ETokenKind::Symbol && (Peek().text == "++" || Peek().text == "--"))
+		{
+			std::unique_ptr<Expr> increment = std::make_unique<Expr>(EExprKind::Increment, line);
+			increment->op = Next().text;
+			increment->operands.push_back(std::move(expr));
+			expr = std::move(increment);
+		}
+		else
+		{
+			return expr;
+		}
+	}
+}
+
+std::unique_ptr<Expr> Parser::ParsePrimary()
+{
+	const Token& token = Next();
+	switch (token.kind)
+	{
+		case ETokenKind::Number:
+		{
+			std::unique_ptr<Expr> number = std::make_unique<Expr>(EExprKind::Number, token.line);
+			number->value = token.value;
+			return number;
+		}
+
+		case ETokenKind::String:
+		{
+			// Strings next to each other are joined, as in C
+			std::unique_ptr<Expr> string = std::make_unique<Expr>(EExprKind::String, token.line);
+			string->name = token.text;
+			while (Peek().kind == ETokenKind::String)
+			{
+				string->name += Next().text;
+			}
+			return string;
+		}
+
+		case ETokenKind::Identifier:
+		{
+			std::unique_ptr<Expr> name = std::make_unique<Expr>(EExprKind::Name, token.line);
+			name->name = token.text;
+			return name;
+		}
+
+		default:
+		{
+			assertf(token.text == "(", "Expected a value but found '%s' on line %d", token.text.c_str(), token.line);
+			std::unique_ptr<Expr> expr = ParseExpression();
+			Expect(")");
+			return expr;
+		}
+	}
+}
@@ -0,0 +1,391 @@
+//
+//	RegisterAllocator
+//
+
+#include "RegisterAllocator.h"
+
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+
+namespace RegisterAllocatorPrivate
+{
+	// x and y first, they never need saving
+	static const int32_t PREFERENCE[] = { 4, 5, 0, 1, 2, 3 };
+
+	void Insert(std::vector<int32_t>& indices, const int32_t index)
+	{
+		if (index >= 0)
+		{
+			indices.push_back(index);
+		}
+	}
+}
+
+Allocation RegisterAllocator::Allocate(const IRFunction& function)
+{
+	using namespace RegisterAllocatorPrivate;
+
+	count = function.registers;
+	words = static_cast<size_t>(count / 64 + 1);
+	FindLiveness(function);
+	FindHints(function);
+	interferes.assign(count, std::vector<bool>(count, false));
+
+	// Each value's interval runs from the first to the last instruction it is live or set in
+	std::vector<int32_t> start(count, INT_MAX);
+	std::vector<int32_t> end(count, -1);
+	std::vector<bool> crossesCall(count, false);
+	std::vector<int32_t> defines;
+	for (size_t i = 0; i < function.code.size(); i++)
+	{
+		const int32_t at = static_cast<int32_t>(i);
+		defines.clear();
+		Defines(function.code[i], defines);
+		FindInterference(function.code[i], defines, liveOut[i]);
+		for (int32_t v = 0; v < count; v++)
+		{
+			const bool defined = std::find(defines.begin(), defines.end(), v) != defines.end();
+			if (defined || IsLive(liveIn[i], v))
+			{
+				start[v] = std::min(start[v], at);
+				end[v] = std::max(end[v], at);
+			}
+
+			const EIROp op = function.code[i].op;
+			if ((op == EIROp::Call || op == EIROp::Sys) && !defined && IsLive(liveOut[i], v))
+			{
+				crossesCall[v] = true;
+			}
+		}
+	}
+
+	std::vector<int32_t> order;
+	for (int32_t v = 0; v < count; v++)
+	{
+		if (end[v] >= 0)
+		{
+			order.push_back(v);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [&start](const int32_t a, const int32_t b) { return start[a] < start[b]; });
+
+	Allocation allocation;
+	allocation.registers.assign(count, -1);
+	allocation.slots.assign(count, -1);
+
+	for (const int32_t v : order)
+	{
+		uint8_t busy = 0;
+		for (int32_t w = 0; w < count; w++)
+		{
+			if (allocation.registers[w] >= 0 && interferes[v][w])
+			{
+				busy |= static_cast<uint8_t>(1 << allocation.registers[w]);
+			}
+		}
+
+		const uint8_t allowed = crossesCall[v] ? 0b001111 : 0b111111;
+		const uint8_t free = allowed & ~busy;
+		auto available = [free](const int32_t reg) { return reg >= 0 && ((free >> reg) & 1) != 0; };
+
+		int32_t pick = -1;
+		const Hint& hint = hints[v];
+		if (available(hint.fixed))
+		{
+			pick = hint.fixed;
+		}
+		else if (hint.follows >= 0 && available(allocation.registers[hint.follows]))
+		{
+			pick = allocation.registers[hint.follows];
+		}
+		else
+		{
+			for (const int32_t reg : PREFERENCE)
+			{
+				if (available(reg))
+				{
+					pick = reg;
+					break;
+				}
+			}
+
+			// Of a to d, one that is already saved costs nothing more
+			for (int32_t reg = 0; pick >= 0 && pick < Allocation::X && reg < Allocation::X; reg++)
+			{
+				if (available(reg) && ((allocation.used >> reg) & 1) != 0)
+				{
+					pick = reg;
+					break;
+				}
+			}
+		}
+
+		if (pick < 0)
+		{
+			// Take the register whose values are all needed for longer than this one, if there
+			// is one, and put those values in memory instead
+			int32_t furthest = end[v];
+			for (int32_t reg = 0; reg < Allocation::REGISTER_COUNT; reg++)
+			{
+				int32_t nearest = INT_MAX;
+				for (int32_t w = 0; w < count && ((allowed >> reg) & 1) != 0; w++)
+				{
+					if (allocation.registers[w] == reg && interferes[v][w])
+					{
+						nearest = std::min(nearest, end[w]);
+					}
+				}
+				if (((allowed >> reg) & 1) != 0 && nearest > furthest)
+				{
+					furthest = nearest;
+					pick = reg;
+				}
+			}
+
+			if (pick < 0)
+			{
+				allocation.slots[v] = allocation.slotCount++;
+				continue;
+			}
+
+			for (int32_t w = 0; w < count; w++)
+			{
+				if (allocation.registers[w] == pick && interferes[v][w])
+				{
+					allocation.registers[w] = -1;
+					allocation.slots[w] = allocation.slotCount++;
+				}
+			}
+		}
+
+		allocation.registers[v] = pick;
+		allocation.used |= static_cast<uint8_t>(1 << pick);
+	}
+
+	allocation.liveOut = liveOut;
+	return allocation;
+}
+
+void RegisterAllocator::FindLiveness(const IRFunction& function)
+{
+	const size_t size = function.code.size();
+
+	std::unordered_map<std::string, size_t> labels;
+	for (size_t i = 0; i < size; i++)
+	{
+		if (function.code[i].op == EIROp::Label)
+		{
+			labels[function.code[i].label] = i;
+		}
+	}
+
+	// Where control can go after each instruction
+	std::vector<std::vector<size_t>> successors(size);
+	for (size_t i = 0; i < size; i++)
+	{
+		const IRInstruction& instruction = function.code[i];
+		if (instruction.op == EIROp::Jump || instruction.op == EIROp::Branch)
+		{
+			successors[i].push_back(labels.at(instruction.label));
+		}
+		if (instruction.op != EIROp::Jump && instruction.op != EIROp::Return && i + 1 < size)
+		{
+			successors[i].push_back(i + 1);
+		}
+	}
+
+	std::vector<std::vector<int32_t>> uses(size);
+	std::vector<std::vector<int32_t>> defines(size);
+	for (size_t i = 0; i < size; i++)
+	{
+		Uses(function.code[i], uses[i]);
+		Defines(function.code[i], defines[i]);
+	}
+
+	liveIn.assign(size, std::vector<uint64_t>(words, 0));
+	liveOut.assign(size, std::vector<uint64_t>(words, 0));
+
+	// Backwards until nothing changes, in = uses + (out - defines)
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+		for (size_t i = size; i-- > 0;)
+		{
+			std::vector<uint64_t> out(words, 0);
+			for (const size_t next : successors[i])
+			{
+				for (size_t w = 0; w < words; w++)
+				{
+					out[w] |= liveIn[next][w];
+				}
+			}
+
+			std::vector<uint64_t> in = out;
+			for (const int32_t v : defines[i])
+			{
+				in[v / 64] &= ~(uint64_t(1) << (v % 64));
+			}
+			for (const int32_t v : uses[i])
+			{
+				in[v / 64] |= uint64_t(1) << (v % 64);
+			}
+
+			if (in != liveIn[i] || out != liveOut[i])
+			{
+				liveIn[i] = std::move(in);
+				liveOut[i] = std::move(out);
+				changed = true;
+			}
+		}
+	}
+}
+
+void RegisterAllocator::FindInterference(const IRInstruction& instruction, const std::vector<int32_t>& defines, const std::vector<uint64_t>& out)
+{
+	std::vector<int32_t> live;
+	for (int32_t v = 0; v < count; v++)
+	{
+		if (IsLive(out, v))
+		{
+			live.push_back(v);
+		}
+	}
+
+	auto interfere = [this](const int32_t v, const int32_t w)
+	{
+		interferes[v][w] = true;
+		interferes[w][v] = true;
+	};
+
+	for (size_t i = 0; i < live.size(); i++)
+	{
+		for (size_t j = i + 1; j < live.size(); j++)
+		{
+			interfere(live[i], live[j]);
+		}
+	}
+
+	// What an instruction sets can't share with anything still needed after it, except for
+	// the value a move copies, since they are the same until one of them changes
+	const bool copy = instruction.op == EIROp::Compute && instruction.opcode == EOpCode::MOV && instruction.b.kind == EOperandKind::Register;
+	for (size_t i = 0; i < defines.size(); i++)
+	{
+		for (const int32_t w : live)
+		{
+			if (w != defines[i] && !(copy && w == instruction.b.index))
+			{
+				interfere(defines[i], w);
+			}
+		}
+		for (size_t j = i + 1; j < defines.size(); j++)
+		{
+			interfere(defines[i], defines[j]);
+		}
+	}
+}
+
+void RegisterAllocator::FindHints(const IRFunction& function)
+{
+	hints.assign(count, Hint{ -1, -1 });
+
+	auto fix = [this](const Operand& operand, const int32_t reg)
+	{
+		if (operand.kind == EOperandKind::Register && hints[operand.index].fixed < 0)
+		{
+			hints[operand.index].fixed = reg;
+		}
+	};
+
+	// Parameters, arguments and results that are in x and y anyway
+	for (const IRInstruction& instruction : function.code)
+	{
+		switch (instruction.op)
+		{
+			case EIROp::Entry:
+			case EIROp::Call:
+			{
+				for (size_t i = 0; i < instruction.arguments.size() && i < 2; i++)
+				{
+					fix(instruction.arguments[i], i == 0 ? Allocation::X : Allocation::Y);
+				}
+				fix(instruction.a, Allocation::X);
+			} break;
+
+			case EIROp::Sys:
+			case EIROp::Return:
+			{
+				for (const Operand& argument : instruction.arguments)
+				{
+					fix(argument, Allocation::X);
+				}
+				fix(instruction.a, Allocation::X);
+			} break;
+
+			case EIROp::Compute:
+			{
+				if (instruction.opcode == EOpCode::MOV && instruction.a.kind == EOperandKind::Register && instruction.b.kind == EOperandKind::Register)
+				{
+					hints[instruction.a.index].follows = instruction.b.index;
+				}
+			} break;
+
+			default:
+			{
+			} break;
+		}
+	}
+}
+
+void RegisterAllocator::Uses(const IRInstruction& instruction, std::vector<int32_t>& uses)
+{
+	using namespace RegisterAllocatorPrivate;
+
+	switch (instruction.op)
+	{
+		case EIROp::Compute:
+		{
+			// mov only writes a, unless a is an address in a register
+			if (instruction.opcode != EOpCode::MOV || instruction.a.kind == EOperandKind::Indirect)
+			{
+				Insert(uses, instruction.a.GetRegister());
+			}
+			Insert(uses, instruction.b.GetRegister());
+		} break;
+
+		case EIROp::Branch:
+		case EIROp::Return:
+		{
+			Insert(uses, instruction.a.GetRegister());
+			Insert(uses, instruction.b.GetRegister());
+		} break;
+
+		case EIROp::Call:
+		case EIROp::Sys:
+		{
+			for (const Operand& argument : instruction.arguments)
+			{
+				Insert(uses, argument.GetRegister());
+			}
+		} break;
+
+		default:
+		{
+		} break;
+	}
+}
+
+void RegisterAllocator::Defines(const IRInstruction& instruction, std::vector<int32_t>& defines)
+{
+	if (instruction.op == EIROp::Entry)
+	{
+		for (const Operand& parameter : instruction.arguments)
+		{
+			defines.push_back(parameter.index);
+		}
+	}
+	else if ((instruction.op == EIROp::Compute || instruction.op == EIROp::Call || instruction.op == EIROp::Sys) && instruction.a.kind == EOperandKind::Register)
+	{
+		defines.push_back(instruction.a.index);
+	}
+}
@@ -0,0 +1,84 @@
+//
+//	qcpu-dis - qcpu disassembler
+//
+
+#include "Assembler.h"
+#include "Disassembler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(const int argc, char* argv[])
+{
+	std::vector<std::string> args(argv + 1, argv + argc);
+
+	auto option = [&args](const char* name)
+	{
+		const auto flag = std::find(args.begin(), args.end(), name);
+		if (flag == args.end())
+		{
+			return false;
+		}
+
+		args.erase(flag);
+		return true;
+	};
+
+	// -a adds each line's address and words as a comment, -n ignores the .debug, and -c
+	// assembles the output again to check it gives back the same image
+	const bool addresses = option("-a");
+	const bool ignoreDebug = option("-n");
+	const bool check = option("-c");
+
+	if (args.empty() || args.size() > 2)
+	{
+		std::cout << "Usage: qcpu-dis [-a] [-n] [-c] <program> [output.asm]" << std::endl;
+		return 1;
+	}
+
+	AssemblyResult program;
+	bool hasDebug = false;
+	if (!Disassembler::Load(args[0], program, hasDebug))
+	{
+		std::cout << "Could not read " << args[0] << std::endl;
+		return 1;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+
+	Disassembler disassembler;
+	if (hasDebug && !ignoreDebug)
+	{
+		disassembler.SetDebugInfo(program.debug);
+	}
+	const std::string text = Disassembler::ToText(disassembler.Disassemble(program.image), program.image, addresses);
+
+	const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	if (args.size() == 2)
+	{
+		std::ofstream(args[1], std::ios::binary) << text;
+		std::cout << "Disassembled " << program.image.size() << " words in " << milliseconds << "ms" << std::endl;
+	}
+	else
+	{
+		std::cout << text;
+	}
+
+	if (check)
+	{
+		Assembler assembler;
+		assembler.LoadText(text);
+		if (assembler.Build().image != program.image)
+		{
+			std::cout << "The disassembly doesn't assemble back to " << args[0] << std::endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}
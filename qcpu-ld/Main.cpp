@@ -0,0 +1,28 @@
+//
+//	qcpu-ld - qcpu linker
+//
+
+#include "Assembler.h"
+#include "Linker.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(const int argc, char* argv[])
+{
+	if (argc <= 2)
+	{
+		std::cout << "Usage: qcpu-ld <output> <unit.asm|unit.qo>..." << std::endl;
+		return 1;
+	}
+
+	// The first unit is placed at address 0, so it should hold the entry point
+	const std::vector<std::string> units(argv + 2, argv + argc);
+
+	Linker linker;
+	linker.AddFiles(units);
+	Assembler::Save(linker.Link(), argv[1]);
+
+	return 0;
+}
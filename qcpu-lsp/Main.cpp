@@ -0,0 +1,84 @@
+//
+//	qcpu-lsp - qcpu language server
+//
+
+#include "Assembler.h"
+#include "LanguageServer.h"
+
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace LanguageServerMain
+{
+	// A message is a Content-Length header, a blank line, then that many bytes of JSON
+	bool ReadMessage(std::string& message)
+	{
+		size_t length = 0;
+		bool found = false;
+
+		std::string line;
+		while (std::getline(std::cin, line))
+		{
+			if (!line.empty() && line.back() == '\r')
+			{
+				line.pop_back();
+			}
+			if (line.empty())
+			{
+				break;
+			}
+
+			const std::string header = "Content-Length:";
+			if (line.compare(0, header.size(), header) == 0)
+			{
+				length = std::stoul(line.substr(header.size()));
+				found = true;
+			}
+		}
+
+		if (!found)
+		{
+			return false;
+		}
+
+		message.resize(length);
+		return static_cast<bool>(std::cin.read(message.data(), length));
+	}
+
+	void WriteMessage(const std::string& message)
+	{
+		std::cout << "Content-Length: " << message.size() << "\r\n\r\n" << message;
+		std::cout.flush();
+	}
+}
+
+int main()
+{
+	using namespace LanguageServerMain;
+
+#ifdef _WIN32
+	// Content-Length counts bytes, so line endings can't be translated
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	// A mistake in the file being edited is reported, it mustn't end the server
+	Assembler::ThrowErrors(true);
+
+	LanguageServer server;
+	std::string message;
+	while (!server.IsFinished() && ReadMessage(message))
+	{
+		for (const std::string& reply : server.Handle(message))
+		{
+			WriteMessage(reply);
+		}
+	}
+
+	return server.GetExitCode();
+}
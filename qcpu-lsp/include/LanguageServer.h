@@ -0,0 +1,55 @@
+//
+//	LanguageServer
+//
+
+#pragma once
+
+#include "SourceDocument.h"
+
+#include <cereal/external/rapidjson/document.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The language server protocol for qasm files, one JSON message at a time. How messages
+// arrive and leave is up to the caller, so the server itself never touches stdout.
+class LanguageServer
+{
+public:
+	LanguageServer();
+
+	// The replies and notifications to send for a message, in order
+	std::vector<std::string> Handle(const std::string& message);
+
+	// Set once the client has asked the server to exit
+	bool IsFinished() const { return finished; }
+	int GetExitCode() const { return shutdown ? 0 : 1; }
+
+	// file:///c%3A/dir/file.asm becomes c:/dir/file.asm
+	static std::string UriToPath(const std::string& uri);
+
+private:
+	using Value = rapidjson::Value;
+	using Allocator = rapidjson::Document::AllocatorType;
+
+	bool Initialize(Value& result, Allocator& allocator);
+	void Open(const Value& params);
+	void Change(const Value& params);
+	void Close(const Value& params);
+	bool Definition(const Value& params, Value& result, Allocator& allocator);
+	bool References(const Value& params, Value& result, Allocator& allocator);
+	bool Hover(const Value& params, Value& result, Allocator& allocator);
+
+	SourceDocument* FindDocument(const Value& params);
+	void Publish(const std::string& uri, const SourceDocument* document);
+
+private:
+	bool shutdown;
+	bool finished;
+	std::map<std::string, std::unique_ptr<SourceDocument>> documents;
+
+	// Notifications raised while handling a message, sent after its reply
+	std::vector<std::string> notifications;
+};
@@ -0,0 +1,98 @@
+//
+//	SourceDocument
+//
+
+#pragma once
+
+#include "Assembler.h"
+#include "LexItem.h"
+#include "TokenData.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Lines and characters count from 0, as they do in the protocol
+struct TextPosition
+{
+	int32_t line;
+	int32_t character;
+};
+
+struct TextRange
+{
+	TextPosition start;
+	TextPosition end;
+};
+
+struct Diagnostic
+{
+	TextRange range;
+	std::string message;
+};
+
+// A qasm file open in an editor. Each line is lexed on its own and kept until it is edited,
+// so a change only costs lexing the lines it touched, plus a linear pass over the tokens to
+// lay them out, find the labels and check them. A file that defines constants or macros,
+// or has an expression running over a line break, is lexed as a whole instead, like the
+// IncrementalAssembler does.
+class SourceDocument
+{
+public:
+	// .include paths are resolved against directory
+	explicit SourceDocument(const std::string& directory);
+
+	void SetText(const std::string& text);
+	// Replaces range with text, it is lexed by the next Update
+	void Edit(const TextRange& range, const std::string& text);
+	void Update();
+
+	const std::vector<Diagnostic>& GetDiagnostics() const { return diagnostics; }
+	// Lines that were lexed, rather than reused, by the last Update
+	size_t GetLexedLineCount() const { return lexedLines; }
+
+	bool FindDefinition(const TextPosition& position, TextRange& definition) const;
+	std::vector<TextRange> FindReferences(const TextPosition& position, const bool includeDeclaration) const;
+	// Markdown describing the instruction, register or label at position, or nothing
+	std::string Hover(const TextPosition& position, TextRange& range) const;
+
+private:
+	struct Line
+	{
+		std::string text;
+		bool dirty;
+		std::vector<LexItem> items;
+		int32_t lexedAt;	// the line number the items were lexed with, counting from 1
+		std::string error;
+	};
+
+private:
+	bool LexLines();
+	void LexWhole();
+	void Check();
+	void AddDiagnostic(const int32_t line, const std::string& message);
+
+	// The word under position, and where it is on its line
+	std::string FindWord(const TextPosition& position, TextRange& range) const;
+	// Where word appears as a whole word on a line, outside of comments and strings
+	std::vector<TextRange> FindOccurrences(const int32_t line, const std::string& word) const;
+
+private:
+	std::string directory;
+	Assembler assembler;
+	std::vector<Line> lines;
+	size_t lexedLines;
+
+	// Set while the file has to be lexed as a whole, then its items are kept here instead
+	bool whole;
+	std::vector<LexItem> wholeItems;
+
+	std::vector<TokenData> tokens;
+	Assembler::LabelMap labels;
+	std::vector<Diagnostic> diagnostics;
+
+	// The line each label or constant is defined on, and the lines each name is used on
+	std::unordered_map<std::string, int32_t> definitions;
+	std::unordered_map<std::string, std::vector<int32_t>> uses;
+};
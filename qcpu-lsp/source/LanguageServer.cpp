@@ -0,0 +1,434 @@
+//
+//	LanguageServer
+//
+
+#include "LanguageServer.h"
+
+#include <cereal/external/rapidjson/stringbuffer.h>
+#include <cereal/external/rapidjson/writer.h>
+
+#include <cctype>
+#include <filesystem>
+
+namespace LanguageServerPrivate
+{
+	using namespace rapidjson;
+
+	// Error codes from the protocol
+	const int PARSE_ERROR = -32700;
+	const int INVALID_REQUEST = -32600;
+	const int METHOD_NOT_FOUND = -32601;
+	const int INVALID_PARAMS = -32602;
+
+	// Sent as an incremental change, with a range
+	const int SYNC_INCREMENTAL = 2;
+
+	std::string ToString(const Value& value)
+	{
+		StringBuffer buffer;
+		Writer<StringBuffer> writer(buffer);
+		value.Accept(writer);
+		return std::string(buffer.GetString(), buffer.GetSize());
+	}
+
+	std::string GetString(const Value& object, const char* name)
+	{
+		if (!object.IsObject())
+		{
+			return std::string();
+		}
+		const auto it = object.FindMember(name);
+		return it != object.MemberEnd() && it->value.IsString() ? std::string(it->value.GetString(), it->value.GetStringLength()) : std::string();
+	}
+
+	const Value* GetObject(const Value& object, const char* name)
+	{
+		if (!object.IsObject())
+		{
+			return nullptr;
+		}
+		const auto it = object.FindMember(name);
+		return it != object.MemberEnd() && it->value.IsObject() ? &it->value : nullptr;
+	}
+
+	bool ReadPosition(const Value* value, TextPosition& position)
+	{
+		if (value == nullptr || !value->HasMember("line") || !value->HasMember("character") || !(*value)["line"].IsInt() || !(*value)["character"].IsInt())
+		{
+			return false;
+		}
+
+		position = TextPosition{ (*value)["line"].GetInt(), (*value)["character"].GetInt() };
+		return true;
+	}
+
+	bool ReadRange(const Value* value, TextRange& range)
+	{
+		return value != nullptr && ReadPosition(GetObject(*value, "start"), range.start) && ReadPosition(GetObject(*value, "end"), range.end);
+	}
+
+	Value WritePosition(const TextPosition& position, Document::AllocatorType& allocator)
+	{
+		Value value(kObjectType);
+		value.AddMember("line", position.line, allocator);
+		value.AddMember("character", position.character, allocator);
+		return value;
+	}
+
+	Value WriteRange(const TextRange& range, Document::AllocatorType& allocator)
+	{
+		Value value(kObjectType);
+		value.AddMember("start", WritePosition(range.start, allocator), allocator);
+		value.AddMember("end", WritePosition(range.end, allocator), allocator);
+		return value;
+	}
+
+	Value WriteLocation(const std::string& uri, const TextRange& range, Document::AllocatorType& allocator)
+	{
+		Value value(kObjectType);
+		value.AddMember("uri", Value(uri.c_str(), allocator), allocator);
+		value.AddMember("range", WriteRange(range, allocator), allocator);
+		return value;
+	}
+
+	std::string Reply(const Value* id, Value& result, Document& document)
+	{
+		document.SetObject();
+		document.AddMember("jsonrpc", "2.0", document.GetAllocator());
+		document.AddMember("id", id != nullptr ? Value(*id, document.GetAllocator()) : Value(kNullType), document.GetAllocator());
+		document.AddMember("result", result, document.GetAllocator());
+		return ToString(document);
+	}
+
+	std::string ReplyError(const Value* id, const int code, const std::string& message)
+	{
+		Document document(kObjectType);
+		Document::AllocatorType& allocator = document.GetAllocator();
+
+		Value error(kObjectType);
+		error.AddMember("code", code, allocator);
+		error.AddMember("message", Value(message.c_str(), allocator), allocator);
+
+		document.AddMember("jsonrpc", "2.0", allocator);
+		document.AddMember("id", id != nullptr ? Value(*id, allocator) : Value(kNullType), allocator);
+		document.AddMember("error", error, allocator);
+		return ToString(document);
+	}
+
+	int HexDigit(const char c)
+	{
+		return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+	}
+}
+
+LanguageServer::LanguageServer()
+	: shutdown(false)
+	, finished(false)
+	, documents()
+	, notifications()
+{
+}
+
+std::vector<std::string> LanguageServer::Handle(const std::string& message)
+{
+	using namespace LanguageServerPrivate;
+
+	rapidjson::Document request;
+	if (request.Parse(message.c_str(), message.size()).HasParseError())
+	{
+		return { ReplyError(nullptr, PARSE_ERROR, "Couldn't parse the message") };
+	}
+	if (!request.IsObject())
+	{
+		return { ReplyError(nullptr, INVALID_REQUEST, "The message isn't an object") };
+	}
+
+	const std::string method = GetString(request, "method");
+	const Value* id = request.HasMember("id") ? &request["id"] : nullptr;
+	static const Value empty(rapidjson::kObjectType);
+	const Value* params = GetObject(request, "params");
+	if (params == nullptr)
+	{
+		params = &empty;
+	}
+
+	// Messages without an id are notifications, which get no reply
+	rapidjson::Document reply;
+	Value result(rapidjson::kNullType);
+	bool handled = true;
+
+	notifications.clear();
+	if (method == "initialize")
+	{
+		handled = Initialize(result, reply.GetAllocator());
+	}
+	else if (method == "initialized")
+	{
+	}
+	else if (method == "shutdown")
+	{
+		shutdown = true;
+	}
+	else if (method == "exit")
+	{
+		finished = true;
+	}
+	else if (method == "textDocument/didOpen")
+	{
+		Open(*params);
+	}
+	else if (method == "textDocument/didChange")
+	{
+		Change(*params);
+	}
+	else if (method == "textDocument/didClose")
+	{
+		Close(*params);
+	}
+	else if (method == "textDocument/definition")
+	{
+		handled = Definition(*params, result, reply.GetAllocator());
+	}
+	else if (method == "textDocument/references")
+	{
+		handled = References(*params, result, reply.GetAllocator());
+	}
+	else if (method == "textDocument/hover")
+	{
+		handled = Hover(*params, result, reply.GetAllocator());
+	}
+	else if (id != nullptr)
+	{
+		return { ReplyError(id, METHOD_NOT_FOUND, "Unknown method: " + method) };
+	}
+
+	std::vector<std::string> messages;
+	if (id != nullptr)
+	{
+		messages.push_back(handled ? Reply(id, result, reply) : ReplyError(id, INVALID_PARAMS, "Invalid parameters for " + method));
+	}
+	messages.insert(messages.end(), notifications.begin(), notifications.end());
+	return messages;
+}
+
+std::string LanguageServer::UriToPath(const std::string& uri)
+{
+	using namespace LanguageServerPrivate;
+
+	const std::string scheme = "file://";
+	const std::string encoded = uri.compare(0, scheme.size(), scheme) == 0 ? uri.substr(scheme.size()) : uri;
+
+	std::string path;
+	for (size_t i = 0; i < encoded.size(); i++)
+	{
+		if (encoded[i] == '%' && i + 2 < encoded.size() && HexDigit(encoded[i + 1]) >= 0 && HexDigit(encoded[i + 2]) >= 0)
+		{
+			path += static_cast<char>(HexDigit(encoded[i + 1]) * 16 + HexDigit(encoded[i + 2]));
+			i += 2;
+		}
+		else
+		{
+			path += encoded[i];
+		}
+	}
+
+	// /c:/dir on Windows
+	if (path.size() >= 3 && path[0] == '/' && std::isalpha(static_cast<unsigned char>(path[1])) && path[2] == ':')
+	{
+		path.erase(0, 1);
+	}
+
+	return path;
+}
+
+bool LanguageServer::Initialize(Value& result, Allocator& allocator)
+{
+	using namespace LanguageServerPrivate;
+
+	Value sync(rapidjson::kObjectType);
+	sync.AddMember("openClose", true, allocator);
+	sync.AddMember("change", SYNC_INCREMENTAL, allocator);
+
+	Value capabilities(rapidjson::kObjectType);
+	capabilities.AddMember("textDocumentSync", sync, allocator);
+	capabilities.AddMember("definitionProvider", true, allocator);
+	capabilities.AddMember("referencesProvider", true, allocator);
+	capabilities.AddMember("hoverProvider", true, allocator);
+
+	Value info(rapidjson::kObjectType);
+	info.AddMember("name", "qcpu-lsp", allocator);
+
+	result.SetObject();
+	result.AddMember("capabilities", capabilities, allocator);
+	result.AddMember("serverInfo", info, allocator);
+	return true;
+}
+
+void LanguageServer::Open(const Value& params)
+{
+	using namespace LanguageServerPrivate;
+
+	const Value* item = GetObject(params, "textDocument");
+	if (item == nullptr)
+	{
+		return;
+	}
+
+	const std::string uri = GetString(*item, "uri");
+	const std::string directory = std::filesystem::path(UriToPath(uri)).parent_path().string();
+
+	std::unique_ptr<SourceDocument>& document = documents[uri];
+	document = std::make_unique<SourceDocument>(directory);
+	document->SetText(GetString(*item, "text"));
+	document->Update();
+	Publish(uri, document.get());
+}
+
+void LanguageServer::Change(const Value& params)
+{
+	using namespace LanguageServerPrivate;
+
+	SourceDocument* document = FindDocument(params);
+	const auto changes = params.FindMember("contentChanges");
+	if (document == nullptr || changes == params.MemberEnd() || !changes->value.IsArray())
+	{
+		return;
+	}
+
+	// Changes apply one after another, each to the text the one before it left
+	for (const Value& change : changes->value.GetArray())
+	{
+		TextRange range;
+		if (ReadRange(GetObject(change, "range"), range))
+		{
+			document->Edit(range, GetString(change, "text"));
+		}
+		else
+		{
+			document->SetText(GetString(change, "text"));
+		}
+	}
+
+	document->Update();
+	Publish(GetString(*GetObject(params, "textDocument"), "uri"), document);
+}
+
+void LanguageServer::Close(const Value& params)
+{
+	using namespace LanguageServerPrivate;
+
+	const Value* item = GetObject(params, "textDocument");
+	if (item != nullptr)
+	{
+		// Its errors go away with it
+		const std::string uri = GetString(*item, "uri");
+		documents.erase(uri);
+		Publish(uri, nullptr);
+	}
+}
+
+bool LanguageServer::Definition(const Value& params, Value& result, Allocator& allocator)
+{
+	using namespace LanguageServerPrivate;
+
+	const SourceDocument* document = FindDocument(params);
+	TextPosition position;
+	if (document == nullptr || !ReadPosition(GetObject(params, "position"), position))
+	{
+		return false;
+	}
+
+	TextRange range;
+	if (document->FindDefinition(position, range))
+	{
+		result = WriteLocation(GetString(*GetObject(params, "textDocument"), "uri"), range, allocator);
+	}
+	return true;
+}
+
+bool LanguageServer::References(const Value& params, Value& result, Allocator& allocator)
+{
+	using namespace LanguageServerPrivate;
+
+	const SourceDocument* document = FindDocument(params);
+	TextPosition position;
+	if (document == nullptr || !ReadPosition(GetObject(params, "position"), position))
+	{
+		return false;
+	}
+
+	const Value* context = GetObject(params, "context");
+	const bool includeDeclaration = context != nullptr && context->HasMember("includeDeclaration") && (*context)["includeDeclaration"].IsBool() && (*context)["includeDeclaration"].GetBool();
+	const std::string uri = GetString(*GetObject(params, "textDocument"), "uri");
+
+	result.SetArray();
+	for (const TextRange& range : document->FindReferences(position, includeDeclaration))
+	{
+		result.PushBack(WriteLocation(uri, range, allocator), allocator);
+	}
+	return true;
+}
+
+bool LanguageServer::Hover(const Value& params, Value& result, Allocator& allocator)
+{
+	using namespace LanguageServerPrivate;
+
+	const SourceDocument* document = FindDocument(params);
+	TextPosition position;
+	if (document == nullptr || !ReadPosition(GetObject(params, "position"), position))
+	{
+		return false;
+	}
+
+	TextRange range;
+	const std::string text = document->Hover(position, range);
+	if (!text.empty())
+	{
+		Value contents(rapidjson::kObjectType);
+		contents.AddMember("kind", "markdown", allocator);
+		contents.AddMember("value", Value(text.c_str(), allocator), allocator);
+
+		result.SetObject();
+		result.AddMember("contents", contents, allocator);
+		result.AddMember("range", WriteRange(range, allocator), allocator);
+	}
+	return true;
+}
+
+SourceDocument* LanguageServer::FindDocument(const Value& params)
+{
+	using namespace LanguageServerPrivate;
+
+	const Value* item = GetObject(params, "textDocument");
+	const auto it = item != nullptr ? documents.find(GetString(*item, "uri")) : documents.end();
+	return it != documents.end() ? it->second.get() : nullptr;
+}
+
+void LanguageServer::Publish(const std::string& uri, const SourceDocument* document)
+{
+	using namespace LanguageServerPrivate;
+
+	rapidjson::Document message(rapidjson::kObjectType);
+	Allocator& allocator = message.GetAllocator();
+
+	static const std::vector<Diagnostic> none;
+	Value diagnostics(rapidjson::kArrayType);
+	for (const Diagnostic& diagnostic : document != nullptr ? document->GetDiagnostics() : none)
+	{
+		Value value(rapidjson::kObjectType);
+		value.AddMember("range", WriteRange(diagnostic.range, allocator), allocator);
+		value.AddMember("severity", 1, allocator);
+		value.AddMember("source", "qcpu", allocator);
+		value.AddMember("message", Value(diagnostic.message.c_str(), allocator), allocator);
+		diagnostics.PushBack(value, allocator);
+	}
+
+	Value params(rapidjson::kObjectType);
+	params.AddMember("uri", Value(uri.c_str(), allocator), allocator);
+	params.AddMember("diagnostics", diagnostics, allocator);
+
+	message.AddMember("jsonrpc", "2.0", allocator);
+	message.AddMember("method", "textDocument/publishDiagnostics", allocator);
+	message.AddMember("params", params, allocator);
+	notifications.push_back(ToString(message));
+}
@@ -0,0 +1,562 @@
+//
+//	SourceDocument
+//
+
+#include "SourceDocument.h"
+
+#include "Expression.h"
+#include "ISA.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+
+namespace SourceDocumentPrivate
+{
+	bool IsWordChar(const char c)
+	{
+		return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+	}
+
+	// Constants, macros and .rept blocks carry state from one line to the next
+	bool IsStateful(std::string text)
+	{
+		std::transform(text.begin(), text.end(), text.begin(), tolower);
+		return text.find(".equ") != std::string::npos || text.find(".macro") != std::string::npos || text.find(".rept") != std::string::npos;
+	}
+
+	std::vector<std::string> SplitLines(const std::string& text)
+	{
+		std::vector<std::string> result;
+		size_t start = 0;
+		while (true)
+		{
+			const size_t end = text.find('\n', start);
+			std::string line = text.substr(start, end == std::string::npos ? std::string::npos : end - start);
+			line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+			result.push_back(std::move(line));
+
+			if (end == std::string::npos)
+			{
+				return result;
+			}
+			start = end + 1;
+		}
+	}
+
+	// The names an expression refers to, from the expression parser itself
+	std::vector<std::string> FindNames(const std::string_view text)
+	{
+		std::vector<std::string> names;
+		const Expression::Resolver record = [&names](const std::string_view name, ExpressionValue& value)
+		{
+			names.emplace_back(name);
+			value = ExpressionValue(1, 0);
+			return true;
+		};
+
+		ExpressionValue value;
+		Expression(text, record).Evaluate(value);
+		return names;
+	}
+
+	std::string Hex(const int32_t value)
+	{
+		char text[16];
+		snprintf(text, sizeof(text), "0x%04X", static_cast<unsigned int>(value));
+		return text;
+	}
+
+	const char* RoleName(const EOperandRole role)
+	{
+		switch (role)
+		{
+			case EOperandRole::Read: return "read";
+			case EOperandRole::Write: return "write";
+			case EOperandRole::ReadWrite: return "read and write";
+			case EOperandRole::Target: return "target";
+			default: return "";
+		}
+	}
+}
+
+SourceDocument::SourceDocument(const std::string& directory)
+	: directory(directory)
+	, assembler()
+	, lines()
+	, lexedLines(0)
+	, whole(false)
+	, wholeItems()
+	, tokens()
+	, labels()
+	, diagnostics()
+	, definitions()
+	, uses()
+{
+	assembler.SetDirectory(directory);
+}
+
+void SourceDocument::SetText(const std::string& text)
+{
+	lines.clear();
+	for (std::string& line : SourceDocumentPrivate::SplitLines(text))
+	{
+		lines.push_back(Line{ std::move(line), true, {}, 0, std::string() });
+	}
+}
+
+void SourceDocument::Edit(const TextRange& range, const std::string& text)
+{
+	auto clamp = [this](const TextPosition& position)
+	{
+		const int32_t line = std::clamp(position.line, 0, static_cast<int32_t>(lines.size()) - 1);
+		const int32_t character = std::clamp(position.character, 0, static_cast<int32_t>(lines[line].text.size()));
+		return TextPosition{ line, character };
+	};
+
+	if (lines.empty())
+	{
+		SetText(text);
+		return;
+	}
+
+	// The lines the range touches become the text in between what comes before and after it
+	const TextPosition start = clamp(range.start);
+	const TextPosition end = clamp(range.end);
+	const std::string joined = lines[start.line].text.substr(0, start.character) + text + lines[end.line].text.substr(end.character);
+
+	std::vector<Line> replacement;
+	for (std::string& line : SourceDocumentPrivate::SplitLines(joined))
+	{
+		replacement.push_back(Line{ std::move(line), true, {}, 0, std::string() });
+	}
+
+	lines.erase(lines.begin() + start.line, lines.begin() + end.line + 1);
+	lines.insert(lines.begin() + start.line, std::make_move_iterator(replacement.begin()), std::make_move_iterator(replacement.end()));
+}
+
+void SourceDocument::Update()
+{
+	const bool stateful = std::any_of(lines.begin(), lines.end(), [](const Line& line) { return SourceDocumentPrivate::IsStateful(line.text); });
+	if (stateful || !LexLines())
+	{
+		LexWhole();
+	}
+
+	Check();
+}
+
+bool SourceDocument::LexLines()
+{
+	whole = false;
+	wholeItems.clear();
+	lexedLines = 0;
+
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		Line& line = lines[i];
+		if (!line.dirty)
+		{
+			continue;
+		}
+
+		const int32_t number = static_cast<int32_t>(i) + 1;
+		line.items.clear();
+		line.error.clear();
+		line.lexedAt = number;
+		line.dirty = false;
+		lexedLines++;
+
+		try
+		{
+			int32_t depth = 0;
+			line.items = assembler.Lex(line.text, number, &depth);
+			if (depth != 0)
+			{
+				line.dirty = true;
+				return false;
+			}
+		}
+		catch (const AssemblyError& error)
+		{
+			// The assembler may have been part way into an include or a macro
+			line.error = error.what();
+			assembler = Assembler();
+			assembler.SetDirectory(directory);
+		}
+	}
+
+	return true;
+}
+
+void SourceDocument::LexWhole()
+{
+	whole = true;
+	wholeItems.clear();
+
+	std::string text;
+	for (Line& line : lines)
+	{
+		text += line.text;
+		text += '\n';
+
+		// Lexed again on their own once the file no longer needs this
+		line.dirty = true;
+		line.items.clear();
+		line.error.clear();
+	}
+	lexedLines = lines.size();
+
+	try
+	{
+		wholeItems = assembler.Lex(text);
+	}
+	catch (const AssemblyError& error)
+	{
+		wholeItems.clear();
+		const size_t at = static_cast<size_t>(std::max(error.line, 1)) - 1;
+		if (at < lines.size())
+		{
+			lines[at].error = error.what();
+		}
+		assembler = Assembler();
+		assembler.SetDirectory(directory);
+	}
+}
+
+void SourceDocument::Check()
+{
+	using namespace SourceDocumentPrivate;
+
+	diagnostics.clear();
+	definitions.clear();
+	uses.clear();
+	tokens.clear();
+
+	int32_t address = 0;
+	if (whole)
+	{
+		Assembler::Layout(wholeItems, 0, address, tokens);
+	}
+
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		if (!lines[i].error.empty())
+		{
+			AddDiagnostic(static_cast<int32_t>(i), lines[i].error);
+		}
+		if (!whole)
+		{
+			Assembler::Layout(lines[i].items, static_cast<int32_t>(i) + 1 - lines[i].lexedAt, address, tokens);
+		}
+	}
+
+	labels = Assembler::BuildLabelTable(tokens);
+
+	auto use = [this](const std::string& name, const int32_t line)
+	{
+		std::vector<int32_t>& at = uses[name];
+		if (at.empty() || at.back() != line)
+		{
+			at.push_back(line);
+		}
+	};
+
+	// Labels and constants first, so that uses before their definition are known
+	for (const TokenData& token : tokens)
+	{
+		const int32_t line = token.line - 1;
+		std::string name;
+		if (token.type == ETokenType::Label && token.data != "+" && token.data != "-")
+		{
+			name = token.data;
+		}
+		else if (token.type == ETokenType::Equ)
+		{
+			name = token.data.substr(0, token.data.find('='));
+		}
+		else
+		{
+			continue;
+		}
+
+		const auto defined = definitions.find(name);
+		if (defined != definitions.end())
+		{
+			AddDiagnostic(line, name + " is already defined on line " + std::to_string(defined->second + 1));
+		}
+		else
+		{
+			definitions[name] = line;
+		}
+	}
+
+	bool unresolved = false;
+	for (size_t i = 0; i < tokens.size(); i++)
+	{
+		const TokenData& token = tokens[i];
+		const int32_t line = token.line - 1;
+
+		std::vector<std::string> names;
+		switch (token.type)
+		{
+			case ETokenType::ImmediateLabelReference:
+			case ETokenType::AbsoluteLabelReference:
+			{
+				if (token.data != "+" && token.data != "-")
+				{
+					names.push_back(token.data[0] == '$' ? token.data.substr(1) : token.data);
+				}
+			} break;
+
+			case ETokenType::Expression:
+			case ETokenType::AbsoluteExpression:
+			{
+				names = FindNames(std::string_view(token.data).substr(token.type == ETokenType::AbsoluteExpression ? 1 : 0));
+			} break;
+
+			case ETokenType::Equ:
+			{
+				for (const std::string& name : FindNames(std::string_view(token.data).substr(token.data.find('=') + 1)))
+				{
+					use(name, line);
+				}
+			} break;
+
+			case ETokenType::Op:
+			{
+				// An instruction needs as many operands as it takes, and can't write to a constant
+				const Instruction* instruction = FindInstruction(token.data);
+				for (size_t j = 0; instruction != nullptr && j < instruction->arity; j++)
+				{
+					const ETokenType operand = i + 1 + j < tokens.size() ? tokens[i + 1 + j].type : ETokenType::None;
+					if (operand == ETokenType::Op || operand == ETokenType::Label || operand == ETokenType::None)
+					{
+						AddDiagnostic(line, token.data + " takes " + std::to_string(instruction->arity) + " operands but is given " + std::to_string(j));
+						break;
+					}
+
+					const EOperandRole role = instruction->roles[j];
+					const bool constant = operand == ETokenType::Immediate || operand == ETokenType::ImmediateLabelReference || operand == ETokenType::Expression;
+					if (constant && (role == EOperandRole::Write || role == EOperandRole::ReadWrite))
+					{
+						AddDiagnostic(tokens[i + 1 + j].line - 1, "Operand " + std::to_string(j + 1) + " of " + token.data + " is written to, so it can't be a constant");
+					}
+				}
+			} break;
+
+			default:
+			{
+			} break;
+		}
+
+		for (const std::string& name : names)
+		{
+			use(name, line);
+			if (definitions.find(name) == definitions.end())
+			{
+				AddDiagnostic(line, "Couldn't find label: " + name);
+				unresolved = true;
+			}
+		}
+	}
+
+	// Anything else is found by converting, which stops at the first error. Every missing
+	// label has been reported above, so there is no need to stop at the first of those.
+	if (!unresolved && diagnostics.empty())
+	{
+		try
+		{
+			assembler.Convert(tokens, labels);
+		}
+		catch (const AssemblyError& error)
+		{
+			AddDiagnostic(std::max(error.line, 1) - 1, error.what());
+		}
+	}
+}
+
+void SourceDocument::AddDiagnostic(const int32_t line, const std::string& message)
+{
+	// The whole line without its indentation
+	const std::string& text = line >= 0 && static_cast<size_t>(line) < lines.size() ? lines[line].text : std::string();
+	const size_t first = text.find_first_not_of(" \t");
+	const int32_t start = first == std::string::npos ? 0 : static_cast<int32_t>(first);
+	diagnostics.push_back(Diagnostic{ TextRange{ TextPosition{ line, start }, TextPosition{ line, static_cast<int32_t>(text.size()) } }, message });
+}
+
+bool SourceDocument::FindDefinition(const TextPosition& position, TextRange& definition) const
+{
+	TextRange range;
+	const std::string word = FindWord(position, range);
+	const auto it = definitions.find(word);
+	if (word.empty() || it == definitions.end())
+	{
+		return false;
+	}
+
+	const std::vector<TextRange> occurrences = FindOccurrences(it->second, word);
+	definition = occurrences.empty() ? TextRange{ TextPosition{ it->second, 0 }, TextPosition{ it->second, 0 } } : occurrences.front();
+	return true;
+}
+
+std::vector<TextRange> SourceDocument::FindReferences(const TextPosition& position, const bool includeDeclaration) const
+{
+	TextRange range;
+	const std::string word = FindWord(position, range);
+	const auto defined = definitions.find(word);
+	if (word.empty() || defined == definitions.end())
+	{
+		return {};
+	}
+
+	std::vector<int32_t> at;
+	const auto used = uses.find(word);
+	if (used != uses.end())
+	{
+		at = used->second;
+	}
+	if (includeDeclaration)
+	{
+		at.push_back(defined->second);
+	}
+	std::sort(at.begin(), at.end());
+	at.erase(std::unique(at.begin(), at.end()), at.end());
+
+	// The definition is the occurrence followed by a ':' or an '=' on its line
+	std::vector<TextRange> references;
+	for (const int32_t line : at)
+	{
+		for (const TextRange& occurrence : FindOccurrences(line, word))
+		{
+			const std::string& text = lines[line].text;
+			const size_t next = text.find_first_not_of(" \t", occurrence.end.character);
+			const bool declaration = line == defined->second && next != std::string::npos && (text[next] == ':' || text[next] == '=' || text[next] == ',');
+			if (includeDeclaration || !declaration)
+			{
+				references.push_back(occurrence);
+			}
+		}
+	}
+
+	return references;
+}
+
+std::string SourceDocument::Hover(const TextPosition& position, TextRange& range) const
+{
+	using namespace SourceDocumentPrivate;
+
+	const std::string word = FindWord(position, range);
+	if (word.empty())
+	{
+		return std::string();
+	}
+
+	const Instruction* instruction = FindInstruction(word);
+	if (instruction != nullptr)
+	{
+		std::string signature = instruction->mnemonic;
+		for (size_t i = 0; i < instruction->arity; i++)
+		{
+			signature += std::string(" <") + RoleName(instruction->roles[i]) + ">";
+		}
+
+		std::string text = "```qasm\n" + signature + "\n```\n" + std::to_string(instruction->arity) + (instruction->arity == 1 ? " operand" : " operands")
+			+ ", encoded in " + std::to_string(1 + instruction->arity) + (instruction->arity == 0 ? " word" : " words")
+			+ ", " + std::to_string(instruction->cycles) + (instruction->cycles == 1 ? " cycle" : " cycles");
+
+		for (const TokenData& token : tokens)
+		{
+			if (token.type == ETokenType::Op && token.line == position.line + 1 && token.data == word)
+			{
+				text += ", at " + Hex(token.address);
+				break;
+			}
+		}
+		return text;
+	}
+
+	for (const RegisterData& reg : Assembler::REGISTERS)
+	{
+		if (reg.name == word)
+		{
+			return "Register " + reg.name + ", encoded as " + std::to_string(reg.value);
+		}
+	}
+
+	const auto label = labels.find(word);
+	if (label != labels.end())
+	{
+		return "Label " + word + " at " + Hex(label->second) + " (" + std::to_string(label->second) + ")";
+	}
+
+	const auto defined = definitions.find(word);
+	if (defined != definitions.end())
+	{
+		return "Constant " + word + ", defined on line " + std::to_string(defined->second + 1);
+	}
+
+	return std::string();
+}
+
+std::string SourceDocument::FindWord(const TextPosition& position, TextRange& range) const
+{
+	using namespace SourceDocumentPrivate;
+
+	if (position.line < 0 || static_cast<size_t>(position.line) >= lines.size())
+	{
+		return std::string();
+	}
+
+	const std::string& text = lines[position.line].text;
+	int32_t start = std::clamp(position.character, 0, static_cast<int32_t>(text.size()));
+	int32_t end = start;
+	while (start > 0 && IsWordChar(text[start - 1]))
+	{
+		start--;
+	}
+	while (end < static_cast<int32_t>(text.size()) && IsWordChar(text[end]))
+	{
+		end++;
+	}
+
+	range = TextRange{ TextPosition{ position.line, start }, TextPosition{ position.line, end } };
+	return text.substr(start, end - start);
+}
+
+std::vector<TextRange> SourceDocument::FindOccurrences(const int32_t line, const std::string& word) const
+{
+	using namespace SourceDocumentPrivate;
+
+	std::vector<TextRange> occurrences;
+	const std::string& text = lines[line].text;
+	char quote = 0;
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		const char c = text[i];
+		if (quote != 0)
+		{
+			quote = c == quote ? 0 : quote;
+			continue;
+		}
+		if (c == '\'' || c == '"')
+		{
+			quote = c;
+			continue;
+		}
+		if (c == ';' || c == '#')
+		{
+			break;
+		}
+
+		if (text.compare(i, word.size(), word) == 0 && (i == 0 || !IsWordChar(text[i - 1]))
+			&& (i + word.size() == text.size() || !IsWordChar(text[i + word.size()])))
+		{
+			const int32_t start = static_cast<int32_t>(i);
+			occurrences.push_back(TextRange{ TextPosition{ line, start }, TextPosition{ line, start + static_cast<int32_t>(word.size()) } });
+			i += word.size() - 1;
+		}
+	}
+
+	return occurrences;
+}
@@ -7,4 +7,7 @@
 const uint16_t SCREEN_WIDTH = 512;
 const uint16_t SCREEN_HEIGHT = 512;
 const uint16_t TEXTURE_WIDTH = 512;
-const uint16_t TEXTURE_HEIGHT = 512;
\ No newline at end of file
+const uint16_t TEXTURE_HEIGHT = 512;
+
+// Where decoded programs are cached between runs, relative to the working directory
+const char* const TRANSLATION_CACHE_DIRECTORY = "cache";
\ No newline at end of file
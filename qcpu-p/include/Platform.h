@@ -6,6 +6,7 @@
 
 #include "DebugInfo.h"
 #include "Display.h"
+#include "IncrementalAssembler.h"
 #include "OpenGL/Quad.h"
 #include "OpenGL/Shader.h"
 #include "OpenGL/Texture.h"
@@ -62,6 +63,18 @@ public:
 		return -1;
 	}
 
+	// Replaces the loaded info, used when a program is assembled in memory
+	void Set(const DebugInfo& debug)
+	{
+		info = debug;
+	}
+
+	// Used as roots when verifying a loaded program
+	std::vector<uint16_t> GetEntryPoints() const
+	{
+		return info.GetEntryPoints();
+	}
+
 private:
 
 	DebugInfo info;
@@ -85,6 +98,8 @@ public:
 private:
 
 	void LoadProgram(Display& display, QCPU& cpu, const std::string& program);
+	void LoadResult(Display& display, QCPU& cpu, const AssemblyResult& result);
+	void HotPatch(Display& display, QCPU& cpu, const std::string& directory);
 
 	void UpdateUI(Display& display, QCPU& cpu);
 	void RenderDisplay();
@@ -99,6 +114,7 @@ private:
 	MemoryEditor m_MemoryEditor;
 	TextEditor m_TextEditor;
 	Debugger m_Debugger;
+	IncrementalAssembler m_IncrementalAssembler;
 
 	SDL_Window* m_Window;
 	SDL_GLContext m_GlContext;
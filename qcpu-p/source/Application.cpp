@@ -59,12 +59,21 @@ int32_t Application::Run()
 		}
 	}
 
-	return 0;
+	return m_Cpu.flags.fault ? 1 : 0;
 }
 
 void Application::Bind()
 {
 	m_Cpu.Load(m_Filename);
+
+	// A warm cache already holds the verification results, so only verify on a miss
+	if (!m_Cpu.LoadTranslationCache(TRANSLATION_CACHE_DIRECTORY))
+	{
+		Debugger debugger;
+		debugger.Load(m_Filename);
+		m_Cpu.Verify(debugger.GetEntryPoints());
+	}
+
 	m_Cpu.Bind(0x06, [this](const OpArgs& args) { Bind_0x06(); });
 	m_Cpu.Bind(0x07, [this](const OpArgs& args) { Bind_0x07(); });
 	m_Cpu.Bind(0x15, [this](const OpArgs& args) { Bind_0x15(); });
@@ -156,7 +165,7 @@ void Application::Bind_0x0C()
 void Application::Update()
 {
 	static bool benchprint = false;
-	if (m_Cpu.flags.exit != -1)
+	if (m_Cpu.flags.exit != -1 || m_Cpu.flags.fault)
 	{
 		if (benchprint)
 		{
@@ -164,14 +173,33 @@ void Application::Update()
 		}
 
 		const double elapsed = m_BenchTimer.ElapsedMilliSeconds();
+		m_Cpu.SaveTranslationCache(TRANSLATION_CACHE_DIRECTORY);
+		if constexpr (QCPU::Policy::RecordProfile)
+		{
+			// For the assembler's -P, see Profile.h
+			m_Cpu.profile.Save(m_Filename + ".profile");
+		}
 
 		outputfile.close(); 
 		std::ifstream f("log.txt");
 		std::cout << f.rdbuf();
 
 		printf("\n");
-		printf("> exited with code %d \n", m_Cpu.flags.exit);
-		printf("> cycle count: %d \n", m_Cpu.cycleCount);
+		if (m_Cpu.flags.fault)
+		{
+			const Fault& fault = m_Cpu.fault;
+			printf("> fault: %s pc=0x%04X opcode=%s operands=", EnumToString(fault.code), fault.pc, EnumToString(fault.opcode));
+			for (uint16_t i = 0; i < fault.operandCount; i++)
+			{
+				printf("%s%s:%d", i > 0 ? "," : "", EnumToString(fault.operands[i].mode), fault.operands[i].value);
+			}
+			printf("\n");
+		}
+		else
+		{
+			printf("> exited with code %d \n", m_Cpu.flags.exit);
+		}
+		printf("> cycle count: %llu \n", static_cast<unsigned long long>(m_Cpu.cycleCount));
 		printf("> execution time: %.3f ms\n", elapsed);
 		printf("> ms/cycle: %.3f ms\n", (elapsed / m_Cpu.cycleCount));
 		benchprint = true;
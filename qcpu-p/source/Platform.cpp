@@ -12,6 +12,21 @@
 #include <imgui/backends/imgui_impl_sdl.h>
 #include <imgui/backends/imgui_impl_opengl3.h>
 
+namespace PlatformPrivate
+{
+	// The memory editor writes through a plain function pointer, so the cpu being edited is held here
+	static QCPU* s_EditedCpu = nullptr;
+
+	static void WriteMemory(ImU8* data, size_t offset, ImU8 value)
+	{
+		data[offset] = value;
+		if (s_EditedCpu != nullptr)
+		{
+			s_EditedCpu->InvalidateRange(static_cast<uint16_t>(offset / sizeof(uint16_t)), 1);
+		}
+	}
+}
+
 Platform::Platform(uint16_t width, uint16_t height)
 	: m_Width(width)
 	, m_Height(height)
@@ -97,9 +112,9 @@ void Platform::Init()
 	m_QuadShader.SetInt("inTexture", 0);
 
 	TextEditor::LanguageDefinition lang = TextEditor::LanguageDefinition::QASM();
-	for (const Opcode& op : Assembler::OPS)
+	for (const Instruction& instruction : INSTRUCTIONS)
 	{
-		lang.mKeywords.insert(op.name);
+		lang.mKeywords.insert(instruction.mnemonic);
 	}
 
 	for (const RegisterData& reg : Assembler::REGISTERS)
@@ -110,7 +125,7 @@ void Platform::Init()
 	}
 
 	static const char* const s_Directives[] = {
-		".text", ".org", ".ds"
+		".text", ".org", ".ds", ".include", ".equ", ".macro", ".endm", ".rept", ".endr"
 	};
 
 	for (auto& directive : s_Directives)
@@ -120,6 +135,8 @@ void Platform::Init()
 
 	m_TextEditor.SetLanguageDefinition(lang);
 	m_TextEditor.SetReadOnly(false);
+
+	m_MemoryEditor.WriteFn = &PlatformPrivate::WriteMemory;
 }
 
 void Platform::Shutdown()
@@ -256,6 +273,46 @@ void Platform::LoadProgram(Display& display, QCPU& cpu, const std::string& progr
 {
 	display.Init();
 	cpu.Load(program.c_str());
+
+	Debugger debugger;
+	debugger.Load(program);
+	cpu.Verify(debugger.GetEntryPoints());
+}
+
+void Platform::LoadResult(Display& display, QCPU& cpu, const AssemblyResult& result)
+{
+	display.Init();
+	cpu.LoadImage(result.image);
+	cpu.Verify(result.GetEntryPoints());
+	m_Debugger.Set(result.debug);
+}
+
+void Platform::HotPatch(Display& display, QCPU& cpu, const std::string& directory)
+{
+	const ImageDelta delta = m_IncrementalAssembler.Assemble(m_TextEditor.GetText(), directory);
+	const AssemblyResult& result = m_IncrementalAssembler.GetResult();
+
+	if (delta.relayout)
+	{
+		// Code moved, so the pc and return addresses can't be trusted, start the new image over
+		LoadResult(display, cpu, result);
+		return;
+	}
+
+	m_Debugger.Set(result.debug);
+
+	// Only words that changed between assemblies are written, anything the program
+	// has stored since it was loaded is left alone
+	for (const auto& word : delta.words)
+	{
+		cpu.memory[word.first] = word.second;
+		cpu.InvalidateRange(word.first, 1);
+	}
+
+	if (!delta.words.empty())
+	{
+		cpu.Verify(result.GetEntryPoints());
+	}
 }
 
 void Platform::UpdateUI(Display& display, QCPU& cpu)
@@ -335,7 +392,8 @@ void Platform::UpdateUI(Display& display, QCPU& cpu)
 
 	if (s_ShowMemoryWindow)
 	{
-		m_MemoryEditor.DrawWindow("Memory Editor", cpu.memory, 0xFFFF, &s_ShowMemoryWindow);
+		PlatformPrivate::s_EditedCpu = &cpu;
+		m_MemoryEditor.DrawWindow("Memory Editor", cpu.memory, sizeof(cpu.memory), &s_ShowMemoryWindow);
 	}
 
 	if (s_ShowTextWindow)
@@ -442,21 +500,23 @@ void Platform::UpdateUI(Display& display, QCPU& cpu)
 						run = true;
 					}
 
+					if (ImGui::MenuItem("Hot Patch"))
+					{
+						HotPatch(display, cpu, std::filesystem::path(s_CurrentProgramPath).parent_path().string());
+					}
+
 					if (build)
 					{
-						Assembler avengers(s_CurrentProgramPath);
-						const std::vector<uint8_t>& text = avengers.Assemble();
+						// The editor's text is assembled in memory, and is what later hot patches are compared against
+						m_IncrementalAssembler.Reset();
+						m_IncrementalAssembler.Assemble(m_TextEditor.GetText(), std::filesystem::path(s_CurrentProgramPath).parent_path().string());
+						const AssemblyResult& result = m_IncrementalAssembler.GetResult();
 
-						std::string newFile = "programs/" + s_CurrentProgramName;
-						std::ofstream file(newFile, std::ios::out | std::ios::binary);
-						if (!text.empty())
-						{
-							file.write(reinterpret_cast<const char*>(text.data()), text.size());
-						}
+						Assembler::Save(result, "programs/" + s_CurrentProgramName);
 
 						if (run)
 						{
-							LoadProgram(display, cpu, newFile);
+							LoadResult(display, cpu, result);
 						}
 
 						build = false;
@@ -571,6 +631,12 @@ void Platform::UpdateUI(Display& display, QCPU& cpu)
 			ImGui::Text("Flags");
 			ImGui::Text("Halt: %d", cpu.flags.halt);
 			ImGui::Text("Stop: %d", cpu.flags.exit);
+			ImGui::Text("Carry: %d", cpu.flags.carry ? 1 : 0);
+
+			if (cpu.fault.code != EFault::None)
+			{
+				ImGui::Text("Fault: %s at 0x%04X (%s)", EnumToString(cpu.fault.code), cpu.fault.pc, EnumToString(cpu.fault.opcode));
+			}
 		}
 		ImGui::End();
 	}
@@ -0,0 +1,185 @@
+//
+//	qcpu-so - qcpu superoptimizer
+//
+
+#include "Assembler.h"
+#include "Superoptimizer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace SuperoptimizerMain
+{
+	// Every run of 2 to length instructions in the program that the superoptimizer can search
+	// for. A run ends at a label, since something else can jump into the middle of it.
+	void CollectWindows(const AssemblyResult& result, const int32_t length, std::set<std::vector<uint16_t>>& windows)
+	{
+		std::set<int32_t> labels;
+		for (const TokenData& token : result.debug.tokens)
+		{
+			if (token.type == ETokenType::Label)
+			{
+				labels.insert(token.address);
+			}
+		}
+
+		std::vector<std::vector<uint16_t>> run;
+		int32_t end = -1;
+		for (const TokenData& token : result.debug.tokens)
+		{
+			if (token.type != ETokenType::Op || token.address < 0 || static_cast<size_t>(token.address) >= result.image.size())
+			{
+				continue;
+			}
+
+			const Instruction* instruction = FindInstruction(result.image[token.address] & 0x00FF);
+			const size_t size = instruction != nullptr ? 1 + instruction->arity : 1;
+			const std::vector<uint16_t> words(result.image.begin() + token.address, result.image.begin() + std::min(result.image.size(), token.address + size));
+
+			if (!Superoptimizer::IsSupported(words) || token.address != end || labels.count(token.address) != 0)
+			{
+				run.clear();
+			}
+
+			end = token.address + static_cast<int32_t>(size);
+			if (!Superoptimizer::IsSupported(words))
+			{
+				continue;
+			}
+
+			run.push_back(words);
+			for (size_t count = 2; count <= std::min(run.size(), static_cast<size_t>(length)); count++)
+			{
+				std::vector<uint16_t> window;
+				for (size_t i = run.size() - count; i < run.size(); i++)
+				{
+					window.insert(window.end(), run[i].begin(), run[i].end());
+				}
+				windows.insert(window);
+			}
+		}
+	}
+
+	int32_t CountInstructions(const std::vector<uint16_t>& words)
+	{
+		int32_t count = 0;
+		for (size_t offset = 0; offset < words.size(); count++)
+		{
+			offset += 1 + FindInstruction(words[offset] & 0x00FF)->arity;
+		}
+
+		return count;
+	}
+
+	std::string Describe(const std::vector<uint16_t>& words)
+	{
+		const int32_t count = CountInstructions(words);
+		return std::to_string(count) + (count == 1 ? " instruction, " : " instructions, ") + std::to_string(words.size()) + " words";
+	}
+}
+
+int main(const int argc, char* argv[])
+{
+	using namespace SuperoptimizerMain;
+
+	std::vector<std::string> args(argv + 1, argv + argc);
+
+	// -n <length> is the longest replacement searched for, -o <file> also writes the library there
+	int32_t length = Superoptimizer::MAX_LENGTH;
+	std::string output;
+	for (auto arg = args.begin(); arg != args.end();)
+	{
+		if ((*arg == "-n" || *arg == "-o") && arg + 1 != args.end())
+		{
+			if (*arg == "-n")
+			{
+				length = std::max(1, std::stoi(*(arg + 1)));
+			}
+			else
+			{
+				output = *(arg + 1);
+			}
+			arg = args.erase(arg, arg + 2);
+		}
+		else
+		{
+			arg++;
+		}
+	}
+
+	if (args.empty())
+	{
+		std::cout << "Usage: qcpu-so [-n <length>] [-o <library>] <program.asm|sequence>..." << std::endl;
+		std::cout << "A sequence is written as assembly, with a ',' between instructions, e.g. \"psh a, pop b\"" << std::endl;
+		return 1;
+	}
+
+	// Windows from every program, or the sequences as given
+	std::set<std::vector<uint16_t>> targets;
+	for (const std::string& arg : args)
+	{
+		if (arg.size() > 4 && arg.substr(arg.size() - 4) == ".asm")
+		{
+			Assembler assembler(arg);
+			CollectWindows(assembler.Build(), length, targets);
+		}
+		else
+		{
+			std::string text = arg;
+			std::replace(text.begin(), text.end(), ',', '\n');
+
+			Assembler assembler;
+			assembler.LoadText(text);
+			const std::vector<uint16_t> image = assembler.Build().image;
+			if (Superoptimizer::IsSupported(image))
+			{
+				targets.insert(image);
+			}
+			else
+			{
+				std::cout << "Can't search for \"" << arg << "\", only register, immediate and stack operations are supported" << std::endl;
+			}
+		}
+	}
+
+	std::ofstream library;
+	if (!output.empty())
+	{
+		library.open(output);
+	}
+
+	// Each rewrite is a comment, the target, => and what it can be replaced with
+	Superoptimizer superoptimizer;
+	int32_t found = 0;
+	for (const std::vector<uint16_t>& target : targets)
+	{
+		Rewrite rewrite;
+		if (!superoptimizer.Optimize(target, length, rewrite))
+		{
+			continue;
+		}
+
+		std::string checked = "checked on " + std::to_string(rewrite.tests) + " sampled inputs";
+		if (rewrite.exhaustive)
+		{
+			checked = rewrite.tests > 2 ? "checked on all " + std::to_string(rewrite.tests) + " inputs" : "reads no registers";
+		}
+		const std::string entry = "# " + Describe(rewrite.target) + " -> " + Describe(rewrite.replacement) + ", " + checked + "\n"
+			+ Superoptimizer::Format(rewrite.target) + "\n=>\n" + Superoptimizer::Format(rewrite.replacement) + "\n\n";
+
+		std::cout << entry;
+		if (library.is_open())
+		{
+			library << entry;
+		}
+		found++;
+	}
+
+	std::cout << "# " << found << " of " << targets.size() << " sequences can be shortened" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,118 @@
+//
+//	Superoptimizer
+//
+
+#pragma once
+
+#include "QCPU.h"
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// A sequence and the shortest one found to do the same thing
+struct Rewrite
+{
+	Rewrite()
+		: target()
+		, replacement()
+		, exhaustive(false)
+		, tests(0)
+	{
+	}
+
+	std::vector<uint16_t> target;
+	std::vector<uint16_t> replacement;
+
+	// Checked on every value its input and the carry flag can take, rather than on a sample of states
+	bool exhaustive;
+	uint64_t tests;
+};
+
+// Searches for the shortest straight line code that leaves the registers, the stack, the
+// carry flag and any fault exactly as a target sequence does. Candidates are built from the ISA table,
+// run on the VM against the target on edge case and random states, each with carry set and
+// clear on the way in, and a survivor is then checked on every input value when the target
+// reads at most one register, or on a much larger sample when it reads more.
+//
+// Only register, immediate and stack operands are supported, and no jumps, calls or
+// system calls. A candidate may only read what the target reads, or what it has written
+// itself, and only write registers that the target writes.
+class Superoptimizer
+{
+public:
+	static const int32_t MAX_LENGTH = 3;
+
+	// Random states every candidate is tried on, on top of the edge cases
+	static const int32_t QUICK_TESTS = 24;
+	// Random states a survivor is checked on when it can't be checked on every input
+	static const int32_t SAMPLED_TESTS = 1 << 20;
+
+public:
+	Superoptimizer();
+
+	// True if every instruction in words is one that can be searched for
+	static bool IsSupported(const std::vector<uint16_t>& words);
+	// Looks for code of up to maxLength instructions that is shorter than target, in
+	// instructions and then in words. Returns false if there is none.
+	bool Optimize(const std::vector<uint16_t>& target, const int32_t maxLength, Rewrite& rewrite);
+	// Assembly for words, one instruction per line
+	static std::string Format(const std::vector<uint16_t>& words);
+
+private:
+	// An instruction candidates can be built from
+	struct Piece
+	{
+		std::vector<uint16_t> words;
+		uint8_t reads;		// Bit n is set if register n is read
+		uint8_t writes;
+		bool stack;
+	};
+
+	// What a sequence starts from, the stack is always empty
+	struct State
+	{
+		Registers registers;
+		bool carry;
+	};
+
+	// Everything a sequence leaves behind that another one has to match, the stack by its
+	// depth and a hash of what is on it
+	struct Outcome
+	{
+		bool fault;
+		bool carry;
+		Registers registers;
+		size_t depth;
+		uint64_t stack;
+	};
+
+private:
+	// The instruction at words[offset], whose length is added to offset. Returns false if
+	// it isn't one that can be searched for.
+	static bool Analyse(const std::vector<uint16_t>& words, size_t& offset, Piece& piece);
+	void BuildPieces(const uint8_t outputs, const bool stack);
+	void BuildStates();
+	void Search(const size_t depth, const size_t length, const uint8_t available);
+	bool Verify(uint64_t& tests, bool& exhaustive);
+	void Load(const std::vector<uint16_t>& words, const uint16_t address);
+	Outcome Run(const State& state, const uint16_t start, const uint16_t end);
+	static bool Same(const Outcome& a, const Outcome& b);
+
+private:
+	std::unique_ptr<TQCPU<FastPolicy>> cpu;
+	std::mt19937 random;
+
+	// Set up for the target being searched, the target is loaded at address 0 and
+	// candidates after it
+	std::vector<uint16_t> target;
+	uint8_t inputs;
+	std::vector<Piece> pieces;
+	std::vector<State> states;
+	std::vector<Outcome> expected;
+	std::vector<uint16_t> candidate;
+	uint16_t candidateAddress;
+	Rewrite best;
+};
@@ -0,0 +1,531 @@
+//
+//	Superoptimizer
+//
+
+#include "Superoptimizer.h"
+#include "Assembler.h"
+
+#include <algorithm>
+#include <bitset>
+
+namespace SuperoptimizerPrivate
+{
+	static const uint16_t REGISTER_COUNT = 6;
+
+	// Candidates are built from these, along with not, psh and pop
+	static const EOpCode COMPUTE[] =
+	{
+		EOpCode::MOV,
+		EOpCode::ADD,
+		EOpCode::SUB,
+		EOpCode::MUL,
+		EOpCode::MDL,
+		EOpCode::AND,
+		EOpCode::ORR,
+		EOpCode::XOR,
+		EOpCode::LSL,
+		EOpCode::LSR
+	};
+
+	// Values that tend to be where code goes wrong, tried on every candidate
+	static const uint16_t EDGES[] = { 0, 1, 2, 3, 15, 16, 17, 0x00FF, 0x0100, 0x7FFF, 0x8000, 0x8001, 0xFF00, 0xFFFE, 0xFFFF };
+
+	bool IsSearchable(const EOpCode opcode)
+	{
+		return std::find(std::begin(COMPUTE), std::end(COMPUTE), opcode) != std::end(COMPUTE)
+			|| opcode == EOpCode::NOT || opcode == EOpCode::PSH || opcode == EOpCode::POP;
+	}
+
+	EAddressingMode GetMode(const uint16_t word, const size_t operand)
+	{
+		return static_cast<EAddressingMode>((word >> (14 - 2 * operand)) & 0b11);
+	}
+
+	uint16_t Encode(const EOpCode opcode, const EAddressingMode first, const EAddressingMode second = EAddressingMode::Imm)
+	{
+		return static_cast<uint16_t>(static_cast<uint16_t>(opcode) | (static_cast<uint16_t>(first) << 14) | (static_cast<uint16_t>(second) << 12));
+	}
+
+	uint16_t& Field(Registers& registers, const uint16_t index)
+	{
+		switch (index)
+		{
+			case 0: return registers.a;
+			case 1: return registers.b;
+			case 2: return registers.c;
+			case 3: return registers.d;
+			case 4: return registers.x;
+			default: return registers.y;
+		}
+	}
+
+	int32_t CountBits(const uint8_t bits)
+	{
+		return static_cast<int32_t>(std::bitset<8>(bits).count());
+	}
+
+	void AddUnique(std::vector<uint16_t>& values, const uint16_t value)
+	{
+		if (std::find(values.begin(), values.end(), value) == values.end())
+		{
+			values.push_back(value);
+		}
+	}
+
+	// An operand that does nothing, such as orr a 0 or mul a 1. add a 0 and sub a 0 clear carry,
+	// so they aren't.
+	bool IsIdentity(const EOpCode opcode, const uint16_t value)
+	{
+		switch (opcode)
+		{
+			case EOpCode::ORR:
+			case EOpCode::XOR:
+			case EOpCode::LSL:
+			case EOpCode::LSR: return value == 0;
+			case EOpCode::MUL: return value == 1;
+			case EOpCode::AND: return value == 0xFFFF;
+			default: return false;
+		}
+	}
+}
+
+Superoptimizer::Superoptimizer()
+	: cpu(std::make_unique<TQCPU<FastPolicy>>())
+	, random(0x5EED)
+	, target()
+	, inputs(0)
+	, pieces()
+	, states()
+	, expected()
+	, candidate()
+	, candidateAddress(0)
+	, best()
+{
+}
+
+bool Superoptimizer::IsSupported(const std::vector<uint16_t>& words)
+{
+	size_t offset = 0;
+	Piece piece;
+	while (offset < words.size())
+	{
+		if (!Analyse(words, offset, piece))
+		{
+			return false;
+		}
+	}
+
+	return !words.empty();
+}
+
+bool Superoptimizer::Optimize(const std::vector<uint16_t>& sequence, const int32_t maxLength, Rewrite& rewrite)
+{
+	using namespace SuperoptimizerPrivate;
+
+	if (!IsSupported(sequence))
+	{
+		return false;
+	}
+
+	// Inputs are registers read before the target writes them, and it mustn't pop what it
+	// didn't push, since nothing can be said about what was there
+	uint8_t outputs = 0;
+	bool stack = false;
+	int32_t depth = 0;
+	int32_t length = 0;
+	inputs = 0;
+	for (size_t offset = 0; offset < sequence.size(); length++)
+	{
+		Piece piece;
+		Analyse(sequence, offset, piece);
+		inputs |= piece.reads & ~outputs;
+		outputs |= piece.writes;
+		stack |= piece.stack;
+
+		const EOpCode opcode = static_cast<EOpCode>(piece.words[0] & 0x00FF);
+		depth += opcode == EOpCode::PSH ? 1 : (opcode == EOpCode::POP ? -1 : 0);
+		if (depth < 0)
+		{
+			return false;
+		}
+	}
+
+	target = sequence;
+	candidateAddress = static_cast<uint16_t>(target.size());
+	BuildPieces(outputs, stack);
+	BuildStates();
+
+	Load(target, 0);
+	expected.clear();
+	for (const State& state : states)
+	{
+		expected.push_back(Run(state, 0, candidateAddress));
+	}
+
+	best = Rewrite();
+	for (int32_t size = 1; size <= std::min(maxLength, length) && best.replacement.empty(); size++)
+	{
+		candidate.clear();
+		Search(0, static_cast<size_t>(size), inputs);
+
+		// The same number of instructions is only better in fewer words
+		if (size == length && best.replacement.size() >= target.size())
+		{
+			best.replacement.clear();
+		}
+	}
+
+	if (best.replacement.empty())
+	{
+		return false;
+	}
+
+	best.target = target;
+	rewrite = best;
+	return true;
+}
+
+std::string Superoptimizer::Format(const std::vector<uint16_t>& words)
+{
+	using namespace SuperoptimizerPrivate;
+
+	std::string text;
+	for (size_t offset = 0; offset < words.size();)
+	{
+		const Instruction* instruction = FindInstruction(words[offset] & 0x00FF);
+		if (instruction == nullptr)
+		{
+			break;
+		}
+
+		text += (text.empty() ? "" : "\n") + std::string(instruction->mnemonic);
+		for (size_t i = 0; i < instruction->arity && offset + 1 + i < words.size(); i++)
+		{
+			const uint16_t value = words[offset + 1 + i];
+			std::string operand = std::to_string(value);
+			if (GetMode(words[offset], i) == EAddressingMode::Reg)
+			{
+				for (const RegisterData& reg : Assembler::REGISTERS)
+				{
+					operand = reg.value == value ? reg.name : operand;
+				}
+			}
+			else if (value > 0xFF)
+			{
+				char hex[8];
+				snprintf(hex, sizeof(hex), "0x%04X", value);
+				operand = hex;
+			}
+			text += " " + operand;
+		}
+
+		offset += 1 + instruction->arity;
+	}
+
+	return text;
+}
+
+bool Superoptimizer::Analyse(const std::vector<uint16_t>& words, size_t& offset, Piece& piece)
+{
+	using namespace SuperoptimizerPrivate;
+
+	const Instruction* instruction = FindInstruction(words[offset] & 0x00FF);
+	if (instruction == nullptr || !IsSearchable(instruction->opcode) || offset + instruction->arity >= words.size())
+	{
+		return false;
+	}
+
+	piece.words.assign(words.begin() + offset, words.begin() + offset + 1 + instruction->arity);
+	piece.reads = 0;
+	piece.writes = 0;
+	piece.stack = instruction->opcode == EOpCode::PSH || instruction->opcode == EOpCode::POP;
+
+	for (size_t i = 0; i < instruction->arity; i++)
+	{
+		const EAddressingMode mode = GetMode(words[offset], i);
+		const uint16_t value = words[offset + 1 + i];
+		const EOperandRole role = instruction->roles[i];
+		if (mode == EAddressingMode::Imm && role == EOperandRole::Read)
+		{
+			continue;
+		}
+
+		if (mode != EAddressingMode::Reg || value >= REGISTER_COUNT)
+		{
+			return false;
+		}
+
+		const uint8_t bit = static_cast<uint8_t>(1 << value);
+		piece.reads |= (role == EOperandRole::Read || role == EOperandRole::ReadWrite) ? bit : 0;
+		piece.writes |= (role == EOperandRole::Write || role == EOperandRole::ReadWrite) ? bit : 0;
+	}
+
+	offset += 1 + instruction->arity;
+	return true;
+}
+
+void Superoptimizer::BuildPieces(const uint8_t outputs, const bool stack)
+{
+	using namespace SuperoptimizerPrivate;
+
+	// Constants the target uses, and the ones that tend to go with them
+	std::vector<uint16_t> constants = { 0, 1, 2, 0xFFFF };
+	for (size_t offset = 0; offset < target.size();)
+	{
+		const Instruction* instruction = FindInstruction(target[offset] & 0x00FF);
+		for (size_t i = 0; i < instruction->arity; i++)
+		{
+			if (GetMode(target[offset], i) != EAddressingMode::Imm)
+			{
+				continue;
+			}
+
+			const uint16_t value = target[offset + 1 + i];
+			AddUnique(constants, value);
+			AddUnique(constants, static_cast<uint16_t>(value - 1));
+			AddUnique(constants, static_cast<uint16_t>(value + 1));
+			AddUnique(constants, static_cast<uint16_t>(~value));
+			if (value < 16)
+			{
+				AddUnique(constants, static_cast<uint16_t>(1 << value));
+				AddUnique(constants, static_cast<uint16_t>(16 - value));
+			}
+			for (uint16_t shift = 0; shift < 16; shift++)
+			{
+				if (value == (1 << shift))
+				{
+					AddUnique(constants, shift);
+				}
+			}
+		}
+		offset += 1 + instruction->arity;
+	}
+
+	pieces.clear();
+	const uint8_t readable = inputs | outputs;
+	for (uint16_t to = 0; to < REGISTER_COUNT; to++)
+	{
+		if ((outputs & (1 << to)) == 0)
+		{
+			continue;
+		}
+
+		const uint8_t bit = static_cast<uint8_t>(1 << to);
+		for (const EOpCode opcode : COMPUTE)
+		{
+			const uint8_t self = opcode == EOpCode::MOV ? 0 : bit;
+			for (uint16_t from = 0; from < REGISTER_COUNT; from++)
+			{
+				// mov a a, sub a a and the like are nops or a constant, which is covered below
+				const bool trivial = from == to && opcode != EOpCode::ADD && opcode != EOpCode::MUL && opcode != EOpCode::LSL && opcode != EOpCode::LSR;
+				if ((readable & (1 << from)) != 0 && !trivial)
+				{
+					pieces.push_back(Piece{ { Encode(opcode, EAddressingMode::Reg, EAddressingMode::Reg), to, from }, static_cast<uint8_t>(self | (1 << from)), bit, false });
+				}
+			}
+
+			for (const uint16_t value : constants)
+			{
+				if (!IsIdentity(opcode, value))
+				{
+					pieces.push_back(Piece{ { Encode(opcode, EAddressingMode::Reg, EAddressingMode::Imm), to, value }, self, bit, false });
+				}
+			}
+		}
+
+		pieces.push_back(Piece{ { Encode(EOpCode::NOT, EAddressingMode::Reg), to }, bit, bit, false });
+		if (stack)
+		{
+			pieces.push_back(Piece{ { Encode(EOpCode::POP, EAddressingMode::Reg), to }, 0, bit, true });
+		}
+	}
+
+	if (stack)
+	{
+		for (uint16_t from = 0; from < REGISTER_COUNT; from++)
+		{
+			if ((readable & (1 << from)) != 0)
+			{
+				pieces.push_back(Piece{ { Encode(EOpCode::PSH, EAddressingMode::Reg), from }, static_cast<uint8_t>(1 << from), 0, true });
+			}
+		}
+
+		for (const uint16_t value : constants)
+		{
+			pieces.push_back(Piece{ { Encode(EOpCode::PSH, EAddressingMode::Imm), value }, 0, 0, true });
+		}
+	}
+}
+
+void Superoptimizer::BuildStates()
+{
+	using namespace SuperoptimizerPrivate;
+
+	// Every input at the same edge case with carry clear and then set, then states that are
+	// random throughout
+	states.clear();
+	for (const uint16_t edge : EDGES)
+	{
+		State state;
+		for (uint16_t i = 0; i < REGISTER_COUNT; i++)
+		{
+			Field(state.registers, i) = (inputs & (1 << i)) != 0 ? edge : static_cast<uint16_t>(random());
+		}
+		state.carry = false;
+		states.push_back(state);
+		state.carry = true;
+		states.push_back(state);
+	}
+
+	for (int32_t test = 0; test < QUICK_TESTS; test++)
+	{
+		State state;
+		for (uint16_t i = 0; i < REGISTER_COUNT; i++)
+		{
+			Field(state.registers, i) = static_cast<uint16_t>(random());
+		}
+		state.carry = (random() & 1) != 0;
+		states.push_back(state);
+	}
+}
+
+void Superoptimizer::Search(const size_t depth, const size_t length, const uint8_t available)
+{
+	if (depth < length)
+	{
+		for (const Piece& piece : pieces)
+		{
+			// Only what the target reads, or what has been written already, can be read
+			if ((piece.reads & ~available) != 0)
+			{
+				continue;
+			}
+
+			candidate.insert(candidate.end(), piece.words.begin(), piece.words.end());
+			Search(depth + 1, length, available | piece.writes);
+			candidate.resize(candidate.size() - piece.words.size());
+		}
+		return;
+	}
+
+	// Of those as long in instructions, keep the one with the fewest words
+	if (!best.replacement.empty() && candidate.size() >= best.replacement.size())
+	{
+		return;
+	}
+
+	Load(candidate, candidateAddress);
+	const uint16_t end = static_cast<uint16_t>(candidateAddress + candidate.size());
+	for (size_t i = 0; i < states.size(); i++)
+	{
+		if (!Same(Run(states[i], candidateAddress, end), expected[i]))
+		{
+			return;
+		}
+	}
+
+	uint64_t tests = 0;
+	bool exhaustive = false;
+	if (Verify(tests, exhaustive))
+	{
+		best.replacement = candidate;
+		best.tests = tests;
+		best.exhaustive = exhaustive;
+	}
+}
+
+bool Superoptimizer::Verify(uint64_t& tests, bool& exhaustive)
+{
+	using namespace SuperoptimizerPrivate;
+
+	const uint16_t end = static_cast<uint16_t>(candidateAddress + candidate.size());
+	State state = states.back();
+
+	// With one input every value it can take is tried with carry clear and set, nothing else
+	// can change the outcome
+	exhaustive = CountBits(inputs) <= 1;
+	if (exhaustive)
+	{
+		uint16_t input = 0;
+		while (input < REGISTER_COUNT && (inputs & (1 << input)) == 0)
+		{
+			input++;
+		}
+
+		const uint32_t count = input < REGISTER_COUNT ? 0x20000 : 2;
+		for (uint32_t value = 0; value < count; value++)
+		{
+			if (input < REGISTER_COUNT)
+			{
+				Field(state.registers, input) = static_cast<uint16_t>(value >> 1);
+			}
+			state.carry = (value & 1) != 0;
+
+			tests++;
+			if (!Same(Run(state, candidateAddress, end), Run(state, 0, candidateAddress)))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Too many combinations, so a large sample with plenty of edge cases mixed in
+	for (int32_t test = 0; test < SAMPLED_TESTS; test++)
+	{
+		for (uint16_t i = 0; i < REGISTER_COUNT; i++)
+		{
+			const uint32_t roll = random();
+			Field(state.registers, i) = (roll & 3) == 0 ? EDGES[(roll >> 2) % std::size(EDGES)] : static_cast<uint16_t>(roll >> 16);
+		}
+		state.carry = (random() & 1) != 0;
+
+		tests++;
+		if (!Same(Run(state, candidateAddress, end), Run(state, 0, candidateAddress)))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Superoptimizer::Load(const std::vector<uint16_t>& words, const uint16_t address)
+{
+	std::copy(words.begin(), words.end(), cpu->memory + address);
+	cpu->InvalidateRange(address, static_cast<uint32_t>(words.size()));
+}
+
+Superoptimizer::Outcome Superoptimizer::Run(const State& state, const uint16_t start, const uint16_t end)
+{
+	cpu->registers = state.registers;
+	cpu->flags = Flags();
+	cpu->flags.carry = state.carry;
+	cpu->stack.clear();
+	cpu->pc = start;
+	while (cpu->pc < end && !cpu->flags.fault)
+	{
+		cpu->Step();
+	}
+
+	Outcome outcome;
+	outcome.fault = cpu->flags.fault;
+	outcome.carry = cpu->flags.carry;
+	outcome.registers = cpu->registers;
+	outcome.depth = cpu->stack.size();
+	outcome.stack = Fnv1a(cpu->stack.data(), cpu->stack.size() * sizeof(uint16_t));
+	return outcome;
+}
+
+bool Superoptimizer::Same(const Outcome& a, const Outcome& b)
+{
+	// Where a fault leaves things doesn't matter, only that both fault
+	if (a.fault || b.fault)
+	{
+		return a.fault == b.fault;
+	}
+
+	return a.registers.a == b.registers.a && a.registers.b == b.registers.b && a.registers.c == b.registers.c
+		&& a.registers.d == b.registers.d && a.registers.x == b.registers.x && a.registers.y == b.registers.y
+		&& a.carry == b.carry && a.depth == b.depth && a.stack == b.stack;
+}
@@ -4,10 +4,38 @@
 
 #pragma once
 
-enum class EAddressingMode
+#include <array>
+#include <stdint.h>
+
+enum class EAddressingMode : uint8_t
 {
 	Imm = 0b00,
 	Abs = 0b01,
 	Ind = 0b10,
 	Reg = 0b11
-};
\ No newline at end of file
+};
+
+static const char* EnumToString(const EAddressingMode InMode)
+{
+	switch (InMode)
+	{
+		case EAddressingMode::Imm: return "Imm";
+		case EAddressingMode::Abs: return "Abs";
+		case EAddressingMode::Ind: return "Ind";
+		case EAddressingMode::Reg: return "Reg";
+	}
+
+	return "";
+}
+
+// The modes of an instruction's four operands, from the high byte of its first word. The
+// first operand's mode is in the top two bits.
+static constexpr std::array<EAddressingMode, 4> GetAddressingModes(const uint8_t InModes)
+{
+	return {
+		static_cast<EAddressingMode>((InModes & 0b11000000) >> 6),
+		static_cast<EAddressingMode>((InModes & 0b00110000) >> 4),
+		static_cast<EAddressingMode>((InModes & 0b00001100) >> 2),
+		static_cast<EAddressingMode>((InModes & 0b00000011))
+	};
+}
\ No newline at end of file
@@ -0,0 +1,117 @@
+//
+//	ControlFlow
+//
+
+#pragma once
+
+#include "ISA.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class EBlockEnd : uint8_t
+{
+	FallThrough,	// runs into a block that starts at a jump target
+	Jump,
+	Branch,
+	Call,
+	Return,
+	Exit,
+	Invalid			// an instruction the Verifier rejects, or one running off the end of the image
+};
+
+struct BasicBlock
+{
+	BasicBlock()
+		: start(0)
+		, end(0)
+		, last(0)
+		, kind(EBlockEnd::FallThrough)
+		, computed(false)
+		, callee(-1)
+		, successors()
+		, predecessors()
+	{
+	}
+
+	uint16_t start;
+	uint32_t end;		// one past its last word
+	uint16_t last;		// its last instruction
+	EBlockEnd kind;
+
+	// Ends in a jump or call to a register or memory, which can't be followed
+	bool computed;
+
+	// The subroutine called at the end, or -1
+	int32_t callee;
+
+	// Blocks in the same subroutine, calls aside
+	std::vector<uint32_t> successors;
+	std::vector<uint32_t> predecessors;
+};
+
+struct Subroutine
+{
+	uint16_t entry;
+
+	// Every block reached from the entry without following calls, the entry first
+	std::vector<uint32_t> blocks;
+	std::vector<uint32_t> callees;
+	bool computedCalls;
+};
+
+// A write to a word that is part of a reachable instruction, so the code changes as it runs
+struct CodeWrite
+{
+	uint16_t address;
+	uint16_t target;
+	uint16_t instruction;
+};
+
+// Words no entry point reaches. Given the addresses of known instructions, such as the
+// .debug's, ranges are split where those start and end, and the ones they cover are dead code.
+struct AddressRange
+{
+	uint16_t start;
+	uint32_t end;
+	bool code;
+};
+
+struct ControlFlowGraph
+{
+	// Block index for an address the block starts at, or -1
+	int32_t FindBlock(const uint16_t address) const;
+
+	// Graphviz, the control flow graph with a cluster per subroutine or just the call graph.
+	// Names label blocks and subroutines by address, anything else is shown as hex.
+	std::string ToDot(const bool calls, const std::unordered_map<uint16_t, std::string>& names = {}) const;
+	std::string ToJson(const std::unordered_map<uint16_t, std::string>& names = {}) const;
+
+	// By address, a block that is jumped into part way through starts one of its own
+	std::vector<BasicBlock> blocks;
+	// The entry points come first, in the order given, then everything they call
+	std::vector<Subroutine> subroutines;
+
+	// Jumps and calls to a register or memory
+	std::vector<uint16_t> computedJumps;
+	// Writes to code through a fixed address, and writes through a register or block operations
+	// whose target isn't known
+	std::vector<CodeWrite> codeWrites;
+	std::vector<uint16_t> indirectWrites;
+	std::vector<AddressRange> unreached;
+
+	// The block starting at each address of the image, or -1
+	std::vector<int32_t> blockAt;
+};
+
+// Builds basic blocks, the control flow graph and the call graph of an image by recursive
+// descent, using the Verifier's walk to find what is reachable
+class ControlFlowAnalyzer
+{
+public:
+
+	// memory must be readable up to 0x10000 words, size is how much of it is the image
+	ControlFlowGraph Analyze(const uint16_t* memory, const uint32_t size, const std::vector<uint16_t>& entries, const std::vector<uint16_t>& code = {}) const;
+};
@@ -0,0 +1,51 @@
+//
+//	QCPU
+//
+
+#pragma once
+
+#include "ISA.h"
+#include "OpArgs.h"
+
+#include <array>
+#include <stdint.h>
+
+// Memory is tracked in 256 word pages, one decoded instruction slot per word
+static const uint16_t CODE_PAGE_SHIFT = 8;
+static const uint16_t CODE_PAGE_SIZE = 1 << CODE_PAGE_SHIFT;
+static const uint16_t CODE_PAGE_MASK = CODE_PAGE_SIZE - 1;
+static const uint16_t CODE_PAGE_COUNT = 0x10000 >> CODE_PAGE_SHIFT;
+
+// Page state bits, a page with none set is plain data and writes to it are not intercepted
+static const uint8_t PAGE_CODE = 1 << 0;		// holds at least one decoded instruction
+static const uint8_t PAGE_READ_ONLY = 1 << 1;	// writes raise EFault::WriteProtected
+
+// An instruction decoded once and cached until a write to one of its words
+struct DecodedOp
+{
+	DecodedOp()
+		: args()
+		, opcode(EOpCode::NOP)
+		, arity(0)
+		, cycles(1)
+		, valid(false)
+		, verified(false)
+		, loopCandidate(false)
+	{
+	}
+
+	std::array<OpArgs, 4> args;
+	EOpCode opcode;
+	uint8_t arity;
+	uint8_t cycles;
+	bool valid;
+	bool verified;
+
+	// A short backward jump, worth checking for a loop that can be fast-forwarded
+	bool loopCandidate;
+};
+
+struct CodePage
+{
+	std::array<DecodedOp, CODE_PAGE_SIZE> ops;
+};
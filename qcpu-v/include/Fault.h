@@ -0,0 +1,72 @@
+//
+//	QCPU
+//
+
+#pragma once
+
+#include "OpArgs.h"
+#include "OpCode.h"
+
+#include <array>
+#include <stdint.h>
+
+enum class EFault : uint8_t
+{
+	None,
+	InvalidOpCode,
+	InvalidRegister,
+	ImmediateWrite,
+	CallStackOverflow,
+	CallStackUnderflow,
+	StackOverflow,
+	StackUnderflow,
+	DivideByZero,
+	UnknownSysCall,
+	WriteProtected
+};
+
+// What the VM does after recording a fault
+enum class EFaultPolicy : uint8_t
+{
+	Halt,	// set flags.fault, the host should stop stepping
+	Trap,	// call the guest handler with the fault code in x and the faulting pc in y
+	Ignore	// skip the faulting operation and carry on
+};
+
+struct Fault
+{
+	Fault()
+		: code(EFault::None)
+		, pc(0)
+		, opcode(EOpCode::NOP)
+		, operands()
+		, operandCount(0)
+	{
+	}
+
+	EFault code;
+	uint16_t pc;
+	EOpCode opcode;
+	std::array<OpArgs, 4> operands;
+	uint16_t operandCount;
+};
+
+static const char* EnumToString(const EFault InFault)
+{
+	switch (InFault)
+	{
+		case EFault::None: return "None";
+		case EFault::InvalidOpCode: return "InvalidOpCode";
+		case EFault::InvalidRegister: return "InvalidRegister";
+		case EFault::ImmediateWrite: return "ImmediateWrite";
+		case EFault::CallStackOverflow: return "CallStackOverflow";
+		case EFault::CallStackUnderflow: return "CallStackUnderflow";
+		case EFault::StackOverflow: return "StackOverflow";
+		case EFault::StackUnderflow: return "StackUnderflow";
+		case EFault::DivideByZero: return "DivideByZero";
+		case EFault::UnknownSysCall: return "UnknownSysCall";
+		case EFault::WriteProtected: return "WriteProtected";
+	}
+
+	return "";
+}
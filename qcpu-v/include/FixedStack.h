@@ -0,0 +1,71 @@
+//
+//	QCPU
+//
+
+#pragma once
+
+#include <array>
+#include <stddef.h>
+
+// A stack with a fixed capacity and no heap allocation. Callers check Full() and
+// Empty() before pushing or popping, the VM turns those cases into faults.
+template <class T, size_t N>
+class FixedStack
+{
+public:
+
+	static const size_t CAPACITY = N;
+
+public:
+
+	FixedStack()
+		: items()
+		, count(0)
+	{
+	}
+
+	void push(const T& value)
+	{
+		items[count++] = value;
+	}
+
+	void pop()
+	{
+		count--;
+	}
+
+	const T& top() const
+	{
+		return items[count - 1];
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	bool full() const
+	{
+		return count == N;
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	void clear()
+	{
+		count = 0;
+	}
+
+	const T* data() const
+	{
+		return items.data();
+	}
+
+private:
+
+	std::array<T, N> items;
+	size_t count;
+};
@@ -12,10 +12,16 @@ struct Flags
 		: halt(0)
 		, exit(-1)
 		, blok(false)
+		, fault(false)
+		, carry(false)
 	{
 	}
 
 	int16_t halt;
 	int16_t exit;
 	bool blok;
+	bool fault;
+
+	// Set by add and adc when they overflow and by sub and sbb when they borrow
+	bool carry;
 };
\ No newline at end of file
@@ -0,0 +1,24 @@
+//
+//	QCPU
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+static const uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325ull;
+static const uint64_t FNV_PRIME = 0x00000100000001B3ull;
+
+// 64 bit FNV-1a, pass a previous result as the seed to hash several buffers as one
+static uint64_t Fnv1a(const void* data, const size_t size, uint64_t hash = FNV_OFFSET_BASIS)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
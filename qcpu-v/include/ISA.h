@@ -0,0 +1,199 @@
+//
+//	QCPU
+//
+
+#pragma once
+
+#include "OpCode.h"
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+
+// What an instruction does with each of its operands
+enum class EOperandRole : uint8_t
+{
+	None,
+	Read,		// value is read
+	Write,		// value is replaced, must not be an immediate
+	ReadWrite,	// value is read then replaced, must not be an immediate
+	Target		// an address that is jumped to
+};
+
+struct Instruction
+{
+	EOpCode opcode;
+	const char* name;		// enum name, as printed in traces and fault reports
+	const char* mnemonic;	// as written in assembly
+	uint8_t arity;
+	std::array<EOperandRole, 4> roles;
+	uint8_t cycles;
+};
+
+// The instruction set, the VM, the verifier, the assembler and the disassembler are all built
+// from this table. Adding an instruction means adding it to EOpCode and to this list.
+static constexpr std::array<Instruction, 33> INSTRUCTIONS =
+{{
+	{ EOpCode::NOP, "NOP", "nop", 0, { EOperandRole::None }, 1 },
+	{ EOpCode::EXT, "EXT", "ext", 1, { EOperandRole::Read }, 1 },
+	{ EOpCode::SYS, "SYS", "sys", 1, { EOperandRole::Read }, 1 },
+	{ EOpCode::MOV, "MOV", "mov", 2, { EOperandRole::Write, EOperandRole::Read }, 1 },
+	{ EOpCode::JMP, "JMP", "jmp", 1, { EOperandRole::Target }, 1 },
+	{ EOpCode::JEQ, "JEQ", "jeq", 3, { EOperandRole::Target, EOperandRole::Read, EOperandRole::Read }, 1 },
+	{ EOpCode::JNE, "JNE", "jne", 3, { EOperandRole::Target, EOperandRole::Read, EOperandRole::Read }, 1 },
+	{ EOpCode::JGT, "JGT", "jgt", 3, { EOperandRole::Target, EOperandRole::Read, EOperandRole::Read }, 1 },
+	{ EOpCode::JGE, "JGE", "jge", 3, { EOperandRole::Target, EOperandRole::Read, EOperandRole::Read }, 1 },
+	{ EOpCode::JLT, "JLT", "jlt", 3, { EOperandRole::Target, EOperandRole::Read, EOperandRole::Read }, 1 },
+	{ EOpCode::JLE, "JLE", "jle", 3, { EOperandRole::Target, EOperandRole::Read, EOperandRole::Read }, 1 },
+	{ EOpCode::JSR, "JSR", "jsr", 1, { EOperandRole::Target }, 1 },
+	{ EOpCode::RET, "RET", "ret", 0, { EOperandRole::None }, 1 },
+	{ EOpCode::ADD, "ADD", "add", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::SUB, "SUB", "sub", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::MUL, "MUL", "mul", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::MDL, "MDL", "mod", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::AND, "AND", "and", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::ORR, "ORR", "orr", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::NOT, "NOT", "not", 1, { EOperandRole::ReadWrite }, 1 },
+	{ EOpCode::XOR, "XOR", "xor", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::LSL, "LSL", "lsl", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::LSR, "LSR", "lsr", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::PSH, "PSH", "psh", 1, { EOperandRole::Read }, 1 },
+	{ EOpCode::POP, "POP", "pop", 1, { EOperandRole::Write }, 1 },
+	{ EOpCode::CPY, "CPY", "cpy", 3, { EOperandRole::Read, EOperandRole::Read, EOperandRole::Read }, 1 },
+	{ EOpCode::FIL, "FIL", "fil", 3, { EOperandRole::Read, EOperandRole::Read, EOperandRole::Read }, 1 },
+	{ EOpCode::CMP, "CMP", "cmp", 4, { EOperandRole::Write, EOperandRole::Read, EOperandRole::Read, EOperandRole::Read }, 1 },
+	{ EOpCode::DIV, "DIV", "div", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::MLH, "MLH", "mulh", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::ADC, "ADC", "adc", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::SBB, "SBB", "sbb", 2, { EOperandRole::ReadWrite, EOperandRole::Read }, 1 },
+	{ EOpCode::DVM, "DVM", "divmod", 2, { EOperandRole::ReadWrite, EOperandRole::ReadWrite }, 1 }
+}};
+
+namespace ISAPrivate
+{
+	// Opcode byte to index in INSTRUCTIONS, -1 for bytes that are not instructions
+	constexpr std::array<int8_t, 256> BuildDecodeTable()
+	{
+		std::array<int8_t, 256> table = {};
+		for (size_t i = 0; i < table.size(); i++)
+		{
+			table[i] = -1;
+		}
+		for (size_t i = 0; i < INSTRUCTIONS.size(); i++)
+		{
+			table[static_cast<uint8_t>(INSTRUCTIONS[i].opcode)] = static_cast<int8_t>(i);
+		}
+		return table;
+	}
+
+	static constexpr std::array<int8_t, 256> DECODE_TABLE = BuildDecodeTable();
+
+	// Mnemonics are found with a perfect hash, the seed is searched for at compile time
+	static constexpr uint32_t MNEMONIC_SLOTS = 128;
+
+	constexpr uint32_t HashMnemonic(const std::string_view mnemonic, const uint32_t seed)
+	{
+		uint32_t hash = seed;
+		for (const char c : mnemonic)
+		{
+			hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+		}
+		return (hash ^ (hash >> 15)) & (MNEMONIC_SLOTS - 1);
+	}
+
+	constexpr uint32_t FindMnemonicSeed()
+	{
+		for (uint32_t seed = 1; seed < 10000; seed++)
+		{
+			std::array<bool, MNEMONIC_SLOTS> used = {};
+			bool collision = false;
+			for (size_t i = 0; i < INSTRUCTIONS.size() && !collision; i++)
+			{
+				const uint32_t slot = HashMnemonic(INSTRUCTIONS[i].mnemonic, seed);
+				collision = used[slot];
+				used[slot] = true;
+			}
+
+			if (!collision)
+			{
+				return seed;
+			}
+		}
+		return 0;
+	}
+
+	static constexpr uint32_t MNEMONIC_SEED = FindMnemonicSeed();
+	static_assert(MNEMONIC_SEED != 0, "No perfect hash seed for the mnemonics, increase MNEMONIC_SLOTS");
+
+	constexpr std::array<int8_t, MNEMONIC_SLOTS> BuildMnemonicTable()
+	{
+		std::array<int8_t, MNEMONIC_SLOTS> table = {};
+		for (size_t i = 0; i < table.size(); i++)
+		{
+			table[i] = -1;
+		}
+		for (size_t i = 0; i < INSTRUCTIONS.size(); i++)
+		{
+			table[HashMnemonic(INSTRUCTIONS[i].mnemonic, MNEMONIC_SEED)] = static_cast<int8_t>(i);
+		}
+		return table;
+	}
+
+	static constexpr std::array<int8_t, MNEMONIC_SLOTS> MNEMONIC_TABLE = BuildMnemonicTable();
+}
+
+// The instruction for an opcode byte, or nullptr if it is not one
+static constexpr const Instruction* FindInstruction(const uint16_t InValue)
+{
+	const int8_t index = InValue < 256 ? ISAPrivate::DECODE_TABLE[InValue] : -1;
+	return index >= 0 ? &INSTRUCTIONS[index] : nullptr;
+}
+
+// The instruction for a mnemonic, or nullptr if it is not one. Case sensitive.
+static constexpr const Instruction* FindInstruction(const std::string_view InMnemonic)
+{
+	const int8_t index = ISAPrivate::MNEMONIC_TABLE[ISAPrivate::HashMnemonic(InMnemonic, ISAPrivate::MNEMONIC_SEED)];
+	return index >= 0 && InMnemonic == INSTRUCTIONS[index].mnemonic ? &INSTRUCTIONS[index] : nullptr;
+}
+
+static_assert(FindInstruction("mod") != nullptr && FindInstruction("mod")->opcode == EOpCode::MDL, "ISA mnemonic lookup is broken");
+static_assert(FindInstruction(static_cast<uint16_t>(EOpCode::POP))->arity == 1, "ISA decode table is broken");
+
+static const char* EnumToString(const EOpCode InOpcode)
+{
+	const Instruction* instruction = FindInstruction(static_cast<uint16_t>(InOpcode));
+	return instruction != nullptr ? instruction->name : "";
+}
+
+static bool IsValidOpCode(const uint16_t InValue)
+{
+	return FindInstruction(InValue) != nullptr;
+}
+
+static uint16_t GetOpCodeArity(const EOpCode InOpcode)
+{
+	const Instruction* instruction = FindInstruction(static_cast<uint16_t>(InOpcode));
+	return instruction != nullptr ? instruction->arity : 0;
+}
+
+static uint16_t GetOpCodeCycles(const EOpCode InOpcode)
+{
+	const Instruction* instruction = FindInstruction(static_cast<uint16_t>(InOpcode));
+	return instruction != nullptr ? instruction->cycles : 1;
+}
+
+// Bitmask of the operands an opcode writes to, bit 0 being the first operand
+static uint16_t GetOpCodeWriteMask(const EOpCode InOpcode)
+{
+	const Instruction* instruction = FindInstruction(static_cast<uint16_t>(InOpcode));
+	uint16_t mask = 0;
+	for (uint16_t i = 0; instruction != nullptr && i < instruction->arity; i++)
+	{
+		if (instruction->roles[i] == EOperandRole::Write || instruction->roles[i] == EOperandRole::ReadWrite)
+		{
+			mask |= 1 << i;
+		}
+	}
+	return mask;
+}
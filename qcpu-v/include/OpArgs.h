@@ -10,6 +10,12 @@
 
 struct OpArgs
 {
+	OpArgs()
+		: value(0)
+		, mode(EAddressingMode::Imm)
+	{
+	}
+
 	OpArgs(const uint16_t value, const EAddressingMode mode)
 		: value(value)
 		, mode(mode)
@@ -4,6 +4,8 @@
 
 #pragma once
 
+// Instruction properties (mnemonic, arity, operand roles, cost) live in ISA.h
+
 #include <stdint.h>
 
 enum class EOpCode : uint8_t
@@ -30,8 +32,8 @@ enum class EOpCode : uint8_t
 	RET = 0xC,  // pop an address from the call stack and jump to that address
 
 	// arithmetic operations	
-	ADD = 0xD,  // add b to the contents of a
-	SUB = 0xE,  // subtract b from the contents of a
+	ADD = 0xD,  // add b to the contents of a, setting carry if it overflows
+	SUB = 0xE,  // subtract b from the contents of a, setting carry if it borrows
 	MUL = 0xF,  // multiply the contents of a by b
 	MDL = 0x10, // set the contents of a to a % b
 
@@ -45,39 +47,17 @@ enum class EOpCode : uint8_t
 
 	// stack operations	
 	PSH = 0x17, // push value of a onto stack
-	POP = 0x18  // pop top value from stack into a
+	POP = 0x18, // pop top value from stack into a
+
+	// block operations, on memory that wraps around at the end of the address space
+	CPY = 0x19, // copy c words from address b to address a, as if through a buffer when they overlap
+	FIL = 0x1A, // set c words from address a to the value b
+	CMP = 0x1B, // compare d words at addresses b and c, setting a to 0 if they match, 1 if b's first different word is greater and 0xFFFF if it is less
+
+	// multi-precision arithmetic
+	DIV = 0x1C, // set the contents of a to a / b
+	MLH = 0x1D, // set the contents of a to the high 16 bits of a * b
+	ADC = 0x1E, // add b and carry to the contents of a, setting carry if it overflows
+	SBB = 0x1F, // subtract b and carry from the contents of a, setting carry if it borrows
+	DVM = 0x20  // set the contents of a to a / b and of b to a % b
 };
-
-static const char* EnumToString(const EOpCode InOpcode)
-{
-	switch (InOpcode)
-	{
-		case EOpCode::NOP: return "NOP";
-		case EOpCode::EXT: return "EXT";
-		case EOpCode::SYS: return "SYS";
-		case EOpCode::MOV: return "MOV";
-		case EOpCode::JMP: return "JMP";
-		case EOpCode::JEQ: return "JEQ";
-		case EOpCode::JNE: return "JNE";
-		case EOpCode::JGT: return "JGT";
-		case EOpCode::JGE: return "JGE";
-		case EOpCode::JLT: return "JLT";
-		case EOpCode::JLE: return "JLE";
-		case EOpCode::JSR: return "JSR";
-		case EOpCode::RET: return "RET";
-		case EOpCode::ADD: return "ADD";
-		case EOpCode::SUB: return "SUB";
-		case EOpCode::MUL: return "MUL";
-		case EOpCode::MDL: return "MDL";
-		case EOpCode::AND: return "AND";
-		case EOpCode::ORR: return "ORR";
-		case EOpCode::NOT: return "NOT";
-		case EOpCode::XOR: return "XOR";
-		case EOpCode::LSL: return "LSL";
-		case EOpCode::LSR: return "LSR";
-		case EOpCode::PSH: return "PSH";
-		case EOpCode::POP: return "POP";
-	}
-
-	return "";
-}
\ No newline at end of file
@@ -0,0 +1,55 @@
+//
+//	QCPU
+//
+
+#pragma once
+
+// Execution policies select, at compile time, which diagnostics are built into
+// the interpreter's hot path. Every branch guarded by a policy flag is an
+// `if constexpr`, so a disabled check costs nothing at runtime.
+
+// No operand validation or tracing. Invalid programs have undefined behaviour.
+struct FastPolicy
+{
+	static constexpr const char* Name = "Fast";
+	static constexpr bool CheckOperands = false;
+	static constexpr bool TraceOps = false;
+	static constexpr bool FastForwardLoops = true;
+	static constexpr bool RecordProfile = false;
+};
+
+// Validates register indices and immediate writes, reporting bad operands.
+struct CheckedPolicy
+{
+	static constexpr const char* Name = "Checked";
+	static constexpr bool CheckOperands = true;
+	static constexpr bool TraceOps = false;
+	static constexpr bool FastForwardLoops = true;
+	static constexpr bool RecordProfile = false;
+};
+
+// Checked, and additionally logs every executed instruction, so loops are never skipped.
+struct TracingPolicy
+{
+	static constexpr const char* Name = "Tracing";
+	static constexpr bool CheckOperands = true;
+	static constexpr bool TraceOps = true;
+	static constexpr bool FastForwardLoops = false;
+	static constexpr bool RecordProfile = false;
+};
+
+// Checked, and counts every executed instruction and taken branch for the assembler's -P,
+// so loops are never skipped. See Profile.h.
+struct ProfilingPolicy
+{
+	static constexpr const char* Name = "Profiling";
+	static constexpr bool CheckOperands = true;
+	static constexpr bool TraceOps = false;
+	static constexpr bool FastForwardLoops = false;
+	static constexpr bool RecordProfile = true;
+};
+
+// The policy used by the QCPU alias, override with /D QCPU_POLICY=FastPolicy etc.
+#ifndef QCPU_POLICY
+#define QCPU_POLICY CheckedPolicy
+#endif
@@ -0,0 +1,92 @@
+//
+//	Profile
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// How often each instruction ran, recorded by the VM under ProfilingPolicy and read back by
+// the assembler's -P. Both counts are kept by the address of the op, taken counts the times
+// it went anywhere other than the instruction after it, so it is only interesting for jumps.
+// Saved as text, one "address executions taken" line in hex for every address that ran.
+// This header doesn't need the VM, so the assembler can use it without linking qcpu-v.
+struct Profile
+{
+	Profile()
+		: executions()
+		, taken()
+	{
+	}
+
+	// Clears every count, for an address space of size
+	void Resize(const size_t size)
+	{
+		executions.assign(size, 0);
+		taken.assign(size, 0);
+	}
+
+	uint64_t GetExecutions(const uint32_t address) const
+	{
+		return address < executions.size() ? executions[address] : 0;
+	}
+
+	uint64_t GetTaken(const uint32_t address) const
+	{
+		return address < taken.size() ? taken[address] : 0;
+	}
+
+	bool Load(const std::string& filename)
+	{
+		std::ifstream file(filename);
+		if (!file)
+		{
+			return false;
+		}
+
+		Resize(0x10000);
+
+		std::string line;
+		while (std::getline(file, line))
+		{
+			unsigned int address = 0;
+			unsigned long long ran = 0;
+			unsigned long long jumped = 0;
+			if (sscanf(line.c_str(), "%x %llx %llx", &address, &ran, &jumped) == 3 && address < executions.size())
+			{
+				executions[address] = ran;
+				taken[address] = jumped;
+			}
+		}
+
+		return true;
+	}
+
+	bool Save(const std::string& filename) const
+	{
+		std::ofstream file(filename);
+		if (!file)
+		{
+			return false;
+		}
+
+		char line[64];
+		for (size_t address = 0; address < executions.size(); address++)
+		{
+			if (executions[address] != 0)
+			{
+				snprintf(line, sizeof(line), "%04zx %llx %llx\n", address, static_cast<unsigned long long>(executions[address]), static_cast<unsigned long long>(taken[address]));
+				file << line;
+			}
+		}
+
+		return true;
+	}
+
+	std::vector<uint64_t> executions;
+	std::vector<uint64_t> taken;
+};
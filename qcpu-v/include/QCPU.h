@@ -5,16 +5,25 @@
 #pragma once
 
 #include "AddressingMode.h"
+#include "DecodedOp.h"
+#include "Fault.h"
+#include "FixedStack.h"
 #include "Flags.h"
+#include "Hash.h"
+#include "ISA.h"
 #include "OpArgs.h"
 #include "OpCode.h"
+#include "Policy.h"
+#include "Profile.h"
 #include "Registers.h"
+#include "Verifier.h"
 
 #include <array>
+#include <bitset>
 #include <fstream>
 #include <functional>
+#include <memory>
 #include <iostream>
-#include <stack>
 #include <stdint.h>
 #include <string>
 #include <unordered_map>
@@ -26,82 +35,203 @@ enum class EDebugState
 	Running
 };
 
-class QCPU
+template <class TPolicy>
+class TQCPU
 {
 	using SysCallMap = std::unordered_map<uint16_t, std::function<void(const OpArgs&)>>;
 
 public:
 
-	static const uint16_t MEMORY_SIZE = 0xFFFF; // 65536
+	using Policy = TPolicy;
+
+	static const uint32_t MEMORY_SIZE = 0x10000; // 65536
+	static const uint16_t CALL_STACK_SIZE = 256;
+	static const uint16_t STACK_SIZE = 1024;
+
+	// Longest loop body, in words, that is considered for fast-forwarding
+	static const uint16_t MAX_LOOP_BODY = 16;
+
+	// Bump when the layout of a .qtc file or of DecodedOp changes
+	static const uint32_t TRANSLATION_CACHE_VERSION = 2;
 
 public:
 
-	QCPU();
+	TQCPU();
 
 public:
 
 	void Load(const std::string& filename);
+	// Loads an image that is already in memory, such as the output of the assembler
+	void LoadImage(const std::vector<uint16_t>& image);
 	void Reset();
 
 	uint16_t GetArity(const EOpCode opcode) const;
 	std::array<EAddressingMode, 4> GetAddressingModes(const uint16_t address) const;
 
-	void ZipArgs(const uint16_t start, const uint16_t end, const std::array<EAddressingMode, 4>& modes);
-	void ExecuteOp(const EOpCode opcode);
+	const DecodedOp& Decode(const uint16_t address);
+	template <bool TCheckOperands = TPolicy::CheckOperands>
+	void ExecuteOp(const DecodedOp& op);
 	void Step();
 
+	VerifyResult Verify(const std::vector<uint16_t>& entries);
+
+	template <bool TCheckOperands = TPolicy::CheckOperands>
 	void Write(const OpArgs to, const uint16_t val);
+	template <bool TCheckOperands = TPolicy::CheckOperands>
 	void WriteReg(const uint16_t to, const uint16_t val);
 
+	template <bool TCheckOperands = TPolicy::CheckOperands>
 	uint16_t Read(const OpArgs from);
+	template <bool TCheckOperands = TPolicy::CheckOperands>
 	uint16_t ReadReg(const uint16_t from);
 
 	void Bind(uint16_t value, const std::function<void(const OpArgs&)>& callback);
+	void SetFaultPolicy(const EFaultPolicy policy, const uint16_t handler = 0);
+
+	// Marks every page overlapping [start, start + count) read-only, writes to them fault
+	void Protect(const uint16_t start, const uint32_t count);
+	// Drops cached decodes for [start, start + count), call after writing memory directly
+	void InvalidateRange(const uint16_t start, const uint32_t count);
+
+	// Decoded instructions and verification results can be kept in <directory>/<key>.qtc,
+	// keyed by the loaded image and this build of the VM, so repeat runs skip the warm-up
+	uint64_t GetTranslationCacheKey() const;
+	bool LoadTranslationCache(const std::string& directory);
+	bool SaveTranslationCache(const std::string& directory) const;
 
 private:
 
 	void LoadInternal(const std::vector<uint8_t>& data);
+	void HashImage();
+	void ClearTranslations();
+	std::string GetTranslationCachePath(const std::string& directory) const;
+	void WriteMemory(const uint16_t address, const uint16_t val);
+	// The write barrier for a block of count words, which wraps at the end of memory. Faults and
+	// returns false if any of it is write protected, otherwise drops the decodes it overlaps.
+	bool PrepareBlockWrite(const uint16_t address, const uint32_t count);
+	void InvalidateCode(const uint16_t address);
+	void MarkCode(const uint16_t address, const uint16_t arity);
+	bool IsLoopCandidate(const DecodedOp& op, const uint16_t address) const;
+	bool FastForward(const DecodedOp& jump);
+	static bool Evaluate(const EOpCode opcode, const int32_t b, const int32_t c);
+	void RaiseFault(const EFault code);
+	void HandleFault();
 
 private:
 
 	void cpu_nop();
+	template <bool TCheckOperands>
 	void cpu_ext(const OpArgs code);
+	template <bool TCheckOperands>
 	void cpu_sys(const OpArgs args);
+	template <bool TCheckOperands>
 	void cpu_mov(const OpArgs to, const OpArgs from);
+	template <bool TCheckOperands>
 	void cpu_jmp(const OpArgs addr);
+	template <bool TCheckOperands>
 	void cpu_jeq(const OpArgs addr, const OpArgs b, const OpArgs c);
+	template <bool TCheckOperands>
 	void cpu_jne(const OpArgs addr, const OpArgs b, const OpArgs c);
+	template <bool TCheckOperands>
 	void cpu_jgt(const OpArgs addr, const OpArgs b, const OpArgs c);
+	template <bool TCheckOperands>
 	void cpu_jge(const OpArgs addr, const OpArgs b, const OpArgs c);
+	template <bool TCheckOperands>
 	void cpu_jlt(const OpArgs addr, const OpArgs b, const OpArgs c);
+	template <bool TCheckOperands>
 	void cpu_jle(const OpArgs addr, const OpArgs b, const OpArgs c);
+	template <bool TCheckOperands>
 	void cpu_jsr(const OpArgs addr);
 	void cpu_ret();
+	template <bool TCheckOperands>
 	void cpu_add(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
 	void cpu_sub(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
 	void cpu_mul(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
 	void cpu_mdl(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
 	void cpu_and(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
 	void cpu_orr(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
 	void cpu_not(const OpArgs a);
+	template <bool TCheckOperands>
 	void cpu_xor(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
 	void cpu_lsl(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
 	void cpu_lsr(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
 	void cpu_psh(const OpArgs a);
+	template <bool TCheckOperands>
 	void cpu_pop(const OpArgs a);
+	template <bool TCheckOperands>
+	void cpu_cpy(const OpArgs a, const OpArgs b, const OpArgs c);
+	template <bool TCheckOperands>
+	void cpu_fil(const OpArgs a, const OpArgs b, const OpArgs c);
+	template <bool TCheckOperands>
+	void cpu_cmp(const OpArgs a, const OpArgs b, const OpArgs c, const OpArgs d);
+	template <bool TCheckOperands>
+	void cpu_div(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
+	void cpu_mlh(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
+	void cpu_adc(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
+	void cpu_sbb(const OpArgs a, const OpArgs b);
+	template <bool TCheckOperands>
+	void cpu_dvm(const OpArgs a, const OpArgs b);
 
 public:
 
 	uint16_t pc;
-	uint16_t cycleCount;
+	uint64_t cycleCount;
 	uint16_t memory[MEMORY_SIZE];
+	std::array<uint8_t, CODE_PAGE_COUNT> pageState;
 	Registers registers;
 	Flags flags;
-	std::stack<uint16_t> callStack;
-	std::stack<uint16_t> stack;
-	std::vector<OpArgs> zip;
+	FixedStack<uint16_t, CALL_STACK_SIZE> callStack;
+	FixedStack<uint16_t, STACK_SIZE> stack;
 	SysCallMap syscalls;
-	
+
+	// Instructions proven valid by the Verifier, these skip operand checks
+	std::bitset<0x10000> verified;
+
+	// Decoded instructions, allocated a page at a time as code is first executed
+	std::array<std::unique_ptr<CodePage>, CODE_PAGE_COUNT> codePages;
+
+	// Hashes of memory as loaded, a page is only cached if it still matches
+	uint64_t imageHash;
+	std::array<uint64_t, CODE_PAGE_COUNT> pageHashes;
+
+	// The most recent fault, and what to do when one is raised
+	Fault fault;
+	EFaultPolicy faultPolicy;
+	uint16_t faultHandler;
+
 	bool debug;
 	EDebugState debugState;
-};
\ No newline at end of file
+
+	// Only counted under a policy with RecordProfile, and cleared by Reset
+	Profile profile;
+
+private:
+
+	// The instruction currently executing, recorded for fault reports
+	uint16_t opAddress;
+	const DecodedOp* currentOp;
+	bool faultPending;
+
+	// Set when something has been decoded or verified that the translation cache does not have yet
+	bool translationsDirty;
+};
+
+// All policies are explicitly instantiated in QCPU.cpp
+extern template class TQCPU<FastPolicy>;
+extern template class TQCPU<CheckedPolicy>;
+extern template class TQCPU<TracingPolicy>;
+extern template class TQCPU<ProfilingPolicy>;
+
+using QCPU = TQCPU<QCPU_POLICY>;
\ No newline at end of file
@@ -0,0 +1,100 @@
+//
+//	Timing
+//
+
+#pragma once
+
+#include "ControlFlow.h"
+
+#include <array>
+#include <limits>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// Stands for a cost or depth nothing bounds: a loop without a bound, recursion, or a jump or
+// call to an address that isn't known
+static constexpr uint64_t UNBOUNDED_CYCLES = std::numeric_limits<uint64_t>::max();
+static constexpr int64_t UNBOUNDED_DEPTH = std::numeric_limits<int64_t>::max();
+
+struct LoopTiming
+{
+	uint16_t header;
+	uint32_t subroutine;
+
+	// Loops it is inside of
+	uint32_t depth;
+
+	// Most times the body runs, UNBOUNDED_CYCLES when no bound was given
+	uint64_t bound;
+
+	// Worst case of one pass through the body and all of it, calls included
+	uint64_t iteration;
+	uint64_t cycles;
+
+	// Its body waits for the next frame, so an iteration is a frame's work
+	bool frame;
+
+	std::vector<uint32_t> blocks;
+};
+
+struct SubroutineTiming
+{
+	// Worst case from the entry to a return, calls included
+	uint64_t cycles;
+
+	// Most return addresses on the call stack while it runs, its own not counted
+	int64_t callDepth;
+
+	// Most words it has on the data stack above where it started, and how many it leaves
+	// there when it returns, negative when it pops its caller's
+	int64_t stackDepth;
+	int64_t stackDelta;
+
+	bool recursive;
+	// Cycles the graph can't go round in one direction, so loops can't be found
+	bool irreducible;
+	// Makes computed jumps or calls
+	bool computed;
+	// Waits for the next frame, itself or in something it calls
+	bool waits;
+};
+
+struct TimingReport
+{
+	// In the order of ControlFlowGraph::subroutines
+	std::vector<SubroutineTiming> subroutines;
+	// Innermost first within each subroutine
+	std::vector<LoopTiming> loops;
+
+	// The longest iteration of a loop that waits for a frame, 0 when no loop does
+	uint64_t frameCycles;
+
+	// The most of any subroutine
+	int64_t callDepth;
+	int64_t stackDepth;
+};
+
+// Bounds the cycles a program takes and how deep its stacks go, without running it. Costs come
+// from the ISA's cycle counts. Loops are the natural loops of each subroutine's graph, and run
+// as many times as the bound given for their header; a loop without one leaves the subroutine
+// it's in unbounded, though one iteration of it still has a bound. Syscalls cost their
+// instruction only, what the host does for them isn't counted.
+class TimingAnalyzer
+{
+public:
+	TimingAnalyzer();
+
+	void SetCycles(const EOpCode opcode, const uint32_t cycles);
+	// The most times the body of the loop starting at header runs
+	void SetLoopBound(const uint16_t header, const uint64_t iterations);
+	// The syscall a program makes to wait for the next frame, 0x20 in qcpu-p
+	void SetFrameSyscall(const uint16_t number);
+
+	TimingReport Analyze(const uint16_t* memory, const ControlFlowGraph& graph) const;
+
+private:
+	std::array<uint32_t, 256> cycles;
+	std::unordered_map<uint16_t, uint64_t> bounds;
+	uint16_t frameSyscall;
+};
@@ -0,0 +1,58 @@
+//
+//	Verifier
+//
+
+#pragma once
+
+#include "AddressingMode.h"
+#include "ISA.h"
+
+#include <bitset>
+#include <stdint.h>
+#include <vector>
+
+enum class EVerifyError : uint8_t
+{
+	InvalidOpCode,
+	InvalidRegister,
+	ImmediateWrite,
+	Truncated
+};
+
+struct VerifyFailure
+{
+	VerifyFailure(const uint16_t address, const EVerifyError error)
+		: address(address)
+		, error(error)
+	{
+	}
+
+	uint16_t address;
+	EVerifyError error;
+};
+
+struct VerifyResult
+{
+	// One bit per address, set when the instruction starting there is proven valid
+	std::bitset<0x10000> verified;
+	std::vector<VerifyFailure> failures;
+
+	// Jumps whose target is not an immediate, so could not be followed
+	std::vector<uint16_t> computedJumps;
+};
+
+// Walks a loaded image by recursive descent from a set of entry points (address 0
+// and, when available, the labels from a .debug file) and proves that every
+// reachable instruction has a valid opcode, register operands in the range 0-5 and
+// no writes to immediate operands. Instructions which fail are left unverified and
+// execute on the checked path.
+class Verifier
+{
+public:
+
+	VerifyResult Verify(const uint16_t* memory, const uint32_t size, const std::vector<uint16_t>& entries) const;
+
+private:
+
+	bool VerifyInstruction(const uint16_t* memory, const uint32_t size, const uint16_t address, VerifyResult& result) const;
+};
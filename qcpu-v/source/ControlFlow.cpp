@@ -0,0 +1,509 @@
+//
+//	ControlFlow
+//
+
+#include "ControlFlow.h"
+
+#include "AddressingMode.h"
+#include "Verifier.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdio>
+#include <deque>
+
+namespace ControlFlowPrivate
+{
+	// How an instruction changes the flow, from its first operand and the calling convention
+	EBlockEnd GetFlow(const Instruction& instruction)
+	{
+		switch (instruction.opcode)
+		{
+			case EOpCode::JMP: return EBlockEnd::Jump;
+			case EOpCode::JSR: return EBlockEnd::Call;
+			case EOpCode::RET: return EBlockEnd::Return;
+			case EOpCode::EXT: return EBlockEnd::Exit;
+			default: return instruction.arity > 0 && instruction.roles[0] == EOperandRole::Target ? EBlockEnd::Branch : EBlockEnd::FallThrough;
+		}
+	}
+
+	const char* ToString(const EBlockEnd kind)
+	{
+		switch (kind)
+		{
+			case EBlockEnd::FallThrough: return "fallthrough";
+			case EBlockEnd::Jump: return "jump";
+			case EBlockEnd::Branch: return "branch";
+			case EBlockEnd::Call: return "call";
+			case EBlockEnd::Return: return "return";
+			case EBlockEnd::Exit: return "exit";
+			case EBlockEnd::Invalid: return "invalid";
+		}
+
+		return "";
+	}
+
+	std::string Hex(const uint32_t address)
+	{
+		char text[16];
+		snprintf(text, sizeof(text), "0x%04X", address);
+		return text;
+	}
+
+	std::string Name(const uint16_t address, const std::unordered_map<uint16_t, std::string>& names)
+	{
+		const auto it = names.find(address);
+		return it != names.end() ? it->second : Hex(address);
+	}
+
+	// Names are labels, but they're quoted properly anyway
+	std::string Quote(const std::string& text)
+	{
+		std::string quoted = "\"";
+		for (const char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				quoted += '\\';
+			}
+			quoted += c;
+		}
+		return quoted + "\"";
+	}
+
+	template <class T>
+	std::string JsonArray(const std::vector<T>& values)
+	{
+		std::string text = "[";
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			text += (i == 0 ? "" : ", ") + std::to_string(values[i]);
+		}
+		return text + "]";
+	}
+}
+
+int32_t ControlFlowGraph::FindBlock(const uint16_t address) const
+{
+	return address < blockAt.size() ? blockAt[address] : -1;
+}
+
+std::string ControlFlowGraph::ToDot(const bool calls, const std::unordered_map<uint16_t, std::string>& names /*= {}*/) const
+{
+	using namespace ControlFlowPrivate;
+
+	std::string text = calls ? "digraph calls {\n" : "digraph cfg {\n";
+	text += "\tnode [shape=box fontname=\"monospace\"];\n";
+
+	if (calls)
+	{
+		bool computed = false;
+		for (size_t i = 0; i < subroutines.size(); i++)
+		{
+			const Subroutine& subroutine = subroutines[i];
+			text += "\ts" + std::to_string(i) + " [label=" + Quote(Name(subroutine.entry, names)) + "];\n";
+			for (const uint32_t callee : subroutine.callees)
+			{
+				text += "\ts" + std::to_string(i) + " -> s" + std::to_string(callee) + ";\n";
+			}
+			if (subroutine.computedCalls)
+			{
+				text += "\ts" + std::to_string(i) + " -> computed [style=dotted];\n";
+				computed = true;
+			}
+		}
+		if (computed)
+		{
+			text += "\tcomputed [label=\"?\" shape=circle];\n";
+		}
+		return text + "}\n";
+	}
+
+	// A block shared by subroutines is drawn in the first one's cluster
+	std::vector<bool> drawn(blocks.size(), false);
+	auto node = [&](const uint32_t index)
+	{
+		const BasicBlock& block = blocks[index];
+		const auto name = names.find(block.start);
+		const std::string range = Hex(block.start) + "-" + Hex(block.last);
+		drawn[index] = true;
+		std::string label = Quote(name != names.end() ? name->second : range);
+		if (name != names.end())
+		{
+			label.insert(label.size() - 1, "\\n" + range);
+		}
+		return "b" + std::to_string(index) + " [label=" + label + "];\n";
+	};
+
+	for (size_t i = 0; i < subroutines.size(); i++)
+	{
+		text += "\tsubgraph cluster_" + std::to_string(i) + " {\n\t\tlabel=" + Quote(Name(subroutines[i].entry, names)) + ";\n";
+		for (const uint32_t index : subroutines[i].blocks)
+		{
+			if (!drawn[index])
+			{
+				text += "\t\t" + node(index);
+			}
+		}
+		text += "\t}\n";
+	}
+	for (uint32_t i = 0; i < blocks.size(); i++)
+	{
+		if (!drawn[i])
+		{
+			text += "\t" + node(i);
+		}
+	}
+
+	for (uint32_t i = 0; i < blocks.size(); i++)
+	{
+		const BasicBlock& block = blocks[i];
+		for (const uint32_t successor : block.successors)
+		{
+			text += "\tb" + std::to_string(i) + " -> b" + std::to_string(successor) + ";\n";
+		}
+		if (block.callee >= 0 && !subroutines[block.callee].blocks.empty())
+		{
+			text += "\tb" + std::to_string(i) + " -> b" + std::to_string(subroutines[block.callee].blocks.front()) + " [style=dashed];\n";
+		}
+	}
+
+	return text + "}\n";
+}
+
+std::string ControlFlowGraph::ToJson(const std::unordered_map<uint16_t, std::string>& names /*= {}*/) const
+{
+	using namespace ControlFlowPrivate;
+
+	std::string text = "{\n\t\"blocks\": [";
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		const BasicBlock& block = blocks[i];
+		text += i == 0 ? "\n" : ",\n";
+		text += "\t\t{ \"start\": " + std::to_string(block.start) + ", \"end\": " + std::to_string(block.end) + ", \"last\": " + std::to_string(block.last)
+			+ ", \"kind\": \"" + ToString(block.kind) + "\", \"computed\": " + (block.computed ? "true" : "false")
+			+ ", \"callee\": " + std::to_string(block.callee) + ", \"successors\": " + JsonArray(block.successors) + " }";
+	}
+
+	text += "\n\t],\n\t\"subroutines\": [";
+	for (size_t i = 0; i < subroutines.size(); i++)
+	{
+		const Subroutine& subroutine = subroutines[i];
+		text += i == 0 ? "\n" : ",\n";
+		text += "\t\t{ \"entry\": " + std::to_string(subroutine.entry) + ", \"name\": " + Quote(Name(subroutine.entry, names))
+			+ ", \"blocks\": " + JsonArray(subroutine.blocks) + ", \"callees\": " + JsonArray(subroutine.callees)
+			+ ", \"computedCalls\": " + (subroutine.computedCalls ? "true" : "false") + " }";
+	}
+
+	text += "\n\t],\n\t\"computedJumps\": " + JsonArray(computedJumps) + ",\n\t\"codeWrites\": [";
+	for (size_t i = 0; i < codeWrites.size(); i++)
+	{
+		const CodeWrite& write = codeWrites[i];
+		text += (i == 0 ? "" : ", ") + std::string("{ \"address\": ") + std::to_string(write.address) + ", \"target\": " + std::to_string(write.target)
+			+ ", \"instruction\": " + std::to_string(write.instruction) + " }";
+	}
+
+	text += "],\n\t\"indirectWrites\": " + JsonArray(indirectWrites) + ",\n\t\"unreached\": [";
+	for (size_t i = 0; i < unreached.size(); i++)
+	{
+		const AddressRange& range = unreached[i];
+		text += (i == 0 ? "" : ", ") + std::string("{ \"start\": ") + std::to_string(range.start) + ", \"end\": " + std::to_string(range.end)
+			+ ", \"code\": " + (range.code ? "true" : "false") + " }";
+	}
+
+	return text + "]\n}\n";
+}
+
+ControlFlowGraph ControlFlowAnalyzer::Analyze(const uint16_t* memory, const uint32_t size, const std::vector<uint16_t>& entries, const std::vector<uint16_t>& code /*= {}*/) const
+{
+	using namespace ControlFlowPrivate;
+
+	ControlFlowGraph graph;
+	const VerifyResult verify = Verifier().Verify(memory, size, entries);
+
+	std::bitset<0x10000> invalid;
+	for (const VerifyFailure& failure : verify.failures)
+	{
+		invalid[failure.address] = failure.address < size;
+	}
+
+	auto isInstruction = [&](const uint32_t address)
+	{
+		return address < size && (verify.verified[address] || invalid[address]);
+	};
+
+	auto decode = [&](const uint16_t address, std::array<EAddressingMode, 4>& modes)
+	{
+		modes = GetAddressingModes(static_cast<uint8_t>(memory[address] >> 8));
+		return FindInstruction(static_cast<uint16_t>(memory[address] & 0x00FF));
+	};
+
+	// Blocks start at entry points, jump targets and after anything that changes the flow
+	std::bitset<0x10000> leaders;
+	for (const uint16_t entry : entries)
+	{
+		leaders[entry] = isInstruction(entry);
+	}
+	for (uint32_t address = 0; address < size; address++)
+	{
+		std::array<EAddressingMode, 4> modes;
+		const Instruction* instruction = verify.verified[address] ? decode(static_cast<uint16_t>(address), modes) : nullptr;
+		if (instruction == nullptr || GetFlow(*instruction) == EBlockEnd::FallThrough)
+		{
+			continue;
+		}
+
+		const uint32_t next = address + 1 + instruction->arity;
+		if (instruction->arity > 0 && modes[0] == EAddressingMode::Imm && isInstruction(memory[address + 1]))
+		{
+			leaders[memory[address + 1]] = true;
+		}
+		if (isInstruction(next))
+		{
+			leaders[next] = true;
+		}
+	}
+
+	// Each leader's block runs until the next leader or a change of flow. The walk only ever
+	// visits instructions the Verifier reached, so anything it stops at is an instruction too.
+	graph.blockAt.assign(size, -1);
+	std::vector<int32_t> targets;
+	for (uint32_t start = 0; start < size; start++)
+	{
+		if (!leaders[start])
+		{
+			continue;
+		}
+
+		BasicBlock block;
+		block.start = static_cast<uint16_t>(start);
+		int32_t target = -1;
+		for (uint32_t address = start;;)
+		{
+			block.last = static_cast<uint16_t>(address);
+			if (invalid[address])
+			{
+				block.end = address + 1;
+				block.kind = EBlockEnd::Invalid;
+				break;
+			}
+
+			std::array<EAddressingMode, 4> modes;
+			const Instruction* instruction = decode(static_cast<uint16_t>(address), modes);
+			block.end = address + 1 + instruction->arity;
+			block.kind = GetFlow(*instruction);
+			if (block.kind != EBlockEnd::FallThrough)
+			{
+				const bool jumps = block.kind == EBlockEnd::Jump || block.kind == EBlockEnd::Branch || block.kind == EBlockEnd::Call;
+				block.computed = jumps && modes[0] != EAddressingMode::Imm;
+				target = jumps && !block.computed ? memory[address + 1] : -1;
+				break;
+			}
+			if (!isInstruction(block.end))
+			{
+				block.kind = EBlockEnd::Invalid;
+				break;
+			}
+			if (leaders[block.end])
+			{
+				break;
+			}
+			address = block.end;
+		}
+
+		graph.blockAt[start] = static_cast<int32_t>(graph.blocks.size());
+		graph.blocks.push_back(block);
+		targets.push_back(target);
+	}
+
+	// Subroutines are the entry points, then every call target in address order
+	std::vector<int32_t> subroutineAt(size, -1);
+	auto addSubroutine = [&](const uint32_t entry)
+	{
+		if (entry < size && graph.blockAt[entry] >= 0 && subroutineAt[entry] < 0)
+		{
+			subroutineAt[entry] = static_cast<int32_t>(graph.subroutines.size());
+			graph.subroutines.push_back(Subroutine{ static_cast<uint16_t>(entry), {}, {}, false });
+		}
+	};
+	for (const uint16_t entry : entries)
+	{
+		addSubroutine(entry);
+	}
+	for (size_t i = 0; i < graph.blocks.size(); i++)
+	{
+		if (graph.blocks[i].kind == EBlockEnd::Call && targets[i] >= 0)
+		{
+			addSubroutine(targets[i]);
+		}
+	}
+
+	for (uint32_t i = 0; i < graph.blocks.size(); i++)
+	{
+		BasicBlock& block = graph.blocks[i];
+		auto link = [&](const int32_t address)
+		{
+			const int32_t to = address >= 0 && static_cast<uint32_t>(address) < size ? graph.blockAt[address] : -1;
+			if (to >= 0 && std::find(block.successors.begin(), block.successors.end(), static_cast<uint32_t>(to)) == block.successors.end())
+			{
+				block.successors.push_back(static_cast<uint32_t>(to));
+			}
+		};
+
+		switch (block.kind)
+		{
+			case EBlockEnd::FallThrough:
+			case EBlockEnd::Call:
+			{
+				link(static_cast<int32_t>(block.end));
+				block.callee = block.kind == EBlockEnd::Call && targets[i] >= 0 ? subroutineAt[targets[i]] : -1;
+			} break;
+
+			case EBlockEnd::Branch:
+			{
+				link(targets[i]);
+				link(static_cast<int32_t>(block.end));
+			} break;
+
+			case EBlockEnd::Jump:
+			{
+				link(targets[i]);
+			} break;
+
+			default:
+			{
+			} break;
+		}
+
+		if (block.computed)
+		{
+			graph.computedJumps.push_back(block.last);
+		}
+	}
+	for (uint32_t i = 0; i < graph.blocks.size(); i++)
+	{
+		for (const uint32_t successor : graph.blocks[i].successors)
+		{
+			graph.blocks[successor].predecessors.push_back(i);
+		}
+	}
+
+	// A subroutine is everything its entry reaches without following calls
+	for (Subroutine& subroutine : graph.subroutines)
+	{
+		std::vector<bool> visited(graph.blocks.size(), false);
+		std::deque<uint32_t> queue = { static_cast<uint32_t>(graph.blockAt[subroutine.entry]) };
+		visited[queue.front()] = true;
+		while (!queue.empty())
+		{
+			const uint32_t index = queue.front();
+			queue.pop_front();
+			subroutine.blocks.push_back(index);
+
+			const BasicBlock& block = graph.blocks[index];
+			if (block.callee >= 0)
+			{
+				subroutine.callees.push_back(static_cast<uint32_t>(block.callee));
+			}
+			subroutine.computedCalls |= block.kind == EBlockEnd::Call && block.computed;
+
+			for (const uint32_t successor : block.successors)
+			{
+				if (!visited[successor])
+				{
+					visited[successor] = true;
+					queue.push_back(successor);
+				}
+			}
+		}
+
+		std::sort(subroutine.callees.begin(), subroutine.callees.end());
+		subroutine.callees.erase(std::unique(subroutine.callees.begin(), subroutine.callees.end()), subroutine.callees.end());
+	}
+
+	// The instruction each reached word belongs to
+	std::vector<int32_t> owner(size, -1);
+	for (uint32_t address = 0; address < size; address++)
+	{
+		std::array<EAddressingMode, 4> modes;
+		const Instruction* instruction = verify.verified[address] ? decode(static_cast<uint16_t>(address), modes) : nullptr;
+		const uint32_t length = instruction != nullptr ? 1 + instruction->arity : invalid[address] ? 1 : 0;
+		for (uint32_t i = 0; i < length && address + i < size; i++)
+		{
+			owner[address + i] = static_cast<int32_t>(address);
+		}
+	}
+
+	for (uint32_t address = 0; address < size; address++)
+	{
+		std::array<EAddressingMode, 4> modes;
+		const Instruction* instruction = verify.verified[address] ? decode(static_cast<uint16_t>(address), modes) : nullptr;
+		bool indirect = false;
+		for (size_t i = 0; instruction != nullptr && i < instruction->arity; i++)
+		{
+			if (instruction->roles[i] != EOperandRole::Write && instruction->roles[i] != EOperandRole::ReadWrite)
+			{
+				continue;
+			}
+
+			const uint16_t target = memory[address + 1 + i];
+			if (modes[i] == EAddressingMode::Abs && target < size && owner[target] >= 0)
+			{
+				graph.codeWrites.push_back(CodeWrite{ static_cast<uint16_t>(address), target, static_cast<uint16_t>(owner[target]) });
+			}
+			indirect |= modes[i] == EAddressingMode::Ind;
+		}
+
+		// Block operations write where their first operand says, which is only known when it
+		// and the length are immediates
+		if (instruction != nullptr && (instruction->opcode == EOpCode::CPY || instruction->opcode == EOpCode::FIL))
+		{
+			const bool known = modes[0] == EAddressingMode::Imm && modes[2] == EAddressingMode::Imm;
+			int32_t last = -1;
+			for (uint32_t i = 0; known && i < memory[address + 3]; i++)
+			{
+				const uint16_t target = static_cast<uint16_t>(memory[address + 1] + i);
+				if (target < size && owner[target] >= 0 && owner[target] != last)
+				{
+					graph.codeWrites.push_back(CodeWrite{ static_cast<uint16_t>(address), target, static_cast<uint16_t>(owner[target]) });
+					last = owner[target];
+				}
+			}
+			indirect |= !known;
+		}
+
+		if (indirect)
+		{
+			graph.indirectWrites.push_back(static_cast<uint16_t>(address));
+		}
+	}
+
+	// The words of known instructions, so dead code is split from the data around it
+	std::bitset<0x10000> known;
+	for (const uint16_t address : code)
+	{
+		const Instruction* instruction = address < size ? FindInstruction(static_cast<uint16_t>(memory[address] & 0x00FF)) : nullptr;
+		for (uint32_t i = 0; instruction != nullptr && i <= instruction->arity && address + i < size; i++)
+		{
+			known[address + i] = true;
+		}
+	}
+	for (uint32_t address = 0; address < size;)
+	{
+		if (owner[address] >= 0)
+		{
+			address++;
+			continue;
+		}
+
+		AddressRange range{ static_cast<uint16_t>(address), address, known[address] };
+		while (range.end < size && owner[range.end] < 0 && known[range.end] == range.code)
+		{
+			range.end++;
+		}
+		graph.unreached.push_back(range);
+		address = range.end;
+	}
+
+	return graph;
+}
@@ -4,21 +4,106 @@
 
 #include "QCPU.h"
 
-QCPU::QCPU()
-	: memory()
-	, pc(0)
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+
+// Identifies the build of the VM in translation cache keys, override with /D QCPU_BUILD_ID=...
+#ifndef QCPU_BUILD_ID
+#define QCPU_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+namespace QCPUPrivate
+{
+	static const uint32_t TRANSLATION_CACHE_MAGIC = 0x31435451; // "QTC1"
+
+	template <class T>
+	static void Put(std::vector<uint8_t>& buffer, const T value)
+	{
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+	}
+
+	template <class T>
+	static bool Get(const std::vector<uint8_t>& buffer, size_t& offset, T& value)
+	{
+		if (offset + sizeof(T) > buffer.size())
+		{
+			return false;
+		}
+
+		memcpy(&value, &buffer[offset], sizeof(T));
+		offset += sizeof(T);
+		return true;
+	}
+
+	// Block operations wrap at the end of memory, so a run of words is at most two pieces
+	static void CopyOut(const uint16_t* memory, const uint16_t address, const uint32_t count, uint16_t* words)
+	{
+		const uint32_t first = std::min<uint32_t>(count, 0x10000 - address);
+		memcpy(words, &memory[address], first * sizeof(uint16_t));
+		memcpy(words + first, &memory[0], (count - first) * sizeof(uint16_t));
+	}
+
+	static void CopyIn(uint16_t* memory, const uint16_t address, const uint32_t count, const uint16_t* words)
+	{
+		const uint32_t first = std::min<uint32_t>(count, 0x10000 - address);
+		memcpy(&memory[address], words, first * sizeof(uint16_t));
+		memcpy(&memory[0], words + first, (count - first) * sizeof(uint16_t));
+	}
+
+	// The jcc that jumps when opcode's doesn't
+	static EOpCode Negate(const EOpCode opcode)
+	{
+		switch (opcode)
+		{
+			case EOpCode::JEQ: return EOpCode::JNE;
+			case EOpCode::JNE: return EOpCode::JEQ;
+			case EOpCode::JGT: return EOpCode::JLE;
+			case EOpCode::JGE: return EOpCode::JLT;
+			case EOpCode::JLT: return EOpCode::JGE;
+			case EOpCode::JLE: return EOpCode::JGT;
+			default: return opcode;
+		}
+	}
+}
+
+template <class TPolicy>
+TQCPU<TPolicy>::TQCPU()
+	: pc(0)
+	, cycleCount(0)
+	, memory()
+	, pageState()
 	, registers()
 	, flags()
 	, callStack()
 	, stack()
 	, syscalls()
+	, imageHash(0)
+	, pageHashes()
+	, fault()
+	, faultPolicy(EFaultPolicy::Halt)
+	, faultHandler(0)
 	, debug(false)
 	, debugState(EDebugState::Running)
+	, profile()
+	, opAddress(0)
+	, currentOp(nullptr)
+	, faultPending(false)
+	, translationsDirty(false)
 {
-	memset(&memory[0], 0, MEMORY_SIZE);
+	memset(&memory[0], 0, sizeof(memory));
+
+	if constexpr (TPolicy::RecordProfile)
+	{
+		profile.Resize(MEMORY_SIZE);
+	}
 }
 
-void QCPU::Load(const std::string& filename)
+template <class TPolicy>
+void TQCPU<TPolicy>::Load(const std::string& filename)
 {
 	Reset();
 
@@ -43,194 +128,284 @@ void QCPU::Load(const std::string& filename)
 	LoadInternal(buffer);
 }
 
-void QCPU::Reset()
+template <class TPolicy>
+void TQCPU<TPolicy>::LoadImage(const std::vector<uint16_t>& image)
+{
+	Reset();
+
+	if (image.size() > MEMORY_SIZE)
+	{
+		std::cout << "Image is larger than memory, it will be truncated!" << std::endl;
+	}
+
+	const size_t count = std::min<size_t>(image.size(), MEMORY_SIZE);
+	std::copy(image.begin(), image.begin() + count, memory);
+
+	HashImage();
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::Reset()
 {
-	memset(&memory[0], 0, MEMORY_SIZE);
+	memset(&memory[0], 0, sizeof(memory));
 	pc = 0;
 	registers = Registers();
 	flags = Flags();
-	callStack = std::stack<uint16_t>();
-	stack = std::stack<uint16_t>();
-	zip.clear();
+	callStack.clear();
+	stack.clear();
+	ClearTranslations();
+
+	if constexpr (TPolicy::RecordProfile)
+	{
+		profile.Resize(MEMORY_SIZE);
+	}
+	imageHash = 0;
+	pageHashes.fill(0);
+	fault = Fault();
+	faultPending = false;
 }
 
-uint16_t QCPU::GetArity(const EOpCode opcode) const
+template <class TPolicy>
+uint16_t TQCPU<TPolicy>::GetArity(const EOpCode opcode) const
 {
-	switch (opcode)
+	return GetOpCodeArity(opcode);
+}
+
+template <class TPolicy>
+std::array<EAddressingMode, 4> TQCPU<TPolicy>::GetAddressingModes(const uint16_t address) const
+{
+	return ::GetAddressingModes(static_cast<uint8_t>(address));
+}
+
+template <class TPolicy>
+const DecodedOp& TQCPU<TPolicy>::Decode(const uint16_t address)
+{
+	std::unique_ptr<CodePage>& page = codePages[address >> CODE_PAGE_SHIFT];
+	if (!page)
 	{
-		default:
-		case EOpCode::NOP:
-		case EOpCode::RET:
-		{
-			return 0;
-		}
-		break;
+		page = std::make_unique<CodePage>();
+	}
 
-		case EOpCode::SYS:
-		case EOpCode::JMP:
-		case EOpCode::JSR:
-		case EOpCode::NOT:
-		case EOpCode::PSH:
-		case EOpCode::POP:
-		{
-			return 1;
-		}
-		break;
+	DecodedOp& op = page->ops[address & CODE_PAGE_MASK];
+	if (op.valid)
+	{
+		return op;
+	}
 
-		case EOpCode::EXT:
-		case EOpCode::MOV:
-		case EOpCode::ADD:
-		case EOpCode::SUB:
-		case EOpCode::MUL:
-		case EOpCode::MDL:
-		case EOpCode::AND:
-		case EOpCode::ORR:
-		case EOpCode::XOR:
-		case EOpCode::LSL:
-		case EOpCode::LSR:
-		{
-			return 2;
-		}
-		break;
+	const uint16_t current = memory[address];
+	const std::array<EAddressingMode, 4> modes = GetAddressingModes((current & 0xFF00) >> 8);
 
-		case EOpCode::JEQ:
-		case EOpCode::JNE:
-		case EOpCode::JGT:
-		case EOpCode::JGE:
-		case EOpCode::JLT:
-		case EOpCode::JLE:
-		{
-			return 3;
-		}
-		break;
+	op.opcode = static_cast<EOpCode>(current & 0x00FF);
+	op.arity = static_cast<uint8_t>(GetArity(op.opcode));
+	op.cycles = static_cast<uint8_t>(GetOpCodeCycles(op.opcode));
+	for (uint16_t i = 0; i < op.arity; i++)
+	{
+		op.args[i] = OpArgs(memory[static_cast<uint16_t>(address + 1 + i)], modes[i]);
 	}
-}
+	op.verified = verified[address];
+	op.loopCandidate = IsLoopCandidate(op, address);
+	op.valid = true;
+	translationsDirty = true;
 
-std::array<EAddressingMode, 4> QCPU::GetAddressingModes(const uint16_t address) const
-{
-	return {
-		static_cast<EAddressingMode>((address & 0b11000000) >> 6),
-		static_cast<EAddressingMode>((address & 0b00110000) >> 4),
-		static_cast<EAddressingMode>((address & 0b00001100) >> 2),
-		static_cast<EAddressingMode>((address & 0b00000011))
-	};
+	MarkCode(address, op.arity);
+	return op;
 }
 
-void QCPU::ZipArgs(const uint16_t start, const uint16_t end, const std::array<EAddressingMode, 4>& modes)
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::ExecuteOp(const DecodedOp& op)
 {
-	zip.clear();
-	for (size_t i = 0; i < end - start; i++)
+	if constexpr (TPolicy::TraceOps)
+	{
+		printf("Executing opcode: %s\n", EnumToString(op.opcode));
+	}
+
+	switch (op.opcode)
 	{
-		switch (i)
+		case EOpCode::NOP: cpu_nop(); break;
+		case EOpCode::EXT: cpu_ext<TCheckOperands>(op.args[0]); break;
+		case EOpCode::SYS: cpu_sys<TCheckOperands>(op.args[0]); break;
+		case EOpCode::MOV: cpu_mov<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::JMP: cpu_jmp<TCheckOperands>(op.args[0]); break;
+		case EOpCode::JEQ: cpu_jeq<TCheckOperands>(op.args[0], op.args[1], op.args[2]); break;
+		case EOpCode::JNE: cpu_jne<TCheckOperands>(op.args[0], op.args[1], op.args[2]); break;
+		case EOpCode::JGT: cpu_jgt<TCheckOperands>(op.args[0], op.args[1], op.args[2]); break;
+		case EOpCode::JGE: cpu_jge<TCheckOperands>(op.args[0], op.args[1], op.args[2]); break;
+		case EOpCode::JLT: cpu_jlt<TCheckOperands>(op.args[0], op.args[1], op.args[2]); break;
+		case EOpCode::JLE: cpu_jle<TCheckOperands>(op.args[0], op.args[1], op.args[2]); break;
+		case EOpCode::JSR: cpu_jsr<TCheckOperands>(op.args[0]); break;
+		case EOpCode::RET: cpu_ret(); break;
+		case EOpCode::ADD: cpu_add<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::SUB: cpu_sub<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::MUL: cpu_mul<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::MDL: cpu_mdl<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::AND: cpu_and<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::ORR: cpu_orr<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::NOT: cpu_not<TCheckOperands>(op.args[0]); break;
+		case EOpCode::XOR: cpu_xor<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::LSL: cpu_lsl<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::LSR: cpu_lsr<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::PSH: cpu_psh<TCheckOperands>(op.args[0]); break;
+		case EOpCode::POP: cpu_pop<TCheckOperands>(op.args[0]); break;
+		case EOpCode::CPY: cpu_cpy<TCheckOperands>(op.args[0], op.args[1], op.args[2]); break;
+		case EOpCode::FIL: cpu_fil<TCheckOperands>(op.args[0], op.args[1], op.args[2]); break;
+		case EOpCode::CMP: cpu_cmp<TCheckOperands>(op.args[0], op.args[1], op.args[2], op.args[3]); break;
+		case EOpCode::DIV: cpu_div<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::MLH: cpu_mlh<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::ADC: cpu_adc<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::SBB: cpu_sbb<TCheckOperands>(op.args[0], op.args[1]); break;
+		case EOpCode::DVM: cpu_dvm<TCheckOperands>(op.args[0], op.args[1]); break;
+		default:
 		{
-			case 0: {} break;
-			case 1:
-			case 2:
-			case 3:
-			case 4: { zip.emplace_back(memory[start + i - 1], modes[i - 1]); } break;
-			default:
+			if constexpr (TCheckOperands)
 			{
-				std::cout << "invalid number of arguments" << std::endl;
+				RaiseFault(EFault::InvalidOpCode);
 			}
-			break;
 		}
+		break;
 	}
 }
 
-void QCPU::ExecuteOp(const EOpCode opcode)
+template <class TPolicy>
+void TQCPU<TPolicy>::Step()
 {
-	static bool opcode_debug = false;
-	if (opcode_debug)
+	const DecodedOp& op = Decode(pc);
+
+	opAddress = pc;
+	currentOp = &op;
+	pc += 1 + op.arity;
+	cycleCount += op.cycles;
+
+	// Where execution goes if the op doesn't jump, op may not survive code writing to itself
+	[[maybe_unused]] const uint16_t next = pc;
+	if constexpr (TPolicy::RecordProfile)
 	{
-		printf("Exectuing opcode: %s\n", EnumToString(opcode));
+		profile.executions[opAddress]++;
 	}
 
-	switch (opcode)
+	if constexpr (TPolicy::FastForwardLoops)
 	{
-		case EOpCode::NOP: cpu_nop(); break;
-		case EOpCode::EXT: cpu_ext(zip[0]); break;
-		case EOpCode::SYS: cpu_sys(zip[0]); break;
-		case EOpCode::MOV: cpu_mov(zip[0], zip[1]); break;
-		case EOpCode::JMP: cpu_jmp(zip[0]); break;
-		case EOpCode::JEQ: cpu_jeq(zip[0], zip[1], zip[2]); break;
-		case EOpCode::JNE: cpu_jne(zip[0], zip[1], zip[2]); break;
-		case EOpCode::JGT: cpu_jgt(zip[0], zip[1], zip[2]); break;
-		case EOpCode::JGE: cpu_jge(zip[0], zip[1], zip[2]); break;
-		case EOpCode::JLT: cpu_jlt(zip[0], zip[1], zip[2]); break;
-		case EOpCode::JLE: cpu_jle(zip[0], zip[1], zip[2]); break;
-		case EOpCode::JSR: cpu_jsr(zip[0]); break;
-		case EOpCode::RET: cpu_ret(); break;
-		case EOpCode::ADD: cpu_add(zip[0], zip[1]); break;
-		case EOpCode::SUB: cpu_sub(zip[0], zip[1]); break;
-		case EOpCode::MUL: cpu_mul(zip[0], zip[1]); break;
-		case EOpCode::MDL: cpu_mdl(zip[0], zip[1]); break;
-		case EOpCode::AND: cpu_and(zip[0], zip[1]); break;
-		case EOpCode::ORR: cpu_orr(zip[0], zip[1]); break;
-		case EOpCode::NOT: cpu_not(zip[0]); break;
-		case EOpCode::XOR: cpu_xor(zip[0], zip[1]); break;
-		case EOpCode::LSL: cpu_lsl(zip[0], zip[1]); break;
-		case EOpCode::LSR: cpu_lsr(zip[0], zip[1]); break;
-		case EOpCode::PSH: cpu_psh(zip[0]); break;
-		case EOpCode::POP: cpu_pop(zip[0]); break;
+		// Single stepping in the debugger must see every iteration
+		if (op.loopCandidate && flags.halt == 0 && !debug && FastForward(op))
+		{
+			return;
+		}
+	}
+
+	if constexpr (TPolicy::CheckOperands)
+	{
+		if (op.verified)
+		{
+			ExecuteOp<false>(op);
+		}
+		else
+		{
+			ExecuteOp(op);
+		}
+	}
+	else
+	{
+		ExecuteOp(op);
+	}
+
+	if (faultPending)
+	{
+		HandleFault();
+	}
+
+	if constexpr (TPolicy::RecordProfile)
+	{
+		if (pc != next)
+		{
+			profile.taken[opAddress]++;
+		}
 	}
 }
 
-void QCPU::Step()
+template <class TPolicy>
+VerifyResult TQCPU<TPolicy>::Verify(const std::vector<uint16_t>& entries)
 {
-	uint16_t	current = memory[pc];
-	uint16_t	op = current & 0x00FF;
-	uint16_t	addr = (current & 0xFF00) >> 8;
-	EOpCode		opcode = static_cast<EOpCode>(op);
-
-	uint16_t	arity = GetArity(opcode);
-	std::array<EAddressingMode, 4> addressing_modes = GetAddressingModes(addr);
+	Verifier verifier;
+	VerifyResult result = verifier.Verify(memory, MEMORY_SIZE, entries);
+	verified = result.verified;
 
-	pc += 1;
-	ZipArgs(pc, pc + arity + 1, addressing_modes);
-	pc += arity;
-	cycleCount++;
+	// Mark code pages up front so that the write barrier sees code that has not run yet,
+	// and drop any decodes made before verification so they pick up the verified bit
+	for (uint32_t address = 0; address < MEMORY_SIZE; address++)
+	{
+		if (verified[address])
+		{
+			const EOpCode opcode = static_cast<EOpCode>(memory[address] & 0x00FF);
+			MarkCode(static_cast<uint16_t>(address), GetArity(opcode));
+		}
+	}
+	for (std::unique_ptr<CodePage>& page : codePages)
+	{
+		page.reset();
+	}
+	translationsDirty = true;
 
-	ExecuteOp(opcode);
+	return result;
 }
 
-void QCPU::Write(const OpArgs to, const uint16_t val)
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::Write(const OpArgs to, const uint16_t val)
 {
 	switch (to.mode)
 	{
 		default:
 		case EAddressingMode::Imm:
 		{
-			std::cout << "cannot write to immediate value: " << to.value << std::endl;
+			if constexpr (TCheckOperands)
+			{
+				RaiseFault(EFault::ImmediateWrite);
+			}
 		}
 		break;
 
 		case EAddressingMode::Abs:
 		{
-			memory[to.value] = val;
+			WriteMemory(to.value, val);
 		}
 		break;
 
 		case EAddressingMode::Ind:
 		{
-			memory[Read({ to.value, EAddressingMode::Reg })] = val;
+			if constexpr (TCheckOperands)
+			{
+				if (to.value > 5)
+				{
+					RaiseFault(EFault::InvalidRegister);
+					return;
+				}
+			}
+
+			const uint16_t address = Read<TCheckOperands>({ to.value, EAddressingMode::Reg });
+			WriteMemory(address, val);
 		}
 		break;
 
 		case EAddressingMode::Reg:
 		{
-			WriteReg(to.value, val);
+			WriteReg<TCheckOperands>(to.value, val);
 		}
 		break;
 	}
 }
 
-void QCPU::WriteReg(const uint16_t to, const uint16_t val)
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::WriteReg(const uint16_t to, const uint16_t val)
 {
 	switch (to)
 	{
 		default:
 		{
-			std::cout << "Unknown register: " << to << std::endl;
+			if constexpr (TCheckOperands)
+			{
+				RaiseFault(EFault::InvalidRegister);
+			}
 		}
 		break;
 
@@ -243,7 +418,9 @@ void QCPU::WriteReg(const uint16_t to, const uint16_t val)
 	}
 }
 
-uint16_t QCPU::Read(const OpArgs from)
+template <class TPolicy>
+template <bool TCheckOperands>
+uint16_t TQCPU<TPolicy>::Read(const OpArgs from)
 {
 	switch (from.mode)
 	{
@@ -262,25 +439,30 @@ uint16_t QCPU::Read(const OpArgs from)
 
 		case EAddressingMode::Ind:
 		{
-			return memory[Read({ from.value, EAddressingMode::Reg })];
+			return memory[Read<TCheckOperands>({ from.value, EAddressingMode::Reg })];
 		}
 		break;
 
 		case EAddressingMode::Reg:
 		{
-			return ReadReg(from.value);
+			return ReadReg<TCheckOperands>(from.value);
 		}
 		break;
 	}
 }
 
-uint16_t QCPU::ReadReg(const uint16_t from)
+template <class TPolicy>
+template <bool TCheckOperands>
+uint16_t TQCPU<TPolicy>::ReadReg(const uint16_t from)
 {
 	switch (from)
 	{
 		default:
 		{
-			std::cout << "Unknown register: %d" << from << std::endl;
+			if constexpr (TCheckOperands)
+			{
+				RaiseFault(EFault::InvalidRegister);
+			}
 			return 0;
 		}
 		break;
@@ -294,12 +476,253 @@ uint16_t QCPU::ReadReg(const uint16_t from)
 	}
 }
 
-void QCPU::Bind(uint16_t value, const std::function<void(const OpArgs&)>& callback)
+template <class TPolicy>
+void TQCPU<TPolicy>::Bind(uint16_t value, const std::function<void(const OpArgs&)>& callback)
 {
 	syscalls.emplace(value, callback);
 }
 
-void QCPU::LoadInternal(const std::vector<uint8_t>& data)
+template <class TPolicy>
+void TQCPU<TPolicy>::SetFaultPolicy(const EFaultPolicy policy, const uint16_t handler /*= 0*/)
+{
+	faultPolicy = policy;
+	faultHandler = handler;
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::Protect(const uint16_t start, const uint32_t count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	const uint32_t first = start >> CODE_PAGE_SHIFT;
+	const uint32_t last = (start + count - 1) >> CODE_PAGE_SHIFT;
+	for (uint32_t page = first; page <= last; page++)
+	{
+		pageState[page % CODE_PAGE_COUNT] |= PAGE_READ_ONLY;
+	}
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::InvalidateRange(const uint16_t start, const uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const uint16_t address = static_cast<uint16_t>(start + i);
+		if ((pageState[address >> CODE_PAGE_SHIFT] & PAGE_CODE) != 0)
+		{
+			InvalidateCode(address);
+		}
+	}
+}
+
+template <class TPolicy>
+bool TQCPU<TPolicy>::IsLoopCandidate(const DecodedOp& op, const uint16_t address) const
+{
+	switch (op.opcode)
+	{
+		case EOpCode::JMP:
+		case EOpCode::JEQ:
+		case EOpCode::JNE:
+		case EOpCode::JGT:
+		case EOpCode::JGE:
+		case EOpCode::JLT:
+		case EOpCode::JLE:
+		{
+			const OpArgs& target = op.args[0];
+			return target.mode == EAddressingMode::Imm && target.value <= address && address - target.value <= MAX_LOOP_BODY;
+		}
+		break;
+
+		default:
+		{
+			return false;
+		}
+		break;
+	}
+}
+
+template <class TPolicy>
+bool TQCPU<TPolicy>::FastForward(const DecodedOp& jump)
+{
+	const uint16_t target = jump.args[0].value;
+	DecodedOp& candidate = codePages[opAddress >> CODE_PAGE_SHIFT]->ops[opAddress & CODE_PAGE_MASK];
+
+	// A loop tested at the bottom ends in the jcc back to its start. One tested at the top ends
+	// in a jmp back to a jcc out of it, like
+	//   -: jeq + d 0
+	//      sub d 1
+	//      jmp -
+	const DecodedOp* test = &jump;
+	uint16_t address = target;
+	if (jump.opcode == EOpCode::JMP)
+	{
+		const DecodedOp& first = Decode(target);
+		// Only a jcc has a negation, and it has to jump to somewhere outside the loop
+		const bool branch = QCPUPrivate::Negate(first.opcode) != first.opcode;
+		const bool leaves = first.args[0].mode == EAddressingMode::Imm && (first.args[0].value < target || first.args[0].value > opAddress);
+		if (!branch || !leaves)
+		{
+			candidate.loopCandidate = false;
+			return false;
+		}
+
+		test = &first;
+		address = static_cast<uint16_t>(target + 1 + first.arity);
+	}
+
+	// The rest of the body may only hold nops and at most one add or sub of an immediate to a register
+	const DecodedOp* counter = nullptr;
+	uint64_t bodyCycles = 0;
+	bool simple = true;
+	while (address < opAddress && simple)
+	{
+		const DecodedOp& op = Decode(address);
+		if ((op.opcode == EOpCode::ADD || op.opcode == EOpCode::SUB) && counter == nullptr
+			&& op.args[0].mode == EAddressingMode::Reg && op.args[0].value <= 5
+			&& op.args[1].mode == EAddressingMode::Imm)
+		{
+			counter = &op;
+		}
+		else if (op.opcode != EOpCode::NOP)
+		{
+			simple = false;
+		}
+
+		address += 1 + op.arity;
+		bodyCycles += op.cycles;
+	}
+
+	// Without a counter nothing in the loop changes, it only ends when the host changes something,
+	// and how long that takes isn't known here so it is left to run
+	if (!simple || address != opAddress || counter == nullptr)
+	{
+		candidate.loopCandidate = false;
+		return false;
+	}
+
+	int32_t delta = counter->opcode == EOpCode::ADD ? counter->args[1].value : -static_cast<int32_t>(counter->args[1].value);
+	delta = static_cast<int16_t>(static_cast<uint16_t>(delta));
+	if (delta == 0)
+	{
+		candidate.loopCandidate = false;
+		return false;
+	}
+
+	// The test must compare the counter register against an immediate
+	const OpArgs& reg = counter->args[0];
+	const bool counterFirst = test->args[1].mode == EAddressingMode::Reg && test->args[1].value == reg.value && test->args[2].mode == EAddressingMode::Imm;
+	const bool counterSecond = test->args[2].mode == EAddressingMode::Reg && test->args[2].value == reg.value && test->args[1].mode == EAddressingMode::Imm;
+	if (!counterFirst && !counterSecond)
+	{
+		candidate.loopCandidate = false;
+		return false;
+	}
+
+	// The loop goes round while a bottom test is true, or while a top test is false
+	const bool top = test != &jump;
+	const EOpCode repeat = top ? QCPUPrivate::Negate(test->opcode) : test->opcode;
+	const int32_t start = ReadReg<false>(reg.value);
+	const int32_t limit = counterFirst ? test->args[2].value : test->args[1].value;
+	auto taken = [&](const int32_t value)
+	{
+		return counterFirst ? Evaluate(repeat, value, limit) : Evaluate(repeat, limit, value);
+	};
+
+	if (!taken(start))
+	{
+		return false;
+	}
+
+	// Find how many more times the body runs before the loop ends. Only loops that end
+	// without the counter wrapping are skipped, anything else is left to the interpreter.
+	const int32_t maxIterations = delta > 0 ? (0xFFFF - start) / delta : start / -delta;
+	int32_t iterations = 0;
+	switch (repeat)
+	{
+		case EOpCode::JEQ:
+		{
+			iterations = 1;
+		}
+		break;
+
+		case EOpCode::JNE:
+		{
+			if ((limit - start) % delta == 0)
+			{
+				iterations = (limit - start) / delta;
+			}
+		}
+		break;
+
+		default:
+		{
+			// Comparisons against a counter moving one way are true until they are false
+			if (maxIterations > 0 && !taken(start + maxIterations * delta))
+			{
+				int32_t lo = 1;
+				int32_t hi = maxIterations;
+				while (lo < hi)
+				{
+					const int32_t mid = lo + (hi - lo) / 2;
+					if (taken(start + mid * delta))
+					{
+						lo = mid + 1;
+					}
+					else
+					{
+						hi = mid;
+					}
+				}
+				iterations = lo;
+			}
+		}
+		break;
+	}
+
+	if (iterations <= 0 || iterations > maxIterations)
+	{
+		candidate.loopCandidate = false;
+		return false;
+	}
+
+	// Leave the machine as if every iteration had run, with carry as the last add or sub left
+	// it. The jump itself was counted by Step. A top test runs once more than the body, and
+	// then leaves the loop.
+	const uint16_t last = static_cast<uint16_t>(start + (iterations - 1) * delta);
+	flags.carry = counter->opcode == EOpCode::ADD ? last + counter->args[1].value > 0xFFFF : last < counter->args[1].value;
+	WriteReg<false>(reg.value, static_cast<uint16_t>(start + iterations * delta));
+	if (top)
+	{
+		cycleCount += static_cast<uint64_t>(iterations) * (test->cycles + bodyCycles + jump.cycles) + test->cycles;
+		pc = test->args[0].value;
+	}
+	else
+	{
+		cycleCount += static_cast<uint64_t>(iterations) * (bodyCycles + jump.cycles);
+	}
+	return true;
+}
+
+template <class TPolicy>
+bool TQCPU<TPolicy>::Evaluate(const EOpCode opcode, const int32_t b, const int32_t c)
+{
+	switch (opcode)
+	{
+		case EOpCode::JEQ: return b == c;
+		case EOpCode::JNE: return b != c;
+		case EOpCode::JGT: return b > c;
+		case EOpCode::JGE: return b >= c;
+		case EOpCode::JLT: return b < c;
+		case EOpCode::JLE: return b <= c;
+		default: return true;
+	}
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::LoadInternal(const std::vector<uint8_t>& data)
 {
 	if (data.size() % 2 != 0)
 	{
@@ -312,4 +735,806 @@ void QCPU::LoadInternal(const std::vector<uint8_t>& data)
 		uint8_t byte2 = data[i * 2 + 1];
 		memory[i] = ((static_cast<uint16_t>(byte2) << 8) + static_cast<uint16_t>(byte1));
 	}
+
+	HashImage();
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::HashImage()
+{
+	imageHash = FNV_OFFSET_BASIS;
+	for (uint32_t page = 0; page < CODE_PAGE_COUNT; page++)
+	{
+		pageHashes[page] = Fnv1a(&memory[page << CODE_PAGE_SHIFT], CODE_PAGE_SIZE * sizeof(uint16_t));
+		imageHash = Fnv1a(&pageHashes[page], sizeof(uint64_t), imageHash);
+	}
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::ClearTranslations()
+{
+	verified.reset();
+	pageState.fill(0);
+	for (std::unique_ptr<CodePage>& page : codePages)
+	{
+		page.reset();
+	}
+	translationsDirty = false;
 }
+
+template <class TPolicy>
+uint64_t TQCPU<TPolicy>::GetTranslationCacheKey() const
+{
+	const char* build = QCPU_BUILD_ID;
+	const uint32_t version = TRANSLATION_CACHE_VERSION;
+
+	uint64_t key = Fnv1a(build, strlen(build));
+	key = Fnv1a(TPolicy::Name, strlen(TPolicy::Name), key);
+	key = Fnv1a(&version, sizeof(version), key);
+	return Fnv1a(&imageHash, sizeof(imageHash), key);
+}
+
+template <class TPolicy>
+std::string TQCPU<TPolicy>::GetTranslationCachePath(const std::string& directory) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.qtc", static_cast<unsigned long long>(GetTranslationCacheKey()));
+	return (std::filesystem::path(directory) / name).string();
+}
+
+template <class TPolicy>
+bool TQCPU<TPolicy>::LoadTranslationCache(const std::string& directory)
+{
+	using namespace QCPUPrivate;
+
+	std::ifstream file(GetTranslationCachePath(directory), std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+
+	std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (buffer.size() < sizeof(uint64_t))
+	{
+		return false;
+	}
+
+	// The file ends with a hash of everything before it, so torn or corrupt writes are rejected
+	uint64_t checksum = 0;
+	const size_t payloadSize = buffer.size() - sizeof(uint64_t);
+	memcpy(&checksum, &buffer[payloadSize], sizeof(uint64_t));
+	if (checksum != Fnv1a(buffer.data(), payloadSize))
+	{
+		return false;
+	}
+	buffer.resize(payloadSize);
+
+	size_t offset = 0;
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint64_t key = 0;
+	uint16_t pageCount = 0;
+	if (!Get(buffer, offset, magic) || magic != TRANSLATION_CACHE_MAGIC
+		|| !Get(buffer, offset, version) || version != TRANSLATION_CACHE_VERSION
+		|| !Get(buffer, offset, key) || key != GetTranslationCacheKey()
+		|| !Get(buffer, offset, pageCount))
+	{
+		return false;
+	}
+
+	ClearTranslations();
+
+	for (uint16_t i = 0; i < pageCount; i++)
+	{
+		uint16_t index = 0;
+		uint16_t entryCount = 0;
+		if (!Get(buffer, offset, index) || index >= CODE_PAGE_COUNT)
+		{
+			ClearTranslations();
+			return false;
+		}
+
+		const uint16_t base = index << CODE_PAGE_SHIFT;
+		pageState[index] |= PAGE_CODE;
+
+		for (uint16_t word = 0; word < CODE_PAGE_SIZE; word += 8)
+		{
+			uint8_t bits = 0;
+			if (!Get(buffer, offset, bits))
+			{
+				ClearTranslations();
+				return false;
+			}
+
+			for (uint16_t bit = 0; bit < 8; bit++)
+			{
+				verified[base + word + bit] = (bits & (1 << bit)) != 0;
+			}
+		}
+
+		if (!Get(buffer, offset, entryCount) || entryCount > CODE_PAGE_SIZE)
+		{
+			ClearTranslations();
+			return false;
+		}
+
+		if (entryCount > 0)
+		{
+			codePages[index] = std::make_unique<CodePage>();
+		}
+
+		for (uint16_t e = 0; e < entryCount; e++)
+		{
+			uint8_t slot = 0;
+			uint8_t opcode = 0;
+			uint8_t arity = 0;
+			uint8_t isVerified = 0;
+			if (!Get(buffer, offset, slot) || !Get(buffer, offset, opcode)
+				|| !Get(buffer, offset, arity) || !Get(buffer, offset, isVerified) || arity > 4)
+			{
+				ClearTranslations();
+				return false;
+			}
+
+			DecodedOp& op = codePages[index]->ops[slot];
+			op.opcode = static_cast<EOpCode>(opcode);
+			op.arity = arity;
+			op.cycles = static_cast<uint8_t>(GetOpCodeCycles(op.opcode));
+			op.verified = isVerified != 0;
+			for (uint8_t a = 0; a < arity; a++)
+			{
+				uint8_t mode = 0;
+				if (!Get(buffer, offset, op.args[a].value) || !Get(buffer, offset, mode))
+				{
+					ClearTranslations();
+					return false;
+				}
+				op.args[a].mode = static_cast<EAddressingMode>(mode & 0b11);
+			}
+			op.loopCandidate = IsLoopCandidate(op, static_cast<uint16_t>(base + slot));
+			op.valid = true;
+
+			MarkCode(static_cast<uint16_t>(base + slot), arity);
+		}
+	}
+
+	translationsDirty = false;
+	return true;
+}
+
+template <class TPolicy>
+bool TQCPU<TPolicy>::SaveTranslationCache(const std::string& directory) const
+{
+	using namespace QCPUPrivate;
+
+	if (!translationsDirty)
+	{
+		return true;
+	}
+
+	// Only pages that still match the loaded image are saved, self-modified code is left to be re-decoded
+	std::array<bool, CODE_PAGE_COUNT> clean;
+	uint16_t pageCount = 0;
+	for (uint32_t page = 0; page < CODE_PAGE_COUNT; page++)
+	{
+		clean[page] = (pageState[page] & PAGE_CODE) != 0
+			&& Fnv1a(&memory[page << CODE_PAGE_SHIFT], CODE_PAGE_SIZE * sizeof(uint16_t)) == pageHashes[page];
+		pageCount += clean[page] ? 1 : 0;
+	}
+
+	std::vector<uint8_t> buffer;
+	Put(buffer, TRANSLATION_CACHE_MAGIC);
+	Put(buffer, TRANSLATION_CACHE_VERSION);
+	Put(buffer, GetTranslationCacheKey());
+	Put(buffer, pageCount);
+
+	for (uint32_t page = 0; page < CODE_PAGE_COUNT; page++)
+	{
+		if (!clean[page])
+		{
+			continue;
+		}
+
+		const uint16_t base = static_cast<uint16_t>(page << CODE_PAGE_SHIFT);
+		Put(buffer, static_cast<uint16_t>(page));
+
+		for (uint16_t word = 0; word < CODE_PAGE_SIZE; word += 8)
+		{
+			uint8_t bits = 0;
+			for (uint16_t bit = 0; bit < 8; bit++)
+			{
+				bits |= verified[base + word + bit] ? (1 << bit) : 0;
+			}
+			Put(buffer, bits);
+		}
+
+		// Entry count is patched once we know which entries survive
+		const size_t countOffset = buffer.size();
+		uint16_t entryCount = 0;
+		Put(buffer, entryCount);
+
+		const std::unique_ptr<CodePage>& codePage = codePages[page];
+		for (uint16_t slot = 0; codePage && slot < CODE_PAGE_SIZE; slot++)
+		{
+			const DecodedOp& op = codePage->ops[slot];
+			const uint16_t end = static_cast<uint16_t>(base + slot + op.arity);
+			if (!op.valid || !clean[end >> CODE_PAGE_SHIFT])
+			{
+				continue;
+			}
+
+			Put(buffer, static_cast<uint8_t>(slot));
+			Put(buffer, static_cast<uint8_t>(op.opcode));
+			Put(buffer, op.arity);
+			Put(buffer, static_cast<uint8_t>(op.verified ? 1 : 0));
+			for (uint8_t a = 0; a < op.arity; a++)
+			{
+				Put(buffer, op.args[a].value);
+				Put(buffer, static_cast<uint8_t>(op.args[a].mode));
+			}
+			entryCount++;
+		}
+		memcpy(&buffer[countOffset], &entryCount, sizeof(entryCount));
+	}
+
+	Put(buffer, Fnv1a(buffer.data(), buffer.size()));
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+
+	// Write to the side and rename, so a concurrent reader never sees a partial file
+	const std::string path = GetTranslationCachePath(directory);
+	const std::string temp = path + ".tmp";
+	{
+		std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+		if (!file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size()))
+		{
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temp, path, error);
+	return !error;
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::WriteMemory(const uint16_t address, const uint16_t val)
+{
+	// Data pages have no state bits, so the common case is a single load and compare
+	const uint8_t state = pageState[address >> CODE_PAGE_SHIFT];
+	if (state != 0)
+	{
+		if ((state & PAGE_READ_ONLY) != 0)
+		{
+			RaiseFault(EFault::WriteProtected);
+			return;
+		}
+
+		InvalidateCode(address);
+	}
+
+	memory[address] = val;
+}
+
+template <class TPolicy>
+bool TQCPU<TPolicy>::PrepareBlockWrite(const uint16_t address, const uint32_t count)
+{
+	// A page at a time, data pages are skipped without looking at their words
+	for (uint32_t offset = 0; offset < count;)
+	{
+		const uint16_t start = static_cast<uint16_t>(address + offset);
+		const uint32_t run = std::min<uint32_t>(count - offset, CODE_PAGE_SIZE - (start & CODE_PAGE_MASK));
+		const uint8_t state = pageState[start >> CODE_PAGE_SHIFT];
+		if ((state & PAGE_READ_ONLY) != 0)
+		{
+			RaiseFault(EFault::WriteProtected);
+			return false;
+		}
+
+		if (state != 0)
+		{
+			for (uint32_t i = 0; i < run; i++)
+			{
+				InvalidateCode(static_cast<uint16_t>(start + i));
+			}
+		}
+		offset += run;
+	}
+
+	return true;
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::InvalidateCode(const uint16_t address)
+{
+	// An instruction is at most 4 words long, so a write can change any that start up to 3 words before it
+	for (uint16_t i = 0; i < 4; i++)
+	{
+		const uint16_t start = static_cast<uint16_t>(address - i);
+		const std::unique_ptr<CodePage>& page = codePages[start >> CODE_PAGE_SHIFT];
+		if (page)
+		{
+			page->ops[start & CODE_PAGE_MASK].valid = false;
+		}
+		verified[start] = false;
+	}
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::MarkCode(const uint16_t address, const uint16_t arity)
+{
+	// An instruction can straddle a page boundary, every page it touches must see writes
+	pageState[address >> CODE_PAGE_SHIFT] |= PAGE_CODE;
+	pageState[static_cast<uint16_t>(address + arity) >> CODE_PAGE_SHIFT] |= PAGE_CODE;
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::RaiseFault(const EFault code)
+{
+	// Keep the first fault of an instruction, later ones are usually knock-on effects
+	if (faultPending)
+	{
+		return;
+	}
+
+	fault.code = code;
+	fault.pc = opAddress;
+	fault.opcode = currentOp->opcode;
+	fault.operandCount = currentOp->arity;
+	fault.operands = currentOp->args;
+
+	faultPending = true;
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::HandleFault()
+{
+	faultPending = false;
+
+	switch (faultPolicy)
+	{
+		case EFaultPolicy::Halt:
+		{
+			flags.fault = true;
+		}
+		break;
+
+		case EFaultPolicy::Trap:
+		{
+			// A fault we cannot trap (no room to store the return address) halts instead
+			if (callStack.full())
+			{
+				flags.fault = true;
+				return;
+			}
+
+			callStack.push(static_cast<uint16_t>(fault.pc + 1 + GetArity(fault.opcode)));
+			registers.x = static_cast<uint16_t>(fault.code);
+			registers.y = fault.pc;
+			pc = faultHandler;
+		}
+		break;
+
+		case EFaultPolicy::Ignore:
+		{
+		}
+		break;
+	}
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::cpu_nop()
+{
+
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_ext(const OpArgs code)
+{
+	flags.exit = Read<TCheckOperands>(code);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_sys(const OpArgs args)
+{
+	auto iter = syscalls.find(Read<TCheckOperands>(args));
+	if (iter != syscalls.end())
+	{
+		syscalls[Read<TCheckOperands>(args)](args);
+	}
+	else
+	{
+		RaiseFault(EFault::UnknownSysCall);
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_mov(const OpArgs to, const OpArgs from)
+{
+	Write<TCheckOperands>(to, Read<TCheckOperands>(from));
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_jmp(const OpArgs addr)
+{
+	pc = Read<TCheckOperands>(addr);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_jeq(const OpArgs addr, const OpArgs b, const OpArgs c)
+{
+	if (Read<TCheckOperands>(b) == Read<TCheckOperands>(c))
+	{
+		cpu_jmp<TCheckOperands>(addr);
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_jne(const OpArgs addr, const OpArgs b, const OpArgs c)
+{
+	if (Read<TCheckOperands>(b) != Read<TCheckOperands>(c))
+	{
+		cpu_jmp<TCheckOperands>(addr);
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_jgt(const OpArgs addr, const OpArgs b, const OpArgs c)
+{
+	if (Read<TCheckOperands>(b) > Read<TCheckOperands>(c))
+	{
+		cpu_jmp<TCheckOperands>(addr);
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_jge(const OpArgs addr, const OpArgs b, const OpArgs c)
+{
+	if (Read<TCheckOperands>(b) >= Read<TCheckOperands>(c))
+	{
+		cpu_jmp<TCheckOperands>(addr);
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_jlt(const OpArgs addr, const OpArgs b, const OpArgs c)
+{
+	if (Read<TCheckOperands>(b) < Read<TCheckOperands>(c))
+	{
+		cpu_jmp<TCheckOperands>(addr);
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_jle(const OpArgs addr, const OpArgs b, const OpArgs c)
+{
+	if (Read<TCheckOperands>(b) <= Read<TCheckOperands>(c))
+	{
+		cpu_jmp<TCheckOperands>(addr);
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_jsr(const OpArgs addr)
+{
+	if (callStack.full())
+	{
+		RaiseFault(EFault::CallStackOverflow);
+		return;
+	}
+
+	callStack.push(pc);
+	cpu_jmp<TCheckOperands>(addr);
+}
+
+template <class TPolicy>
+void TQCPU<TPolicy>::cpu_ret()
+{
+	if (callStack.empty())
+	{
+		RaiseFault(EFault::CallStackUnderflow);
+	}
+	else
+	{
+		pc = callStack.top();
+		callStack.pop();
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_add(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	const bool carry = read_a + read_b > 0xFFFF;
+	Write<TCheckOperands>(a, read_a + read_b);
+
+	// An instruction that faults leaves carry as it was
+	if (!faultPending)
+	{
+		flags.carry = carry;
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_sub(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	const bool carry = read_a < read_b;
+	Write<TCheckOperands>(a, read_a - read_b);
+	if (!faultPending)
+	{
+		flags.carry = carry;
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_mul(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	Write<TCheckOperands>(a, read_a * read_b);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_mdl(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	if (read_b == 0)
+	{
+		RaiseFault(EFault::DivideByZero);
+		return;
+	}
+	Write<TCheckOperands>(a, read_a % read_b);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_and(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	Write<TCheckOperands>(a, read_a & read_b);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_orr(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	Write<TCheckOperands>(a, read_a | read_b);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_not(const OpArgs a)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	Write<TCheckOperands>(a, ~read_a);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_xor(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	Write<TCheckOperands>(a, read_a ^ read_b);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_lsl(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	Write<TCheckOperands>(a, read_a << read_b);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_lsr(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	Write<TCheckOperands>(a, read_a >> read_b);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_psh(const OpArgs a)
+{
+	if (stack.full())
+	{
+		RaiseFault(EFault::StackOverflow);
+		return;
+	}
+
+	uint16_t read_a = Read<TCheckOperands>(a);
+	stack.push(read_a);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_pop(const OpArgs a)
+{
+	if (stack.empty())
+	{
+		RaiseFault(EFault::StackUnderflow);
+	}
+	else
+	{
+		uint16_t value = stack.top();
+		stack.pop();
+		Write<TCheckOperands>(a, value);
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_cpy(const OpArgs a, const OpArgs b, const OpArgs c)
+{
+	const uint16_t to = Read<TCheckOperands>(a);
+	const uint16_t from = Read<TCheckOperands>(b);
+	const uint16_t count = Read<TCheckOperands>(c);
+	if (count == 0 || !PrepareBlockWrite(to, count))
+	{
+		return;
+	}
+
+	if (to + count <= MEMORY_SIZE && from + count <= MEMORY_SIZE)
+	{
+		memmove(&memory[to], &memory[from], count * sizeof(uint16_t));
+	}
+	else
+	{
+		// When either end wraps, going through a buffer is simpler than working out which way
+		// round is safe to copy
+		std::vector<uint16_t> words(count);
+		QCPUPrivate::CopyOut(memory, from, count, words.data());
+		QCPUPrivate::CopyIn(memory, to, count, words.data());
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_fil(const OpArgs a, const OpArgs b, const OpArgs c)
+{
+	const uint16_t to = Read<TCheckOperands>(a);
+	const uint16_t value = Read<TCheckOperands>(b);
+	const uint16_t count = Read<TCheckOperands>(c);
+	if (count == 0 || !PrepareBlockWrite(to, count))
+	{
+		return;
+	}
+
+	const uint32_t first = std::min<uint32_t>(count, MEMORY_SIZE - to);
+	std::fill_n(&memory[to], first, value);
+	std::fill_n(&memory[0], count - first, value);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_cmp(const OpArgs a, const OpArgs b, const OpArgs c, const OpArgs d)
+{
+	const uint16_t left = Read<TCheckOperands>(b);
+	const uint16_t right = Read<TCheckOperands>(c);
+	const uint16_t count = Read<TCheckOperands>(d);
+
+	// Compared in runs that neither side wraps in the middle of
+	uint16_t result = 0;
+	for (uint32_t done = 0; done < count;)
+	{
+		const uint16_t l = static_cast<uint16_t>(left + done);
+		const uint16_t r = static_cast<uint16_t>(right + done);
+		const uint32_t run = std::min<uint32_t>(count - done, MEMORY_SIZE - std::max(l, r));
+		const auto [x, y] = std::mismatch(&memory[l], &memory[l] + run, &memory[r]);
+		if (x != &memory[l] + run)
+		{
+			result = *x > *y ? 1 : 0xFFFF;
+			break;
+		}
+		done += run;
+	}
+
+	Write<TCheckOperands>(a, result);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_div(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	if (read_b == 0)
+	{
+		RaiseFault(EFault::DivideByZero);
+		return;
+	}
+	Write<TCheckOperands>(a, read_a / read_b);
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_mlh(const OpArgs a, const OpArgs b)
+{
+	uint32_t read_a = Read<TCheckOperands>(a);
+	uint32_t read_b = Read<TCheckOperands>(b);
+	Write<TCheckOperands>(a, static_cast<uint16_t>((read_a * read_b) >> 16));
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_adc(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	uint32_t sum = read_a + read_b + (flags.carry ? 1 : 0);
+	Write<TCheckOperands>(a, static_cast<uint16_t>(sum));
+	if (!faultPending)
+	{
+		flags.carry = sum > 0xFFFF;
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_sbb(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	uint32_t subtrahend = read_b + (flags.carry ? 1 : 0);
+	Write<TCheckOperands>(a, static_cast<uint16_t>(read_a - subtrahend));
+	if (!faultPending)
+	{
+		flags.carry = read_a < subtrahend;
+	}
+}
+
+template <class TPolicy>
+template <bool TCheckOperands>
+void TQCPU<TPolicy>::cpu_dvm(const OpArgs a, const OpArgs b)
+{
+	uint16_t read_a = Read<TCheckOperands>(a);
+	uint16_t read_b = Read<TCheckOperands>(b);
+	if (read_b == 0)
+	{
+		RaiseFault(EFault::DivideByZero);
+		return;
+	}
+	Write<TCheckOperands>(a, read_a / read_b);
+	if (faultPending)
+	{
+		return;
+	}
+
+	// A fault writing the remainder puts the quotient's operand back, so nothing is changed
+	Write<TCheckOperands>(b, read_a % read_b);
+	if (faultPending)
+	{
+		Write<TCheckOperands>(a, read_a);
+	}
+}
+
+template class TQCPU<FastPolicy>;
+template class TQCPU<CheckedPolicy>;
+template class TQCPU<TracingPolicy>;
+template class TQCPU<ProfilingPolicy>;
@@ -0,0 +1,529 @@
+//
+//	Timing
+//
+
+#include "Timing.h"
+
+#include "AddressingMode.h"
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+
+namespace TimingPrivate
+{
+	uint64_t AddCycles(const uint64_t a, const uint64_t b)
+	{
+		return a > UNBOUNDED_CYCLES - b ? UNBOUNDED_CYCLES : a + b;
+	}
+
+	uint64_t MultiplyCycles(const uint64_t a, const uint64_t b)
+	{
+		return a != 0 && b > UNBOUNDED_CYCLES / a ? UNBOUNDED_CYCLES : a * b;
+	}
+
+	// Depths are small, only unbounded ones need care
+	int64_t AddDepth(const int64_t a, const int64_t b)
+	{
+		return a == UNBOUNDED_DEPTH || b == UNBOUNDED_DEPTH ? UNBOUNDED_DEPTH : a + b;
+	}
+
+	// What running a block, or all of a loop, costs. Depths are relative to the data stack as it
+	// was on the way in.
+	struct Summary
+	{
+		uint64_t cycles;
+		int64_t peak;
+		int64_t delta;
+		bool returns;
+		bool waits;
+	};
+
+	// Blocks of a subroutine numbered from 0, the entry, in the order of Subroutine::blocks
+	struct LocalGraph
+	{
+		std::vector<uint32_t> blocks;
+		std::vector<std::vector<uint32_t>> successors;
+		std::vector<std::vector<uint32_t>> predecessors;
+	};
+
+	// Reverse postorder from the entry, and the edges that go back to a block still being walked
+	void Walk(const LocalGraph& local, std::vector<uint32_t>& order, std::vector<std::pair<uint32_t, uint32_t>>& retreating)
+	{
+		const size_t count = local.blocks.size();
+		std::vector<uint8_t> state(count, 0);
+		std::vector<std::pair<uint32_t, size_t>> stack = { { 0, 0 } };
+		state[0] = 1;
+		while (!stack.empty())
+		{
+			auto& [node, next] = stack.back();
+			if (next < local.successors[node].size())
+			{
+				const uint32_t successor = local.successors[node][next++];
+				if (state[successor] == 0)
+				{
+					state[successor] = 1;
+					stack.push_back({ successor, 0 });
+				}
+				else if (state[successor] == 1)
+				{
+					retreating.push_back({ node, successor });
+				}
+				continue;
+			}
+
+			state[node] = 2;
+			order.push_back(node);
+			stack.pop_back();
+		}
+
+		std::reverse(order.begin(), order.end());
+	}
+
+	// Immediate dominators, by Cooper, Harvey and Kennedy's iteration over the reverse postorder
+	std::vector<int32_t> FindDominators(const LocalGraph& local, const std::vector<uint32_t>& order)
+	{
+		std::vector<int32_t> position(local.blocks.size(), -1);
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			position[order[i]] = static_cast<int32_t>(i);
+		}
+
+		std::vector<int32_t> dominator(local.blocks.size(), -1);
+		dominator[0] = 0;
+		for (bool changed = true; changed;)
+		{
+			changed = false;
+			for (size_t i = 1; i < order.size(); i++)
+			{
+				const uint32_t node = order[i];
+				int32_t found = -1;
+				for (const uint32_t predecessor : local.predecessors[node])
+				{
+					if (dominator[predecessor] < 0)
+					{
+						continue;
+					}
+
+					int32_t a = static_cast<int32_t>(predecessor);
+					int32_t b = found;
+					while (b >= 0 && a != b)
+					{
+						while (position[a] > position[b])
+						{
+							a = dominator[a];
+						}
+						while (position[b] > position[a])
+						{
+							b = dominator[b];
+						}
+					}
+					found = a;
+				}
+
+				if (found != dominator[node])
+				{
+					dominator[node] = found;
+					changed = true;
+				}
+			}
+		}
+
+		return dominator;
+	}
+
+	bool Dominates(const std::vector<int32_t>& dominator, const uint32_t a, uint32_t b)
+	{
+		while (b != a && b != 0)
+		{
+			b = static_cast<uint32_t>(dominator[b]);
+		}
+		return b == a;
+	}
+}
+
+TimingAnalyzer::TimingAnalyzer()
+	: cycles()
+	, bounds()
+	, frameSyscall(0x20)
+{
+	for (size_t i = 0; i < cycles.size(); i++)
+	{
+		cycles[i] = GetOpCodeCycles(static_cast<EOpCode>(i));
+	}
+}
+
+void TimingAnalyzer::SetCycles(const EOpCode opcode, const uint32_t opcodeCycles)
+{
+	cycles[static_cast<uint8_t>(opcode)] = opcodeCycles;
+}
+
+void TimingAnalyzer::SetLoopBound(const uint16_t header, const uint64_t iterations)
+{
+	bounds[header] = iterations;
+}
+
+void TimingAnalyzer::SetFrameSyscall(const uint16_t number)
+{
+	frameSyscall = number;
+}
+
+TimingReport TimingAnalyzer::Analyze(const uint16_t* memory, const ControlFlowGraph& graph) const
+{
+	using namespace TimingPrivate;
+
+	TimingReport report;
+	report.subroutines.assign(graph.subroutines.size(), SubroutineTiming{ 0, 0, 0, 0, false, false, false, false });
+	report.frameCycles = 0;
+	report.callDepth = 0;
+	report.stackDepth = 0;
+
+	// Each block's own cost and what it does to the data stack, calls aside
+	std::vector<Summary> blockSummaries(graph.blocks.size());
+	for (size_t i = 0; i < graph.blocks.size(); i++)
+	{
+		const BasicBlock& block = graph.blocks[i];
+		Summary summary{ 0, 0, 0, block.kind == EBlockEnd::Return, false };
+		for (uint32_t address = block.start; address <= block.last;)
+		{
+			const Instruction* instruction = FindInstruction(static_cast<uint16_t>(memory[address] & 0x00FF));
+			if (instruction == nullptr)
+			{
+				summary.cycles += 1;
+				break;
+			}
+
+			summary.cycles += cycles[static_cast<uint8_t>(instruction->opcode)];
+			summary.delta += instruction->opcode == EOpCode::PSH ? 1 : instruction->opcode == EOpCode::POP ? -1 : 0;
+			summary.peak = std::max(summary.peak, summary.delta);
+			if (instruction->opcode == EOpCode::SYS)
+			{
+				const EAddressingMode mode = GetAddressingModes(static_cast<uint8_t>(memory[address] >> 8))[0];
+				summary.waits |= mode == EAddressingMode::Imm && memory[address + 1] == frameSyscall;
+			}
+			address += 1 + instruction->arity;
+		}
+
+		// Where a jump goes isn't known, so neither is what follows it
+		if (block.computed)
+		{
+			summary.cycles = UNBOUNDED_CYCLES;
+			summary.peak = UNBOUNDED_DEPTH;
+			summary.delta = UNBOUNDED_DEPTH;
+		}
+		blockSummaries[i] = summary;
+	}
+
+	// Callees are done before their callers, one still being done when it's called again is
+	// recursion and unbounded
+	std::vector<uint8_t> state(graph.subroutines.size(), 0);
+	std::function<void(uint32_t)> analyzeSubroutine = [&](const uint32_t index)
+	{
+		state[index] = 1;
+		const Subroutine& subroutine = graph.subroutines[index];
+		SubroutineTiming timing{ 0, 0, 0, 0, false, false, false, false };
+
+		for (const uint32_t block : subroutine.blocks)
+		{
+			const int32_t callee = graph.blocks[block].callee;
+			if (callee >= 0 && state[callee] == 0)
+			{
+				analyzeSubroutine(static_cast<uint32_t>(callee));
+			}
+		}
+
+		LocalGraph local;
+		local.blocks = subroutine.blocks;
+		std::vector<int32_t> localIndex(graph.blocks.size(), -1);
+		for (size_t i = 0; i < local.blocks.size(); i++)
+		{
+			localIndex[local.blocks[i]] = static_cast<int32_t>(i);
+		}
+		local.successors.resize(local.blocks.size());
+		local.predecessors.resize(local.blocks.size());
+		for (uint32_t i = 0; i < local.blocks.size(); i++)
+		{
+			for (const uint32_t successor : graph.blocks[local.blocks[i]].successors)
+			{
+				local.successors[i].push_back(static_cast<uint32_t>(localIndex[successor]));
+				local.predecessors[localIndex[successor]].push_back(i);
+			}
+		}
+
+		// Blocks with their calls
+		std::vector<Summary> nodes(local.blocks.size());
+		for (size_t i = 0; i < local.blocks.size(); i++)
+		{
+			const BasicBlock& block = graph.blocks[local.blocks[i]];
+			Summary summary = blockSummaries[local.blocks[i]];
+			timing.computed |= block.computed;
+			if (block.kind == EBlockEnd::Call && !block.computed)
+			{
+				const bool known = block.callee >= 0 && state[block.callee] == 2;
+				const SubroutineTiming callee = known ? report.subroutines[block.callee] : SubroutineTiming{ UNBOUNDED_CYCLES, UNBOUNDED_DEPTH, UNBOUNDED_DEPTH, UNBOUNDED_DEPTH, false, false, false, false };
+				timing.recursive |= block.callee >= 0 && !known;
+				summary.cycles = AddCycles(summary.cycles, callee.cycles);
+				summary.peak = std::max(summary.peak, AddDepth(summary.delta, callee.stackDepth));
+				summary.delta = AddDepth(summary.delta, callee.stackDelta);
+				summary.waits |= callee.waits;
+				timing.callDepth = std::max(timing.callDepth, AddDepth(callee.callDepth, 1));
+			}
+			else if (block.computed)
+			{
+				timing.callDepth = UNBOUNDED_DEPTH;
+			}
+			nodes[i] = summary;
+		}
+
+		std::vector<uint32_t> order;
+		std::vector<std::pair<uint32_t, uint32_t>> retreating;
+		Walk(local, order, retreating);
+		const std::vector<int32_t> dominator = FindDominators(local, order);
+
+		// A natural loop is everything that gets back to a header without going through it.
+		// Loops sharing a header are one loop.
+		std::vector<uint32_t> headers;
+		std::vector<std::vector<bool>> bodies;
+		for (const auto& [from, to] : retreating)
+		{
+			if (!Dominates(dominator, to, from))
+			{
+				timing.irreducible = true;
+				continue;
+			}
+
+			auto header = std::find(headers.begin(), headers.end(), to);
+			if (header == headers.end())
+			{
+				headers.push_back(to);
+				bodies.push_back(std::vector<bool>(local.blocks.size(), false));
+				bodies.back()[to] = true;
+				header = headers.end() - 1;
+			}
+
+			std::vector<bool>& body = bodies[header - headers.begin()];
+			std::deque<uint32_t> queue;
+			if (!body[from])
+			{
+				body[from] = true;
+				queue.push_back(from);
+			}
+			while (!queue.empty())
+			{
+				const uint32_t node = queue.front();
+				queue.pop_front();
+				for (const uint32_t predecessor : local.predecessors[node])
+				{
+					if (!body[predecessor])
+					{
+						body[predecessor] = true;
+						queue.push_back(predecessor);
+					}
+				}
+			}
+		}
+
+		// Innermost first, so each loop is summed up before the loops around it
+		std::vector<uint32_t> loops(headers.size());
+		for (uint32_t i = 0; i < loops.size(); i++)
+		{
+			loops[i] = i;
+		}
+		std::sort(loops.begin(), loops.end(), [&](const uint32_t a, const uint32_t b)
+		{
+			return std::count(bodies[a].begin(), bodies[a].end(), true) < std::count(bodies[b].begin(), bodies[b].end(), true);
+		});
+
+		// Once summed up, a loop stands in for its blocks as a single node
+		const uint32_t count = static_cast<uint32_t>(local.blocks.size());
+		std::vector<uint32_t> owner(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			owner[i] = i;
+		}
+		std::vector<Summary> units = nodes;
+		units.resize(count + loops.size());
+		std::vector<bool> frames(count + loops.size(), false);
+
+		// The longest path through a region from its header, with back edges to the header left
+		// out. Anything left over is a cycle that isn't a natural loop.
+		struct Region
+		{
+			uint64_t cycles;
+			int64_t peak;
+			int64_t latch;
+			int64_t exit;
+			bool returns;
+			bool waits;
+		};
+		auto sumRegion = [&](const std::vector<bool>& body, const uint32_t header, const bool loop)
+		{
+			std::vector<int32_t> indegree(units.size(), -1);
+			std::vector<std::vector<uint32_t>> edges(units.size());
+			std::vector<bool> latches(units.size(), false);
+			std::vector<bool> exits(units.size(), false);
+			for (uint32_t node = 0; node < count; node++)
+			{
+				if (!body[node])
+				{
+					continue;
+				}
+
+				const uint32_t from = owner[node];
+				indegree[from] = std::max(indegree[from], 0);
+				for (const uint32_t successor : local.successors[node])
+				{
+					if (!body[successor])
+					{
+						exits[from] = true;
+					}
+					else if (loop && successor == header)
+					{
+						latches[from] = true;
+					}
+					else if (owner[successor] != from)
+					{
+						edges[from].push_back(owner[successor]);
+					}
+				}
+			}
+			for (uint32_t unit = 0; unit < units.size(); unit++)
+			{
+				for (const uint32_t to : edges[unit])
+				{
+					indegree[to]++;
+				}
+			}
+
+			Region region{ 0, 0, std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::min(), false, false };
+			std::vector<uint64_t> distance(units.size(), 0);
+			std::vector<int64_t> depth(units.size(), std::numeric_limits<int64_t>::min());
+			const uint32_t start = owner[header];
+			depth[start] = 0;
+
+			std::deque<uint32_t> ready = { start };
+			size_t done = 0;
+			while (!ready.empty())
+			{
+				const uint32_t unit = ready.front();
+				ready.pop_front();
+				done++;
+
+				const Summary& summary = units[unit];
+				distance[unit] = AddCycles(distance[unit], summary.cycles);
+				region.cycles = std::max(region.cycles, distance[unit]);
+				region.peak = std::max(region.peak, AddDepth(depth[unit], summary.peak));
+				region.waits |= summary.waits;
+
+				const int64_t after = AddDepth(depth[unit], summary.delta);
+				region.latch = latches[unit] ? std::max(region.latch, after) : region.latch;
+				region.exit = exits[unit] || summary.returns ? std::max(region.exit, after) : region.exit;
+				region.returns |= summary.returns;
+
+				for (const uint32_t to : edges[unit])
+				{
+					distance[to] = std::max(distance[to], distance[unit]);
+					depth[to] = std::max(depth[to], after);
+					if (--indegree[to] == 0)
+					{
+						ready.push_back(to);
+					}
+				}
+			}
+
+			const size_t used = std::count_if(indegree.begin(), indegree.end(), [](const int32_t degree) { return degree >= 0; });
+			if (done < used)
+			{
+				timing.irreducible = true;
+				region.cycles = UNBOUNDED_CYCLES;
+				region.peak = UNBOUNDED_DEPTH;
+				region.exit = UNBOUNDED_DEPTH;
+			}
+			return region;
+		};
+
+		for (size_t i = 0; i < loops.size(); i++)
+		{
+			const uint32_t loop = loops[i];
+			const std::vector<bool>& body = bodies[loop];
+			const Region region = sumRegion(body, headers[loop], true);
+
+			const auto bound = bounds.find(static_cast<uint16_t>(graph.blocks[local.blocks[headers[loop]]].start));
+			LoopTiming loopTiming{};
+			loopTiming.header = graph.blocks[local.blocks[headers[loop]]].start;
+			loopTiming.subroutine = index;
+			loopTiming.bound = bound != bounds.end() ? bound->second : UNBOUNDED_CYCLES;
+			loopTiming.iteration = region.cycles;
+			loopTiming.cycles = MultiplyCycles(loopTiming.bound, region.cycles);
+
+			// A loop that adds to the stack each time round adds to it as many times as it goes round
+			int64_t growth = 0;
+			if (region.latch > 0)
+			{
+				growth = loopTiming.bound == UNBOUNDED_CYCLES || region.latch == UNBOUNDED_DEPTH ? UNBOUNDED_DEPTH : static_cast<int64_t>(loopTiming.bound - 1) * region.latch;
+			}
+
+			// Only the innermost loop that waits is a frame
+			bool inner = false;
+			for (uint32_t node = 0; node < count; node++)
+			{
+				inner |= body[node] && owner[node] >= count && frames[owner[node]];
+			}
+			loopTiming.frame = region.waits && !inner;
+
+			for (uint32_t node = 0; node < count; node++)
+			{
+				if (body[node])
+				{
+					loopTiming.blocks.push_back(local.blocks[node]);
+					owner[node] = count + static_cast<uint32_t>(i);
+				}
+			}
+			std::sort(loopTiming.blocks.begin(), loopTiming.blocks.end());
+
+			units[count + i] = Summary{ loopTiming.cycles, AddDepth(region.peak, growth), AddDepth(region.exit == std::numeric_limits<int64_t>::min() ? 0 : region.exit, growth), region.returns, region.waits };
+			frames[count + i] = loopTiming.frame || inner;
+			if (loopTiming.frame)
+			{
+				report.frameCycles = std::max(report.frameCycles, loopTiming.iteration);
+			}
+			report.loops.push_back(loopTiming);
+		}
+
+		// Loops inside other loops
+		const size_t first = report.loops.size() - loops.size();
+		for (size_t i = first; i < report.loops.size(); i++)
+		{
+			for (size_t j = i + 1; j < report.loops.size(); j++)
+			{
+				const std::vector<uint32_t>& outer = report.loops[j].blocks;
+				report.loops[i].depth += std::binary_search(outer.begin(), outer.end(), static_cast<uint32_t>(graph.blockAt[report.loops[i].header])) ? 1 : 0;
+			}
+		}
+
+		const Region region = sumRegion(std::vector<bool>(count, true), 0, false);
+		timing.cycles = region.cycles;
+		timing.stackDepth = region.peak;
+		timing.stackDelta = region.returns && region.exit != std::numeric_limits<int64_t>::min() ? region.exit : 0;
+		timing.waits = region.waits;
+		if (timing.recursive)
+		{
+			timing.callDepth = UNBOUNDED_DEPTH;
+		}
+
+		report.callDepth = std::max(report.callDepth, timing.callDepth);
+		report.stackDepth = std::max(report.stackDepth, timing.stackDepth);
+		report.subroutines[index] = timing;
+		state[index] = 2;
+	};
+
+	for (uint32_t i = 0; i < graph.subroutines.size(); i++)
+	{
+		if (state[i] == 0)
+		{
+			analyzeSubroutine(i);
+		}
+	}
+
+	return report;
+}
@@ -0,0 +1,121 @@
+//
+//	Verifier
+//
+
+#include "Verifier.h"
+
+VerifyResult Verifier::Verify(const uint16_t* memory, const uint32_t size, const std::vector<uint16_t>& entries) const
+{
+	VerifyResult result;
+	std::bitset<0x10000> visited;
+	std::vector<uint16_t> worklist(entries.begin(), entries.end());
+
+	while (!worklist.empty())
+	{
+		const uint16_t address = worklist.back();
+		worklist.pop_back();
+
+		if (visited[address])
+		{
+			continue;
+		}
+		visited[address] = true;
+
+		if (!VerifyInstruction(memory, size, address, result))
+		{
+			continue;
+		}
+
+		const uint16_t current = memory[address];
+		const EOpCode opcode = static_cast<EOpCode>(current & 0x00FF);
+		const EAddressingMode targetMode = static_cast<EAddressingMode>((current & 0xC000) >> 14);
+		const uint16_t next = static_cast<uint16_t>(address + 1 + GetOpCodeArity(opcode));
+
+		switch (opcode)
+		{
+			case EOpCode::JMP:
+			case EOpCode::JSR:
+			case EOpCode::JEQ:
+			case EOpCode::JNE:
+			case EOpCode::JGT:
+			case EOpCode::JGE:
+			case EOpCode::JLT:
+			case EOpCode::JLE:
+			{
+				// Jumps take an operand, so VerifyInstruction has already checked it is in memory
+				if (targetMode == EAddressingMode::Imm)
+				{
+					worklist.push_back(memory[address + 1]);
+				}
+				else
+				{
+					result.computedJumps.push_back(address);
+				}
+
+				if (opcode != EOpCode::JMP)
+				{
+					worklist.push_back(next);
+				}
+			}
+			break;
+
+			case EOpCode::EXT:
+			case EOpCode::RET:
+			{
+			}
+			break;
+
+			default:
+			{
+				worklist.push_back(next);
+			}
+			break;
+		}
+	}
+
+	return result;
+}
+
+bool Verifier::VerifyInstruction(const uint16_t* memory, const uint32_t size, const uint16_t address, VerifyResult& result) const
+{
+	const uint16_t current = memory[address];
+	const uint16_t op = current & 0x00FF;
+	const uint16_t modes = (current & 0xFF00) >> 8;
+
+	if (!IsValidOpCode(op))
+	{
+		result.failures.emplace_back(address, EVerifyError::InvalidOpCode);
+		return false;
+	}
+
+	const EOpCode opcode = static_cast<EOpCode>(op);
+	const uint16_t arity = GetOpCodeArity(opcode);
+	const uint16_t writeMask = GetOpCodeWriteMask(opcode);
+
+	if (static_cast<uint32_t>(address) + arity >= size)
+	{
+		result.failures.emplace_back(address, EVerifyError::Truncated);
+		return false;
+	}
+
+	for (uint16_t i = 0; i < arity; i++)
+	{
+		const EAddressingMode mode = static_cast<EAddressingMode>((modes >> (6 - i * 2)) & 0b11);
+		const uint16_t value = memory[address + 1 + i];
+
+		if ((mode == EAddressingMode::Reg || mode == EAddressingMode::Ind) && value > 5)
+		{
+			result.failures.emplace_back(address, EVerifyError::InvalidRegister);
+			return false;
+		}
+
+		if (mode == EAddressingMode::Imm && (writeMask & (1 << i)) != 0)
+		{
+			result.failures.emplace_back(address, EVerifyError::ImmediateWrite);
+			return false;
+		}
+	}
+
+	result.verified[address] = true;
+	return true;
+}